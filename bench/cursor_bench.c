@@ -0,0 +1,202 @@
+//
+// PV Display Helper
+//
+// Copyright (C) 2016 - 2017 Assured Information Security, Inc. All rights reserved.
+//
+// Benchmark for the cursor loaders: times the per-pixel loop drivers used
+// before load_cursor_image_mono / load_cursor_image_masked existed (test each
+// mask bit, then copy_image the result) against the helper's scalar and SSE2
+// row expanders, and checks that all three produce identical images.
+//
+// Build with "make bench" and run ./cursor_bench [iterations].
+//
+
+//Pull in the guest helper whole, so we can reach its static expanders. It's
+//built against the mock libivc used by the fuzzing harness; nothing here
+//touches the transport.
+#include "../pv_display_helper.c"
+
+#include <stdio.h>
+#include <time.h>
+
+//The largest cursor the helper supports, and a typical one with a partial mask byte.
+#define BENCH_CURSOR_SIZES 2
+static const uint32_t bench_cursor_widths[BENCH_CURSOR_SIZES]  = { 64, 27 };
+
+//Expand this many cursors per timing, unless told otherwise.
+#define BENCH_DEFAULT_ITERATIONS 200000
+
+typedef void (*bench_mono_row)(uint32_t *, const uint8_t *, const uint8_t *, uint32_t);
+typedef void (*bench_masked_row)(uint32_t *, const uint32_t *, const uint8_t *, uint32_t);
+
+/**
+ * The conversion a driver would have written by hand: one bit test per pixel,
+ * into a temporary image, which is then copied into the cursor buffer.
+ */
+static void __bench_driver_mono_row(uint32_t *destination, const uint8_t *and_row,
+    const uint8_t *xor_row, uint32_t width)
+{
+    uint32_t x;
+
+    for(x = 0; x < width; ++x)
+    {
+        const int and_bit = (and_row[x / 8] >> (7 - (x % 8))) & 1;
+        const int xor_bit = (xor_row[x / 8] >> (7 - (x % 8))) & 1;
+
+        if(and_bit && !xor_bit)
+            destination[x] = 0x00000000;
+        else if(!and_bit && xor_bit)
+            destination[x] = 0xFFFFFFFF;
+        else
+            destination[x] = 0xFF000000;
+    }
+}
+
+static void __bench_driver_masked_row(uint32_t *destination, const uint32_t *source,
+    const uint8_t *and_row, uint32_t width)
+{
+    uint32_t x;
+
+    for(x = 0; x < width; ++x)
+    {
+        const uint32_t color = source[x] & 0x00FFFFFF;
+
+        if(((and_row[x / 8] >> (7 - (x % 8))) & 1) && !color)
+            destination[x] = 0x00000000;
+        else
+            destination[x] = color | 0xFF000000;
+    }
+}
+
+static double __bench_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (now.tv_nsec / 1e9);
+}
+
+/**
+ * Expands the given cursor 'iterations' times, row by row, into 'out'.
+ * When 'copy' is set, each cursor is staged in a temporary image first and
+ * then copied out, as the driver-side conversion had to.
+ */
+static double __bench_run(bench_mono_row mono, bench_masked_row masked, bool copy,
+    uint32_t *out, uint32_t *staging, const uint32_t *color, const uint8_t *and_mask,
+    const uint8_t *xor_mask, uint32_t width, unsigned long iterations)
+{
+    const uint32_t height    = PV_DRIVER_CURSOR_HEIGHT;
+    const uint32_t mask_pitch = (width + 7) / 8;
+    double start = __bench_now();
+    unsigned long i;
+    uint32_t y;
+
+    for(i = 0; i < iterations; ++i)
+    {
+        uint32_t *target = copy ? staging : out;
+
+        for(y = 0; y < height; ++y)
+        {
+            if(color)
+                masked(target + (y * width), color + (y * width), and_mask + (y * mask_pitch), width);
+            else
+                mono(target + (y * width), and_mask + (y * mask_pitch), xor_mask + (y * mask_pitch), width);
+        }
+
+        if(copy)
+            memcpy(out, staging, pixels_to_bytes(width) * height);
+
+        //Keep the compiler from discarding all but the last iteration.
+        __asm__ __volatile__("" : : "r"(out) : "memory");
+    }
+
+    return __bench_now() - start;
+}
+
+int main(int argc, char **argv)
+{
+    const size_t pixels = PV_DRIVER_CURSOR_WIDTH * PV_DRIVER_CURSOR_HEIGHT;
+    unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_ITERATIONS;
+    uint32_t *color    = malloc(pixels * sizeof(uint32_t));
+    uint32_t *staging  = malloc(pixels * sizeof(uint32_t));
+    uint32_t *expected = malloc(pixels * sizeof(uint32_t));
+    uint32_t *actual   = malloc(pixels * sizeof(uint32_t));
+    uint8_t and_mask[PV_DRIVER_CURSOR_WIDTH * PV_DRIVER_CURSOR_HEIGHT / 8];
+    uint8_t xor_mask[sizeof(and_mask)];
+    int failed = 0;
+    size_t i;
+    int size, kind;
+
+    if(!color || !staging || !expected || !actual || !iterations)
+    {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    //Random masks hit every palette entry; a quarter of the colors are black,
+    //so masked pixels are a mix of transparent and inverting.
+    srand(1);
+    for(i = 0; i < sizeof(and_mask); ++i)
+    {
+        and_mask[i] = rand();
+        xor_mask[i] = rand();
+    }
+
+    for(i = 0; i < pixels; ++i)
+        color[i] = (rand() & 3) ? (uint32_t)rand() : 0;
+
+#ifdef PV_HELPER_CURSOR_SSE2
+    printf("%-8s %5s %12s %12s %12s\n", "cursor", "width", "driver", "scalar", "sse2");
+#else
+    printf("%-8s %5s %12s %12s\n", "cursor", "width", "driver", "scalar");
+#endif
+
+    for(kind = 0; kind < 2; ++kind)
+    {
+        const uint32_t *source = kind ? color : NULL;
+
+        for(size = 0; size < BENCH_CURSOR_SIZES; ++size)
+        {
+            const uint32_t width = bench_cursor_widths[size];
+            const size_t bytes = pixels_to_bytes(width) * PV_DRIVER_CURSOR_HEIGHT;
+            double driver, scalar;
+
+            driver = __bench_run(__bench_driver_mono_row, __bench_driver_masked_row, true,
+                expected, staging, source, and_mask, xor_mask, width, iterations);
+            scalar = __bench_run(__expand_mono_cursor_row, __expand_masked_cursor_row, false,
+                actual, staging, source, and_mask, xor_mask, width, iterations);
+            failed |= memcmp(expected, actual, bytes);
+
+            printf("%-8s %5u %10.1fns %10.1fns", kind ? "masked" : "mono", width,
+                driver * 1e9 / iterations, scalar * 1e9 / iterations);
+
+#ifdef PV_HELPER_CURSOR_SSE2
+            {
+                double sse2;
+
+                memset(actual, 0, bytes);
+                sse2 = __bench_run(__expand_mono_cursor_row_sse2, __expand_masked_cursor_row_sse2, false,
+                    actual, staging, source, and_mask, xor_mask, width, iterations);
+                failed |= memcmp(expected, actual, bytes);
+
+                printf(" %10.1fns", sse2 * 1e9 / iterations);
+            }
+#endif
+
+            printf("\n");
+        }
+    }
+
+    free(color);
+    free(staging);
+    free(expected);
+    free(actual);
+
+    if(failed)
+    {
+        fprintf(stderr, "FAILED: the expanders disagree with the reference conversion\n");
+        return 1;
+    }
+
+    return 0;
+}
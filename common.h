@@ -17,8 +17,11 @@
 #include <linux/slab.h>
 #include <linux/delay.h>
 #include <linux/init.h>
+#include <linux/ktime.h>
 #elif defined __linux__
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
 #include "data-structs/list.h"
 #define PAGE_SIZE 0x1000
 #define PAGE_MASK ~((uintptr_t)(PAGE_SIZE - 1))
@@ -113,10 +116,30 @@ static inline size_t bytes_to_store_framebuffer(size_t stride, size_t height)
 
 
 /**
- * By its spec, a hardware cursor image is guaranteed to be 64x64 with a stride
- * of 64 pixels. At 32bpp, this should take 16,384 bytes.
+ * By its spec, a hardware cursor image is square, with a stride equal to its
+ * width: 64x64 unless a larger size has been negotiated. At 32bpp, a 64x64
+ * cursor should take 16,384 bytes.
  */
-#define CURSOR_IMAGE_SIZE (64 * 64 * (bits_per_pixel / 8))
+static inline size_t cursor_image_size(size_t cursor_size)
+{
+    return bytes_to_store_framebuffer(cursor_size, cursor_size);
+}
+
+
+/**
+ * Computes the capabilities both sides of a connection can use, given the
+ * negotiable capabilities requested by the driver and those offered by the
+ * display handler. Boolean capabilities must be present on both sides; for
+ * the cursor size class, the smaller of the two classes wins.
+ */
+static inline uint32_t __pv_helper_negotiate_capabilities(uint32_t driver_flags, uint32_t host_flags)
+{
+    uint32_t driver_cursor = driver_flags & DH_CAP_CURSOR_SIZE_MASK;
+    uint32_t host_cursor   = host_flags & DH_CAP_CURSOR_SIZE_MASK;
+    uint32_t features      = driver_flags & host_flags & DH_CAP_NEGOTIABLE & ~DH_CAP_CURSOR_SIZE_MASK;
+
+    return features | ((driver_cursor < host_cursor) ? driver_cursor : host_cursor);
+}
 
 
 /******************************************************************************/
@@ -132,11 +155,19 @@ struct pv_display_provider;
  */
 struct pv_cursor
 {
-    //A pointer to a 64x64 ARGB8888 cursor bitmap,
+    //A pointer to a square ARGB8888 cursor bitmap,
     //which is shared directly with the display handler host,
     //or NULL if PV cursors are not supported.
     void *image;
 
+    //The width and height of the cursor bitmap, in pixels;
+    //64 unless a larger size was negotiated.
+    uint32_t size;
+
+    //The power-of-two factor by which the last loaded image was
+    //downscaled to fit the cursor bitmap; applied to the hot spot.
+    uint32_t scale_shift;
+
     //The cursor's hot spot-- that is, the location on the
     //cursor that represents the click target.
     uint32_t hotspot_x;
@@ -186,6 +217,48 @@ struct pv_cursor
 #endif
 
 
+/******************************************************************************/
+/* Static Probes                                                              */
+/******************************************************************************/
+
+/**
+ * pv_helper_probe(name, args...) marks a point of interest on a hot path,
+ * for use by tracing tools. Unlike __PV_HELPER_TRACE__, probes cost close to
+ * nothing unless a tracer is attached. Available probes, and their arguments:
+ *
+ *   send_enter(type, length)                 a packet is about to be sent
+ *   send_exit(type, length, rc)              a packet send has completed
+ *   ring_full(type, needed, available)       a send was refused for lack of ring space
+ *                                            (type 0 is the dirty rectangle ring)
+ *   invalidate_fallback(key, full_refresh)   a dirty rectangle was dropped or widened
+ *   control_dispatch(type, length)           a control packet is being handled
+ *   crc_mismatch(type, length, expected, actual)  a received packet was corrupt
+ *   reconnect(key, rc)                       a display has reconnected
+ *   resync(skipped)                          a stream was resynchronized after a framing error
+ *   startup_step(key, step, elapsed_ns)      a step of the initialization sequence completed
+ *                                            (key is 0 for session steps, and a display's
+ *                                            event port on the host side)
+ *
+ * On the Linux kernel, these are tracepoints in the pv_display system, named
+ * pv_display_<probe>. In Linux userspace, they are USDT probes in the
+ * pv_display_helper provider, if <sys/sdt.h> is available and PV_HELPER_NO_USDT
+ * isn't defined. Elsewhere, they compile away.
+ */
+#if defined __linux__ && defined __KERNEL__
+#include "pv_display_helper_trace.h"
+#define pv_helper_probe(name, ...) trace_pv_display_##name(__VA_ARGS__)
+#elif defined __linux__ && defined __has_include && !defined PV_HELPER_NO_USDT
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define pv_helper_probe(name, ...) STAP_PROBEV(pv_display_helper, name, __VA_ARGS__)
+#endif
+#endif
+
+#ifndef pv_helper_probe
+#define pv_helper_probe(name, ...) do { } while(0)
+#endif
+
+
 /******************************************************************************/
 /* Platform Abstractions                                                      */
 /******************************************************************************/
@@ -197,9 +270,11 @@ struct pv_cursor
  */
 #ifdef DEBUG_LOCKS
 #define pv_helper_lock(name) do { pv_display_debug("LOCK: %s -- %s:%d\n", #name, __FUNCTION__, __LINE__); __pv_helper_lock(name); } while(0)
+#define pv_helper_lock_counted(name, stats) do { pv_display_debug("LOCK: %s -- %s:%d\n", #name, __FUNCTION__, __LINE__); __pv_helper_lock_counted(name, stats); } while(0)
 #define pv_helper_unlock(name) do { pv_display_debug("UNLOCK: %s -- %s:%d\n", #name, __FUNCTION__, __LINE__); __pv_helper_unlock(name); } while(0)
 #else
 #define pv_helper_lock(name) __pv_helper_lock(name)
+#define pv_helper_lock_counted(name, stats) __pv_helper_lock_counted(name, stats)
 #define pv_helper_unlock(name) __pv_helper_unlock(name)
 #endif
 
@@ -234,6 +309,17 @@ static inline void *pv_helper_malloc(size_t size)
 }
 
 
+/**
+ * Platform-agnostic function for allocating memory that the caller will fully
+ * overwrite; unlike pv_helper_malloc, the memory is not zeroed. Free with pv_helper_free.
+ */
+static inline void *pv_helper_malloc_uninit(size_t size)
+{
+    might_sleep();
+    return kmalloc(size, GFP_KERNEL);
+}
+
+
 /**
  * Platform-agnostic function for freeing memory.
  */
@@ -261,6 +347,38 @@ static inline void __pv_helper_lock(pv_helper_mutex *lock)
 }
 
 
+/**
+ * Platform-agnostic function for locking a mutex, if it's not already held.
+ *
+ * @return True iff the lock was acquired.
+ */
+static inline bool __pv_helper_trylock(pv_helper_mutex *lock)
+{
+    return mutex_trylock(lock);
+}
+
+
+/**
+ * Platform-agnostic function for reading a monotonic clock, in nanoseconds.
+ */
+static inline uint64_t pv_helper_time_ns(void)
+{
+    return ktime_get_ns();
+}
+
+
+/**
+ * Platform-agnostic function for sleeping for (at least) the given number of nanoseconds.
+ */
+static inline void pv_helper_sleep_ns(uint64_t ns)
+{
+    unsigned long us = (unsigned long)(ns / 1000);
+
+    might_sleep();
+    usleep_range(us, us + (us / 8) + 1);
+}
+
+
 /**
  * Platform-agnostic function for unlocking a mutex.
  */
@@ -295,11 +413,25 @@ typedef pthread_mutex_t pv_helper_mutex;
 static inline void *pv_helper_malloc(size_t size)
 {
     void *ptr = malloc(size);
-    memset(ptr, 0x00, size);
+
+    //Zero memory on successful allocation.
+    if(ptr)
+        memset(ptr, 0x00, size);
+
     return ptr;
 }
 
 
+/**
+ * Platform-agnostic function for allocating memory that the caller will fully
+ * overwrite; unlike pv_helper_malloc, the memory is not zeroed. Free with pv_helper_free.
+ */
+static inline void *pv_helper_malloc_uninit(size_t size)
+{
+    return malloc(size);
+}
+
+
 /**
  * Platform-agnostic function for freeing memory.
  */
@@ -327,6 +459,44 @@ static inline void __pv_helper_lock(pv_helper_mutex *lock)
 }
 
 
+/**
+ * Platform-agnostic function for locking a mutex, if it's not already held.
+ *
+ * @return True iff the lock was acquired.
+ */
+static inline bool __pv_helper_trylock(pv_helper_mutex *lock)
+{
+    return pthread_mutex_trylock(lock) == 0;
+}
+
+
+/**
+ * Platform-agnostic function for reading a monotonic clock, in nanoseconds.
+ */
+static inline uint64_t pv_helper_time_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+
+/**
+ * Platform-agnostic function for sleeping for (at least) the given number of nanoseconds.
+ */
+static inline void pv_helper_sleep_ns(uint64_t ns)
+{
+    struct timespec delay = {
+        .tv_sec  = (time_t)(ns / 1000000000ULL),
+        .tv_nsec = (long)(ns % 1000000000ULL),
+    };
+
+    //Resume the sleep if we're interrupted by a signal.
+    while(nanosleep(&delay, &delay) && (errno == EINTR));
+}
+
+
 /**
  * Platform-agnostic function for unlocking a mutex.
  */
@@ -338,10 +508,14 @@ static inline void __pv_helper_unlock(pv_helper_mutex *lock)
 _IRQL_requires_same_
 static inline void *pv_helper_malloc(size_t size);
 
+_IRQL_requires_same_
+static inline void *pv_helper_malloc_uninit(size_t size);
+
 _IRQL_requires_same_
 static inline void pv_helper_free(void *buffer);
 
 #pragma alloc_text("PAGED_CODE", pv_helper_malloc)
+#pragma alloc_text("PAGED_CODE", pv_helper_malloc_uninit)
 #pragma alloc_text("PAGED_CODE", pv_helper_free )
 
 typedef FAST_MUTEX pv_helper_mutex;
@@ -367,6 +541,17 @@ static inline void *pv_helper_malloc(size_t size)
     return data;
 }
 
+/**
+ * Platform-agnostic function for allocating memory that the caller will fully
+ * overwrite; unlike pv_helper_malloc, the memory is not zeroed.
+ */
+_IRQL_requires_same_
+static inline void *pv_helper_malloc_uninit(size_t size)
+{
+    PAGED_CODE();
+    return ExAllocatePoolWithTag(NonPagedPool, size, MEM_TAG);
+}
+
 /**
  * Platform-agnostic function for freeing memory.
  */
@@ -401,6 +586,42 @@ _Inout_ _Requires_lock_not_held_(*_Curr_) _Acquires_lock_(*_Curr_)
     ExAcquireFastMutex(lock);
 }
 
+/**
+ * Platform-agnostic function for locking a mutex, if it's not already held.
+ *
+ * @return True iff the lock was acquired.
+ */
+_IRQL_raises_(APC_LEVEL)
+_IRQL_saves_global_(FAST_MUTEX, lock)
+static inline
+bool __pv_helper_trylock(
+_Inout_ _Requires_lock_not_held_(*_Curr_) _When_(return != 0, _Acquires_lock_(*_Curr_))
+                      pv_helper_mutex *lock)
+{
+    return ExTryToAcquireFastMutex(lock) != FALSE;
+}
+
+/**
+ * Platform-agnostic function for reading a monotonic clock, in nanoseconds.
+ * The interrupt time counts in 100ns units.
+ */
+static inline uint64_t pv_helper_time_ns(void)
+{
+    return (uint64_t)KeQueryInterruptTime() * 100;
+}
+
+/**
+ * Platform-agnostic function for sleeping for (at least) the given number of nanoseconds.
+ * Negative intervals are relative, in 100ns units.
+ */
+static inline void pv_helper_sleep_ns(uint64_t ns)
+{
+    LARGE_INTEGER interval;
+
+    interval.QuadPart = -(LONGLONG)((ns + 99) / 100);
+    KeDelayExecutionThread(KernelMode, FALSE, &interval);
+}
+
 /**
  * Platform-agnostic function for unlocking a mutex.
  */
@@ -429,6 +650,11 @@ static inline void *pv_helper_malloc(size_t size)
     return data;
 }
 
+static inline void *pv_helper_malloc_uninit(size_t size)
+{
+    return malloc(size);
+}
+
 /**
 * Platform-agnostic function for freeing memory.
 */
@@ -451,6 +677,26 @@ static inline void __pv_helper_lock(pv_helper_mutex *lock)
     res = WaitForSingleObject(*lock, INFINITE);
 }
 
+static inline bool __pv_helper_trylock(pv_helper_mutex *lock)
+{
+    return WaitForSingleObject(*lock, 0) == WAIT_OBJECT_0;
+}
+
+static inline uint64_t pv_helper_time_ns(void)
+{
+    LARGE_INTEGER now, frequency;
+
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((now.QuadPart / frequency.QuadPart) * 1000000000ULL +
+                      ((now.QuadPart % frequency.QuadPart) * 1000000000ULL) / frequency.QuadPart);
+}
+
+static inline void pv_helper_sleep_ns(uint64_t ns)
+{
+    Sleep((DWORD)((ns + 999999) / 1000000));
+}
+
 static inline void __pv_helper_unlock(pv_helper_mutex *lock)
 {
     ReleaseMutex(*lock);
@@ -472,178 +718,1945 @@ static inline uintptr_t align_to_next_page(uintptr_t address)
 }
 
 /******************************************************************************/
-/* Internal Data                                                              */
+/* Buffer Pools                                                               */
 /******************************************************************************/
 
-
 /**
- * CRC look-up table for the CRC-16-CCITT algorithm below.
+ * A pv_helper_pool hands out fixed-size buffers, recycling freed ones rather than
+ * returning them to the general-purpose allocator. Unlike pv_helper_malloc, pool
+ * buffers are *not* zeroed; callers must initialize everything they use.
+ *
+ * Pools are backed by a kmem_cache in the Linux kernel, a lookaside list in the
+ * Windows kernel, and a short free-list in Linux userspace. Until a pool is set up
+ * with pv_helper_pool_init (and after it's torn down), or where no pool is available,
+ * its buffers come from the general-purpose allocator instead; so a pool that's
+ * statically initialized with PV_HELPER_POOL_INITIALIZER is always safe to use.
  */
-static const uint16_t crc_tbl[16] =
+#if defined __linux__ && defined __KERNEL__
+struct pv_helper_pool
 {
-    0x0000, 0x1081, 0x2102, 0x3183,
-    0x4204, 0x5285, 0x6306, 0x7387,
-    0x8408, 0x9489, 0xa50a, 0xb58b,
-    0xc60c, 0xd68d, 0xe70e, 0xf78f
+    struct kmem_cache *cache;
+    size_t size;
 };
 
+#define PV_HELPER_POOL_INITIALIZER(object_size) { NULL, (object_size) }
+
 /**
- * Compute the CRC-16-CCITT, as used by the Display Handler.
- *
- * @param data_sections Array of "data sections" to be checksummed; each array member should be
- *    a pointer to a section of binary data to be included in the checksum.
- * @param data_lengths The lengths of the data sections in the data sections array.
- * @param sections The data sections
+ * Sets up a pool of buffers of the given size.
  *
- * @return The CRC-16-CCITT of the given data.
+ * @return 0 on success, or an error code on failure.
  */
-static int16_t __pv_helper_checksum(void **data_sections, size_t *data_lengths, size_t sections)
+static inline int pv_helper_pool_init(struct pv_helper_pool *pool, size_t size, const char *name)
 {
-    uint16_t crc = 0xffff;
-    size_t i;
-    
-    __PV_HELPER_TRACE__;
-
-    //For each of the provided data sections.
-    for(i = 0; i < sections; ++i)
-    {
-
-        //Get a reference to the data item to be processed...
-        const unsigned char *p = (const unsigned char *)data_sections[i];
-        unsigned char c;
-        size_t len = data_lengths[i];
-
-        //... and compute the CRC for the given section..
-        while(len--)
-        {
-            c = *p++;
-            crc = ((crc >> 4) & 0x0fff) ^ crc_tbl[((crc ^ c) & 15)];
-            c >>= 4;
-            crc = ((crc >> 4) & 0x0fff) ^ crc_tbl[((crc ^ c) & 15)];
-        }
-    }
-
-    return ~crc & 0xffff;
+    pool->size  = size;
+    pool->cache = kmem_cache_create(name, size, 0, 0, NULL);
+    return pool->cache ? 0 : -ENOMEM;
 }
 
-
 /**
- * Conveience version of the PV helper checksum function, which accepts a seperate header
- * and payload. Used for packet transmission and receipt.
- *
- * @param data The data to be checksummed.
- * @param len The lenghth of the data to be checksummed.
- *
- * @return The CRC-16-CCITT of the given data.
+ * Allocates a single (uninitialized) buffer from the pool.
+ * Like pv_helper_malloc, this may block.
  */
-static inline uint16_t __pv_helper_packet_checksum(struct dh_header *header, void *payload, size_t payload_length)
+static inline void *pv_helper_pool_alloc(struct pv_helper_pool *pool)
 {
-    //Place the relevant sections into arrays.
-    void *data_sections[] = { header, payload };
-    size_t data_lengths[]  = { sizeof(struct dh_header), payload_length };
+    might_sleep();
 
-    __PV_HELPER_TRACE__;
+    if(!pool->cache)
+        return kmalloc(pool->size, GFP_KERNEL);
 
-    //Compute the checksum.
-    return __pv_helper_checksum(data_sections, data_lengths, 2);
+    return kmem_cache_alloc(pool->cache, GFP_KERNEL);
 }
 
-
 /**
- * Convenience version of the PV helper checksum function which accepts a single binary
- * blob as its argument. May disappear shortly.
- *
- * @param data The data to be checksummed.
- * @param len The lenghth of the data to be checksummed.
- *
- * @return The CRC-16-CCITT of the given data.
+ * Returns a buffer to the pool it was allocated from.
  */
-static inline uint16_t __pv_helper_blob_checksum(void *data, size_t len)
+static inline void pv_helper_pool_free(struct pv_helper_pool *pool, void *buffer)
 {
-    __PV_HELPER_TRACE__;
-    return __pv_helper_checksum(&data, &len, 1);
-}
+    if(!buffer)
+        return;
 
+    if(!pool->cache)
+        kfree(buffer);
+    else
+        kmem_cache_free(pool->cache, buffer);
+}
 
 /**
- * Sends a binary payload over a provided IVC communications channel.
- * Executes "atomically", from the channel's perspective-- so no lock needs to be held while using this.
- *
- * @param channel The channel over which the data is to be transmitted.
- * @param type The packet type to be transmitted, as defined by the PV display interface.
- * @param length The length of the data to be transmitted.
- *
- * @return 0 on success, or an error code on failure.
+ * Tears down a pool. All of its buffers must have been freed.
  */
-static int __send_packet(struct libivc_client *channel, uint32_t type, void *data, uint32_t length)
+static inline void pv_helper_pool_destroy(struct pv_helper_pool *pool)
 {
-    char *transmit_buffer;
-    struct dh_header *header;
-    struct dh_footer *footer;
-    size_t available;
-    size_t packet_length;
-    char *payload;
-    int rc;
+    kmem_cache_destroy(pool->cache);
+    pool->cache = NULL;
+}
+#elif defined __linux__
+//In userspace, freed buffers are kept on a singly-linked list threaded through
+//the buffers themselves, up to PV_HELPER_POOL_MAX_FREE of them.
+#define PV_HELPER_POOL_MAX_FREE 16
 
-    if(!libivc_isOpen(channel)) {
-        return -ENOENT;
-    }
+struct pv_helper_pool
+{
+    pthread_mutex_t lock;
+    void *free_list;
+    uint32_t free_count;
+    size_t size;
+};
 
-    available = 0;
+#define PV_HELPER_POOL_INITIALIZER(object_size) { PTHREAD_MUTEX_INITIALIZER, NULL, 0, (object_size) }
 
-    //Compute the size of the packet to be transmitted.
-    packet_length = sizeof(struct dh_header) + length + sizeof(struct dh_footer);
+static inline int pv_helper_pool_init(struct pv_helper_pool *pool, size_t size, const char *name)
+{
+    (void)name;
 
-    __PV_HELPER_TRACE__;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->free_list  = NULL;
+    pool->free_count = 0;
+    pool->size       = (size < sizeof(void *)) ? sizeof(void *) : size;
+    return 0;
+}
 
-    //Allocate space for the full packet...
-    transmit_buffer = (char*)pv_helper_malloc(packet_length);
+static inline void *pv_helper_pool_alloc(struct pv_helper_pool *pool)
+{
+    void *buffer;
 
-    //If we weren't able to get a buffer for transmission, error out.
-    if(!transmit_buffer)
-        return -ENOMEM;
+    pthread_mutex_lock(&pool->lock);
+    buffer = pool->free_list;
+    if(buffer)
+    {
+        pool->free_list = *(void **)buffer;
+        --pool->free_count;
+    }
+    pthread_mutex_unlock(&pool->lock);
 
-    //Create simple convenience pointers to the header, payload, and footer
-    //within the allocated buffer.
-    header  = (struct dh_header *)transmit_buffer;
-    payload = transmit_buffer + sizeof(struct dh_header);
-    footer  = (struct dh_footer *)(payload + length);
+    return buffer ? buffer : malloc(pool->size);
+}
 
-    //Populate the packet's header...
-    header->magic1 = PV_DRIVER_MAGIC1;
-    header->magic2 = PV_DRIVER_MAGIC2;
-    header->type   = type;
-    header->length = length;
+static inline void pv_helper_pool_free(struct pv_helper_pool *pool, void *buffer)
+{
+    if(!buffer)
+        return;
 
-    //... payload ...
-    memcpy(payload, data, length);
+    pthread_mutex_lock(&pool->lock);
+    if(pool->free_count < PV_HELPER_POOL_MAX_FREE)
+    {
+        *(void **)buffer = pool->free_list;
+        pool->free_list  = buffer;
+        ++pool->free_count;
+        buffer = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
 
-    //... and footer.
-    footer->crc = __pv_helper_blob_checksum(transmit_buffer, sizeof(struct dh_header) + length);
+    free(buffer);
+}
 
-    //Output a short debug message, which can be removed once this is stable.
-    pv_display_debug("SEND: Type %u, len = %u, crc= %u\n", (unsigned int)header->type,
-                     (unsigned int)header->length, (unsigned int)footer->crc);
+static inline void pv_helper_pool_destroy(struct pv_helper_pool *pool)
+{
+    void *buffer;
 
-    if((rc = libivc_getAvailableSpace(channel, &available))) {
-        return rc;
+    pthread_mutex_lock(&pool->lock);
+    while((buffer = pool->free_list))
+    {
+        pool->free_list = *(void **)buffer;
+        free(buffer);
     }
+    pool->free_count = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
+#elif defined KERNEL
+struct pv_helper_pool
+{
+    NPAGED_LOOKASIDE_LIST list;
+    bool initialized;
+    size_t size;
+};
 
-    if(available < packet_length) {
-        return -ENOMEM;
-    }
+#define PV_HELPER_POOL_INITIALIZER(object_size) { { 0 }, false, (object_size) }
+
+static inline int pv_helper_pool_init(struct pv_helper_pool *pool, size_t size, const char *name)
+{
+    (void)name;
+
+    pool->size = size;
+    ExInitializeNPagedLookasideList(&pool->list, NULL, NULL, 0, size, MEM_TAG, 0);
+    pool->initialized = true;
+    return 0;
+}
+
+static inline void *pv_helper_pool_alloc(struct pv_helper_pool *pool)
+{
+    if(!pool->initialized)
+        return ExAllocatePoolWithTag(NonPagedPool, pool->size, MEM_TAG);
+
+    return ExAllocateFromNPagedLookasideList(&pool->list);
+}
+
+static inline void pv_helper_pool_free(struct pv_helper_pool *pool, void *buffer)
+{
+    if(!buffer)
+        return;
+
+    if(!pool->initialized)
+        ExFreePool(buffer);
+    else
+        ExFreeToNPagedLookasideList(&pool->list, buffer);
+}
+
+static inline void pv_helper_pool_destroy(struct pv_helper_pool *pool)
+{
+    if(!pool->initialized)
+        return;
+
+    pool->initialized = false;
+    ExDeleteNPagedLookasideList(&pool->list);
+}
+#else
+//Windows userspace has no statically-initializable lock to guard a free-list,
+//so its pools are a thin wrapper around the general-purpose allocator.
+struct pv_helper_pool
+{
+    size_t size;
+};
+
+#define PV_HELPER_POOL_INITIALIZER(object_size) { (object_size) }
+
+static inline int pv_helper_pool_init(struct pv_helper_pool *pool, size_t size, const char *name)
+{
+    (void)name;
+    pool->size = size;
+    return 0;
+}
+
+static inline void *pv_helper_pool_alloc(struct pv_helper_pool *pool)
+{
+    return malloc(pool->size);
+}
+
+static inline void pv_helper_pool_free(struct pv_helper_pool *pool, void *buffer)
+{
+    (void)pool;
+    free(buffer);
+}
+
+static inline void pv_helper_pool_destroy(struct pv_helper_pool *pool)
+{
+    (void)pool;
+}
+#endif
+
+/**
+ * Packet buffers are sized for the largest packet either side will send, which
+ * already counts its header and footer; at a page, each one fills a single cache
+ * object. Both the send path and the receive paths draw on them.
+ */
+#define PV_HELPER_PACKET_BUFFER_SIZE PV_DRIVER_MAX_PACKET_SIZE
+
+/**
+ * The packet buffer pool, shared by everything in a library. Each library defines
+ * it exactly once, with PV_HELPER_DEFINE_PACKET_POOL, in one of its source files.
+ */
+extern struct pv_helper_pool pv_helper_packet_pool;
+
+#define PV_HELPER_DEFINE_PACKET_POOL() \
+    struct pv_helper_pool pv_helper_packet_pool = PV_HELPER_POOL_INITIALIZER(PV_HELPER_PACKET_BUFFER_SIZE)
+
+/**
+ * Sets up the packet buffer pool; called once, when the driver is loaded.
+ * (Userspace needs no setup; its pool is ready from the start.)
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static inline int pv_helper_packet_pool_init(void)
+{
+    return pv_helper_pool_init(&pv_helper_packet_pool, PV_HELPER_PACKET_BUFFER_SIZE, "pv_display_packet");
+}
+
+/**
+ * Tears down the packet buffer pool; called once, when the driver is unloaded.
+ */
+static inline void pv_helper_packet_pool_destroy(void)
+{
+    pv_helper_pool_destroy(&pv_helper_packet_pool);
+}
+
+/**
+ * Allocates an uninitialized buffer for a packet of the given size. Oversized
+ * packets fall back to the general-purpose allocator.
+ */
+static inline void *pv_helper_packet_alloc(size_t size)
+{
+    if(size > PV_HELPER_PACKET_BUFFER_SIZE)
+        return pv_helper_malloc_uninit(size);
+
+    return pv_helper_pool_alloc(&pv_helper_packet_pool);
+}
+
+/**
+ * Frees a buffer from pv_helper_packet_alloc; size must match the allocation's.
+ */
+static inline void pv_helper_packet_free(void *buffer, size_t size)
+{
+    if(size > PV_HELPER_PACKET_BUFFER_SIZE)
+        pv_helper_free(buffer);
+    else
+        pv_helper_pool_free(&pv_helper_packet_pool, buffer);
+}
+
+/******************************************************************************/
+/* Deferred Work                                                              */
+/******************************************************************************/
+
+/**
+ * A pv_helper_work runs a callback once, in the background, after a delay--
+ * much like the Linux kernel's delayed_work, which backs it there. Scheduling
+ * work that's already pending has no effect; the callback may reschedule its
+ * own work item. Work items must be cancelled before they're freed, and must
+ * never be cancelled from their own callback.
+ *
+ * pv_helper_run_async is the fire-and-forget equivalent: it runs a callback once,
+ * in the background, as soon as it can. There's nothing to cancel; the callback
+ * owns whatever it's passed. If it returns an error, the callback won't run.
+ */
+typedef void (*pv_helper_work_fn)(void *opaque);
+
+#if defined __linux__ && defined __KERNEL__
+#include <linux/workqueue.h>
+
+struct pv_helper_work
+{
+    struct delayed_work work;
+    pv_helper_work_fn fn;
+    void *opaque;
+};
+
+static inline void __pv_helper_work_trampoline(struct work_struct *work)
+{
+    struct pv_helper_work *item = container_of(to_delayed_work(work), struct pv_helper_work, work);
+    item->fn(item->opaque);
+}
+
+/**
+ * Prepares a work item to run the given callback.
+ */
+static inline void pv_helper_work_init(struct pv_helper_work *work, pv_helper_work_fn fn, void *opaque)
+{
+    work->fn     = fn;
+    work->opaque = opaque;
+    INIT_DELAYED_WORK(&work->work, __pv_helper_work_trampoline);
+}
+
+/**
+ * Runs the work item's callback after (at least) the given delay.
+ * The callback may block, so it's run on the long-running workqueue.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static inline int pv_helper_work_schedule(struct pv_helper_work *work, uint64_t delay_ns)
+{
+    queue_delayed_work(system_long_wq, &work->work, nsecs_to_jiffies(delay_ns));
+    return 0;
+}
+
+/**
+ * Cancels the work item, waiting for its callback to finish if it's running.
+ */
+static inline void pv_helper_work_cancel(struct pv_helper_work *work)
+{
+    cancel_delayed_work_sync(&work->work);
+}
+
+struct __pv_helper_async
+{
+    struct work_struct work;
+    pv_helper_work_fn fn;
+    void *opaque;
+};
+
+static inline void __pv_helper_async_trampoline(struct work_struct *work)
+{
+    struct __pv_helper_async *task = container_of(work, struct __pv_helper_async, work);
+
+    task->fn(task->opaque);
+    kfree(task);
+}
+
+/**
+ * Runs the given callback once, in the background. The callback may block,
+ * and runs unbound, so that many can proceed at once.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static inline int pv_helper_run_async(pv_helper_work_fn fn, void *opaque)
+{
+    struct __pv_helper_async *task = kmalloc(sizeof(*task), GFP_KERNEL);
+
+    if(!task)
+        return -ENOMEM;
+
+    task->fn     = fn;
+    task->opaque = opaque;
+    INIT_WORK(&task->work, __pv_helper_async_trampoline);
+    queue_work(system_unbound_wq, &task->work);
+    return 0;
+}
+#elif defined __linux__
+//In userspace, each work item gets a thread of its own, created the first time
+//the work is scheduled; it sleeps until the work is due, and lives until cancelled.
+struct pv_helper_work
+{
+    pv_helper_work_fn fn;
+    void *opaque;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    bool started;
+    bool stopping;
+    bool scheduled;
+    uint64_t deadline_ns;
+};
+
+static inline void *__pv_helper_work_thread(void *opaque)
+{
+    struct pv_helper_work *work = opaque;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&work->lock);
+    while(!work->stopping)
+    {
+        //Wait for the work to be scheduled...
+        if(!work->scheduled)
+        {
+            pthread_cond_wait(&work->wake, &work->lock);
+            continue;
+        }
+
+        //... and then for it to be due.
+        if(pv_helper_time_ns() < work->deadline_ns)
+        {
+            deadline.tv_sec  = (time_t)(work->deadline_ns / 1000000000ULL);
+            deadline.tv_nsec = (long)(work->deadline_ns % 1000000000ULL);
+            pthread_cond_timedwait(&work->wake, &work->lock, &deadline);
+            continue;
+        }
+
+        //Run the callback without our lock held, so it can reschedule itself.
+        work->scheduled = false;
+        pthread_mutex_unlock(&work->lock);
+        work->fn(work->opaque);
+        pthread_mutex_lock(&work->lock);
+    }
+    pthread_mutex_unlock(&work->lock);
+
+    return NULL;
+}
+
+/**
+ * Prepares a work item to run the given callback.
+ */
+static inline void pv_helper_work_init(struct pv_helper_work *work, pv_helper_work_fn fn, void *opaque)
+{
+    pthread_condattr_t attributes;
+
+    work->fn        = fn;
+    work->opaque    = opaque;
+    work->started   = false;
+    work->stopping  = false;
+    work->scheduled = false;
+
+    //Deadlines are measured against the same clock as pv_helper_time_ns.
+    pthread_mutex_init(&work->lock, NULL);
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&work->wake, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+/**
+ * Runs the work item's callback after (at least) the given delay.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static inline int pv_helper_work_schedule(struct pv_helper_work *work, uint64_t delay_ns)
+{
+    int rc = 0;
+
+    pthread_mutex_lock(&work->lock);
+
+    if(!work->started)
+    {
+        rc = -pthread_create(&work->thread, NULL, __pv_helper_work_thread, work);
+        work->started = (rc == 0);
+    }
+
+    if(!rc && !work->scheduled)
+    {
+        work->scheduled   = true;
+        work->deadline_ns = pv_helper_time_ns() + delay_ns;
+        pthread_cond_signal(&work->wake);
+    }
+
+    pthread_mutex_unlock(&work->lock);
+    return rc;
+}
+
+/**
+ * Cancels the work item, waiting for its callback to finish if it's running.
+ */
+static inline void pv_helper_work_cancel(struct pv_helper_work *work)
+{
+    pthread_mutex_lock(&work->lock);
+    work->scheduled = false;
+
+    if(!work->started)
+    {
+        pthread_mutex_unlock(&work->lock);
+        return;
+    }
+
+    work->stopping = true;
+    pthread_cond_signal(&work->wake);
+    pthread_mutex_unlock(&work->lock);
+
+    pthread_join(work->thread, NULL);
+
+    work->started  = false;
+    work->stopping = false;
+}
+
+struct __pv_helper_async
+{
+    pv_helper_work_fn fn;
+    void *opaque;
+};
+
+static inline void *__pv_helper_async_thread(void *opaque)
+{
+    struct __pv_helper_async *task = opaque;
+
+    task->fn(task->opaque);
+    free(task);
+    return NULL;
+}
+
+/**
+ * Runs the given callback once, on a (detached) thread of its own.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static inline int pv_helper_run_async(pv_helper_work_fn fn, void *opaque)
+{
+    struct __pv_helper_async *task = malloc(sizeof(*task));
+    pthread_attr_t attributes;
+    pthread_t thread;
+    int rc;
+
+    if(!task)
+        return -ENOMEM;
+
+    task->fn     = fn;
+    task->opaque = opaque;
+
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    rc = pthread_create(&thread, &attributes, __pv_helper_async_thread, task);
+    pthread_attr_destroy(&attributes);
+
+    if(rc)
+    {
+        free(task);
+        return -rc;
+    }
+
+    return 0;
+}
+#else
+//Deferred work isn't yet supported on Windows; callers should fall back to
+//whatever they did before they had it.
+struct pv_helper_work
+{
+    pv_helper_work_fn fn;
+    void *opaque;
+};
+
+static inline void pv_helper_work_init(struct pv_helper_work *work, pv_helper_work_fn fn, void *opaque)
+{
+    work->fn     = fn;
+    work->opaque = opaque;
+}
+
+static inline int pv_helper_work_schedule(struct pv_helper_work *work, uint64_t delay_ns)
+{
+    (void)work;
+    (void)delay_ns;
+    return -ENOSYS;
+}
+
+static inline void pv_helper_work_cancel(struct pv_helper_work *work)
+{
+    (void)work;
+}
+
+static inline int pv_helper_run_async(pv_helper_work_fn fn, void *opaque)
+{
+    (void)fn;
+    (void)opaque;
+    return -ENOSYS;
+}
+#endif
+
+/******************************************************************************/
+/* Completions                                                                */
+/******************************************************************************/
+
+/**
+ * A pv_helper_completion lets one thread wait for another to finish something,
+ * much like the Linux kernel's completion, which backs it there. Once complete,
+ * it stays complete-- waking every waiter, present and future-- until reset.
+ */
+#if defined __linux__ && defined __KERNEL__
+#include <linux/completion.h>
+
+typedef struct completion pv_helper_completion;
+
+static inline void pv_helper_completion_init(pv_helper_completion *completion)
+{
+    init_completion(completion);
+}
+
+static inline void pv_helper_completion_reset(pv_helper_completion *completion)
+{
+    reinit_completion(completion);
+}
+
+static inline void pv_helper_completion_complete(pv_helper_completion *completion)
+{
+    complete_all(completion);
+}
+
+static inline void pv_helper_completion_wait(pv_helper_completion *completion)
+{
+    wait_for_completion(completion);
+}
+
+static inline void pv_helper_completion_destroy(pv_helper_completion *completion)
+{
+    (void)completion;
+}
+#elif defined __linux__
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool done;
+} pv_helper_completion;
+
+static inline void pv_helper_completion_init(pv_helper_completion *completion)
+{
+    pthread_mutex_init(&completion->lock, NULL);
+    pthread_cond_init(&completion->wake, NULL);
+    completion->done = false;
+}
+
+static inline void pv_helper_completion_reset(pv_helper_completion *completion)
+{
+    pthread_mutex_lock(&completion->lock);
+    completion->done = false;
+    pthread_mutex_unlock(&completion->lock);
+}
+
+static inline void pv_helper_completion_complete(pv_helper_completion *completion)
+{
+    pthread_mutex_lock(&completion->lock);
+    completion->done = true;
+    pthread_cond_broadcast(&completion->wake);
+    pthread_mutex_unlock(&completion->lock);
+}
+
+static inline void pv_helper_completion_wait(pv_helper_completion *completion)
+{
+    pthread_mutex_lock(&completion->lock);
+    while(!completion->done)
+        pthread_cond_wait(&completion->wake, &completion->lock);
+    pthread_mutex_unlock(&completion->lock);
+}
+
+static inline void pv_helper_completion_destroy(pv_helper_completion *completion)
+{
+    pthread_cond_destroy(&completion->wake);
+    pthread_mutex_destroy(&completion->lock);
+}
+#elif defined KERNEL
+//A notification event stays signalled until it's cleared, just like a completion.
+typedef KEVENT pv_helper_completion;
+
+static inline void pv_helper_completion_init(pv_helper_completion *completion)
+{
+    KeInitializeEvent(completion, NotificationEvent, FALSE);
+}
+
+static inline void pv_helper_completion_reset(pv_helper_completion *completion)
+{
+    KeClearEvent(completion);
+}
+
+static inline void pv_helper_completion_complete(pv_helper_completion *completion)
+{
+    KeSetEvent(completion, IO_NO_INCREMENT, FALSE);
+}
+
+static inline void pv_helper_completion_wait(pv_helper_completion *completion)
+{
+    KeWaitForSingleObject(completion, Executive, KernelMode, FALSE, NULL);
+}
+
+static inline void pv_helper_completion_destroy(pv_helper_completion *completion)
+{
+    (void)completion;
+}
+#else
+typedef HANDLE pv_helper_completion;
+
+static inline void pv_helper_completion_init(pv_helper_completion *completion)
+{
+    *completion = CreateEvent(NULL, TRUE, FALSE, NULL);
+}
+
+static inline void pv_helper_completion_reset(pv_helper_completion *completion)
+{
+    ResetEvent(*completion);
+}
+
+static inline void pv_helper_completion_complete(pv_helper_completion *completion)
+{
+    SetEvent(*completion);
+}
+
+static inline void pv_helper_completion_wait(pv_helper_completion *completion)
+{
+    WaitForSingleObject(*completion, INFINITE);
+}
+
+static inline void pv_helper_completion_destroy(pv_helper_completion *completion)
+{
+    CloseHandle(*completion);
+}
+#endif
+
+/******************************************************************************/
+/* Event Notifiers                                                            */
+/******************************************************************************/
+
+/**
+ * A pv_helper_notifier lets an object hand the work its libivc callbacks would
+ * do off to an event loop of its owner's choosing. Once enabled, each callback
+ * just records what happened as a set of pending flags and makes a file
+ * descriptor readable; the event loop polls that descriptor (with epoll,
+ * io_uring, or the like), and takes the flags to do the work on its own thread.
+ *
+ * Notifiers are only supported in Linux userspace, where they're eventfds;
+ * elsewhere, pv_helper_notifier_enable fails, and the callbacks carry on as before.
+ */
+struct pv_helper_notifier
+{
+    //Set once fd is ready, and read by the callbacks without a lock; only ever
+    //accessed atomically.
+    bool enabled;
+    int fd;
+    uint32_t pending;
+};
+
+#if defined __linux__ && !defined __KERNEL__
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * Enables a notifier, which must be zero-initialized.
+ *
+ * @return The file descriptor to be polled, or an error code on failure.
+ */
+static inline int pv_helper_notifier_enable(struct pv_helper_notifier *notifier)
+{
+    int fd;
+
+    if(__atomic_load_n(&notifier->enabled, __ATOMIC_ACQUIRE))
+        return notifier->fd;
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if(fd < 0)
+        return -errno;
+
+    //Publish the descriptor before the callbacks can see that we're enabled.
+    notifier->fd = fd;
+    __atomic_store_n(&notifier->enabled, true, __ATOMIC_RELEASE);
+    return fd;
+}
+
+/**
+ * Posts work to a notifier, if it's enabled.
+ *
+ * @param flags The work to be posted, which accumulates with any already pending.
+ * @return True iff the work was posted, and so should be left for the event loop.
+ */
+static inline bool pv_helper_notifier_post(struct pv_helper_notifier *notifier, uint32_t flags)
+{
+    uint64_t one = 1;
+    ssize_t rc;
+
+    if(!__atomic_load_n(&notifier->enabled, __ATOMIC_ACQUIRE))
+        return false;
+
+    __atomic_fetch_or(&notifier->pending, flags, __ATOMIC_RELEASE);
+
+    //This can only fail if the counter would overflow, in which case it's readable anyway.
+    rc = write(notifier->fd, &one, sizeof(one));
+    (void)rc;
+
+    return true;
+}
+
+/**
+ * Takes all of the work pending on a notifier, leaving its descriptor unreadable
+ * until more is posted.
+ *
+ * @return The flags posted since the last call.
+ */
+static inline uint32_t pv_helper_notifier_take(struct pv_helper_notifier *notifier)
+{
+    uint64_t count;
+    ssize_t rc;
+
+    if(!__atomic_load_n(&notifier->enabled, __ATOMIC_ACQUIRE))
+        return 0;
+
+    //Drain the descriptor first, so work posted from here on makes it readable again.
+    //(If there's nothing to drain, the read just fails with EAGAIN.)
+    rc = read(notifier->fd, &count, sizeof(count));
+    (void)rc;
+
+    return __atomic_exchange_n(&notifier->pending, 0, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Releases a notifier's descriptor, if it has one. No work may be posted afterwards.
+ */
+static inline void pv_helper_notifier_destroy(struct pv_helper_notifier *notifier)
+{
+    if(__atomic_exchange_n(&notifier->enabled, false, __ATOMIC_ACQ_REL))
+        close(notifier->fd);
+}
+#else
+static inline int pv_helper_notifier_enable(struct pv_helper_notifier *notifier)
+{
+    (void)notifier;
+    return -ENOSYS;
+}
+
+static inline bool pv_helper_notifier_post(struct pv_helper_notifier *notifier, uint32_t flags)
+{
+    (void)notifier;
+    (void)flags;
+    return false;
+}
+
+static inline uint32_t pv_helper_notifier_take(struct pv_helper_notifier *notifier)
+{
+    (void)notifier;
+    return 0;
+}
+
+static inline void pv_helper_notifier_destroy(struct pv_helper_notifier *notifier)
+{
+    (void)notifier;
+}
+#endif
+
+/******************************************************************************/
+/* Performance Counters                                                       */
+/******************************************************************************/
+
+/**
+ * The number of per-packet-type counter slots. Control packet types are numbered
+ * from 0 and event packet types from 100, so each object indexes its counters by
+ * type modulo 100; any type past the last slot is counted in the last slot.
+ */
+#define PV_HELPER_STATS_PACKET_TYPES 16
+
+#define PV_HELPER_STATS_SLOT(type) \
+    ((((type) % 100) < PV_HELPER_STATS_PACKET_TYPES) ? ((type) % 100) : (PV_HELPER_STATS_PACKET_TYPES - 1))
+
+/**
+ * PV Helper Performance Counters
+ * Kept by each display, display provider, display backend and display consumer.
+ * Counters only ever increase, and are updated atomically, so a snapshot can be
+ * taken at any time without holding the owning object's lock.
+ */
+struct pv_helper_stats
+{
+    //Packets and payload bytes sent and received, by packet type.
+    uint64_t packets_sent[PV_HELPER_STATS_PACKET_TYPES];
+    uint64_t bytes_sent[PV_HELPER_STATS_PACKET_TYPES];
+    uint64_t packets_received[PV_HELPER_STATS_PACKET_TYPES];
+    uint64_t bytes_received[PV_HELPER_STATS_PACKET_TYPES];
+
+    //Dirty rectangles passed to invalidate_region (or, on the host, received);
+    //merged into another rectangle before sending; and discarded outright.
+    uint64_t dirty_rects_submitted;
+    uint64_t dirty_rects_coalesced;
+    uint64_t dirty_rects_dropped;
+
+    //Frames committed (or, on the host, whose commit markers were received);
+    //see Frame Commits in pv_driver_interface.h.
+    uint64_t frames_committed;
+
+    //The number of sends that failed because the ring had no space left.
+    uint64_t ring_full;
+
+    //The number of dirty rectangles replaced with a full-screen refresh
+    //because the dirty rectangle ring was about to overflow.
+    uint64_t full_refreshes;
+
+    //The number of received packets whose CRC didn't match.
+    uint64_t crc_failures;
+
+    //The number of received packets rejected as malformed; see Packet Validation.
+    uint64_t malformed_packets;
+
+    //The number of times a receive path lost its place in a stream, and the
+    //number of bytes it discarded finding the next packet; see Resynchronization.
+    uint64_t resyncs;
+    uint64_t resync_bytes_skipped;
+
+    //The number of attempts made to reconnect to a restarted Display Handler,
+    //and the number of those that succeeded.
+    uint64_t reconnect_attempts;
+    uint64_t reconnects;
+
+    //The number of times the remote side was notified of new data.
+    uint64_t notifies;
+
+    //The number of times the object's lock was found to be held by someone
+    //else on a hot path (receive threads and per-frame calls), and the total
+    //time spent waiting for it as a result.
+    uint64_t lock_contentions;
+    uint64_t lock_wait_ns;
+};
+
+/**
+ * Atomically adds to a performance counter.
+ */
+#if defined _WIN32
+#define pv_helper_stats_add(counter, value) \
+    InterlockedExchangeAdd64((volatile LONG64 *)&(counter), (LONG64)(value))
+#else
+#define pv_helper_stats_add(counter, value) \
+    __atomic_fetch_add(&(counter), (uint64_t)(value), __ATOMIC_RELAXED)
+#endif
+
+#define pv_helper_stats_inc(counter) pv_helper_stats_add(counter, 1)
+
+/**
+ * Atomically reads a performance counter.
+ */
+#if defined _WIN32
+#define pv_helper_stats_read(counter) \
+    ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)&(counter), 0, 0))
+#else
+#define pv_helper_stats_read(counter) \
+    __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+#endif
+
+/**
+ * Takes a snapshot of a set of performance counters.
+ */
+static inline void pv_helper_stats_snapshot(struct pv_helper_stats *destination, struct pv_helper_stats *source)
+{
+    const uint64_t *from = (const uint64_t *)source;
+    uint64_t *to = (uint64_t *)destination;
+    size_t i;
+
+    //Copy each counter individually, so no counter is ever torn.
+    for(i = 0; i < sizeof(*source) / sizeof(uint64_t); ++i)
+        to[i] = pv_helper_stats_read(from[i]);
+}
+
+/**
+ * Counts a single packet of the given type and payload length.
+ *
+ * @param packets The per-type packet counters to be updated (packets_sent or packets_received).
+ * @param bytes The per-type byte counters to be updated (bytes_sent or bytes_received).
+ */
+static inline void pv_helper_stats_count_packet(uint64_t *packets, uint64_t *bytes, uint32_t type, uint32_t length)
+{
+    pv_helper_stats_inc(packets[PV_HELPER_STATS_SLOT(type)]);
+    pv_helper_stats_add(bytes[PV_HELPER_STATS_SLOT(type)], length);
+}
+
+/**
+ * Returns the current time as a packet timestamp (see Latency Sampling in
+ * pv_driver_interface.h). Never returns 0, which means "not stamped".
+ */
+static inline uint32_t pv_helper_timestamp(void)
+{
+    uint32_t timestamp = (uint32_t)(pv_helper_time_ns() >> PV_DRIVER_TIMESTAMP_NS_SHIFT);
+    return timestamp ? timestamp : 1;
+}
+
+/**
+ * The number of linear sub-buckets per power of two in a latency histogram.
+ * Eight sub-buckets bound the error of any reported value to 12.5%.
+ */
+#define PV_HELPER_HISTOGRAM_SUB_BUCKET_BITS 3
+#define PV_HELPER_HISTOGRAM_SUB_BUCKETS (1U << PV_HELPER_HISTOGRAM_SUB_BUCKET_BITS)
+
+/**
+ * The number of buckets needed to cover every 32-bit value: values below
+ * 2 * SUB_BUCKETS get a bucket each, and each of the remaining powers of
+ * two gets SUB_BUCKETS buckets.
+ */
+#define PV_HELPER_HISTOGRAM_BUCKETS \
+    ((32 - PV_HELPER_HISTOGRAM_SUB_BUCKET_BITS + 1) * PV_HELPER_HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * PV Helper Latency Histogram
+ * A log-bucketed ("HDR") histogram of 32-bit values, which keeps a constant
+ * relative precision across the whole range at a fixed, small size.
+ */
+struct pv_helper_histogram
+{
+    //The number of values recorded, and the largest of them.
+    uint64_t count;
+    uint64_t max;
+
+    //The number of values recorded in each bucket.
+    uint64_t buckets[PV_HELPER_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * @return The histogram bucket in which the given value belongs.
+ */
+static inline uint32_t __pv_helper_histogram_index(uint32_t value)
+{
+    uint32_t shift = 0;
+
+    //Find the power of two at which the value has SUB_BUCKET_BITS + 1 significant bits...
+    while((value >> shift) >= (2 * PV_HELPER_HISTOGRAM_SUB_BUCKETS))
+        ++shift;
+
+    //... and use its top bits to pick a sub-bucket.
+    return (shift * PV_HELPER_HISTOGRAM_SUB_BUCKETS) + (value >> shift);
+}
+
+/**
+ * @return The largest value that falls into the given histogram bucket.
+ */
+static inline uint64_t __pv_helper_histogram_bucket_max(uint32_t index)
+{
+    uint32_t shift, mantissa;
+
+    if(index < (2 * PV_HELPER_HISTOGRAM_SUB_BUCKETS))
+        return index;
+
+    shift    = (index / PV_HELPER_HISTOGRAM_SUB_BUCKETS) - 1;
+    mantissa = (index % PV_HELPER_HISTOGRAM_SUB_BUCKETS) + PV_HELPER_HISTOGRAM_SUB_BUCKETS;
+
+    return (((uint64_t)mantissa + 1) << shift) - 1;
+}
+
+/**
+ * Records a single value in a latency histogram. The caller is responsible
+ * for serializing access to the histogram.
+ */
+static inline void pv_helper_histogram_record(struct pv_helper_histogram *histogram, uint32_t value)
+{
+    histogram->buckets[__pv_helper_histogram_index(value)]++;
+    histogram->count++;
+
+    if(value > histogram->max)
+        histogram->max = value;
+}
+
+/**
+ * Computes a percentile of the values recorded in a latency histogram.
+ *
+ * @param histogram The histogram to be queried.
+ * @param permille The percentile to be computed, in tenths of a percent; e.g. 990 for p99.
+ * @return An upper bound on the given percentile, or 0 if nothing has been recorded.
+ */
+static inline uint64_t pv_helper_histogram_percentile(struct pv_helper_histogram *histogram, uint32_t permille)
+{
+    uint64_t target, seen = 0;
+    uint32_t i;
+
+    if(!histogram->count)
+        return 0;
+
+    //Find the number of values that must lie at or below the percentile...
+    target = (histogram->count * permille + 999) / 1000;
+
+    //... and find the bucket in which the last of them lies.
+    for(i = 0; i < PV_HELPER_HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += histogram->buckets[i];
+
+        if(seen >= target)
+            break;
+    }
+
+    //The top bucket's bound may overstate the largest value actually seen.
+    return (__pv_helper_histogram_bucket_max(i) < histogram->max) ? __pv_helper_histogram_bucket_max(i) : histogram->max;
+}
+
+/**
+ * PV Helper Delay Baseline
+ * Tracks the smallest delay observed between timestamps taken on two unsynchronized
+ * clocks. The clocks' offset is unknown, but constant, so delays measured relative
+ * to the smallest one observed are meaningful, even though absolute ones are not.
+ */
+struct pv_helper_delay_baseline
+{
+    uint32_t minimum;
+    bool valid;
+};
+
+/**
+ * Computes the delay between a remote send timestamp and a local receipt timestamp,
+ * relative to the smallest such delay seen so far, updating the baseline as needed.
+ * All arithmetic is modulo 2^32, so timestamps may wrap.
+ */
+static inline uint32_t pv_helper_relative_delay(struct pv_helper_delay_baseline *baseline, uint32_t sent, uint32_t received)
+{
+    uint32_t delay = received - sent;
+
+    //If this is the fastest delivery we've seen, it becomes the new baseline.
+    if(!baseline->valid || ((int32_t)(delay - baseline->minimum) < 0))
+    {
+        baseline->minimum = delay;
+        baseline->valid = true;
+    }
+
+    return delay - baseline->minimum;
+}
+
+/**
+ * The steps of the initialization sequence (see pv_driver_interface.h), in the
+ * order in which they normally complete. Session steps are tracked by the
+ * provider and consumer; the remainder, by each display and display backend.
+ */
+enum pv_helper_startup_step
+{
+    //The control channel has been established.
+    PV_HELPER_STARTUP_CONTROL_CONNECTED,
+
+    //The dh_driver_capabilities, dh_display_list and dh_display_advertised_list
+    //packets have been sent or received.
+    PV_HELPER_STARTUP_CAPABILITIES,
+    PV_HELPER_STARTUP_DISPLAY_LIST,
+    PV_HELPER_STARTUP_ADVERTISED_LIST,
+
+    //For a session, the first dh_add_display has been sent or received; for a
+    //display, its creation has begun.
+    PV_HELPER_STARTUP_ADD_DISPLAY,
+
+    //Each of the display's connections has been established.
+    PV_HELPER_STARTUP_EVENT_CONNECTED,
+    PV_HELPER_STARTUP_FRAMEBUFFER_CONNECTED,
+    PV_HELPER_STARTUP_DIRTY_RECTANGLES_CONNECTED,
+    PV_HELPER_STARTUP_CURSOR_IMAGE_CONNECTED,
+
+    //The display's first dh_set_display has been sent or received.
+    PV_HELPER_STARTUP_SET_DISPLAY,
+
+    PV_HELPER_STARTUP_STEPS
+};
+
+/**
+ * PV Helper Startup Profile
+ * Records when each step of the initialization sequence completed, so slow
+ * bring-ups can be pinned on the step responsible. A display's profile starts
+ * as a copy of its session's, so it covers the whole sequence.
+ */
+struct pv_helper_startup_profile
+{
+    //The time at which the session began, per pv_helper_time_ns.
+    uint64_t start_ns;
+
+    //The time at which each step completed, relative to start_ns; or 0 if it hasn't.
+    uint64_t step_ns[PV_HELPER_STARTUP_STEPS];
+};
+
+/**
+ * Starts a fresh startup profile, as a new session begins.
+ */
+static inline void pv_helper_startup_begin(struct pv_helper_startup_profile *profile)
+{
+    memset(profile, 0, sizeof(*profile));
+    profile->start_ns = pv_helper_time_ns();
+}
+
+/**
+ * Records the completion of a step in a startup profile. Only the first completion
+ * of each step is kept; later ones (e.g. display lists sent on hotplug) are not part
+ * of startup. The caller is responsible for serializing access to the profile.
+ *
+ * @param key The key of the display whose step has completed, or 0 for a session step.
+ */
+static inline void pv_helper_startup_mark(struct pv_helper_startup_profile *profile, uint32_t key, enum pv_helper_startup_step step)
+{
+    uint64_t elapsed;
+
+    if(profile->step_ns[step])
+        return;
+
+    //Never record 0, which means the step hasn't completed.
+    elapsed = pv_helper_time_ns() - profile->start_ns;
+    profile->step_ns[step] = elapsed ? elapsed : 1;
+
+    //The key is only for the probe, which may be compiled out.
+    (void)key;
+    pv_helper_probe(startup_step, key, (uint32_t)step, elapsed);
+}
+
+/**
+ * Locks a mutex, accounting for any time spent waiting for it in the given
+ * performance counters. The clock is only read if the lock is contended, so
+ * the uncontended path costs no more than a plain lock.
+ */
+static inline void __pv_helper_lock_counted(pv_helper_mutex *lock, struct pv_helper_stats *stats)
+{
+    uint64_t start;
+
+    if(__pv_helper_trylock(lock))
+        return;
+
+    start = pv_helper_time_ns();
+    __pv_helper_lock(lock);
+
+    pv_helper_stats_inc(stats->lock_contentions);
+    pv_helper_stats_add(stats->lock_wait_ns, pv_helper_time_ns() - start);
+}
+
+/******************************************************************************/
+/* Tile Compression                                                           */
+/******************************************************************************/
+
+/**
+ * State for a tile being compressed: the words written so far, and where the
+ * header of the literal run being built is, if there is one.
+ */
+struct pv_helper_tile_encoder
+{
+    uint32_t *out;
+    size_t words;
+    size_t literal;
+    bool in_literal;
+};
+
+/**
+ * Appends length copies of a pixel to a tile being compressed: as a run, if
+ * there are enough of them to be worth it, or as literals otherwise.
+ */
+static inline void __pv_helper_tile_emit(struct pv_helper_tile_encoder *encoder, uint32_t pixel, uint32_t length)
+{
+    if(length >= 3)
+    {
+        encoder->out[encoder->words++] = DH_TILE_RUN | length;
+        encoder->out[encoder->words++] = pixel;
+        encoder->in_literal = false;
+        return;
+    }
+
+    while(length--)
+    {
+        if(!encoder->in_literal)
+        {
+            encoder->literal = encoder->words++;
+            encoder->out[encoder->literal] = 0;
+            encoder->in_literal = true;
+        }
+
+        encoder->out[encoder->words++] = pixel;
+        ++encoder->out[encoder->literal];
+    }
+}
+
+/**
+ * Run-length encodes one tile of a 32bpp image; see Compressed Tiles in
+ * pv_driver_interface.h.
+ *
+ * @param out Receives the compressed tile; room for DH_TILE_MAX_WORDS words.
+ * @param image The tile's top-left pixel.
+ * @param stride The distance between the image's rows, in bytes.
+ * @param width, height The size of the tile, each no more than DH_TILE_SIZE.
+ *
+ * @return The length of the compressed tile, in words.
+ */
+static inline size_t __pv_helper_tile_compress(uint32_t *out, const void *image, size_t stride,
+                                               uint32_t width, uint32_t height)
+{
+    struct pv_helper_tile_encoder encoder = { out, 0, 0, false };
+    uint32_t run_pixel = 0;
+    uint32_t run_length = 0;
+    uint32_t x, y;
+
+    for(y = 0; y < height; ++y)
+    {
+        const uint32_t *row = (const uint32_t *)((const char *)image + (y * stride));
+
+        for(x = 0; x < width; ++x)
+        {
+            if(run_length && (row[x] == run_pixel))
+            {
+                ++run_length;
+                continue;
+            }
+
+            if(run_length)
+                __pv_helper_tile_emit(&encoder, run_pixel, run_length);
+
+            run_pixel  = row[x];
+            run_length = 1;
+        }
+    }
+
+    if(run_length)
+        __pv_helper_tile_emit(&encoder, run_pixel, run_length);
+
+    return encoder.words;
+}
+
+/**
+ * Decodes a tile compressed by __pv_helper_tile_compress. The compressed data may
+ * come straight from another domain, so it's trusted no further than its length.
+ *
+ * @param image Receives the tile's pixels, starting with its top-left pixel.
+ * @param stride The distance between the image's rows, in bytes.
+ * @param width, height The size of the tile.
+ * @param in, words The compressed tile, and its length in words.
+ *
+ * @return 0 on success, or -EINVAL if the data doesn't describe exactly one tile.
+ */
+static inline int __pv_helper_tile_decompress(void *image, size_t stride, uint32_t width, uint32_t height,
+                                              const uint32_t *in, size_t words)
+{
+    size_t remaining = (size_t)width * height;
+    uint32_t *row = (uint32_t *)image;
+    uint32_t x = 0;
+    size_t i = 0;
+
+    while(i < words)
+    {
+        uint32_t token  = in[i++];
+        uint32_t length = token & ~DH_TILE_RUN;
+        bool run        = (token & DH_TILE_RUN) != 0;
+        uint32_t k;
+
+        if(!length || (length > remaining) || ((run ? 1 : length) > words - i))
+            return -EINVAL;
+
+        for(k = 0; k < length; ++k)
+        {
+            row[x] = run ? in[i] : in[i + k];
+
+            if(++x == width)
+            {
+                x = 0;
+                row = (uint32_t *)((char *)row + stride);
+            }
+        }
+
+        i += run ? 1 : length;
+        remaining -= length;
+    }
+
+    return remaining ? -EINVAL : 0;
+}
+
+/******************************************************************************/
+/* Internal Data                                                              */
+/******************************************************************************/
+
+
+/**
+ * CRC look-up table for the CRC-16-CCITT algorithm below.
+ */
+static const uint16_t crc_tbl[16] =
+{
+    0x0000, 0x1081, 0x2102, 0x3183,
+    0x4204, 0x5285, 0x6306, 0x7387,
+    0x8408, 0x9489, 0xa50a, 0xb58b,
+    0xc60c, 0xd68d, 0xe70e, 0xf78f
+};
+
+/**
+ * The CRC-16-CCITT can be computed incrementally: start with PV_HELPER_CRC_INIT,
+ * feed each section of data in turn to __pv_helper_checksum_update, and finish
+ * with __pv_helper_checksum_final.
+ */
+#define PV_HELPER_CRC_INIT 0xffff
+
+static inline uint16_t __pv_helper_checksum_update(uint16_t crc, const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    unsigned char c;
+
+    while(length--)
+    {
+        c = *p++;
+        crc = ((crc >> 4) & 0x0fff) ^ crc_tbl[((crc ^ c) & 15)];
+        c >>= 4;
+        crc = ((crc >> 4) & 0x0fff) ^ crc_tbl[((crc ^ c) & 15)];
+    }
+
+    return crc;
+}
+
+static inline uint16_t __pv_helper_checksum_final(uint16_t crc)
+{
+    return ~crc & 0xffff;
+}
+
+
+/**
+ * Compute the CRC-16-CCITT, as used by the Display Handler.
+ *
+ * @param data_sections Array of "data sections" to be checksummed; each array member should be
+ *    a pointer to a section of binary data to be included in the checksum.
+ * @param data_lengths The lengths of the data sections in the data sections array.
+ * @param sections The data sections
+ *
+ * @return The CRC-16-CCITT of the given data.
+ */
+static int16_t __pv_helper_checksum(void **data_sections, size_t *data_lengths, size_t sections)
+{
+    uint16_t crc = PV_HELPER_CRC_INIT;
+    size_t i;
+    
+    __PV_HELPER_TRACE__;
+
+    //Compute the CRC over each of the provided data sections, in turn.
+    for(i = 0; i < sections; ++i)
+        crc = __pv_helper_checksum_update(crc, data_sections[i], data_lengths[i]);
+
+    return __pv_helper_checksum_final(crc);
+}
+
+
+/**
+ * Conveience version of the PV helper checksum function, which accepts a seperate header
+ * and payload. Used for packet transmission and receipt.
+ *
+ * @param data The data to be checksummed.
+ * @param len The lenghth of the data to be checksummed.
+ *
+ * @return The CRC-16-CCITT of the given data.
+ */
+static inline uint16_t __pv_helper_packet_checksum(struct dh_header *header, void *payload, size_t payload_length)
+{
+    //Place the relevant sections into arrays.
+    void *data_sections[] = { header, payload };
+    size_t data_lengths[]  = { sizeof(struct dh_header), payload_length };
+
+    __PV_HELPER_TRACE__;
+
+    //Compute the checksum.
+    return __pv_helper_checksum(data_sections, data_lengths, 2);
+}
+
+
+/**
+ * Convenience version of the PV helper checksum function which accepts a single binary
+ * blob as its argument. May disappear shortly.
+ *
+ * @param data The data to be checksummed.
+ * @param len The lenghth of the data to be checksummed.
+ *
+ * @return The CRC-16-CCITT of the given data.
+ */
+static inline uint16_t __pv_helper_blob_checksum(void *data, size_t len)
+{
+    __PV_HELPER_TRACE__;
+    return __pv_helper_checksum(&data, &len, 1);
+}
+
+
+/**
+ * Packet Validation
+ *
+ * Every received packet is validated in two O(1) stages, so that garbage on a channel
+ * is rejected before we allocate for it, checksum it, or hand it to a handler:
+ *
+ *  - __pv_helper_validate_header runs as soon as a header arrives, and checks its
+ *    magic numbers, that its type belongs on the channel, and that its length is
+ *    exactly right for its type. Unknown types are accepted at any length up to the
+ *    maximum, so that a newer peer's packets can be skipped rather than treated as
+ *    errors; a newer protocol that grows a known payload must use a new type.
+ *
+ *  - __pv_helper_validate_payload runs once the payload arrives, before its CRC is
+ *    checked, and checks any count the payload carries against its length.
+ */
+
+/**
+ * @return The expected payload length for a packet of the given type, or 0 if the
+ *    type is unknown. For display lists, this is the length of an empty list; each
+ *    display adds a dh_display_info.
+ */
+static inline uint32_t __pv_helper_packet_payload_length(uint32_t type, bool *is_list)
+{
+    *is_list = (type == PACKET_TYPE_CONTROL_HOST_DISPLAY_LIST) || (type == PACKET_TYPE_CONTROL_ADVERTISED_DISPLAY_LIST);
+
+    switch(type)
+    {
+        case PACKET_TYPE_CONTROL_DRIVER_CAPABILITIES:         return sizeof(struct dh_driver_capabilities);
+        case PACKET_TYPE_CONTROL_HOST_DISPLAY_LIST:           return sizeof(struct dh_display_list);
+        case PACKET_TYPE_CONTROL_ADVERTISED_DISPLAY_LIST:     return sizeof(struct dh_display_advertised_list);
+        case PACKET_TYPE_CONTROL_ADD_DISPLAY:                 return sizeof(struct dh_add_display);
+        case PACKET_TYPE_CONTROL_REMOVE_DISPLAY:              return sizeof(struct dh_remove_display);
+        case PACKET_TYPE_CONTROL_DISPLAY_NO_LONGER_AVAILABLE: return sizeof(struct dh_display_no_longer_available);
+        case PACKET_TYPE_CONTROL_TEXT_MODE:                   return sizeof(struct dh_text_mode);
+        case PACKET_TYPE_CONTROL_HOST_CAPABILITIES:           return sizeof(struct dh_host_capabilities);
+        case PACKET_TYPE_CONTROL_FRAME_DONE:                  return sizeof(struct dh_frame_done);
+        case PACKET_TYPE_CONTROL_DIRTY_RECTANGLE_CREDITS:     return sizeof(struct dh_dirty_rectangle_credits);
+        case PACKET_TYPE_CONTROL_ADD_OVERLAY:                 return sizeof(struct dh_add_overlay);
+        case PACKET_TYPE_EVENT_SET_DISPLAY:                   return sizeof(struct dh_set_display);
+        case PACKET_TYPE_EVENT_UPDATE_CURSOR:                 return sizeof(struct dh_update_cursor);
+        case PACKET_TYPE_EVENT_MOVE_CURSOR:                   return sizeof(struct dh_move_cursor);
+        case PACKET_TYPE_EVENT_BLANK_DISPLAY:                 return sizeof(struct dh_blanking);
+        case PACKET_TYPE_EVENT_DAMAGE_SAMPLE:                 return sizeof(struct dh_damage_sample);
+        case PACKET_TYPE_EVENT_FRAMEBUFFER_PRESERVED:         return sizeof(struct dh_framebuffer_preserved);
+        case PACKET_TYPE_EVENT_SET_OVERLAY:                   return sizeof(struct dh_set_overlay);
+        case PACKET_TYPE_EVENT_OVERLAY_FRAME:                 return sizeof(struct dh_overlay_frame);
+        case PACKET_TYPE_EVENT_TILE_STORE:                    return sizeof(struct dh_tile_store);
+        default:                                              return 0;
+    }
+}
+
+
+/**
+ * Validates a newly-received packet header; see Packet Validation, above.
+ *
+ * @param header The header to be validated.
+ * @param event_channel True if the header was received on an event channel;
+ *    false if it was received on a control channel.
+ * @return 0 if the header is valid; -EBADMSG if its magic numbers are wrong;
+ *    -EMSGSIZE if its length could never be received; or -EPROTO if its type
+ *    doesn't belong on the channel, or its length doesn't match its type.
+ */
+static inline int __pv_helper_validate_header(struct dh_header *header, bool event_channel)
+{
+    uint32_t expected;
+    bool is_list;
+
+    if((header->magic1 != PV_DRIVER_MAGIC1) || (header->magic2 != PV_DRIVER_MAGIC2))
+        return -EBADMSG;
+
+    //No packet has an empty payload-- a zero length is what marks "no header yet"
+    //on the receive paths, so accepting one would misalign the stream.
+    if((header->length == 0) || (header->length > PV_DRIVER_MAX_PAYLOAD_SIZE))
+        return -EMSGSIZE;
+
+    //Control packet types are numbered from 0, and event packet types from 100.
+    if(event_channel != (header->type >= PACKET_TYPE_EVENT_NONE))
+        return -EPROTO;
+
+    expected = __pv_helper_packet_payload_length(header->type, &is_list);
+
+    if(!expected)
+        return 0;
+
+    if(is_list)
+        return ((header->length >= expected) && !((header->length - expected) % sizeof(struct dh_display_info))) ? 0 : -EPROTO;
+
+    return (header->length == expected) ? 0 : -EPROTO;
+}
+
+
+/**
+ * Validates a received packet's payload against its (already validated) header;
+ * see Packet Validation, above.
+ *
+ * @return 0 if the payload is valid, or -EPROTO if it isn't.
+ */
+static inline int __pv_helper_validate_payload(struct dh_header *header, void *payload)
+{
+    uint32_t expected;
+    bool is_list;
+
+    expected = __pv_helper_packet_payload_length(header->type, &is_list);
+
+    //Both list types start with their display count, which must account for the
+    //rest of the payload. (The header check guarantees the division is exact.)
+    if(is_list && (((struct dh_display_list *)payload)->num_displays !=
+                   (header->length - expected) / sizeof(struct dh_display_info)))
+        return -EPROTO;
+
+    return 0;
+}
+
+
+/**
+ * Resynchronization
+ *
+ * A corrupt packet shouldn't cost a whole connection. When a receive path rejects a
+ * header, it slides its window forward to the next byte that could start a pair of
+ * magic numbers, reads enough to fill the window again, and retries; when a packet
+ * fails its CRC, it's dropped, and the next header tells us whether we're still in
+ * step. Only once more than a threshold's worth of bytes have been discarded without
+ * an intervening good packet is the stream given up on.
+ */
+
+//The default number of bytes a receive path may discard before giving up on a stream.
+#ifndef PV_HELPER_RESYNC_THRESHOLD
+#define PV_HELPER_RESYNC_THRESHOLD (4 * PV_DRIVER_MAX_PACKET_SIZE)
+#endif
+
+/**
+ * Per-stream resynchronization state; zero-initialized.
+ */
+struct pv_helper_resync
+{
+    //The window into the stream in which we're looking for a header, and the
+    //number of bytes of it that we currently hold.
+    union {
+        struct dh_header header;
+        uint8_t bytes[sizeof(struct dh_header)];
+    } window;
+    size_t held;
+
+    //The number of bytes discarded since the last good packet.
+    uint64_t skipped;
+};
+
+/**
+ * @return The distance by which a rejected header window must slide to bring the next
+ *    possible start of a pair of magic numbers to its front. Magic numbers that run
+ *    off the end of the window count, as the rest of them may yet arrive.
+ */
+static inline size_t __pv_helper_resync_offset(struct pv_helper_resync *resync)
+{
+    struct dh_header magic = { .magic1 = PV_DRIVER_MAGIC1, .magic2 = PV_DRIVER_MAGIC2 };
+    const size_t magic_length = sizeof(magic.magic1) + sizeof(magic.magic2);
+    size_t offset, remaining;
+
+    for(offset = 1; offset < sizeof(resync->window.bytes); ++offset)
+    {
+        remaining = sizeof(resync->window.bytes) - offset;
+
+        if(!memcmp(resync->window.bytes + offset, &magic, (remaining < magic_length) ? remaining : magic_length))
+            break;
+    }
+
+    return offset;
+}
+
+/**
+ * Accounts for bytes discarded while a stream is out of step.
+ *
+ * @param bytes The number of bytes discarded.
+ * @param threshold The number of bytes that may be discarded before giving up.
+ * @return True iff the stream should be given up on.
+ */
+static inline bool __pv_helper_resync_skip(struct pv_helper_resync *resync, struct pv_helper_stats *stats,
+                                           size_t bytes, uint64_t threshold)
+{
+    if(!resync->skipped)
+        pv_helper_stats_inc(stats->resyncs);
+
+    resync->skipped += bytes;
+    pv_helper_stats_add(stats->resync_bytes_skipped, bytes);
+
+    return resync->skipped > threshold;
+}
+
+/**
+ * Notes the receipt of a good packet, which means the stream is in step.
+ */
+static inline void __pv_helper_resync_complete(struct pv_helper_resync *resync)
+{
+    if(!resync->skipped)
+        return;
+
+    pv_display_error("Resynchronized with the remote side after discarding %llu bytes.\n",
+                     (unsigned long long)resync->skipped);
+    pv_helper_probe(resync, resync->skipped);
+    resync->skipped = 0;
+}
+
+/**
+ * Attempts to receive a valid packet header from a stream, sliding past any bytes
+ * that can't start one; see Resynchronization, above.
+ *
+ * @param header Receives the header, if one is read.
+ * @param event_channel True iff the stream is an event channel; see __pv_helper_validate_header.
+ * @param threshold The number of bytes that may be discarded before giving up.
+ * @return 1 if a valid header was read; 0 if more data is needed; or -EPROTO if
+ *    the threshold was exceeded, and the stream should be given up on.
+ */
+static inline int __pv_helper_receive_header(struct libivc_client *channel, struct pv_helper_resync *resync,
+                                             struct pv_helper_stats *stats, struct dh_header *header,
+                                             bool event_channel, uint64_t threshold)
+{
+    size_t available, needed, offset;
+    int rc;
+
+    for(;;)
+    {
+        //Fill the window, if the data to do so has arrived.
+        needed = sizeof(resync->window.bytes) - resync->held;
+
+        if(libivc_getAvailableData(channel, &available) || (available < needed))
+            return 0;
+
+        if(libivc_recv(channel, (char *)resync->window.bytes + resync->held, needed))
+            return 0;
+
+        resync->held = sizeof(resync->window.bytes);
+
+        if(!(rc = __pv_helper_validate_header(&resync->window.header, event_channel)))
+        {
+            *header = resync->window.header;
+            resync->held = 0;
+            return 1;
+        }
+
+        if(!resync->skipped)
+        {
+            pv_display_error("Communications error: received an invalid packet header (type %u, length %u: %d). Resynchronizing.\n",
+                             (unsigned int)resync->window.header.type, (unsigned int)resync->window.header.length, rc);
+        }
+
+        pv_helper_stats_inc(stats->malformed_packets);
+
+        //Slide the window to the next place a header could start, and try again.
+        offset = __pv_helper_resync_offset(resync);
+        memmove(resync->window.bytes, resync->window.bytes + offset, sizeof(resync->window.bytes) - offset);
+        resync->held -= offset;
+
+        if(__pv_helper_resync_skip(resync, stats, offset, threshold))
+        {
+            pv_display_error("Could not resynchronize after discarding %llu bytes; giving up on the stream.\n",
+                             (unsigned long long)resync->skipped);
+            resync->held = 0;
+            resync->skipped = 0;
+            return -EPROTO;
+        }
+    }
+}
+
+
+/**
+ * Sends a binary payload over a provided IVC communications channel.
+ * Executes "atomically", from the channel's perspective-- so no lock needs to be held while using this.
+ *
+ * @param channel The channel over which the data is to be transmitted.
+ * @param stats The performance counters for the object which owns the channel.
+ * @param type The packet type to be transmitted, as defined by the PV display interface.
+ * @param length The length of the data to be transmitted.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static int __send_packet(struct libivc_client *channel, struct pv_helper_stats *stats, uint32_t type, void *data, uint32_t length)
+{
+    char *transmit_buffer;
+    struct dh_header *header;
+    struct dh_footer *footer;
+    size_t available;
+    size_t packet_length;
+    char *payload;
+    int rc;
+
+    if(!channel || !libivc_isOpen(channel)) {
+        return -ENOENT;
+    }
+
+    pv_helper_probe(send_enter, type, length);
+
+    available = 0;
+
+    //Compute the size of the packet to be transmitted.
+    packet_length = sizeof(struct dh_header) + length + sizeof(struct dh_footer);
+
+    __PV_HELPER_TRACE__;
+
+    //Allocate space for the full packet...
+    transmit_buffer = (char*)pv_helper_packet_alloc(packet_length);
+
+    //If we weren't able to get a buffer for transmission, error out.
+    if(!transmit_buffer) {
+        pv_helper_probe(send_exit, type, length, -ENOMEM);
+        return -ENOMEM;
+    }
+
+    //Create simple convenience pointers to the header, payload, and footer
+    //within the allocated buffer.
+    header  = (struct dh_header *)transmit_buffer;
+    payload = transmit_buffer + sizeof(struct dh_header);
+    footer  = (struct dh_footer *)(payload + length);
+
+    //Packet buffers aren't zeroed for us, so clear the header and footer first;
+    //their reserved fields must go out as zero.
+    memset(header, 0, sizeof(*header));
+    memset(footer, 0, sizeof(*footer));
+
+    //Populate the packet's header...
+    header->magic1 = PV_DRIVER_MAGIC1;
+    header->magic2 = PV_DRIVER_MAGIC2;
+    header->type   = type;
+    header->length = length;
+
+    //... payload ...
+    memcpy(payload, data, length);
+
+    //... and footer.
+    footer->crc = __pv_helper_blob_checksum(transmit_buffer, sizeof(struct dh_header) + length);
+    footer->timestamp = pv_helper_timestamp();
+
+    //Output a short debug message, which can be removed once this is stable.
+    pv_display_debug("SEND: Type %u, len = %u, crc= %u\n", (unsigned int)header->type,
+                     (unsigned int)header->length, (unsigned int)footer->crc);
+
+    if((rc = libivc_getAvailableSpace(channel, &available))) {
+        pv_helper_packet_free(transmit_buffer, packet_length);
+        pv_helper_probe(send_exit, type, length, rc);
+        return rc;
+    }
+
+    if(available < packet_length) {
+        pv_helper_stats_inc(stats->ring_full);
+        pv_helper_probe(ring_full, type, packet_length, available);
+        pv_helper_packet_free(transmit_buffer, packet_length);
+        pv_helper_probe(send_exit, type, length, -ENOMEM);
+        return -ENOMEM;
+    }
 
     //Finally, attempt to send the packet via the provided channel.
     rc = libivc_send(channel, transmit_buffer, packet_length);
 
+    if(!rc) {
+        pv_helper_stats_count_packet(stats->packets_sent, stats->bytes_sent, type, length);
+    }
+
     libivc_notify_remote(channel);
     libivc_notify_remote(channel);
+    pv_helper_stats_add(stats->notifies, 2);
 
     //Free the allocated transmit buffer.
-    pv_helper_free(transmit_buffer);
+    pv_helper_packet_free(transmit_buffer, packet_length);
+    pv_helper_probe(send_exit, type, length, rc);
 
     //... and return the final status of the transmission.
     return rc;
 }
 
+/**
+ * A single segment of a scatter-gather packet payload.
+ */
+struct pv_helper_iovec
+{
+    void *base;
+    size_t length;
+};
+
+
+/**
+ * Sends a packet whose payload is gathered from several segments, writing its header,
+ * each segment and its footer straight into the channel's ring, rather than assembling
+ * the packet in a buffer first.
+ *
+ * Unlike __send_packet, this takes several writes to the ring; so the caller must
+ * serialize use of the channel, or another sender's packet could land mid-packet.
+ *
+ * @param channel The channel over which the data is to be transmitted.
+ * @param stats The performance counters for the object which owns the channel.
+ * @param type The packet type to be transmitted, as defined by the PV display interface.
+ * @param segments The segments which, concatenated, make up the payload.
+ * @param segment_count The number of segments.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static int __send_packetv(struct libivc_client *channel, struct pv_helper_stats *stats, uint32_t type,
+                          const struct pv_helper_iovec *segments, size_t segment_count)
+{
+    struct dh_header header;
+    struct dh_footer footer;
+    size_t available = 0;
+    size_t packet_length;
+    uint32_t length = 0;
+    uint16_t crc;
+    size_t i;
+    int rc;
+
+    if(!channel || !libivc_isOpen(channel)) {
+        return -ENOENT;
+    }
+
+    __PV_HELPER_TRACE__;
+
+    //Compute the size of the payload, and of the packet to be transmitted.
+    for(i = 0; i < segment_count; ++i) {
+        length += (uint32_t)segments[i].length;
+    }
+
+    pv_helper_probe(send_enter, type, length);
+    packet_length = sizeof(struct dh_header) + length + sizeof(struct dh_footer);
+
+    //Populate the packet's header, leaving its reserved fields zeroed...
+    memset(&header, 0, sizeof(header));
+    header.magic1 = PV_DRIVER_MAGIC1;
+    header.magic2 = PV_DRIVER_MAGIC2;
+    header.type   = type;
+    header.length = length;
+
+    //... and checksum it, along with each payload segment in turn.
+    crc = __pv_helper_checksum_update(PV_HELPER_CRC_INIT, &header, sizeof(header));
+    for(i = 0; i < segment_count; ++i) {
+        crc = __pv_helper_checksum_update(crc, segments[i].base, segments[i].length);
+    }
+
+    memset(&footer, 0, sizeof(footer));
+    footer.crc       = __pv_helper_checksum_final(crc);
+    footer.timestamp = pv_helper_timestamp();
+
+    pv_display_debug("SEND: Type %u, len = %u, crc= %u\n", (unsigned int)header.type,
+                     (unsigned int)header.length, (unsigned int)footer.crc);
+
+    //Make sure the whole packet fits before we write any of it.
+    if((rc = libivc_getAvailableSpace(channel, &available))) {
+        pv_helper_probe(send_exit, type, length, rc);
+        return rc;
+    }
+
+    if(available < packet_length) {
+        pv_helper_stats_inc(stats->ring_full);
+        pv_helper_probe(ring_full, type, packet_length, available);
+        pv_helper_probe(send_exit, type, length, -ENOMEM);
+        return -ENOMEM;
+    }
+
+    //Finally, write the packet into the ring, piece by piece.
+    rc = libivc_send(channel, (char *)&header, sizeof(header));
+
+    for(i = 0; !rc && i < segment_count; ++i) {
+        if(segments[i].length)
+            rc = libivc_send(channel, (char *)segments[i].base, segments[i].length);
+    }
+
+    if(!rc) {
+        rc = libivc_send(channel, (char *)&footer, sizeof(footer));
+    }
+
+    if(!rc) {
+        pv_helper_stats_count_packet(stats->packets_sent, stats->bytes_sent, type, length);
+    }
+
+    libivc_notify_remote(channel);
+    libivc_notify_remote(channel);
+    pv_helper_stats_add(stats->notifies, 2);
+
+    pv_helper_probe(send_exit, type, length, rc);
+    return rc;
+}
+
+
 #endif // COMMON__H
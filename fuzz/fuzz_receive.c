@@ -0,0 +1,462 @@
+//
+// PV Display Helper
+//
+// Copyright (C) 2016 - 2017 Assured Information Security, Inc. All rights reserved.
+//
+// Fuzzing harness for everything the display backend reads from a guest: the
+// control channel, the event channel, the dirty rectangle ring, and the shared
+// buffers (overlay frames and compressed tiles) those describe. Arbitrary bytes
+// are pushed through the real receive paths over the mock transport in libivc.c.
+//
+// Build with "make fuzz" (libFuzzer; run ./fuzz_receive) or "make fuzz-standalone"
+// (reads each file named on the command line, or stdin: for AFL, or for replaying
+// a crash under a debugger).
+//
+// Inputs are laid out as:
+//
+//   byte 0      target: 0 = control channel, 1 = display (event channel, then
+//               dirty rectangles), 2 = compressed tile decoder
+//   byte 1      control/display: which optional capabilities are negotiated (see
+//               fuzz_capabilities); bit 6 fills in each packet's magic numbers and
+//               CRC (see __fuzz_fix_packets); bit 7 enables latency histograms.
+//               Tiles: the tile's width
+//   byte 2      control/display: where to split the rest between deliveries (or,
+//               for displays, between channels); tiles: the tile's height
+//   bytes 3...  the stream itself
+//
+
+//Pull in the backend whole, so we can drive its receive paths directly.
+#include "../pv_display_backend_helper.c"
+
+enum
+{
+    FUZZ_TARGET_CONTROL,
+    FUZZ_TARGET_DISPLAY,
+    FUZZ_TARGET_TILES,
+    FUZZ_TARGETS
+};
+
+//Room for a handful of compressed tiles after a small framebuffer, and a small overlay.
+#define FUZZ_FRAMEBUFFER_SIZE (8 * DH_TILE_SLOT_SIZE)
+#define FUZZ_OVERLAY_BUFFER_SIZE (64 * 1024)
+
+//Handlers read everything they're handed into here, so the sanitizers see every access.
+static volatile uint32_t fuzz_sink;
+
+//Selector bits that don't pick capabilities.
+#define FUZZ_FIX_PACKETS 0x40
+#define FUZZ_LATENCY     0x80
+
+/**
+ * The optional capabilities each bit of the capability selector negotiates.
+ */
+static const uint32_t fuzz_capabilities[] =
+{
+    DH_CAP_COMPACT_DIRTY_RECTANGLES,
+    DH_CAP_FRAME_COMMIT,
+    DH_CAP_LATENCY_SAMPLES,
+    DH_CAP_VIDEO_OVERLAY,
+    DH_CAP_COMPRESSED_TILES,
+    DH_CAP_DIRTY_RECTANGLE_CREDITS,
+};
+
+static uint32_t __fuzz_capabilities(uint8_t selector)
+{
+    uint32_t capabilities = 0;
+    size_t i;
+
+    for(i = 0; i < sizeof(fuzz_capabilities) / sizeof(fuzz_capabilities[0]); ++i)
+    {
+        if(selector & (1 << i))
+            capabilities |= fuzz_capabilities[i];
+    }
+
+    return capabilities;
+}
+
+/**
+ * Walks a stream as a sequence of packets, filling in each one's magic numbers and
+ * CRC, so the fuzzer can spend its time on what's inside them instead.
+ */
+static void __fuzz_fix_packets(uint8_t *stream, size_t size)
+{
+    size_t offset = 0;
+    struct dh_header header;
+    struct dh_footer footer;
+
+    while(size - offset >= sizeof(header))
+    {
+        memcpy(&header, stream + offset, sizeof(header));
+        header.magic1 = PV_DRIVER_MAGIC1;
+        header.magic2 = PV_DRIVER_MAGIC2;
+        memcpy(stream + offset, &header, sizeof(header));
+
+        if((size - offset < sizeof(header) + sizeof(footer)) ||
+           (header.length > size - offset - sizeof(header) - sizeof(footer)))
+            return;
+
+        offset += sizeof(header);
+        memcpy(&footer, stream + offset + header.length, sizeof(footer));
+        footer.crc = __pv_helper_packet_checksum(&header, stream + offset, header.length);
+        memcpy(stream + offset + header.length, &footer, sizeof(footer));
+        offset += header.length + sizeof(footer);
+    }
+}
+
+static void __fuzz_touch(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    size_t i;
+
+    for(i = 0; i < length; ++i)
+        fuzz_sink += bytes[i];
+}
+
+//
+// Consumer handlers
+//
+
+static void fuzz_driver_capabilities(struct pv_display_consumer *consumer, struct dh_driver_capabilities *request)
+{
+    (void)consumer;
+    __fuzz_touch(request, sizeof(*request));
+}
+
+static void fuzz_advertised_list(struct pv_display_consumer *consumer, struct dh_display_advertised_list *request)
+{
+    (void)consumer;
+    __fuzz_touch(request->displays, request->num_displays * sizeof(request->displays[0]));
+}
+
+static void fuzz_no_longer_available(struct pv_display_consumer *consumer, struct dh_display_no_longer_available *request)
+{
+    (void)consumer;
+    __fuzz_touch(request, sizeof(*request));
+}
+
+static void fuzz_text_mode(struct pv_display_consumer *consumer, bool force)
+{
+    (void)consumer;
+    fuzz_sink += force;
+}
+
+//
+// Display handlers
+//
+
+/**
+ * Reads back the compressed tile under each dirty rectangle, as a forwarding
+ * display handler would.
+ */
+static void fuzz_dirty_rectangle(struct pv_display_backend *display, uint32_t x, uint32_t y,
+                                 uint32_t width, uint32_t height)
+{
+    static uint32_t image[DH_TILE_SIZE * DH_TILE_SIZE];
+    struct dh_tile_header header;
+    const void *data;
+
+    (void)width;
+    (void)height;
+
+    if(!display->get_compressed_tile(display, x / DH_TILE_SIZE, y / DH_TILE_SIZE, &header, &data))
+        __fuzz_touch(data, header.length);
+
+    display->decompress_tile(display, x / DH_TILE_SIZE, y / DH_TILE_SIZE, image, sizeof(uint32_t) * DH_TILE_SIZE);
+}
+
+static void fuzz_frame_commit(struct pv_display_backend *display, uint32_t frame)
+{
+    (void)display;
+    fuzz_sink += frame;
+}
+
+static void fuzz_move_cursor(struct pv_display_backend *display, uint32_t x, uint32_t y)
+{
+    (void)display;
+    fuzz_sink += x + y;
+}
+
+static void fuzz_update_cursor(struct pv_display_backend *display, uint32_t xhot, uint32_t yhot, uint32_t show)
+{
+    (void)display;
+    fuzz_sink += xhot + yhot + show;
+}
+
+static void fuzz_set_display(struct pv_display_backend *display, uint32_t width, uint32_t height, uint32_t stride)
+{
+    (void)display;
+    fuzz_sink += width + height + stride;
+}
+
+static void fuzz_blank_display(struct pv_display_backend *display, uint32_t reason)
+{
+    (void)display;
+    fuzz_sink += reason;
+}
+
+static void fuzz_framebuffer_preserved(struct pv_display_backend *display, uint32_t width, uint32_t height, uint32_t stride)
+{
+    (void)display;
+    fuzz_sink += width + height + stride;
+}
+
+static void fuzz_set_overlay(struct pv_display_backend *display, struct dh_set_overlay *overlay)
+{
+    (void)display;
+    __fuzz_touch(overlay, sizeof(*overlay));
+}
+
+/**
+ * Reads the whole of each overlay frame we're handed, as described by the last
+ * set overlay event.
+ */
+static void fuzz_overlay_frame(struct pv_display_backend *display, uint32_t frame, void *image)
+{
+    fuzz_sink += frame;
+
+    if(image)
+        __fuzz_touch(image, DH_OVERLAY_FRAME_SIZE(display->overlay.pitch, display->overlay.height));
+}
+
+//
+// Targets
+//
+
+static struct pv_display_consumer *__fuzz_create_consumer(uint32_t capabilities)
+{
+    struct pv_display_consumer *consumer;
+
+    if(create_pv_display_consumer(&consumer, 1, 1000, NULL) || consumer->start_server(consumer))
+        abort();
+
+    consumer->set_host_capabilities(consumer, capabilities);
+    consumer->register_driver_capabilities_request_handler(consumer, fuzz_driver_capabilities);
+    consumer->register_display_advertised_list_request_handler(consumer, fuzz_advertised_list);
+    consumer->register_display_no_longer_available_request_handler(consumer, fuzz_no_longer_available);
+    consumer->register_text_mode_request_handler(consumer, fuzz_text_mode);
+
+    return consumer;
+}
+
+/**
+ * Fills a shared buffer with the input, over and over, so that whatever the
+ * stream says is in it is guest-controlled too.
+ */
+static void __fuzz_fill(struct libivc_client *client, const uint8_t *data, size_t size)
+{
+    char *buffer;
+    size_t length, offset;
+
+    libivc_getLocalBuffer(client, &buffer);
+    libivc_getLocalBufferSize(client, &length);
+
+    for(offset = 0; size && (offset < length); offset += size)
+        memcpy(buffer + offset, data, (length - offset < size) ? (length - offset) : size);
+}
+
+static void __fuzz_control(uint8_t selector, uint8_t split, uint8_t *data, size_t size)
+{
+    struct pv_display_consumer *consumer = __fuzz_create_consumer(__fuzz_capabilities(selector));
+    struct libivc_client *control = mock_libivc_open(0);
+    size_t first = (size * split) / 256;
+
+    if(selector & FUZZ_FIX_PACKETS)
+        __fuzz_fix_packets(data, size);
+
+    //The stream arrives in two pieces, so packets can straddle deliveries.
+    mock_libivc_push(control, data, first);
+    consumer->finish_control_connection(consumer, control);
+
+    mock_libivc_push(control, data + first, size - first);
+    __handle_control_channel_event(consumer, control);
+
+    consumer->destroy(consumer);
+}
+
+static void __fuzz_display(uint8_t selector, uint8_t split, uint8_t *data, size_t size)
+{
+    struct pv_display_consumer *consumer = __fuzz_create_consumer(__fuzz_capabilities(selector));
+    struct libivc_client *framebuffer = mock_libivc_open(FUZZ_FRAMEBUFFER_SIZE);
+    struct libivc_client *overlay = mock_libivc_open(FUZZ_OVERLAY_BUFFER_SIZE);
+    struct libivc_client *events = mock_libivc_open(0);
+    struct libivc_client *rects = mock_libivc_open(0);
+    struct pv_display_backend *display;
+    size_t first = (size * split) / 256;
+
+    if(selector & FUZZ_FIX_PACKETS)
+        __fuzz_fix_packets(data, first);
+
+    //Pretend the guest agreed to everything we offered.
+    consumer->negotiated_capabilities = __fuzz_capabilities(selector);
+
+    if(consumer->create_pv_display_backend(consumer, &display, 1, 1001, 1002, 1003, 1004, NULL))
+        abort();
+
+    if(selector & FUZZ_LATENCY)
+        display->enable_latency_histograms(display);
+
+    display->register_dirty_rectangle_handler(display, fuzz_dirty_rectangle);
+    display->register_frame_commit_handler(display, fuzz_frame_commit);
+    display->register_move_cursor_handler(display, fuzz_move_cursor);
+    display->register_update_cursor_handler(display, fuzz_update_cursor);
+    display->register_set_display_handler(display, fuzz_set_display);
+    display->register_blank_display_handler(display, fuzz_blank_display);
+    display->register_framebuffer_preserved_handler(display, fuzz_framebuffer_preserved);
+    display->register_set_overlay_handler(display, fuzz_set_overlay);
+    display->register_overlay_frame_handler(display, fuzz_overlay_frame);
+
+    __fuzz_fill(framebuffer, data, size);
+    __fuzz_fill(overlay, data, size);
+
+    display->finish_framebuffer_connection(display, framebuffer);
+    __handle_overlay_connection(display, overlay);
+    display->finish_event_connection(display, events);
+    display->finish_dirty_rect_connection(display, rects);
+
+    //Everything before the split goes to the event channel, and the rest to the dirty
+    //rectangle ring; each arrives in two pieces.
+    mock_libivc_push(events, data, first / 2);
+    __handle_event_channel_event(display, events);
+    mock_libivc_push(events, data + (first / 2), first - (first / 2));
+    __handle_event_channel_event(display, events);
+
+    mock_libivc_push(rects, data + first, (size - first) / 2);
+    __handle_dirty_rectangle_event(display, rects);
+    mock_libivc_push(rects, data + first + ((size - first) / 2), (size - first) - ((size - first) / 2));
+    __handle_dirty_rectangle_event(display, rects);
+
+    consumer->destroy_display(consumer, display);
+    consumer->destroy(consumer);
+}
+
+/**
+ * Decodes the stream as a single compressed tile; anything that decodes must
+ * survive a round trip through the encoder unchanged.
+ */
+static void __fuzz_tiles(uint8_t width, uint8_t height, const uint8_t *data, size_t size)
+{
+    static uint32_t words[DH_TILE_MAX_WORDS];
+    static uint32_t image[DH_TILE_SIZE * DH_TILE_SIZE];
+    static uint32_t round_trip[DH_TILE_SIZE * DH_TILE_SIZE];
+    uint32_t tile_width = (width % DH_TILE_SIZE) + 1;
+    uint32_t tile_height = (height % DH_TILE_SIZE) + 1;
+    size_t count = size / sizeof(uint32_t);
+    uint32_t *input;
+    uint32_t row;
+
+    //Give the decoder exactly the words we have, so any overread is caught.
+    input = malloc(count ? count * sizeof(uint32_t) : 1);
+
+    if(!input)
+        abort();
+
+    memcpy(input, data, count * sizeof(uint32_t));
+
+    if(!__pv_helper_tile_decompress(image, sizeof(uint32_t) * DH_TILE_SIZE, tile_width, tile_height, input, count))
+    {
+        size_t compressed = __pv_helper_tile_compress(words, image, sizeof(uint32_t) * DH_TILE_SIZE, tile_width, tile_height);
+
+        if((compressed > DH_TILE_MAX_WORDS) ||
+           __pv_helper_tile_decompress(round_trip, sizeof(uint32_t) * DH_TILE_SIZE, tile_width, tile_height, words, compressed))
+            abort();
+
+        for(row = 0; row < tile_height; ++row)
+        {
+            if(memcmp(image + (row * DH_TILE_SIZE), round_trip + (row * DH_TILE_SIZE), tile_width * sizeof(uint32_t)))
+                abort();
+        }
+    }
+
+    free(input);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    uint8_t *stream;
+
+    if(size < 3)
+        return 0;
+
+    //Work on a copy of exactly the stream's size, which we're free to fix up.
+    stream = malloc((size > 3) ? size - 3 : 1);
+
+    if(!stream)
+        abort();
+
+    memcpy(stream, data + 3, size - 3);
+
+    switch(data[0] % FUZZ_TARGETS)
+    {
+        case FUZZ_TARGET_CONTROL:
+            __fuzz_control(data[1], data[2], stream, size - 3);
+            break;
+
+        case FUZZ_TARGET_DISPLAY:
+            __fuzz_display(data[1], data[2], stream, size - 3);
+            break;
+
+        case FUZZ_TARGET_TILES:
+            __fuzz_tiles(data[1], data[2], stream, size - 3);
+            break;
+    }
+
+    free(stream);
+    mock_libivc_reset();
+    return 0;
+}
+
+#ifndef PV_HELPER_LIBFUZZER
+
+/**
+ * Runs a single input from the given file.
+ */
+static int __fuzz_run_file(FILE *file)
+{
+    uint8_t *data = NULL;
+    size_t size = 0, capacity = 0, length;
+
+    do
+    {
+        if(size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            data = realloc(data, capacity);
+
+            if(!data)
+                return 1;
+        }
+
+        length = fread(data + size, 1, capacity - size, file);
+        size += length;
+    }
+    while(length);
+
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    if(argc < 2)
+        return __fuzz_run_file(stdin);
+
+    for(i = 1; i < argc; ++i)
+    {
+        FILE *file = fopen(argv[i], "rb");
+
+        if(!file || __fuzz_run_file(file))
+        {
+            fprintf(stderr, "Could not read %s.\n", argv[i]);
+            return 1;
+        }
+
+        fclose(file);
+    }
+
+    return 0;
+}
+
+#endif
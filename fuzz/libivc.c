@@ -0,0 +1,224 @@
+//
+// PV Display Helper
+//
+// Copyright (C) 2016 - 2017 Assured Information Security, Inc. All rights reserved.
+//
+// The mock libivc described in libivc.h.
+//
+#include <stdlib.h>
+#include "libivc.h"
+
+//Sends always have this much room; they're dropped on the floor anyway.
+#define MOCK_LIBIVC_SEND_SPACE (1 << 20)
+
+struct libivc_client
+{
+    //The client's stand-in for its shared pages.
+    char *buffer;
+    size_t buffer_size;
+
+    //Everything the remote has "sent" us, and how much of it we've read.
+    char *received;
+    size_t received_length;
+    size_t received_offset;
+
+    bool open;
+
+    //Every client we've created, so reset can free them.
+    struct libivc_client *next;
+};
+
+struct libivc_server
+{
+    int unused;
+};
+
+static struct libivc_client *mock_clients = NULL;
+static struct libivc_server mock_server;
+
+struct libivc_client *mock_libivc_open(size_t buffer_size)
+{
+    struct libivc_client *client = calloc(1, sizeof(*client));
+
+    if(!client)
+        abort();
+
+    client->buffer = calloc(1, buffer_size ? buffer_size : 1);
+
+    if(!client->buffer)
+        abort();
+
+    client->buffer_size = buffer_size;
+    client->open        = true;
+    client->next        = mock_clients;
+    mock_clients        = client;
+
+    return client;
+}
+
+void mock_libivc_push(struct libivc_client *client, const void *data, size_t length)
+{
+    char *received = realloc(client->received, client->received_length + length + 1);
+
+    if(!received)
+        abort();
+
+    memcpy(received + client->received_length, data, length);
+    client->received = received;
+    client->received_length += length;
+}
+
+void mock_libivc_reset(void)
+{
+    while(mock_clients)
+    {
+        struct libivc_client *client = mock_clients;
+
+        mock_clients = client->next;
+        free(client->buffer);
+        free(client->received);
+        free(client);
+    }
+}
+
+int libivc_connect_with_id(struct libivc_client **ivc, uint16_t remote_dom_id, uint16_t remote_port, uint32_t numPages, uint64_t connection_id)
+{
+    (void)remote_dom_id;
+    (void)remote_port;
+    (void)connection_id;
+
+    //The real thing keeps its metadata in the first page.
+    *ivc = mock_libivc_open(numPages ? ((size_t)numPages - 1) * 0x1000 : 0);
+    return SUCCESS;
+}
+
+int libivc_register_event_callbacks(struct libivc_client *client, libivc_client_event_fired eventCallback, libivc_client_disconnected disconnectCallback, void *opaque)
+{
+    (void)client;
+    (void)eventCallback;
+    (void)disconnectCallback;
+    (void)opaque;
+    return SUCCESS;
+}
+
+int libivc_recv(struct libivc_client *client, char *dest, size_t destSize)
+{
+    if(!client || !client->open || (destSize > client->received_length - client->received_offset))
+        return -ENODATA;
+
+    memcpy(dest, client->received + client->received_offset, destSize);
+    client->received_offset += destSize;
+    return SUCCESS;
+}
+
+int libivc_send(struct libivc_client *client, char *src, size_t srcSize)
+{
+    (void)src;
+
+    if(!client || !client->open || (srcSize > MOCK_LIBIVC_SEND_SPACE))
+        return -ENOSPC;
+
+    return SUCCESS;
+}
+
+int libivc_getAvailableSpace(struct libivc_client *client, size_t *space)
+{
+    if(!client || !client->open)
+        return -ENOTCONN;
+
+    *space = MOCK_LIBIVC_SEND_SPACE;
+    return SUCCESS;
+}
+
+int libivc_getAvailableData(struct libivc_client *client, size_t *data)
+{
+    if(!client || !client->open)
+        return -ENOTCONN;
+
+    *data = client->received_length - client->received_offset;
+    return SUCCESS;
+}
+
+int libivc_getLocalBuffer(struct libivc_client *client, char **buf)
+{
+    if(!client)
+        return -EINVAL;
+
+    *buf = client->buffer;
+    return SUCCESS;
+}
+
+int libivc_getLocalBufferSize(struct libivc_client *client, size_t *size)
+{
+    if(!client)
+        return -EINVAL;
+
+    *size = client->buffer_size;
+    return SUCCESS;
+}
+
+bool libivc_isOpen(struct libivc_client *client)
+{
+    return client && client->open;
+}
+
+int libivc_notify_remote(struct libivc_client *client)
+{
+    (void)client;
+    return SUCCESS;
+}
+
+int libivc_reconnect(struct libivc_client *client, uint16_t remote_dom_id, uint16_t remote_port)
+{
+    (void)remote_dom_id;
+    (void)remote_port;
+
+    if(!client)
+        return -EINVAL;
+
+    client->open = true;
+    return SUCCESS;
+}
+
+void libivc_disconnect(struct libivc_client *client)
+{
+    if(client)
+        client->open = false;
+}
+
+int libivc_enable_events(struct libivc_client *client)
+{
+    (void)client;
+    return SUCCESS;
+}
+
+int libivc_disable_events(struct libivc_client *client)
+{
+    (void)client;
+    return SUCCESS;
+}
+
+int libivc_start_listening_server(struct libivc_server **server, uint16_t listening_port, uint16_t listen_for_domid, uint64_t listen_for_client_id, libivc_client_connected connectCallback, void *opaque)
+{
+    (void)listening_port;
+    (void)listen_for_domid;
+    (void)listen_for_client_id;
+    (void)connectCallback;
+    (void)opaque;
+
+    *server = &mock_server;
+    return SUCCESS;
+}
+
+struct libivc_server *libivc_find_listening_server(uint16_t connecting_domid, uint16_t port, uint64_t connection_id)
+{
+    (void)connecting_domid;
+    (void)port;
+    (void)connection_id;
+    return NULL;
+}
+
+void libivc_shutdownIvcServer(struct libivc_server *server)
+{
+    (void)server;
+}
@@ -0,0 +1,73 @@
+//
+// PV Display Helper
+//
+// Copyright (C) 2016 - 2017 Assured Information Security, Inc. All rights reserved.
+//
+// A mock of libivc's client API, for the fuzzing harness and benchmarks. Each
+// client is an in-memory byte stream (what the remote side has "sent" us) plus a
+// local buffer standing in for the shared pages; sends are accepted and dropped.
+// Nothing is ever actually shared, and no callbacks fire on their own-- the
+// harness drives them. Not thread safe.
+//
+#ifndef MOCK_LIBIVC__H
+#define MOCK_LIBIVC__H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#define SUCCESS 0
+
+//Connects without a connection ID.
+#define LIBIVC_ID_NONE 0xFFFFFFFFFFFFFFFFULL
+
+typedef uint16_t domid_t;
+
+struct libivc_client;
+struct libivc_server;
+
+typedef void (*libivc_client_event_fired)(void *opaque, struct libivc_client *client);
+typedef void (*libivc_client_disconnected)(void *opaque, struct libivc_client *client);
+typedef void (*libivc_client_connected)(void *opaque, struct libivc_client *client);
+
+int libivc_connect_with_id(struct libivc_client **ivc, uint16_t remote_dom_id, uint16_t remote_port, uint32_t numPages, uint64_t connection_id);
+int libivc_register_event_callbacks(struct libivc_client *client, libivc_client_event_fired eventCallback, libivc_client_disconnected disconnectCallback, void *opaque);
+int libivc_recv(struct libivc_client *client, char *dest, size_t destSize);
+int libivc_send(struct libivc_client *client, char *src, size_t srcSize);
+int libivc_getAvailableSpace(struct libivc_client *client, size_t *space);
+int libivc_getAvailableData(struct libivc_client *client, size_t *data);
+int libivc_getLocalBuffer(struct libivc_client *client, char **buf);
+int libivc_getLocalBufferSize(struct libivc_client *client, size_t *size);
+bool libivc_isOpen(struct libivc_client *client);
+int libivc_notify_remote(struct libivc_client *client);
+int libivc_reconnect(struct libivc_client *client, uint16_t remote_dom_id, uint16_t remote_port);
+void libivc_disconnect(struct libivc_client *client);
+int libivc_enable_events(struct libivc_client *client);
+int libivc_disable_events(struct libivc_client *client);
+int libivc_start_listening_server(struct libivc_server **server, uint16_t listening_port, uint16_t listen_for_domid, uint64_t listen_for_client_id, libivc_client_connected connectCallback, void *opaque);
+struct libivc_server *libivc_find_listening_server(uint16_t connecting_domid, uint16_t port, uint64_t connection_id);
+void libivc_shutdownIvcServer(struct libivc_server *server);
+
+//
+// Mock-only functions.
+//
+
+/**
+ * Creates a connected client with a zeroed local buffer of the given size.
+ * The client lives until mock_libivc_reset, whether or not it's disconnected.
+ */
+struct libivc_client *mock_libivc_open(size_t buffer_size);
+
+/**
+ * Appends data to what the client has received, as though the remote had sent it.
+ */
+void mock_libivc_push(struct libivc_client *client, const void *data, size_t length);
+
+/**
+ * Frees every client created since the last reset.
+ */
+void mock_libivc_reset(void);
+
+#endif // MOCK_LIBIVC__H
@@ -0,0 +1,5 @@
+//
+// PV Display Helper
+//
+// Stands in for <xen/xen.h> alongside the mock libivc.h, which provides domid_t.
+//
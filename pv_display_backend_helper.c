@@ -7,40 +7,1038 @@
 #include "pv_display_helper.h"
 #include "pv_display_backend_helper.h"
 
+//The work a polled consumer or display backend leaves for its process_pending method.
+#define PV_DISPLAY_PENDING_DATA             (1 << 0)
+#define PV_DISPLAY_PENDING_DIRTY_RECTANGLES (1 << 1)
+#define PV_DISPLAY_PENDING_DISCONNECT       (1 << 2)
+
+//The negotiable capabilities the helper handles on its own, and so always offers,
+//whatever its owner passes to set_host_capabilities.
+#define PV_DISPLAY_BACKEND_CAPABILITIES (DH_CAP_COMPACT_DIRTY_RECTANGLES | DH_CAP_DIRTY_RECTANGLE_CREDITS)
+
+//The room frame done reports leave free in the control ring, so the add and remove
+//display packets behind them always fit; a quarter of the guest's default ring.
+#define PV_DISPLAY_FRAME_DONE_RESERVE 1024
+
+//The pool our packet buffers are drawn from. The backend only runs in userspace,
+//where the pool is ready from the start; see pv_helper_packet_pool_init.
+PV_HELPER_DEFINE_PACKET_POOL();
+
+/**
+ * Triggers the given consumers's fatal error handler, if one exists.
+ * Assumes that the caller holds the consumer's lock, as the receive path does.
+ *
+ * @param display The PV display whose fatal error handler is to be triggered.
+ */
+static void __trigger_fatal_error_on_consumer_locked(struct pv_display_consumer *consumer)
+{
+    __PV_HELPER_TRACE__;
+    if(consumer->fatal_error_handler)
+        consumer->fatal_error_handler(consumer);
+    pv_display_error(" triggering consumer error\n");
+}
+
+/**
+ * Triggers the given consumers's fatal error handler, if one exists.
+ * For use when the caller doesn't already hold the consumer's lock.
+ */
+static void __trigger_fatal_error_on_consumer(struct pv_display_consumer *consumer)
+{
+    pv_helper_lock(&consumer->lock);
+    __trigger_fatal_error_on_consumer_locked(consumer);
+    pv_helper_unlock(&consumer->lock);
+}
+
+/**
+ * Triggers the given display's fatal error handler, if one exists.
+ *
+ * @param display The PV display whose fatal error handler is to be triggered.
+ */
+static void __trigger_fatal_error_on_display_backend(struct pv_display_backend *display)
+{
+    __PV_HELPER_TRACE__;
+    if(!display) {
+        return;
+    }
+
+    pv_helper_lock(&display->fatal_lock);
+    if(display->fatal_error_handler) {
+        fatal_display_backend_error_handler tmp_fn = display->fatal_error_handler;
+        display->fatal_error_handler = NULL;
+        tmp_fn(display);
+    }
+    pv_helper_unlock(&display->fatal_lock);
+}
+
+/**
+ * Handles the loss of one of a display's connections: right away, or, if the
+ * display is being polled, once its event loop calls process_pending.
+ */
+static void __dispatch_display_disconnect(struct pv_display_backend *display)
+{
+    if(!pv_helper_notifier_post(&display->notifier, PV_DISPLAY_PENDING_DISCONNECT))
+        __trigger_fatal_error_on_display_backend(display);
+}
+
+/**
+ * Appends a single record to a recording. The record's payload is gathered from
+ * the given sections, in the same style as __pv_helper_checksum.
+ */
+static void __record(struct pv_display_recorder *recorder, uint16_t type, uint16_t source,
+                     void **sections, size_t *lengths, size_t count)
+{
+    struct pv_display_record_header record;
+    size_t i;
+
+    if(!recorder) {
+        return;
+    }
+
+    record.time_ns = pv_helper_time_ns() - recorder->start_ns;
+    record.type    = type;
+    record.source  = source;
+    record.length  = 0;
+
+    for(i = 0; i < count; ++i)
+        record.length += (uint32_t)lengths[i];
+
+    pv_helper_lock(&recorder->lock);
+
+    if(recorder->failed) {
+        pv_helper_unlock(&recorder->lock);
+        return;
+    }
+
+    //Write the record as a unit, so records from different channels never interleave.
+    recorder->failed = (fwrite(&record, sizeof(record), 1, recorder->file) != 1);
+
+    for(i = 0; (i < count) && !recorder->failed; ++i)
+        recorder->failed = (fwrite(sections[i], 1, lengths[i], recorder->file) != lengths[i]);
+
+    if(recorder->failed) {
+        pv_display_error("Could not write to a recording; recording has stopped.\n");
+    } else {
+        recorder->records++;
+        recorder->bytes += sizeof(record) + record.length;
+    }
+
+    pv_helper_unlock(&recorder->lock);
+}
+
+/**
+ * Records a received packet exactly as it arrived.
+ *
+ * @param buffer The packet's payload, followed by its footer.
+ */
+static void __record_packet(struct pv_display_recorder *recorder, uint16_t type, uint16_t source,
+                            struct dh_header *header, void *buffer)
+{
+    void *sections[] = { header, buffer };
+    size_t lengths[] = { sizeof(*header), header->length + sizeof(struct dh_footer) };
+
+    __record(recorder, type, source, sections, lengths, 2);
+}
+
+int create_pv_display_recorder(struct pv_display_recorder **recorder, const char *path, uint32_t snapshot_interval)
+{
+    struct pv_display_recording_header header = {
+        .magic   = PV_DISPLAY_RECORDING_MAGIC,
+        .version = PV_DISPLAY_RECORDING_VERSION,
+    };
+    struct pv_display_recorder *new_recorder;
+
+    pv_display_checkp(recorder, -EINVAL);
+    pv_display_checkp(path, -EINVAL);
+
+    new_recorder = pv_helper_malloc(sizeof(*new_recorder));
+
+    if(!new_recorder) {
+        return -ENOMEM;
+    }
+
+    new_recorder->file = fopen(path, "wb");
+
+    if(!new_recorder->file) {
+        pv_display_error("Could not create recording %s!\n", path);
+        pv_helper_free(new_recorder);
+        return -EIO;
+    }
+
+    if(fwrite(&header, sizeof(header), 1, new_recorder->file) != 1) {
+        pv_display_error("Could not write to recording %s!\n", path);
+        fclose(new_recorder->file);
+        pv_helper_free(new_recorder);
+        return -EIO;
+    }
+
+    pv_helper_mutex_init(&new_recorder->lock);
+    new_recorder->snapshot_interval = snapshot_interval;
+    new_recorder->start_ns = pv_helper_time_ns();
+
+    *recorder = new_recorder;
+    return 0;
+}
+
+void destroy_pv_display_recorder(struct pv_display_recorder *recorder)
+{
+    if(!recorder) {
+        return;
+    }
+
+    if(fclose(recorder->file)) {
+        pv_display_error("Could not finish writing a recording; it may be truncated.\n");
+    }
+
+    pv_display_debug("Recorded %llu records (%llu bytes).\n",
+                     (unsigned long long)recorder->records, (unsigned long long)recorder->bytes);
+    pv_helper_free(recorder);
+}
+
+/**
+ * Video Overlays
+ *
+ */
+
+/**
+ * Finds one of the frames in a display's overlay buffer, as the guest last described
+ * it. Assumes that the caller holds the display's lock.
+ *
+ * @return The frame's Y plane, or NULL if the frame doesn't fit in the buffer.
+ */
+static void *__overlay_frame_image(struct pv_display_backend *display, uint32_t buffer)
+{
+    struct dh_set_overlay *overlay = &display->overlay;
+
+    if(!display->overlay_buffer || (overlay->format == DH_OVERLAY_FORMAT_NONE) ||
+       (buffer >= DH_OVERLAY_BUFFERS) || (overlay->pitch < overlay->width)) {
+        return NULL;
+    }
+
+    //The guest sizes the buffer for its frames; don't trust it to have got that right.
+    if(DH_OVERLAY_BUFFER_SIZE(overlay->pitch, overlay->height) > display->overlay_buffer_size) {
+        return NULL;
+    }
+
+    return (char *)display->overlay_buffer + (buffer * DH_OVERLAY_FRAME_SIZE(overlay->pitch, overlay->height));
+}
+
+/**
+ * Compressed Tiles
+ *
+ */
+
+/**
+ * Finds one of the guest's compressed tiles, and checks its header against the
+ * display's geometry. Assumes that the caller holds the display's lock.
+ *
+ * @return The tile's compressed data, or NULL if there's no such valid tile.
+ */
+static const uint32_t *__find_tile(struct pv_display_backend *display, uint32_t column, uint32_t row,
+                                   struct dh_tile_header *header)
+{
+    struct dh_tile_store *store = &display->tile_store;
+    const char *slot;
+    uint32_t width, height;
+
+    if(!display->framebuffer || (column >= store->columns) || (row >= store->rows) ||
+       (column * DH_TILE_SIZE >= display->tile_width) || (row * DH_TILE_SIZE >= display->tile_height)) {
+        return NULL;
+    }
+
+    slot = (const char *)display->framebuffer + store->offset +
+           ((((size_t)row * store->columns) + column) * DH_TILE_SLOT_SIZE);
+
+    //The header may be rewritten under us; read it just the once.
+    memcpy(header, slot, sizeof(*header));
+
+    width  = ((display->tile_width - (column * DH_TILE_SIZE)) < DH_TILE_SIZE) ? (display->tile_width - (column * DH_TILE_SIZE)) : DH_TILE_SIZE;
+    height = ((display->tile_height - (row * DH_TILE_SIZE)) < DH_TILE_SIZE) ? (display->tile_height - (row * DH_TILE_SIZE)) : DH_TILE_SIZE;
+
+    if((header->width != width) || (header->height != height) ||
+       (header->length % sizeof(uint32_t)) || (header->length > DH_TILE_MAX_WORDS * sizeof(uint32_t))) {
+        return NULL;
+    }
+
+    return (const uint32_t *)(slot + sizeof(*header));
+}
+
+/**
+ * Finds one of the guest's compressed tiles, for forwarding; see get_compressed_tile.
+ */
+static int pv_display_backend_get_compressed_tile(struct pv_display_backend *display, uint32_t column, uint32_t row,
+                                                  struct dh_tile_header *header, const void **data)
+{
+    const uint32_t *tile;
+    int rc = 0;
+
+    pv_display_checkp(display, -EINVAL);
+    pv_display_checkp(header, -EINVAL);
+    pv_display_checkp(data, -EINVAL);
+
+    pv_helper_lock_counted(&display->lock, &display->stats);
+
+    if((column >= display->tile_store.columns) || (row >= display->tile_store.rows)) {
+        rc = -ENOENT;
+    } else if(!(tile = __find_tile(display, column, row, header))) {
+        rc = -EINVAL;
+    } else {
+        *data = tile;
+    }
+
+    pv_helper_unlock(&display->lock);
+    return rc;
+}
+
+/**
+ * Decompresses one of the guest's tiles into an image; see decompress_tile.
+ */
+static int pv_display_backend_decompress_tile(struct pv_display_backend *display, uint32_t column, uint32_t row,
+                                              void *image, uint32_t stride)
+{
+    struct dh_tile_header header;
+    const uint32_t *tile;
+    int rc;
+
+    pv_display_checkp(display, -EINVAL);
+    pv_display_checkp(image, -EINVAL);
+
+    pv_helper_lock_counted(&display->lock, &display->stats);
+
+    if((column >= display->tile_store.columns) || (row >= display->tile_store.rows)) {
+        rc = -ENOENT;
+    } else if(!(tile = __find_tile(display, column, row, &header))) {
+        rc = -EINVAL;
+    } else {
+        rc = __pv_helper_tile_decompress(image, stride, header.width, header.height,
+                                         tile, header.length / sizeof(uint32_t));
+    }
+
+    pv_helper_unlock(&display->lock);
+    return rc;
+}
+
+/**
+ * Dispatch
+ *
+ */
+
+/**
+ * The handlers a dispatcher can run, in the order in which coalesced events
+ * (see struct pv_display_dispatch_ring) are delivered.
+ */
+enum pv_display_dispatch_type
+{
+    PV_DISPLAY_DISPATCH_SET_DISPLAY,
+    PV_DISPLAY_DISPATCH_FRAMEBUFFER_PRESERVED,
+    PV_DISPLAY_DISPATCH_BLANK_DISPLAY,
+    PV_DISPLAY_DISPATCH_UPDATE_CURSOR,
+    PV_DISPLAY_DISPATCH_MOVE_CURSOR,
+    PV_DISPLAY_DISPATCH_SET_OVERLAY,
+    PV_DISPLAY_DISPATCH_OVERLAY_FRAME,
+    PV_DISPLAY_DISPATCH_DIRTY_RECTANGLE,
+    PV_DISPLAY_DISPATCH_FRAME_COMMIT,
+    PV_DISPLAY_DISPATCH_TYPES
+};
+
+/**
+ * A single decoded event, waiting for its handler to be run; args holds the
+ * handler's arguments, in order.
+ */
+struct pv_display_dispatch_event
+{
+    uint32_t type;
+    uint32_t args[4];
+};
+
+#if defined __linux__ && !defined __KERNEL__
+#include <unistd.h>
+
+/**
+ * Calls the handler for a decoded event, if one's (still) registered.
+ */
+static void __deliver_dispatched_event(struct pv_display_backend *display, struct pv_display_dispatch_event *event)
+{
+    uint32_t *args = event->args;
+
+    switch(event->type)
+    {
+        case PV_DISPLAY_DISPATCH_SET_DISPLAY:
+            if(display->set_display_handler)
+                display->set_display_handler(display, args[0], args[1], args[2]);
+            break;
+
+        case PV_DISPLAY_DISPATCH_FRAMEBUFFER_PRESERVED:
+            if(display->framebuffer_preserved_handler)
+                display->framebuffer_preserved_handler(display, args[0], args[1], args[2]);
+            else if(display->dirty_rectangle_handler)
+                display->dirty_rectangle_handler(display, 0, 0, args[0], args[1]);
+            break;
+
+        case PV_DISPLAY_DISPATCH_BLANK_DISPLAY:
+            if(display->blank_display_handler)
+                display->blank_display_handler(display, args[0]);
+            break;
+
+        case PV_DISPLAY_DISPATCH_UPDATE_CURSOR:
+            if(display->update_cursor_handler)
+                display->update_cursor_handler(display, args[0], args[1], args[2]);
+            break;
+
+        case PV_DISPLAY_DISPATCH_MOVE_CURSOR:
+            if(display->move_cursor_handler)
+                display->move_cursor_handler(display, args[0], args[1]);
+            break;
+
+        //The overlay's description doesn't fit in an event's arguments, so it's read
+        //from the display when the handler runs; the latest one is what matters, anyway.
+        case PV_DISPLAY_DISPATCH_SET_OVERLAY:
+            if(display->set_overlay_handler) {
+                struct dh_set_overlay overlay;
+
+                pv_helper_lock_counted(&display->lock, &display->stats);
+                overlay = display->overlay;
+                pv_helper_unlock(&display->lock);
+
+                display->set_overlay_handler(display, &overlay);
+            }
+            break;
+
+        //The frame lives in the overlay's buffer, which goes away if the overlay
+        //disconnects; hold the display's lock, as the receive path would, until the
+        //handler's done with it.
+        case PV_DISPLAY_DISPATCH_OVERLAY_FRAME:
+            if(display->overlay_frame_handler) {
+                pv_helper_lock_counted(&display->lock, &display->stats);
+                display->overlay_frame_handler(display, args[0], __overlay_frame_image(display, args[1]));
+                pv_helper_unlock(&display->lock);
+            }
+            break;
+
+        case PV_DISPLAY_DISPATCH_DIRTY_RECTANGLE:
+            if(display->dirty_rectangle_handler)
+                display->dirty_rectangle_handler(display, args[0], args[1], args[2], args[3]);
+            break;
+
+        case PV_DISPLAY_DISPATCH_FRAME_COMMIT:
+            if(display->frame_commit_handler)
+                display->frame_commit_handler(display, args[0]);
+            break;
+
+        default:
+            break;
+    }
+}
+
+//The number of events each display can have queued on each of its rings; a power of two.
+#define PV_DISPLAY_DISPATCH_RING_LENGTH 256
+
+//The most events a worker handles for one display before moving on to the next.
+#define PV_DISPLAY_DISPATCH_BATCH 64
+
+/**
+ * A single-producer, single-consumer ring of events for one display. The producer
+ * is whichever thread is receiving from the display's channel; the consumer, the
+ * display's worker. Neither ever waits for the other: events that arrive while the
+ * ring is full (and every one after them, until the worker catches up, so nothing
+ * is delivered out of order) are coalesced instead, keeping only the latest of each
+ * type-- or, for dirty rectangles, their bounding box.
+ */
+struct pv_display_dispatch_ring
+{
+    //The next event to be handled, written only by the worker; and the next
+    //slot to be filled, written only by the producer.
+    uint32_t head;
+    uint32_t tail;
+    struct pv_display_dispatch_event events[PV_DISPLAY_DISPATCH_RING_LENGTH];
+
+    //The coalesced events, and a bit for each type that has one.
+    pv_helper_mutex overflow_lock;
+    uint32_t overflow_mask;
+    struct pv_display_dispatch_event overflow[PV_DISPLAY_DISPATCH_TYPES];
+};
+
+/**
+ * A display's place in a dispatcher.
+ */
+struct pv_display_dispatch_queue
+{
+    struct pv_display_backend *display;
+    struct pv_display_dispatch_worker *worker;
+    struct pv_display_dispatch_queue *next;
+
+    //Event channel packets and dirty rectangles are received on different threads,
+    //so each gets a ring of its own. Frame commits arrive with the dirty rectangles,
+    //and must stay behind them, so they share the dirty rectangles' ring.
+    struct pv_display_dispatch_ring events;
+    struct pv_display_dispatch_ring dirty_rectangles;
+};
+
+/**
+ * A worker thread, and the displays whose handlers it runs.
+ */
+struct pv_display_dispatch_worker
+{
+    pthread_t thread;
+    bool started;
+
+    //Protects the fields below.
+    pthread_mutex_t lock;
+
+    //Signalled when there's work for a sleeping worker, and when the worker
+    //finishes with a display, respectively.
+    pthread_cond_t wake;
+    pthread_cond_t idle;
+
+    struct pv_display_dispatch_queue *queues;
+    uint32_t queue_count;
+
+    //The display the worker is running handlers for, if any.
+    struct pv_display_dispatch_queue *current;
+
+    //Set while the worker is (about to be) waiting for work; read without the lock.
+    bool sleeping;
+    bool stopping;
+};
+
+struct pv_display_dispatcher
+{
+    uint32_t worker_count;
+    struct pv_display_dispatch_worker *workers;
+};
+
+/**
+ * Adds an event to a ring, unless it's full. Called only by the ring's producer.
+ *
+ * @return True iff the event was added.
+ */
+static bool __dispatch_ring_push(struct pv_display_dispatch_ring *ring, struct pv_display_dispatch_event *event)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if((ring->tail - head) >= PV_DISPLAY_DISPATCH_RING_LENGTH)
+        return false;
+
+    ring->events[ring->tail & (PV_DISPLAY_DISPATCH_RING_LENGTH - 1)] = *event;
+
+    //Publish the event. This must be ordered before the producer checks whether
+    //the worker's asleep; see __dispatch_wake.
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_SEQ_CST);
+    return true;
+}
+
+/**
+ * Takes the oldest event from a ring. Called only by the ring's worker.
+ *
+ * @return True iff there was an event to take.
+ */
+static bool __dispatch_ring_pop(struct pv_display_dispatch_ring *ring, struct pv_display_dispatch_event *event)
+{
+    if(ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return false;
+
+    *event = ring->events[ring->head & (PV_DISPLAY_DISPATCH_RING_LENGTH - 1)];
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @return True iff the given ring has events waiting.
+ */
+static bool __dispatch_ring_has_work(struct pv_display_dispatch_ring *ring)
+{
+    return (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST)) ||
+           __atomic_load_n(&ring->overflow_mask, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Adds an event to a ring: queued, if there's room and nothing's already been
+ * coalesced; or coalesced otherwise.
+ *
+ * @return True iff the event had to be coalesced.
+ */
+static bool __dispatch_ring_add(struct pv_display_dispatch_ring *ring, struct pv_display_dispatch_event *event)
+{
+    struct pv_display_dispatch_event *slot = &ring->overflow[event->type];
+    uint32_t bit = 1U << event->type;
+
+    if(!__atomic_load_n(&ring->overflow_mask, __ATOMIC_SEQ_CST) && __dispatch_ring_push(ring, event))
+        return false;
+
+    pv_helper_lock(&ring->overflow_lock);
+
+    //Grow any dirty rectangle we're already holding to cover the new one...
+    //(The guest picks the rectangles, so their edges are computed in 64 bits, where they
+    //can't wrap, and the box is clamped to what a rectangle can describe.)
+    if((event->type == PV_DISPLAY_DISPATCH_DIRTY_RECTANGLE) && (ring->overflow_mask & bit))
+    {
+        uint32_t left   = (event->args[0] < slot->args[0]) ? event->args[0] : slot->args[0];
+        uint32_t top    = (event->args[1] < slot->args[1]) ? event->args[1] : slot->args[1];
+        uint64_t right  = (uint64_t)event->args[0] + event->args[2];
+        uint64_t bottom = (uint64_t)event->args[1] + event->args[3];
+
+        if(right < (uint64_t)slot->args[0] + slot->args[2])
+            right = (uint64_t)slot->args[0] + slot->args[2];
+        if(bottom < (uint64_t)slot->args[1] + slot->args[3])
+            bottom = (uint64_t)slot->args[1] + slot->args[3];
+
+        slot->args[0] = left;
+        slot->args[1] = top;
+        slot->args[2] = (uint32_t)((right - left > 0xFFFFFFFF) ? 0xFFFFFFFF : right - left);
+        slot->args[3] = (uint32_t)((bottom - top > 0xFFFFFFFF) ? 0xFFFFFFFF : bottom - top);
+    }
+    //... and otherwise, just keep the latest event.
+    else
+    {
+        *slot = *event;
+    }
+
+    __atomic_fetch_or(&ring->overflow_mask, bit, __ATOMIC_SEQ_CST);
+    pv_helper_unlock(&ring->overflow_lock);
+
+    return true;
+}
+
+/**
+ * Runs the handlers for a batch of a ring's events. Called only by the ring's worker.
+ */
+static void __dispatch_ring_drain(struct pv_display_backend *display, struct pv_display_dispatch_ring *ring)
+{
+    struct pv_display_dispatch_event event;
+    struct pv_display_dispatch_event overflow[PV_DISPLAY_DISPATCH_TYPES];
+    uint32_t mask;
+    int handled;
+
+    for(handled = 0; handled < PV_DISPLAY_DISPATCH_BATCH; ++handled)
+    {
+        if(!__dispatch_ring_pop(ring, &event))
+            break;
+
+        __deliver_dispatched_event(display, &event);
+    }
+
+    //Coalesced events are newer than anything in the ring, so only deliver them
+    //once the ring's empty.
+    if((handled == PV_DISPLAY_DISPATCH_BATCH) || !__atomic_load_n(&ring->overflow_mask, __ATOMIC_SEQ_CST))
+        return;
+
+    pv_helper_lock(&ring->overflow_lock);
+    mask = __atomic_exchange_n(&ring->overflow_mask, 0, __ATOMIC_SEQ_CST);
+    memcpy(overflow, ring->overflow, sizeof(overflow));
+    pv_helper_unlock(&ring->overflow_lock);
+
+    for(event.type = 0; event.type < PV_DISPLAY_DISPATCH_TYPES; ++event.type)
+    {
+        if(mask & (1U << event.type))
+            __deliver_dispatched_event(display, &overflow[event.type]);
+    }
+}
+
+/**
+ * Wakes a worker that's waiting for work, if it is.
+ */
+static void __dispatch_wake(struct pv_display_dispatch_worker *worker)
+{
+    //The worker announces it's going to sleep before its final check for work, and we
+    //publish our work before checking for that announcement-- so at least one of us
+    //sees the other. If we see it, the worker holds its lock until it's actually waiting.
+    if(!__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST))
+        return;
+
+    pthread_mutex_lock(&worker->lock);
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/**
+ * Hands a decoded event to the given display's worker, if it has one.
+ *
+ * @return True iff the event was handed off, and so shouldn't be handled now.
+ */
+static bool __dispatch(struct pv_display_backend *display, uint32_t type,
+                       uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+    struct pv_display_dispatch_queue *queue;
+    struct pv_display_dispatch_event event = { .type = type, .args = { arg0, arg1, arg2, arg3 } };
+    struct pv_display_dispatch_ring *ring;
+
+    //Hold on to the queue until the event's on it; see __dispatch_detach.
+    pv_helper_lock(&display->dispatch_lock);
+    queue = display->dispatch_queue;
+
+    if(!queue) {
+        pv_helper_unlock(&display->dispatch_lock);
+        return false;
+    }
+
+    ring = ((type == PV_DISPLAY_DISPATCH_DIRTY_RECTANGLE) || (type == PV_DISPLAY_DISPATCH_FRAME_COMMIT)) ?
+        &queue->dirty_rectangles : &queue->events;
+
+    if(__dispatch_ring_add(ring, &event) && (type == PV_DISPLAY_DISPATCH_DIRTY_RECTANGLE))
+        pv_helper_stats_inc(display->stats.dirty_rects_coalesced);
+
+    __dispatch_wake(queue->worker);
+    pv_helper_unlock(&display->dispatch_lock);
+    return true;
+}
+
+/**
+ * @return True iff any of the given worker's displays have events waiting.
+ *    Assumes the worker is locked.
+ */
+static bool __dispatch_worker_has_work(struct pv_display_dispatch_worker *worker)
+{
+    struct pv_display_dispatch_queue *queue;
+
+    for(queue = worker->queues; queue; queue = queue->next)
+    {
+        if(__dispatch_ring_has_work(&queue->events) || __dispatch_ring_has_work(&queue->dirty_rectangles))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * The body of each worker thread: runs its displays' handlers, a batch at a time
+ * for each display in turn, until it's told to stop.
+ */
+static void *__dispatch_worker(void *opaque)
+{
+    struct pv_display_dispatch_worker *worker = opaque;
+    struct pv_display_dispatch_queue *queue, *next;
+    bool worked;
+
+    pthread_mutex_lock(&worker->lock);
+
+    while(!worker->stopping)
+    {
+        worked = false;
+
+        for(queue = worker->queues; queue; queue = next)
+        {
+            if(__dispatch_ring_has_work(&queue->events) || __dispatch_ring_has_work(&queue->dirty_rectangles))
+            {
+                //Run the handlers without our lock, so displays can be attached meanwhile.
+                //A display can't be detached while it's current.
+                worker->current = queue;
+                pthread_mutex_unlock(&worker->lock);
+
+                __dispatch_ring_drain(queue->display, &queue->events);
+                __dispatch_ring_drain(queue->display, &queue->dirty_rectangles);
+
+                pthread_mutex_lock(&worker->lock);
+                worker->current = NULL;
+                pthread_cond_broadcast(&worker->idle);
+                worked = true;
+            }
+
+            next = queue->next;
+        }
+
+        if(worked)
+            continue;
+
+        //Nothing left to do; wait for more. See __dispatch_wake.
+        __atomic_store_n(&worker->sleeping, true, __ATOMIC_SEQ_CST);
+
+        if(!__dispatch_worker_has_work(worker) && !worker->stopping)
+            pthread_cond_wait(&worker->wake, &worker->lock);
+
+        __atomic_store_n(&worker->sleeping, false, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+/**
+ * Gives a display a place in a dispatcher, on whichever worker has the fewest
+ * displays; it stays with that worker, so its handlers always run in order.
+ */
+static int __dispatch_attach(struct pv_display_backend *display, struct pv_display_dispatcher *dispatcher)
+{
+    struct pv_display_dispatch_queue *queue;
+    struct pv_display_dispatch_worker *worker = NULL;
+    uint32_t i, count, fewest = 0;
+
+    queue = pv_helper_malloc(sizeof(*queue));
+
+    if(!queue)
+        return -ENOMEM;
+
+    queue->display = display;
+    pv_helper_mutex_init(&queue->events.overflow_lock);
+    pv_helper_mutex_init(&queue->dirty_rectangles.overflow_lock);
+
+    //Other displays may be coming and going meanwhile, so this is only a best guess.
+    for(i = 0; i < dispatcher->worker_count; ++i)
+    {
+        pthread_mutex_lock(&dispatcher->workers[i].lock);
+        count = dispatcher->workers[i].queue_count;
+        pthread_mutex_unlock(&dispatcher->workers[i].lock);
+
+        if(!worker || (count < fewest)) {
+            worker = &dispatcher->workers[i];
+            fewest = count;
+        }
+    }
+
+    pthread_mutex_lock(&worker->lock);
+    queue->worker  = worker;
+    queue->next    = worker->queues;
+    worker->queues = queue;
+    worker->queue_count++;
+    pthread_mutex_unlock(&worker->lock);
+
+    pv_helper_lock(&display->dispatch_lock);
+    display->dispatch_queue = queue;
+    pv_helper_unlock(&display->dispatch_lock);
+    return 0;
+}
+
+/**
+ * Removes a display from its dispatcher, discarding anything still queued, once
+ * its worker is done running its handlers.
+ */
+static void __dispatch_detach(struct pv_display_backend *display)
+{
+    struct pv_display_dispatch_queue *queue;
+    struct pv_display_dispatch_worker *worker;
+    struct pv_display_dispatch_queue **link;
+
+    //Once we've taken the queue, nothing more can be queued on it...
+    pv_helper_lock(&display->dispatch_lock);
+    queue = display->dispatch_queue;
+    display->dispatch_queue = NULL;
+    pv_helper_unlock(&display->dispatch_lock);
+
+    if(!queue)
+        return;
+
+    worker = queue->worker;
+
+    //... and once its worker is done with it, nothing can run from it.
+    pthread_mutex_lock(&worker->lock);
+
+    for(link = &worker->queues; *link; link = &(*link)->next)
+    {
+        if(*link == queue)
+        {
+            *link = queue->next;
+            worker->queue_count--;
+            break;
+        }
+    }
+
+    while(worker->current == queue)
+        pthread_cond_wait(&worker->idle, &worker->lock);
+
+    pthread_mutex_unlock(&worker->lock);
+
+    pthread_mutex_destroy(&queue->events.overflow_lock);
+    pthread_mutex_destroy(&queue->dirty_rectangles.overflow_lock);
+    pv_helper_free(queue);
+}
+
+int create_pv_display_dispatcher(struct pv_display_dispatcher **dispatcher, uint32_t workers)
+{
+    struct pv_display_dispatcher *new_dispatcher;
+    long cpus;
+    uint32_t i;
+    int rc = 0;
+
+    pv_display_checkp(dispatcher, -EINVAL);
+
+    //By default, use a worker per CPU.
+    if(!workers)
+    {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = (cpus > 0) ? (uint32_t)cpus : 1;
+    }
+
+    new_dispatcher = pv_helper_malloc(sizeof(*new_dispatcher));
+
+    if(!new_dispatcher)
+        return -ENOMEM;
+
+    new_dispatcher->workers = pv_helper_malloc(sizeof(*new_dispatcher->workers) * workers);
+
+    if(!new_dispatcher->workers)
+    {
+        pv_helper_free(new_dispatcher);
+        return -ENOMEM;
+    }
+
+    new_dispatcher->worker_count = workers;
+
+    //Set up every worker before starting any, so destroy can tear them all down.
+    for(i = 0; i < workers; ++i)
+    {
+        struct pv_display_dispatch_worker *worker = &new_dispatcher->workers[i];
+
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->wake, NULL);
+        pthread_cond_init(&worker->idle, NULL);
+    }
+
+    for(i = 0; i < workers; ++i)
+    {
+        struct pv_display_dispatch_worker *worker = &new_dispatcher->workers[i];
+
+        rc = -pthread_create(&worker->thread, NULL, __dispatch_worker, worker);
+
+        if(rc)
+        {
+            pv_display_error("Could not start a dispatch worker (%d)!\n", rc);
+            break;
+        }
+
+        worker->started = true;
+    }
+
+    if(rc)
+    {
+        destroy_pv_display_dispatcher(new_dispatcher);
+        return rc;
+    }
+
+    *dispatcher = new_dispatcher;
+    return 0;
+}
+
+void destroy_pv_display_dispatcher(struct pv_display_dispatcher *dispatcher)
+{
+    uint32_t i;
+
+    if(!dispatcher)
+        return;
+
+    for(i = 0; i < dispatcher->worker_count; ++i)
+    {
+        struct pv_display_dispatch_worker *worker = &dispatcher->workers[i];
+
+        if(worker->started)
+        {
+            pthread_mutex_lock(&worker->lock);
+            worker->stopping = true;
+            pthread_cond_signal(&worker->wake);
+            pthread_mutex_unlock(&worker->lock);
+
+            pthread_join(worker->thread, NULL);
+        }
+
+        pthread_cond_destroy(&worker->idle);
+        pthread_cond_destroy(&worker->wake);
+        pthread_mutex_destroy(&worker->lock);
+    }
+
+    pv_helper_free(dispatcher->workers);
+    pv_helper_free(dispatcher);
+}
+#else
+//Dispatchers are only supported in Linux userspace; elsewhere, handlers are
+//always run as events are received.
+static bool __dispatch(struct pv_display_backend *display, uint32_t type,
+                       uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3)
+{
+    (void)display;
+    (void)type;
+    (void)arg0;
+    (void)arg1;
+    (void)arg2;
+    (void)arg3;
+    return false;
+}
+
+static int __dispatch_attach(struct pv_display_backend *display, struct pv_display_dispatcher *dispatcher)
+{
+    (void)display;
+    (void)dispatcher;
+    return -ENOSYS;
+}
+
+static void __dispatch_detach(struct pv_display_backend *display)
+{
+    (void)display;
+}
+
+int create_pv_display_dispatcher(struct pv_display_dispatcher **dispatcher, uint32_t workers)
+{
+    (void)dispatcher;
+    (void)workers;
+    return -ENOSYS;
+}
+
+void destroy_pv_display_dispatcher(struct pv_display_dispatcher *dispatcher)
+{
+    (void)dispatcher;
+}
+#endif
+
 /**
- * Triggers the given consumers's fatal error handler, if one exists.
+ * Sends a packet on the consumer's control channel. Packets may take several
+ * writes to the ring, so every control channel send goes through here.
  *
- * @param display The PV display whose fatal error handler is to be triggered.
+ * @return 0 on success, or an error code on failure.
  */
-static void __trigger_fatal_error_on_consumer(struct pv_display_consumer *consumer)
+static int __send_control_packetv(struct pv_display_consumer *consumer, uint32_t type,
+                                  const struct pv_helper_iovec *segments, size_t segment_count)
 {
-    __PV_HELPER_TRACE__;
-    pv_helper_lock(&consumer->lock);
-    if(consumer->fatal_error_handler)
-        consumer->fatal_error_handler(consumer);
-    pv_display_error(" triggering consumer error\n");
-    pv_helper_unlock(&consumer->lock);
+    int rc;
+
+    pv_helper_lock(&consumer->send_lock);
+    rc = __send_packetv(consumer->control_channel, &consumer->stats, type, segments, segment_count);
+    pv_helper_unlock(&consumer->send_lock);
+
+    return rc;
+}
+
+static int __send_control_packet(struct pv_display_consumer *consumer, uint32_t type, void *data, uint32_t length)
+{
+    int rc;
+
+    pv_helper_lock(&consumer->send_lock);
+    rc = __send_packet(consumer->control_channel, &consumer->stats, type, data, length);
+    pv_helper_unlock(&consumer->send_lock);
+
+    return rc;
 }
 
 /**
- * Triggers the given display's fatal error handler, if one exists.
+ * Sends a packet on the consumer's control channel, if the guest agreed to the
+ * given capability, and if doing so would leave at least 'reserve' bytes free in
+ * the ring. The capability is checked under the send lock, which is also held
+ * while it's negotiated, so the check and the send can't straddle a renegotiation.
  *
- * @param display The PV display whose fatal error handler is to be triggered.
+ * @return 0 on success; -ENODEV if the capability wasn't negotiated; -EAGAIN if
+ *    the ring is too full; or another error code on failure.
  */
-static void __trigger_fatal_error_on_display_backend(struct pv_display_backend *display)
+static int __send_negotiated_control_packet(struct pv_display_consumer *consumer, uint32_t capability,
+                                            size_t reserve, uint32_t type, void *data, uint32_t length)
 {
-    __PV_HELPER_TRACE__;
-    if(!display) {
-        return;
-    }
+    size_t space = 0;
+    int rc;
 
-    pv_helper_lock(&display->fatal_lock);
-    if(display->fatal_error_handler) {
-        fatal_display_backend_error_handler tmp_fn = display->fatal_error_handler;
-        display->fatal_error_handler = NULL;
-        tmp_fn(display);
+    pv_helper_lock(&consumer->send_lock);
+
+    if(!(consumer->negotiated_capabilities & capability))
+    {
+        rc = -ENODEV;
     }
-    pv_helper_unlock(&display->fatal_lock);
+    else if(reserve && (libivc_getAvailableSpace(consumer->control_channel, &space) ||
+            (space < sizeof(struct dh_header) + length + sizeof(struct dh_footer) + reserve)))
+    {
+        pv_helper_stats_inc(consumer->stats.ring_full);
+        rc = -EAGAIN;
+    }
+    else
+    {
+        rc = __send_packet(consumer->control_channel, &consumer->stats, type, data, length);
+    }
+
+    pv_helper_unlock(&consumer->send_lock);
+
+    return rc;
 }
 
 /**
@@ -56,17 +1054,65 @@ static bool __try_to_read_header(struct pv_display_consumer *consumer)
 
     __PV_HELPER_TRACE__;
 
-    //Attempt to perform a packetized read, which will pull in a header packet
-    //if at all possible.
-    rc = libivc_recv(consumer->control_channel, (char *)&consumer->current_packet_header, sizeof(struct dh_header));
+    //Attempt to read in a valid header, resynchronizing with the stream if need be.
+    rc = __pv_helper_receive_header(consumer->control_channel, &consumer->resync, &consumer->stats,
+                                    &consumer->current_packet_header, false, PV_HELPER_RESYNC_THRESHOLD);
+
+    //If we couldn't find our place in the stream again, it can't be trusted.
+    if(rc < 0)
+    {
+        pv_display_error("Communications error: lost the control stream. Terminating connections.\n");
+        __trigger_fatal_error_on_consumer_locked(consumer);
+        return false;
+    }
 
-    return (rc == SUCCESS);
+    return (rc > 0);
 }
 
 static void __handle_guest_driver_capabilities_event(struct pv_display_consumer *consumer, struct dh_driver_capabilities *request)
 {
+    int rc;
+    struct dh_host_capabilities reply = { .version = PV_DRIVER_INTERFACE_VERSION };
+
     __PV_HELPER_TRACE__;
 
+    //Tell the driver which of its negotiable capabilities we'll accept, and what
+    //we support ourselves. This has to go out before the driver's handler has a
+    //chance to send the display list, as the guest sizes its displays' buffers from
+    //it. Our caller already holds the consumer's lock.
+    pv_helper_startup_mark(&consumer->startup, 0, PV_HELPER_STARTUP_CAPABILITIES);
+
+    consumer->driver_version      = request->version;
+    consumer->driver_capabilities = request->flags;
+
+    //Hold the send lock while we renegotiate, so the sends that depend on what
+    //was negotiated see either the old capabilities or the new ones.
+    pv_helper_lock(&consumer->send_lock);
+
+    //A driver from another major version may not mean what we do by any of its bits;
+    //grant it nothing, and stick to the base protocol.
+    if(PV_DRIVER_INTERFACE_COMPATIBLE(request->version, PV_DRIVER_INTERFACE_VERSION))
+    {
+        consumer->negotiated_capabilities =
+            __pv_helper_negotiate_capabilities(request->flags, consumer->capabilities | PV_DISPLAY_BACKEND_CAPABILITIES);
+    }
+    else
+    {
+        pv_display_error("The guest speaks interface version %x, which is incompatible with ours (%x).\n",
+            (unsigned int)request->version, (unsigned int)PV_DRIVER_INTERFACE_VERSION);
+        consumer->negotiated_capabilities = 0;
+    }
+
+    reply.flags = consumer->negotiated_capabilities | (consumer->capabilities & ~DH_CAP_NEGOTIABLE);
+
+    pv_helper_unlock(&consumer->send_lock);
+
+    rc = __send_control_packet(consumer, PACKET_TYPE_CONTROL_HOST_CAPABILITIES, &reply, sizeof(reply));
+
+    if(rc) {
+        pv_display_error("Unable to reply to the guest's capabilities! (%d)", rc);
+    }
+
     if(!consumer->driver_capabilities_handler)
     {
         pv_display_error("A driver capabilities packet has been received, but no handler has been registered.");
@@ -80,6 +1126,8 @@ static void __handle_advertised_display_list_request(struct pv_display_consumer
 {
     __PV_HELPER_TRACE__;
 
+    pv_helper_startup_mark(&consumer->startup, 0, PV_HELPER_STARTUP_ADVERTISED_LIST);
+
     if(!consumer->advertised_list_handler)
     {
         pv_display_error("An advertised display list packet has been received, but no handler has been registered.");
@@ -126,6 +1174,7 @@ static void __handle_text_mode_request(struct pv_display_consumer *consumer, str
 static void __handle_control_packet_receipt(struct pv_display_consumer *consumer, struct dh_header *header, void *buffer)
 {
     __PV_HELPER_TRACE__;
+    pv_helper_probe(control_dispatch, header->type, header->length);
 
     //Delegate the event to the approriate handler, according to type.
     switch(header->type)
@@ -161,6 +1210,19 @@ static void __handle_control_packet_receipt(struct pv_display_consumer *consumer
     }
 }
 
+/**
+ * Accounts for, and handles, a complete and valid control packet. Used both for
+ * packets received from the guest, and for those replayed from a recording.
+ * Assumes that the caller holds the consumer's lock.
+ */
+static void __deliver_control_packet(struct pv_display_consumer *consumer, struct dh_header *header, void *buffer)
+{
+    pv_helper_stats_count_packet(consumer->stats.packets_received, consumer->stats.bytes_received,
+        header->type, header->length);
+
+    __handle_control_packet_receipt(consumer, header, buffer);
+}
+
 /**
  * Handle the (possible) receipt of a control packet. Note that this function
  * can be called at any time after a valid packet header has been received.
@@ -171,11 +1233,13 @@ static bool __try_to_receive_control_packet(struct pv_display_consumer *consumer
 {
     __PV_HELPER_TRACE__;
 
+    struct dh_header header;
     size_t length_with_footer;
 
     size_t data_available;
     struct dh_footer *footer;
     uint16_t checksum;
+    bool valid = true;
     char *buffer;
     int rc;
 
@@ -190,7 +1254,7 @@ static bool __try_to_receive_control_packet(struct pv_display_consumer *consumer
     if(rc)
     {
         pv_display_error("Could not query IVC for its available data!\n");
-        __trigger_fatal_error_on_consumer(consumer);
+        __trigger_fatal_error_on_consumer_locked(consumer);
         return false;
     }
 
@@ -204,7 +1268,7 @@ static bool __try_to_receive_control_packet(struct pv_display_consumer *consumer
 
     //Otherwise, try to read the given data. First, we'll create a buffer
     //large enough to receive the rest of the packet.
-    buffer = pv_helper_malloc(length_with_footer);
+    buffer = pv_helper_packet_alloc(length_with_footer);
 
     //If we weren't able to allocate a receive buffer, we'll try to recover
     //on a future iteration. For now, abort!
@@ -224,7 +1288,7 @@ static bool __try_to_receive_control_packet(struct pv_display_consumer *consumer
     if(rc)
     {
         pv_display_error("Could not read in a packet, though IVC claims it's there. Locking problems?\n");
-        pv_helper_free(buffer);
+        pv_helper_packet_free(buffer, length_with_footer);
         return false;
     }
 
@@ -232,31 +1296,57 @@ static bool __try_to_receive_control_packet(struct pv_display_consumer *consumer
     //which should be located right after the main packet body.
     footer = (struct dh_footer *)(buffer + consumer->current_packet_header.length);
 
-    //Compute the checksum of the received packet.
-    checksum = __pv_helper_packet_checksum(&consumer->current_packet_header, buffer, consumer->current_packet_header.length);
-
-    //Check the packet's CRC. If it doesn't match, we're in serious trouble. Bail out.
-    if(checksum != footer->crc)
+    //Make sure the payload agrees with its header before we spend any time checksumming it;
+    //then check the packet's CRC.
+    if(__pv_helper_validate_payload(&consumer->current_packet_header, buffer))
+    {
+        pv_display_error("Communications error: received a malformed Type-%u control packet. Dropping it.\n",
+                         (unsigned int)consumer->current_packet_header.type);
+        pv_helper_stats_inc(consumer->stats.malformed_packets);
+        valid = false;
+    }
+    else if((checksum = __pv_helper_packet_checksum(&consumer->current_packet_header, buffer,
+                                                    consumer->current_packet_header.length)) != footer->crc)
     {
-        pv_display_error("Communications error: CRC did not match for a control packet. Terminating connections.\n");
+        pv_display_error("Communications error: CRC did not match for a control packet. Dropping it.\n");
+        pv_helper_stats_inc(consumer->stats.crc_failures);
+        pv_helper_probe(crc_mismatch, consumer->current_packet_header.type, consumer->current_packet_header.length,
+                        footer->crc, checksum);
+        valid = false;
+    }
 
+    //If the packet was bad, drop it; the next header will tell us whether we're still in step
+    //with the stream. We only give up on it if we've been out of step for too long.
+    if(!valid)
+    {
         //Invalidate the received packet...
         consumer->current_packet_header.length = 0;
+        pv_helper_packet_free(buffer, length_with_footer);
 
-        //... clean up, and return.
-        pv_helper_free(buffer);
-        __trigger_fatal_error_on_consumer(consumer);
-        return false;
+        if(__pv_helper_resync_skip(&consumer->resync, &consumer->stats,
+                                   sizeof(struct dh_header) + length_with_footer, PV_HELPER_RESYNC_THRESHOLD))
+        {
+            pv_display_error("Communications error: too many bad control packets. Terminating connections.\n");
+            __trigger_fatal_error_on_consumer_locked(consumer);
+            return false;
+        }
+
+        return true;
     }
 
+    __pv_helper_resync_complete(&consumer->resync);
+
+    header = consumer->current_packet_header;
+    __record_packet(consumer->recorder, PV_DISPLAY_RECORD_CONTROL_PACKET, 0, &header, buffer);
+
     //Invalidate the current packet header, as we've already handled it!
     consumer->current_packet_header.length = 0;
 
     //Finally, pass the compelted packet to our packet receipt handler.
-    __handle_control_packet_receipt(consumer, &consumer->current_packet_header, buffer);
+    __deliver_control_packet(consumer, &header, buffer);
 
     //Clean up our buffer.
-    pv_helper_free(buffer);
+    pv_helper_packet_free(buffer, length_with_footer);
     return true;
 }
 
@@ -273,7 +1363,7 @@ static void __handle_control_channel_event(void *opaque, struct libivc_client *c
 
     //Find the PV display provider associated with the given client.
     struct pv_display_consumer *consumer = opaque;
-    pv_helper_lock(&consumer->lock);
+    pv_helper_lock_counted(&consumer->lock, &consumer->stats);
 
     bool continue_to_read = false;
     pv_display_debug("Received a control channel event for remote %d on port %d\n", consumer->rx_domain, consumer->control_port);
@@ -290,44 +1380,178 @@ static void __handle_control_channel_event(void *opaque, struct libivc_client *c
             continue_to_read = __try_to_read_header(consumer);
         }
 
-        //If we now have a defined packet "shape" to receive, try to receive it.
-        if(consumer->current_packet_header.length > 0)
-        {
-            pv_display_debug("Receiving a Type-%u packet in progress. Trying to receive...\n",
-                             (unsigned int)consumer->current_packet_header.type);
-            continue_to_read = __try_to_receive_control_packet(consumer);
-        }
+        //If we now have a defined packet "shape" to receive, try to receive it.
+        if(consumer->current_packet_header.length > 0)
+        {
+            pv_display_debug("Receiving a Type-%u packet in progress. Trying to receive...\n",
+                             (unsigned int)consumer->current_packet_header.type);
+            continue_to_read = __try_to_receive_control_packet(consumer);
+        }
+    }
+    while(continue_to_read);
+    pv_helper_unlock(&consumer->lock);
+}
+
+/**
+ * Sets the private per-driver data for the given display.
+ *
+ * @param display The display for which the data should be associated.
+ * @param data The data to be associated with the given display.
+ */
+static void pv_display_backend_set_driver_data(struct pv_display_backend *display, void *data)
+{
+    __PV_HELPER_TRACE__;
+
+    pv_helper_lock(&display->lock);
+    display->driver_data = data;
+    pv_helper_unlock(&display->lock);
+}
+
+/**
+ * @return The display driver data associated with the given display.
+ */
+static void *pv_display_backend_get_driver_data(struct pv_display_backend *display)
+{
+    __PV_HELPER_TRACE__;
+    void *value;
+
+    value = display->driver_data;
+
+    return value;
+}
+
+/**
+ * Takes a snapshot of the given display's performance counters.
+ */
+static void pv_display_backend_get_stats(struct pv_display_backend *display, struct pv_helper_stats *stats)
+{
+    pv_helper_stats_snapshot(stats, &display->stats);
+}
+
+/**
+ * Takes a snapshot of the given display's startup profile.
+ */
+static void pv_display_backend_get_startup_profile(struct pv_display_backend *display, struct pv_helper_startup_profile *profile)
+{
+    *profile = display->startup;
+}
+
+/**
+ * Switches the given display to being driven by its owner's event loop; see enable_polling.
+ */
+static int pv_display_backend_enable_polling(struct pv_display_backend *display)
+{
+    int rc;
+
+    pv_helper_lock(&display->lock);
+    rc = pv_helper_notifier_enable(&display->notifier);
+    pv_helper_unlock(&display->lock);
+
+    return rc;
+}
+
+/**
+ * Starts recording latency histograms for the given display.
+ */
+static int pv_display_backend_enable_latency_histograms(struct pv_display_backend *display)
+{
+    struct pv_display_latency *latency;
+
+    pv_display_checkp(display, -EINVAL);
+
+    pv_helper_lock(&display->lock);
+
+    if(!display->latency) {
+        latency = pv_helper_malloc(sizeof(*latency));
+
+        if(!latency) {
+            pv_helper_unlock(&display->lock);
+            return -ENOMEM;
+        }
+
+        pv_helper_mutex_init(&latency->lock);
+        display->latency = latency;
+    }
+
+    pv_helper_unlock(&display->lock);
+    return 0;
+}
+
+/**
+ * Returns the given display's latency histograms, if they've been enabled.
+ * For use by paths that don't otherwise hold the display's lock; once enabled,
+ * the histograms live as long as the display.
+ */
+static struct pv_display_latency *__get_latency(struct pv_display_backend *display)
+{
+    struct pv_display_latency *latency;
+
+    pv_helper_lock(&display->lock);
+    latency = display->latency;
+    pv_helper_unlock(&display->lock);
+
+    return latency;
+}
+
+/**
+ * Takes a snapshot of the given display's latency histograms.
+ */
+static int pv_display_backend_get_latency_histograms(struct pv_display_backend *display,
+                                                     struct pv_helper_histogram *damage,
+                                                     struct pv_helper_histogram *cursor)
+{
+    struct pv_display_latency *latency;
+
+    pv_display_checkp(display, -EINVAL);
+
+    latency = __get_latency(display);
+
+    if(!latency) {
+        return -ENOENT;
+    }
+
+    pv_helper_lock(&latency->lock);
+
+    if(damage) {
+        *damage = latency->damage;
+    }
+
+    if(cursor) {
+        *cursor = latency->cursor;
     }
-    while(continue_to_read);
-    pv_helper_unlock(&consumer->lock);
+
+    pv_helper_unlock(&latency->lock);
+    return 0;
 }
 
 /**
- * Sets the private per-driver data for the given display.
- *
- * @param display The display for which the data should be associated.
- * @param data The data to be associated with the given display.
+ * Starts (or, given NULL, stops) recording everything the given display receives.
  */
-static void pv_display_backend_set_driver_data(struct pv_display_backend *display, void *data)
+static void pv_display_backend_set_recorder(struct pv_display_backend *display, struct pv_display_recorder *recorder)
 {
     __PV_HELPER_TRACE__;
 
     pv_helper_lock(&display->lock);
-    display->driver_data = data;
+    display->recorder = recorder;
     pv_helper_unlock(&display->lock);
 }
 
 /**
- * @return The display driver data associated with the given display.
+ * Hands the given display's handlers to a dispatcher's workers (or, given NULL,
+ * takes them back); see set_dispatcher.
  */
-static void *pv_display_backend_get_driver_data(struct pv_display_backend *display)
+static int pv_display_backend_set_dispatcher(struct pv_display_backend *display, struct pv_display_dispatcher *dispatcher)
 {
     __PV_HELPER_TRACE__;
-    void *value;
 
-    value = display->driver_data;
+    //We can't hold the display's lock here: detaching waits for the display's
+    //handlers to finish, and they're free to take it.
+    __dispatch_detach(display);
 
-    return value;
+    if(!dispatcher)
+        return 0;
+
+    return __dispatch_attach(display, dispatcher);
 }
 
 /**
@@ -354,6 +1578,7 @@ void __handle_control_connection(void *opaque, struct libivc_client *client)
 
     struct pv_display_consumer *consumer = (struct pv_display_consumer *)opaque;
     pv_helper_lock(&consumer->lock);
+    pv_helper_startup_mark(&consumer->startup, 0, PV_HELPER_STARTUP_CONTROL_CONNECTED);
     if(consumer && consumer->new_control_connection) {
         consumer->new_control_connection(consumer->data, client);
     }
@@ -361,6 +1586,26 @@ void __handle_control_connection(void *opaque, struct libivc_client *client)
 
 }
 
+/**
+ * libivc's entry points for the control channel: each handles its event right
+ * away, or, if the consumer is being polled, leaves it for process_pending.
+ */
+static void __dispatch_control_channel_event(void *opaque, struct libivc_client *client)
+{
+    struct pv_display_consumer *consumer = opaque;
+
+    if(!pv_helper_notifier_post(&consumer->notifier, PV_DISPLAY_PENDING_DATA))
+        __handle_control_channel_event(consumer, client);
+}
+
+static void __dispatch_control_channel_disconnect(void *opaque, struct libivc_client *client)
+{
+    struct pv_display_consumer *consumer = opaque;
+
+    if(!pv_helper_notifier_post(&consumer->notifier, PV_DISPLAY_PENDING_DISCONNECT))
+        __handle_control_channel_disconnect(consumer, client);
+}
+
 void finish_control_connection(struct pv_display_consumer *consumer,
                                void *cli)
 {
@@ -369,11 +1614,11 @@ void finish_control_connection(struct pv_display_consumer *consumer,
     consumer->control_channel = client;
 
     libivc_register_event_callbacks(consumer->control_channel,
-                                    __handle_control_channel_event,
-                                    __handle_control_channel_disconnect,
+                                    __dispatch_control_channel_event,
+                                    __dispatch_control_channel_disconnect,
                                     consumer);
 
-    __handle_control_channel_event(consumer, consumer->control_channel);
+    __dispatch_control_channel_event(consumer, consumer->control_channel);
 }
 
 int __create_control_server(struct pv_display_consumer *consumer)
@@ -394,6 +1639,15 @@ int __create_control_server(struct pv_display_consumer *consumer)
     return rc;
 }
 
+/**
+ * Records the completion of a step in a display backend's startup profile. Each
+ * step is only ever recorded from a single callback, so no lock is needed.
+ */
+static void __mark_backend_startup(struct pv_display_backend *display, enum pv_helper_startup_step step)
+{
+    pv_helper_startup_mark(&display->startup, display->event_port, step);
+}
+
 /**
  * Event Connections
  *
@@ -407,26 +1661,32 @@ int __create_control_server(struct pv_display_consumer *consumer)
   */
  static bool __try_to_read_event_header(struct pv_display_backend *display)
  {
-     int rc = -1;
-     size_t available_data = 0;
+     int rc;
      __PV_HELPER_TRACE__;
 
+     //Attempt to read in a valid header, resynchronizing with the stream if need be.
+     rc = __pv_helper_receive_header(display->event_connection, &display->resync, &display->stats,
+                                     &display->current_packet_header, true, PV_HELPER_RESYNC_THRESHOLD);
 
-     //Attempt to perform a packetized read, which will pull in a header packet
-     //if at all possible.
-     libivc_getAvailableData(display->event_connection, &available_data);
-
-     if(available_data >= sizeof(struct dh_header)) {
-       rc = libivc_recv(display->event_connection,
-			(char *)&display->current_packet_header,
-			sizeof(struct dh_header));
+     //If we couldn't find our place in the stream again, it can't be trusted.
+     if(rc < 0) {
+       pv_display_error("Communications error: lost the event stream. Terminating connections.\n");
+       display->event_stream_failed = true;
+       return false;
      }
 
-     return (rc == SUCCESS);
+     return (rc > 0);
  }
 
 static void __handle_set_display_request(struct pv_display_backend *display, struct dh_set_display *request)
 {
+    __mark_backend_startup(display, PV_HELPER_STARTUP_SET_DISPLAY);
+
+    //Any compressed tiles describe the old geometry; the guest follows up with a new store.
+    display->tile_width = request->width;
+    display->tile_height = request->height;
+    memset(&display->tile_store, 0, sizeof(display->tile_store));
+
     if(!display->set_display_handler) {
         pv_display_debug("A 'set display' event was received, but no one registered a listener.\n");
         return;
@@ -434,6 +1694,10 @@ static void __handle_set_display_request(struct pv_display_backend *display, str
 
     pv_display_debug("display_request: %p - %dx%d - %d", display, request->width, request->height, request->stride);
 
+    if(__dispatch(display, PV_DISPLAY_DISPATCH_SET_DISPLAY, request->width, request->height, request->stride, 0)) {
+        return;
+    }
+
     display->set_display_handler(display, request->width, request->height, request->stride);
 }
 
@@ -444,6 +1708,10 @@ static void __handle_update_cursor_request(struct pv_display_backend *display, s
         return;
     }
 
+    if(__dispatch(display, PV_DISPLAY_DISPATCH_UPDATE_CURSOR, request->xhot, request->yhot, request->show, 0)) {
+        return;
+    }
+
     display->update_cursor_handler(display, request->xhot, request->yhot, request->show);
 }
 
@@ -454,9 +1722,85 @@ static void __handle_move_cursor_request(struct pv_display_backend *display, str
         return;
     }
 
+    if(__dispatch(display, PV_DISPLAY_DISPATCH_MOVE_CURSOR, request->x, request->y, 0, 0)) {
+        return;
+    }
+
     display->move_cursor_handler(display, request->x, request->y);
 }
 
+/**
+ * Restarts damage sampling for a new dirty rectangle connection, whose
+ * rectangles the guest numbers from zero again.
+ */
+static void __reset_damage_samples(struct pv_display_backend *display)
+{
+    struct pv_display_latency *latency = __get_latency(display);
+
+    if(!latency) {
+        return;
+    }
+
+    pv_helper_lock(&latency->lock);
+    latency->dirty_rects_received = 0;
+    latency->sample_pending       = false;
+    pv_helper_unlock(&latency->lock);
+}
+
+/**
+ * Records the latency of a sampled dirty rectangle, if it's been received.
+ * Assumes that the caller holds the latency lock.
+ *
+ * @return True iff the sample was recorded.
+ */
+static bool __try_to_record_damage_sample(struct pv_display_latency *latency, struct dh_damage_sample *sample, uint32_t now)
+{
+    uint32_t delay;
+
+    //If we haven't yet received the sampled rectangle, we can't measure it yet.
+    if((int32_t)(latency->dirty_rects_received - sample->sequence) < 0)
+        return false;
+
+    delay = pv_helper_relative_delay(&latency->damage_baseline, sample->timestamp, now);
+    pv_helper_histogram_record(&latency->damage, delay);
+    return true;
+}
+
+static void __handle_damage_sample(struct pv_display_backend *display, struct dh_damage_sample *sample)
+{
+    struct pv_display_latency *latency = display->latency;
+
+    if(!latency || !sample->timestamp) {
+        return;
+    }
+
+    pv_helper_lock(&latency->lock);
+
+    //If the sampled rectangle has already arrived, record it now; otherwise,
+    //hold on to the sample until the rectangle does. Only the latest sample is kept.
+    latency->sample_pending = !__try_to_record_damage_sample(latency, sample, pv_helper_timestamp());
+    latency->pending_sample = *sample;
+
+    pv_helper_unlock(&latency->lock);
+}
+
+/**
+ * Records the latency of a cursor packet, if latency histograms are enabled.
+ */
+static void __record_cursor_latency(struct pv_display_backend *display, struct dh_footer *footer, uint32_t now)
+{
+    struct pv_display_latency *latency = display->latency;
+
+    if(!latency || !footer->timestamp) {
+        return;
+    }
+
+    pv_helper_lock(&latency->lock);
+    pv_helper_histogram_record(&latency->cursor,
+        pv_helper_relative_delay(&latency->cursor_baseline, footer->timestamp, now));
+    pv_helper_unlock(&latency->lock);
+}
+
 static void __handle_blank_display_request(struct pv_display_backend *display, struct dh_blanking *request)
 {
   if(!display->blank_display_handler) {
@@ -464,9 +1808,77 @@ static void __handle_blank_display_request(struct pv_display_backend *display, s
     return;
   }
 
+  if(__dispatch(display, PV_DISPLAY_DISPATCH_BLANK_DISPLAY, request->reason, 0, 0, 0)) {
+    return;
+  }
+
   display->blank_display_handler(display, request->reason);
 }
 
+static void __handle_framebuffer_preserved_request(struct pv_display_backend *display, struct dh_framebuffer_preserved *request)
+{
+    if(__dispatch(display, PV_DISPLAY_DISPATCH_FRAMEBUFFER_PRESERVED, request->width, request->height, request->stride, 0)) {
+        return;
+    }
+
+    if(display->framebuffer_preserved_handler) {
+        display->framebuffer_preserved_handler(display, request->width, request->height, request->stride);
+        return;
+    }
+
+    //If no one's listening, fall back to what the guest would have sent us otherwise:
+    //a request to draw the whole framebuffer.
+    if(display->dirty_rectangle_handler) {
+        display->dirty_rectangle_handler(display, 0, 0, request->width, request->height);
+    }
+}
+
+static void __handle_set_overlay_request(struct pv_display_backend *display, struct dh_set_overlay *request)
+{
+    //Frames are laid out according to the latest description, whoever's listening.
+    display->overlay = *request;
+
+    if(!display->set_overlay_handler) {
+        pv_display_debug("A 'set overlay' event was received, but no one registered a listener.\n");
+        return;
+    }
+
+    if(__dispatch(display, PV_DISPLAY_DISPATCH_SET_OVERLAY, 0, 0, 0, 0)) {
+        return;
+    }
+
+    display->set_overlay_handler(display, &display->overlay);
+}
+
+static void __handle_overlay_frame_request(struct pv_display_backend *display, struct dh_overlay_frame *request)
+{
+    if(!display->overlay_frame_handler) {
+        pv_display_debug("An 'overlay frame' event was received, but no one registered a listener.\n");
+        return;
+    }
+
+    if(__dispatch(display, PV_DISPLAY_DISPATCH_OVERLAY_FRAME, request->frame, request->buffer, 0, 0)) {
+        return;
+    }
+
+    display->overlay_frame_handler(display, request->frame, __overlay_frame_image(display, request->buffer));
+}
+
+static void __handle_tile_store_request(struct pv_display_backend *display, struct dh_tile_store *request)
+{
+    uint64_t slots = (uint64_t)request->columns * request->rows;
+
+    //The store shares the framebuffer's buffer; make sure it really fits there.
+    if(slots && ((request->offset > display->framebuffer_size) ||
+                 (slots * DH_TILE_SLOT_SIZE > display->framebuffer_size - request->offset))) {
+        pv_display_error("The guest described a compressed tile store that doesn't fit its framebuffer; ignoring it.\n");
+        memset(&display->tile_store, 0, sizeof(display->tile_store));
+        return;
+    }
+
+    display->tile_store = *request;
+}
+
 static void __handle_event_packet_receipt(struct pv_display_backend *display, struct dh_header *header, void *buffer)
 {
     __PV_HELPER_TRACE__;
@@ -498,6 +1910,33 @@ static void __handle_event_packet_receipt(struct pv_display_backend *display, st
             __handle_move_cursor_request(display, (struct dh_move_cursor *)buffer);
             break;
 
+        //Damage Samples-- the guest is telling us when a dirty rectangle was submitted
+        case PACKET_TYPE_EVENT_DAMAGE_SAMPLE:
+            __handle_damage_sample(display, (struct dh_damage_sample *)buffer);
+            break;
+
+        //Framebuffer Preserved-- the guest has reconnected, and its framebuffer is still good
+        case PACKET_TYPE_EVENT_FRAMEBUFFER_PRESERVED:
+            pv_display_debug("Received a framebuffer preserved event!\n");
+            __handle_framebuffer_preserved_request(display, (struct dh_framebuffer_preserved *)buffer);
+            break;
+
+        //Video Overlays-- the guest is describing, or presenting a frame of, its overlay
+        case PACKET_TYPE_EVENT_SET_OVERLAY:
+            pv_display_debug("Received a set overlay event!\n");
+            __handle_set_overlay_request(display, (struct dh_set_overlay *)buffer);
+            break;
+
+        case PACKET_TYPE_EVENT_OVERLAY_FRAME:
+            __handle_overlay_frame_request(display, (struct dh_overlay_frame *)buffer);
+            break;
+
+        //Compressed Tiles-- the guest is telling us where it keeps them
+        case PACKET_TYPE_EVENT_TILE_STORE:
+            pv_display_debug("Received a tile store event!\n");
+            __handle_tile_store_request(display, (struct dh_tile_store *)buffer);
+            break;
+
         default:
             //For now, do nothing if we receive an unknown packet type-- this gives us some safety in the event of a version
             //mismatch. We may want to consider other behaviors, as well-- disconnecting, or sending an event to the host.
@@ -506,6 +1945,27 @@ static void __handle_event_packet_receipt(struct pv_display_backend *display, st
     }
 }
 
+/**
+ * Accounts for, and handles, a complete and valid event packet. Used both for
+ * packets received from the guest, and for those replayed from a recording.
+ * Assumes that the caller holds the display's lock.
+ *
+ * @param buffer The packet's payload, followed by its footer.
+ */
+static void __deliver_event_packet(struct pv_display_backend *display, struct dh_header *header, void *buffer)
+{
+    struct dh_footer *footer = (struct dh_footer *)((char *)buffer + header->length);
+
+    pv_helper_stats_count_packet(display->stats.packets_received, display->stats.bytes_received,
+        header->type, header->length);
+
+    //Cursor packets are latency sensitive; note how long this one took to get here.
+    if((header->type == PACKET_TYPE_EVENT_MOVE_CURSOR) || (header->type == PACKET_TYPE_EVENT_UPDATE_CURSOR))
+        __record_cursor_latency(display, footer, pv_helper_timestamp());
+
+    __handle_event_packet_receipt(display, header, buffer);
+}
+
 /**
  * Handle the (possible) receipt of a control packet. Note that this function
  * can be called at any time after a valid packet header has been received.
@@ -516,11 +1976,13 @@ static bool __try_to_receive_event_packet(struct pv_display_backend *display)
 {
     __PV_HELPER_TRACE__;
 
+    struct dh_header header;
     size_t length_with_footer;
 
     size_t data_available;
     struct dh_footer *footer;
     uint16_t checksum;
+    bool valid = true;
     char *buffer;
     int rc;
 
@@ -547,7 +2009,7 @@ static bool __try_to_receive_event_packet(struct pv_display_backend *display)
 
     //Otherwise, try to read the given data. First, we'll create a buffer
     //large enough to receive the rest of the packet.
-    buffer = pv_helper_malloc(length_with_footer);
+    buffer = pv_helper_packet_alloc(length_with_footer);
 
     //If we weren't able to allocate a receive buffer, we'll try to recover
     //on a future iteration. For now, abort!
@@ -567,7 +2029,7 @@ static bool __try_to_receive_event_packet(struct pv_display_backend *display)
     if(rc)
     {
         pv_display_error("Could not read in a packet, though IVC claims it's there. Locking problems?\n");
-        pv_helper_free(buffer);
+        pv_helper_packet_free(buffer, length_with_footer);
         return false;
     }
 
@@ -575,30 +2037,57 @@ static bool __try_to_receive_event_packet(struct pv_display_backend *display)
     //which should be located right after the main packet body.
     footer = (struct dh_footer *)(buffer + display->current_packet_header.length);
 
-    //Compute the checksum of the received packet.
-    checksum = __pv_helper_packet_checksum(&display->current_packet_header, buffer, display->current_packet_header.length);
-
-    //Check the packet's CRC. If it doesn't match, we're in serious trouble. Bail out.
-    if(checksum != footer->crc)
+    //Make sure the payload agrees with its header before we spend any time checksumming it;
+    //then check the packet's CRC.
+    if(__pv_helper_validate_payload(&display->current_packet_header, buffer))
+    {
+        pv_display_error("Communications error: received a malformed Type-%u event packet. Dropping it.\n",
+                         (unsigned int)display->current_packet_header.type);
+        pv_helper_stats_inc(display->stats.malformed_packets);
+        valid = false;
+    }
+    else if((checksum = __pv_helper_packet_checksum(&display->current_packet_header, buffer,
+                                                    display->current_packet_header.length)) != footer->crc)
     {
-        pv_display_error("Communications error: CRC did not match for a control packet. Terminating connections.\n");
+        pv_display_error("Communications error: CRC did not match for an event packet. Dropping it.\n");
+        pv_helper_stats_inc(display->stats.crc_failures);
+        pv_helper_probe(crc_mismatch, display->current_packet_header.type, display->current_packet_header.length,
+                        footer->crc, checksum);
+        valid = false;
+    }
 
+    //If the packet was bad, drop it; the next header will tell us whether we're still in step
+    //with the stream. We only give up on it if we've been out of step for too long.
+    if(!valid)
+    {
         //Invalidate the received packet...
         display->current_packet_header.length = 0;
+        pv_helper_packet_free(buffer, length_with_footer);
 
-        //... clean up, and return.
-        pv_helper_free(buffer);
-        return false;
+        if(__pv_helper_resync_skip(&display->resync, &display->stats,
+                                   sizeof(struct dh_header) + length_with_footer, PV_HELPER_RESYNC_THRESHOLD))
+        {
+            pv_display_error("Communications error: too many bad event packets. Terminating connections.\n");
+            display->event_stream_failed = true;
+            return false;
+        }
+
+        return true;
     }
 
+    __pv_helper_resync_complete(&display->resync);
+
+    header = display->current_packet_header;
+    __record_packet(display->recorder, PV_DISPLAY_RECORD_EVENT_PACKET, display->event_port, &header, buffer);
+
     //Invalidate the current packet header, as we've already handled it!
     display->current_packet_header.length = 0;
 
     //Finally, pass the compelted packet to our packet receipt handler.
-    __handle_event_packet_receipt(display, &display->current_packet_header, buffer);
+    __deliver_event_packet(display, &header, buffer);
 
     //Clean up our buffer.
-    pv_helper_free(buffer);
+    pv_helper_packet_free(buffer, length_with_footer);
 
     return true;
  }
@@ -616,9 +2105,10 @@ static bool __try_to_receive_event_packet(struct pv_display_backend *display)
      //Find the PV display provider associated with the given client.
      struct pv_display_backend *display = opaque;
      bool continue_to_read = false;
+     bool stream_failed;
      
      //Lock this so we don't disconnect while we are reading
-     pv_helper_lock(&display->lock);
+     pv_helper_lock_counted(&display->lock, &display->stats);
 
      if (display->disconnected) {
          pv_display_debug("Received event on closed channel \n");
@@ -646,9 +2136,16 @@ static bool __try_to_receive_event_packet(struct pv_display_backend *display)
              continue_to_read = __try_to_receive_event_packet(display);
          }
      }
-     while(continue_to_read);
+     while(continue_to_read && !display->event_stream_failed);
+
+     //If the stream has broken, let the display's owner tear it down-- which it
+     //can only do once we've released the display's lock.
+     stream_failed = display->event_stream_failed;
+     display->event_stream_failed = false;
      pv_helper_unlock(&display->lock);
 
+     if(stream_failed)
+         __trigger_fatal_error_on_display_backend(display);
  }
 
 static void __handle_event_channel_disconnect(void *opaque, struct libivc_client *client)
@@ -658,7 +2155,19 @@ static void __handle_event_channel_disconnect(void *opaque, struct libivc_client
         return;
     }
 
-    __trigger_fatal_error_on_display_backend(display);
+    __dispatch_display_disconnect(display);
+}
+
+/**
+ * libivc's entry point for event channel data: handles it right away, or, if the
+ * display is being polled, leaves it for process_pending.
+ */
+static void __dispatch_event_channel_event(void *opaque, struct libivc_client *client)
+{
+    struct pv_display_backend *display = opaque;
+
+    if(!pv_helper_notifier_post(&display->notifier, PV_DISPLAY_PENDING_DATA))
+        __handle_event_channel_event(display, client);
 }
 
 static void finish_event_connection(struct pv_display_backend *display,
@@ -671,7 +2180,7 @@ static void finish_event_connection(struct pv_display_backend *display,
     }
 
     libivc_register_event_callbacks(display->event_connection,
-                                    __handle_event_channel_event,
+                                    __dispatch_event_channel_event,
                                     __handle_event_channel_disconnect,
                                     display);
 
@@ -682,6 +2191,8 @@ static void __handle_event_connection(void *opaque, struct libivc_client *client
 {
     struct pv_display_backend *display = (struct pv_display_backend *)opaque;
     __PV_HELPER_TRACE__;
+    __mark_backend_startup(display, PV_HELPER_STARTUP_EVENT_CONNECTED);
+
     if(display->new_event_connection_handler) {
         display->new_event_connection_handler(display->driver_data, client);
     }
@@ -698,7 +2209,7 @@ static void __handle_framebuffer_disconnect(void *opaque, struct libivc_client *
         return;
     }
 
-    __trigger_fatal_error_on_display_backend(display);
+    __dispatch_display_disconnect(display);
 }
 
 static void finish_framebuffer_connection(struct pv_display_backend *display,
@@ -721,6 +2232,8 @@ static void __handle_framebuffer_connection(void *opaque, struct libivc_client *
     struct pv_display_backend *display = (struct pv_display_backend *)opaque;
 
     __PV_HELPER_TRACE__;
+    __mark_backend_startup(display, PV_HELPER_STARTUP_FRAMEBUFFER_CONNECTED);
+
 
     if(display->new_framebuffer_connection_handler) {
         display->new_framebuffer_connection_handler(display->driver_data, client);
@@ -731,20 +2244,156 @@ static void __handle_framebuffer_connection(void *opaque, struct libivc_client *
  * Dirty Rectangle Connections
  *
  */
+
+/**
+ * Accounts for, and handles, a single dirty rectangle. Used both for rectangles
+ * received from the guest, and for those replayed from a recording.
+ */
+static void __deliver_dirty_rectangle(struct pv_display_backend *display, struct dh_dirty_rectangle *rect)
+{
+    //Once frame commits are negotiated, a zero-area rectangle marks the end of a frame.
+    if((display->capabilities & DH_CAP_FRAME_COMMIT) && !rect->width && !rect->height) {
+        uint32_t frame = DH_FRAME_COMMIT_FRAME(rect->x, rect->y);
+
+        pv_helper_stats_inc(display->stats.frames_committed);
+
+        if(__dispatch(display, PV_DISPLAY_DISPATCH_FRAME_COMMIT, frame, 0, 0, 0))
+            return;
+
+        if(display->frame_commit_handler)
+            display->frame_commit_handler(display, frame);
+        return;
+    }
+
+    pv_helper_stats_inc(display->stats.dirty_rects_submitted);
+
+    if(__dispatch(display, PV_DISPLAY_DISPATCH_DIRTY_RECTANGLE, rect->x, rect->y, rect->width, rect->height))
+        return;
+
+    if(display->dirty_rectangle_handler)
+        display->dirty_rectangle_handler(display, rect->x, rect->y, rect->width, rect->height);
+}
+
+//The most dirty rectangles a receive batch holds on to for the recorder before
+//taking the display's lock to write them out.
+#define PV_DISPLAY_RECORD_BATCH 64
+
+/**
+ * Records a batch of received dirty rectangles, if a recorder's attached.
+ * Assumes that the caller holds the display's lock.
+ */
+static void __record_dirty_rectangles(struct pv_display_backend *display,
+                                      struct dh_dirty_rectangle *rects, size_t count)
+{
+    size_t length = sizeof(*rects);
+    size_t i;
+
+    for(i = 0; (i < count) && display->recorder; ++i) {
+      void *section = &rects[i];
+
+      __record(display->recorder, PV_DISPLAY_RECORD_DIRTY_RECTANGLE, display->event_port, &section, &length, 1);
+    }
+}
+
+/**
+ * Finishes off a batch of dirty rectangles: records the batch, along with any
+ * damage sample that it completed, and captures the framebuffer if the batch
+ * crossed a recorder's snapshot interval.
+ *
+ * @param before The display's received rectangle count before the batch.
+ * @param latency The display's latency histograms, if latency is being measured.
+ * @param now The time at which the batch was received, if latency is being measured.
+ * @param rects, count The rectangles still to be recorded, if any.
+ */
+static void __finish_dirty_rectangles(struct pv_display_backend *display, uint64_t before,
+                                      struct pv_display_latency *latency, uint32_t now,
+                                      struct dh_dirty_rectangle *rects, size_t count)
+{
+    struct pv_display_recorder *recorder;
+    uint64_t after = pv_helper_stats_read(display->stats.dirty_rects_submitted);
+
+    //Frame commit markers don't count as damage, but are still recorded.
+    if((after == before) && !count) {
+        return;
+    }
+
+    //If we're measuring latency, see if we've now received a sampled rectangle.
+    if(latency && (after != before)) {
+      pv_helper_lock(&latency->lock);
+
+      latency->dirty_rects_received += (uint32_t)(after - before);
+
+      if(latency->sample_pending && __try_to_record_damage_sample(latency, &latency->pending_sample, now))
+        latency->sample_pending = false;
+
+      pv_helper_unlock(&latency->lock);
+    }
+
+    //The recorder is only used under the display's lock, so set_recorder(NULL)
+    //can't return while we're still writing to it.
+    pv_helper_lock(&display->lock);
+    __record_dirty_rectangles(display, rects, count);
+    recorder = display->recorder;
+
+    if(recorder && recorder->snapshot_interval && display->framebuffer &&
+       ((after / recorder->snapshot_interval) != (before / recorder->snapshot_interval))) {
+      void *sections[] = { display->framebuffer };
+      size_t lengths[] = { display->framebuffer_size };
+
+      __record(recorder, PV_DISPLAY_RECORD_FRAMEBUFFER, display->event_port, sections, lengths, 1);
+    }
+
+    pv_helper_unlock(&display->lock);
+}
+
 static void __handle_dirty_rectangle_event(void *opaque, struct libivc_client *client)
 {
-    struct dh_dirty_rectangle rect;
+    struct dh_dirty_rectangle rects[PV_DISPLAY_RECORD_BATCH];
+    struct dh_compact_dirty_rectangle compact;
     struct pv_display_backend *display = (struct pv_display_backend *)opaque;
     size_t available_data = 0;
+    size_t count = 0;
+    uint64_t before = pv_helper_stats_read(display->stats.dirty_rects_submitted);
+    struct pv_display_latency *latency = __get_latency(display);
+    uint32_t now = latency ? pv_helper_timestamp() : 0;
+
+    //The guest sends whichever format we negotiated; see Compact Dirty Rectangles.
+    bool compact_rects = (display->capabilities & DH_CAP_COMPACT_DIRTY_RECTANGLES) != 0;
+    size_t rect_size = compact_rects ? sizeof(compact) : sizeof(rects[0]);
 
     libivc_getAvailableData(client, &available_data);
 
-    while(available_data >= sizeof(struct dh_dirty_rectangle) && libivc_isOpen(client) && display->dirty_rectangles_connection) {
-      memset(&rect, 0, sizeof(struct dh_dirty_rectangle));
-      libivc_recv(client, (char*)&rect, sizeof(struct dh_dirty_rectangle));
-      display->dirty_rectangle_handler(display, rect.x, rect.y, rect.width, rect.height);
-      available_data -= sizeof(struct dh_dirty_rectangle);
+    while(available_data >= rect_size && libivc_isOpen(client) && display->dirty_rectangles_connection) {
+      struct dh_dirty_rectangle *rect;
+
+      //Rectangles are kept for the recorder until the batch is done; only a batch
+      //too long to keep is recorded as it goes.
+      if(count == PV_DISPLAY_RECORD_BATCH) {
+        pv_helper_lock(&display->lock);
+        __record_dirty_rectangles(display, rects, count);
+        pv_helper_unlock(&display->lock);
+        count = 0;
+      }
+
+      rect = &rects[count++];
+      memset(rect, 0, sizeof(*rect));
+
+      //Recordings always hold full-size rectangles, whatever came over the wire.
+      if(compact_rects) {
+        libivc_recv(client, (char*)&compact, sizeof(compact));
+        rect->x      = compact.x;
+        rect->y      = compact.y;
+        rect->width  = compact.width;
+        rect->height = compact.height;
+      } else {
+        libivc_recv(client, (char*)rect, sizeof(*rect));
+      }
+
+      __deliver_dirty_rectangle(display, rect);
+      available_data -= rect_size;
     }
+
+    __finish_dirty_rectangles(display, before, latency, now, rects, count);
 }
 
 static void __handle_dirty_rectangle_disconnect(void *opaque, struct libivc_client *client)
@@ -754,7 +2403,19 @@ static void __handle_dirty_rectangle_disconnect(void *opaque, struct libivc_clie
         return;
     }
 
-    __trigger_fatal_error_on_display_backend(display);
+    __dispatch_display_disconnect(display);
+}
+
+/**
+ * libivc's entry point for dirty rectangles: handles them right away, or, if the
+ * display is being polled, leaves them for process_pending.
+ */
+static void __dispatch_dirty_rectangle_event(void *opaque, struct libivc_client *client)
+{
+    struct pv_display_backend *display = opaque;
+
+    if(!pv_helper_notifier_post(&display->notifier, PV_DISPLAY_PENDING_DIRTY_RECTANGLES))
+        __handle_dirty_rectangle_event(display, client);
 }
 
 static void finish_dirty_rect_connection(struct pv_display_backend *display, struct libivc_client *client)
@@ -765,8 +2426,11 @@ static void finish_dirty_rect_connection(struct pv_display_backend *display, str
         return;
     }
 
+    //The guest numbers the rectangles on each new connection from zero.
+    __reset_damage_samples(display);
+
     libivc_register_event_callbacks(display->dirty_rectangles_connection,
-                                    __handle_dirty_rectangle_event,
+                                    __dispatch_dirty_rectangle_event,
                                     __handle_dirty_rectangle_disconnect,
                                     display);
 
@@ -779,6 +2443,8 @@ static void __handle_dirty_rectangle_connection(void *opaque, struct libivc_clie
     struct pv_display_backend *display = (struct pv_display_backend *)opaque;
 
     __PV_HELPER_TRACE__;
+    __mark_backend_startup(display, PV_HELPER_STARTUP_DIRTY_RECTANGLES_CONNECTED);
+
     if(display->new_dirty_rect_connection_handler) {
         display->new_dirty_rect_connection_handler(display->driver_data, client);
     }
@@ -795,7 +2461,7 @@ static void __handle_cursor_disconnect(void *opaque, struct libivc_client *clien
         return;
     }
 
-    __trigger_fatal_error_on_display_backend(display);
+    __dispatch_display_disconnect(display);
 }
 
 static void finish_cursor_connection(struct pv_display_backend *display, struct libivc_client *client)
@@ -814,14 +2480,73 @@ static void finish_cursor_connection(struct pv_display_backend *display, struct
                           (char **)&display->cursor.image);
 }
 
-static void __handle_cursor_connection(void *opaque, struct libivc_client *client)
+static void __handle_cursor_connection(void *opaque, struct libivc_client *client)
+{
+    struct pv_display_backend *display = (struct pv_display_backend *)opaque;
+
+    __PV_HELPER_TRACE__;
+    __mark_backend_startup(display, PV_HELPER_STARTUP_CURSOR_IMAGE_CONNECTED);
+
+    if(display->new_cursor_connection_handler) {
+        display->new_cursor_connection_handler(display->driver_data, client);
+    }
+}
+
+/**
+ * Overlay Connections
+ *
+ */
+
+/**
+ * Losing the overlay just loses the overlay-- the guest drops it to destroy it--
+ * so unlike our other connections, this doesn't take the display down with it.
+ */
+static void __handle_overlay_disconnect(void *opaque, struct libivc_client *client)
+{
+    struct pv_display_backend *display = (struct pv_display_backend *)opaque;
+    if(!display) {
+        return;
+    }
+
+    pv_helper_lock(&display->lock);
+
+    if(display->overlay_connection != client) {
+        pv_helper_unlock(&display->lock);
+        return;
+    }
+
+    display->overlay_connection = NULL;
+    display->overlay_buffer = NULL;
+    display->overlay_buffer_size = 0;
+    display->overlay.format = DH_OVERLAY_FORMAT_NONE;
+
+    pv_helper_unlock(&display->lock);
+
+    libivc_disconnect(client);
+}
+
+static void __handle_overlay_connection(void *opaque, struct libivc_client *client)
 {
     struct pv_display_backend *display = (struct pv_display_backend *)opaque;
 
     __PV_HELPER_TRACE__;
-    if(display->new_cursor_connection_handler) {
-        display->new_cursor_connection_handler(display->driver_data, client);
+
+    pv_helper_lock(&display->lock);
+
+    //A display has only one overlay at a time; one that's still connected wins.
+    if(display->overlay_connection) {
+        pv_helper_unlock(&display->lock);
+        pv_display_error("Refusing a second video overlay for display %u.\n", (unsigned int)display->key);
+        libivc_disconnect(client);
+        return;
     }
+
+    display->overlay_connection = client;
+    libivc_register_event_callbacks(client, NULL, __handle_overlay_disconnect, display);
+    libivc_getLocalBuffer(client, (char **)&display->overlay_buffer);
+    libivc_getLocalBufferSize(client, &display->overlay_buffer_size);
+
+    pv_helper_unlock(&display->lock);
 }
 
 typedef void (*dirty_rectangle_request_handler)(struct pv_display_backend *display,
@@ -939,6 +2664,50 @@ display_register_blank_display_handler(struct pv_display_backend *display, blank
 }
 
 
+static void
+display_register_framebuffer_preserved_handler(struct pv_display_backend *display, framebuffer_preserved_request_handler handler)
+{
+    pv_helper_lock(&display->lock);
+
+    display->framebuffer_preserved_handler = handler;
+
+    pv_helper_unlock(&display->lock);
+}
+
+
+static void
+display_register_frame_commit_handler(struct pv_display_backend *display, frame_commit_request_handler handler)
+{
+    pv_helper_lock(&display->lock);
+
+    display->frame_commit_handler = handler;
+
+    pv_helper_unlock(&display->lock);
+}
+
+
+static void
+display_register_set_overlay_handler(struct pv_display_backend *display, set_overlay_request_handler handler)
+{
+    pv_helper_lock(&display->lock);
+
+    display->set_overlay_handler = handler;
+
+    pv_helper_unlock(&display->lock);
+}
+
+
+static void
+display_register_overlay_frame_handler(struct pv_display_backend *display, overlay_frame_request_handler handler)
+{
+    pv_helper_lock(&display->lock);
+
+    display->overlay_frame_handler = handler;
+
+    pv_helper_unlock(&display->lock);
+}
+
+
 static void
 display_register_fatal_error_handler(struct pv_display_backend *display, fatal_display_backend_error_handler handler)
 {
@@ -961,8 +2730,11 @@ pv_display_backend_display_disconnect(struct pv_display_backend *display)
         libivc_disable_events(display->event_connection);
         display->set_display_handler = NULL;
         display->blank_display_handler = NULL;
+        display->framebuffer_preserved_handler = NULL;
         display->move_cursor_handler = NULL;
         display->update_cursor_handler = NULL;
+        display->set_overlay_handler = NULL;
+        display->overlay_frame_handler = NULL;
         libivc_disconnect(display->event_connection);
         display->event_connection = NULL;
     }
@@ -971,6 +2743,7 @@ pv_display_backend_display_disconnect(struct pv_display_backend *display)
         libivc_disconnect(display->framebuffer_connection);
         display->framebuffer_connection = NULL;
         display->framebuffer_size = 0;
+        memset(&display->tile_store, 0, sizeof(display->tile_store));
     }
 
     if(display->dirty_rectangles_connection) {
@@ -978,6 +2751,7 @@ pv_display_backend_display_disconnect(struct pv_display_backend *display)
         libivc_disconnect(display->dirty_rectangles_connection);
         display->dirty_rectangles_connection = NULL;
         display->dirty_rectangle_handler = NULL;
+        display->frame_commit_handler = NULL;
     }
 
     if(display->cursor_image_connection) {
@@ -985,10 +2759,42 @@ pv_display_backend_display_disconnect(struct pv_display_backend *display)
         libivc_disconnect(display->cursor_image_connection);
         display->cursor_image_connection = NULL;
     }
+
+    if(display->overlay_connection) {
+        libivc_disable_events(display->overlay_connection);
+        libivc_disconnect(display->overlay_connection);
+        display->overlay_connection = NULL;
+        display->overlay_buffer = NULL;
+        display->overlay_buffer_size = 0;
+    }
     display->disconnected = true;
     pv_helper_unlock(&display->lock);
 }
 
+/**
+ * Does whatever work a polled display's callbacks have left for its event loop.
+ */
+static void
+pv_display_backend_process_pending(struct pv_display_backend *display)
+{
+    uint32_t pending = pv_helper_notifier_take(&display->notifier);
+
+    __PV_HELPER_TRACE__;
+
+    //Handle any data first, so nothing that arrived before a disconnect is lost.
+    if((pending & PV_DISPLAY_PENDING_DATA) && display->event_connection) {
+        __handle_event_channel_event(display, display->event_connection);
+    }
+
+    if((pending & PV_DISPLAY_PENDING_DIRTY_RECTANGLES) && display->dirty_rectangles_connection) {
+        __handle_dirty_rectangle_event(display, display->dirty_rectangles_connection);
+    }
+
+    if(pending & PV_DISPLAY_PENDING_DISCONNECT) {
+        __trigger_fatal_error_on_display_backend(display);
+    }
+}
+
 static void
 consumer_destroy_display(struct pv_display_consumer *consumer, struct pv_display_backend *display)
 {
@@ -1009,8 +2815,11 @@ consumer_destroy_display(struct pv_display_consumer *consumer, struct pv_display
       display->event_server_listening = false;
       display->set_display_handler = NULL;
       display->blank_display_handler = NULL;
+      display->framebuffer_preserved_handler = NULL;
       display->move_cursor_handler = NULL;
       display->update_cursor_handler = NULL;
+      display->set_overlay_handler = NULL;
+      display->overlay_frame_handler = NULL;
 
       libivc_shutdownIvcServer(tmp);
     }
@@ -1020,6 +2829,7 @@ consumer_destroy_display(struct pv_display_consumer *consumer, struct pv_display
       display->dirty_rectangles_server = NULL;
       display->dirty_rectangles_server_listening = false;
       display->dirty_rectangle_handler = NULL;
+      display->frame_commit_handler = NULL;
       libivc_shutdownIvcServer(tmp);
     }
 
@@ -1030,6 +2840,13 @@ consumer_destroy_display(struct pv_display_consumer *consumer, struct pv_display
       libivc_shutdownIvcServer(tmp);
     }
 
+    if(display->overlay_server_listening) {
+      struct libivc_server *tmp = display->overlay_server;
+      display->overlay_server = NULL;
+      display->overlay_server_listening = false;
+      libivc_shutdownIvcServer(tmp);
+    }
+
     if(display->framebuffer_server_listening) {
       struct libivc_server *tmp = display->framebuffer_server;
       display->framebuffer_server = NULL;
@@ -1039,6 +2856,9 @@ consumer_destroy_display(struct pv_display_consumer *consumer, struct pv_display
     }
     pv_helper_unlock(&display->lock);
 
+    __dispatch_detach(display);
+    pv_helper_notifier_destroy(&display->notifier);
+    pv_helper_free(display->latency);
     pv_helper_free(display);
 }
 
@@ -1146,6 +2966,48 @@ event_server_fail:
     return -EINVAL;
 }
 
+static int
+pv_display_backend_start_overlay_server(struct pv_display_backend *display, uint16_t overlay_port)
+{
+    int rc;
+
+    if(!display || !overlay_port) {
+        return -EINVAL;
+    }
+
+    pv_helper_lock(&display->lock);
+
+    if(display->overlay_server_listening) {
+        pv_helper_unlock(&display->lock);
+        return -EBUSY;
+    }
+
+    display->overlay_port = overlay_port;
+    display->overlay_server = libivc_find_listening_server(display->domid,
+                                                           display->overlay_port,
+                                                           CONNECTIONID_ANY);
+    if(!display->overlay_server) {
+        rc = libivc_start_listening_server(&display->overlay_server,
+                                           display->overlay_port,
+                                           display->domid,
+                                           CONNECTIONID_ANY,
+                                           __handle_overlay_connection,
+                                           display);
+
+        if(rc) {
+            pv_display_error("Failed to create overlay server for %d, %d\n", display->domid, rc);
+            display->overlay_server = NULL;
+            pv_helper_unlock(&display->lock);
+            return rc;
+        }
+    }
+
+    display->overlay_server_listening = true;
+
+    pv_helper_unlock(&display->lock);
+    return 0;
+}
+
 int consumer_create_pv_display_backend(struct pv_display_consumer *consumer,
                                        struct pv_display_backend **d,
                                        domid_t domid,
@@ -1172,6 +3034,7 @@ int consumer_create_pv_display_backend(struct pv_display_consumer *consumer,
     //is completely initialized.
     pv_helper_mutex_init(&display->lock);
     pv_helper_mutex_init(&display->fatal_lock);
+    pv_helper_mutex_init(&display->dispatch_lock);
 
     //When set true, pending events will not be processed
     display->disconnected = false;
@@ -1180,7 +3043,18 @@ int consumer_create_pv_display_backend(struct pv_display_consumer *consumer,
 
     display->set_driver_data = pv_display_backend_set_driver_data;
     display->get_driver_data = pv_display_backend_get_driver_data;
+    display->get_stats = pv_display_backend_get_stats;
+    display->get_startup_profile = pv_display_backend_get_startup_profile;
+    display->enable_polling = pv_display_backend_enable_polling;
+    display->process_pending = pv_display_backend_process_pending;
+    display->enable_latency_histograms = pv_display_backend_enable_latency_histograms;
+    display->get_latency_histograms = pv_display_backend_get_latency_histograms;
+    display->set_recorder = pv_display_backend_set_recorder;
+    display->set_dispatcher = pv_display_backend_set_dispatcher;
     display->start_servers = pv_display_backend_start_servers;
+    display->start_overlay_server = pv_display_backend_start_overlay_server;
+    display->get_compressed_tile = pv_display_backend_get_compressed_tile;
+    display->decompress_tile = pv_display_backend_decompress_tile;
     display->disconnect_display = pv_display_backend_display_disconnect;
     display->driver_data = opaque;
 
@@ -1195,6 +3069,16 @@ int consumer_create_pv_display_backend(struct pv_display_consumer *consumer,
     display->cursor_bitmap_port = cursor_bitmap_port;
     display->dirty_rectangles_port = dirty_rectangles_port;
 
+    //The guest will size its cursor image to whatever we negotiated.
+    display->capabilities = consumer->negotiated_capabilities;
+    display->cursor.size = DH_CAP_CURSOR_SIZE(consumer->negotiated_capabilities);
+
+    //Time the display's bring-up as part of the consumer's session, from now. We may be
+    //called from one of the consumer's handlers, so we can't take its lock here.
+    display->startup = consumer->startup;
+    display->startup.step_ns[PV_HELPER_STARTUP_ADD_DISPLAY] = 0;
+    __mark_backend_startup(display, PV_HELPER_STARTUP_ADD_DISPLAY);
+
     //
     // Connection Registration Functions
     //
@@ -1211,6 +3095,10 @@ int consumer_create_pv_display_backend(struct pv_display_consumer *consumer,
     display->register_update_cursor_handler = display_register_update_cursor_handler;
     display->register_set_display_handler = display_register_set_display_handler;
     display->register_blank_display_handler = display_register_blank_display_handler;
+    display->register_framebuffer_preserved_handler = display_register_framebuffer_preserved_handler;
+    display->register_frame_commit_handler = display_register_frame_commit_handler;
+    display->register_set_overlay_handler = display_register_set_overlay_handler;
+    display->register_overlay_frame_handler = display_register_overlay_frame_handler;
     display->register_fatal_error_handler = display_register_fatal_error_handler;
 
     pv_helper_unlock(&display->lock);
@@ -1225,30 +3113,23 @@ static int consumer_display_list(struct pv_display_consumer *consumer, struct dh
     int rc;
     __PV_HELPER_TRACE__;
 
-    //Determine the total size of our advertisement payload.
-    size_t payload_size = sizeof(struct dh_display_list) + sizeof(struct dh_display_info) * display_count;
-
-    // Allocate space
-    struct dh_display_list* display_list = pv_helper_malloc(payload_size);
-
-    if(!display_list) {
-        pv_display_error("Couldn't allocate memory for host display list.");
-        return -ENOMEM;
-    }
-
-    display_list->num_displays = display_count;
-    memcpy(display_list->displays, displays, display_count * sizeof(*displays));
+    //The list goes out as its display count, followed by the caller's displays;
+    //there's no need to assemble a copy of it first.
+    struct pv_helper_iovec display_list[] =
+    {
+        { &display_count, sizeof(display_count) },
+        { displays, sizeof(struct dh_display_info) * display_count },
+    };
 
     //... and send it via IVC.
-    rc = __send_packet(consumer->control_channel, PACKET_TYPE_CONTROL_HOST_DISPLAY_LIST,
-                       display_list, payload_size);
+    rc = __send_control_packetv(consumer, PACKET_TYPE_CONTROL_HOST_DISPLAY_LIST, display_list, 2);
 
     if(rc) {
       pv_display_error("Unable to send a list of host displays! (%d)", rc);
+    } else {
+      pv_helper_startup_mark(&consumer->startup, 0, PV_HELPER_STARTUP_DISPLAY_LIST);
     }
 
-    pv_helper_free(display_list);
-
     //Indicate success.
     return rc;
 }
@@ -1274,11 +3155,12 @@ int consumer_add_display(struct pv_display_consumer *consumer,
     payload.cursor_bitmap_port = cursor_bitmap_port;
 
     //... and send it via IVC.
-    rc = __send_packet(consumer->control_channel, PACKET_TYPE_CONTROL_ADD_DISPLAY,
-                       &payload, sizeof(payload));
+    rc = __send_control_packet(consumer, PACKET_TYPE_CONTROL_ADD_DISPLAY, &payload, sizeof(payload));
 
     if(rc) {
         pv_display_error("Unable to send an add host displays! (%d)", rc);
+    } else {
+        pv_helper_startup_mark(&consumer->startup, 0, PV_HELPER_STARTUP_ADD_DISPLAY);
     }
 
     //Indicate success.
@@ -1297,8 +3179,7 @@ int consumer_remove_display(struct pv_display_consumer *consumer, uint32_t key)
     payload.key = key;
 
     //... and send it via IVC.
-    rc = __send_packet(consumer->control_channel, PACKET_TYPE_CONTROL_REMOVE_DISPLAY,
-                       &payload, sizeof(payload));
+    rc = __send_control_packet(consumer, PACKET_TYPE_CONTROL_REMOVE_DISPLAY, &payload, sizeof(payload));
 
     if(rc) {
         pv_display_error("Unable to send an remove host displays! (%d)", rc);
@@ -1308,6 +3189,81 @@ int consumer_remove_display(struct pv_display_consumer *consumer, uint32_t key)
     return 0;
 }
 
+static int consumer_frame_done(struct pv_display_consumer *consumer, uint32_t key, uint32_t frame)
+{
+    struct dh_frame_done payload;
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    payload.key       = key;
+    payload.frame     = frame;
+    payload.timestamp = pv_helper_timestamp();
+
+    //These go out every vblank; hold them back once the ring is nearly full, rather
+    //than let them crowd out the display list changes that share it.
+    rc = __send_negotiated_control_packet(consumer, DH_CAP_FRAME_DONE, PV_DISPLAY_FRAME_DONE_RESERVE,
+                                          PACKET_TYPE_CONTROL_FRAME_DONE, &payload, sizeof(payload));
+
+    if(rc == -ENODEV) {
+        return 0;
+    }
+
+    //A lost report is made up for by the next; the frame numbers say how many passed.
+    if(rc) {
+        pv_display_debug("Unable to report a finished frame for display %u (%d).\n", (unsigned int)key, rc);
+    }
+
+    return rc;
+}
+
+static int consumer_grant_dirty_rectangle_credits(struct pv_display_consumer *consumer, uint32_t key, uint32_t credits)
+{
+    struct dh_dirty_rectangle_credits payload;
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    payload.key     = key;
+    payload.credits = credits;
+
+    rc = __send_negotiated_control_packet(consumer, DH_CAP_DIRTY_RECTANGLE_CREDITS, 0,
+                                          PACKET_TYPE_CONTROL_DIRTY_RECTANGLE_CREDITS, &payload, sizeof(payload));
+
+    //Guests that didn't agree to credits send freely; there's nothing to grant.
+    if(rc == -ENODEV) {
+        return 0;
+    }
+
+    //Unlike a lost frame report, a lost grant isn't made up for on its own; the caller
+    //should retry, or the guest will keep holding its damage back.
+    if(rc) {
+        pv_display_error("Unable to grant dirty rectangle credits for display %u (%d).\n", (unsigned int)key, rc);
+    }
+
+    return rc;
+}
+
+static int consumer_add_overlay(struct pv_display_consumer *consumer, uint32_t key, uint32_t overlay_port)
+{
+    struct dh_add_overlay payload;
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    payload.key          = key;
+    payload.overlay_port = overlay_port;
+
+    rc = __send_negotiated_control_packet(consumer, DH_CAP_VIDEO_OVERLAY, 0,
+                                          PACKET_TYPE_CONTROL_ADD_OVERLAY, &payload, sizeof(payload));
+
+    if(rc && (rc != -ENODEV)) {
+        pv_display_error("Unable to offer a video overlay for display %u (%d).\n", (unsigned int)key, rc);
+    }
+
+    return rc;
+}
+
 static void consumer_destroy(struct pv_display_consumer *consumer)
 {
   if(consumer->control_channel_server_listening) {
@@ -1318,6 +3274,7 @@ static void consumer_destroy(struct pv_display_consumer *consumer)
       if(consumer->fatal_error_handler)
           consumer->fatal_error_handler(consumer);
 
+      pv_helper_notifier_destroy(&consumer->notifier);
       pv_helper_free(consumer);
   }
 }
@@ -1342,6 +3299,61 @@ static void consumer_register_driver_capabilities_request_handler(struct pv_disp
     pv_helper_unlock(&consumer->lock);
 }
 
+static void consumer_set_host_capabilities(struct pv_display_consumer *consumer, uint32_t flags)
+{
+    __PV_HELPER_TRACE__;
+    pv_helper_lock(&consumer->lock);
+
+    consumer->capabilities = flags;
+
+    pv_helper_unlock(&consumer->lock);
+}
+
+static void consumer_get_stats(struct pv_display_consumer *consumer, struct pv_helper_stats *stats)
+{
+    pv_helper_stats_snapshot(stats, &consumer->stats);
+}
+
+static void consumer_get_startup_profile(struct pv_display_consumer *consumer, struct pv_helper_startup_profile *profile)
+{
+    *profile = consumer->startup;
+}
+
+static int consumer_enable_polling(struct pv_display_consumer *consumer)
+{
+    int rc;
+
+    pv_helper_lock(&consumer->lock);
+    rc = pv_helper_notifier_enable(&consumer->notifier);
+    pv_helper_unlock(&consumer->lock);
+
+    return rc;
+}
+
+static void consumer_process_pending(struct pv_display_consumer *consumer)
+{
+    uint32_t pending = pv_helper_notifier_take(&consumer->notifier);
+
+    __PV_HELPER_TRACE__;
+
+    //Handle any data first, so nothing that arrived before a disconnect is lost.
+    if((pending & PV_DISPLAY_PENDING_DATA) && consumer->control_channel)
+        __handle_control_channel_event(consumer, consumer->control_channel);
+
+    if((pending & PV_DISPLAY_PENDING_DISCONNECT) && consumer->control_channel)
+        __handle_control_channel_disconnect(consumer, consumer->control_channel);
+}
+
+static void consumer_set_recorder(struct pv_display_consumer *consumer, struct pv_display_recorder *recorder)
+{
+    __PV_HELPER_TRACE__;
+    pv_helper_lock(&consumer->lock);
+
+    consumer->recorder = recorder;
+
+    pv_helper_unlock(&consumer->lock);
+}
+
 static void consumer_set_driver_data(struct pv_display_consumer *consumer, void *data)
 {
     __PV_HELPER_TRACE__;
@@ -1453,17 +3465,30 @@ int create_pv_display_consumer_with_conn_id(struct pv_display_consumer **display
     consumer->data        =  opaque;
     consumer->current_packet_header.length = 0;
 
+    //Time the session from here; the guest connects once we're listening.
+    pv_helper_startup_begin(&consumer->startup);
+
     //... and the lock that protects the display provider.
     pv_helper_mutex_init(&consumer->lock);
+    pv_helper_mutex_init(&consumer->send_lock);
     pv_helper_lock(&consumer->lock);
 
     consumer->create_pv_display_backend = consumer_create_pv_display_backend;
     consumer->finish_control_connection = finish_control_connection;
     consumer->set_driver_data = consumer_set_driver_data;
+    consumer->set_host_capabilities = consumer_set_host_capabilities;
     consumer->get_driver_data = consumer_get_driver_data;
+    consumer->get_stats = consumer_get_stats;
+    consumer->get_startup_profile = consumer_get_startup_profile;
+    consumer->enable_polling = consumer_enable_polling;
+    consumer->process_pending = consumer_process_pending;
+    consumer->set_recorder = consumer_set_recorder;
     consumer->display_list = consumer_display_list;
     consumer->add_display = consumer_add_display;
     consumer->remove_display = consumer_remove_display;
+    consumer->frame_done = consumer_frame_done;
+    consumer->grant_dirty_rectangle_credits = consumer_grant_dirty_rectangle_credits;
+    consumer->add_overlay = consumer_add_overlay;
     consumer->destroy_display = consumer_destroy_display;
     consumer->start_server = consumer_start_server;
     consumer->destroy = consumer_destroy;
@@ -1515,3 +3540,220 @@ int create_pv_display_consumer(struct pv_display_consumer **display_consumer, do
 	return create_pv_display_consumer_with_conn_id(display_consumer, guest_domain, control_port, 0, opaque);
 }
 
+/**
+ * Replays a single record from a recording.
+ *
+ * @return 0 on success, or -EINVAL if the record is malformed.
+ */
+static int __replay_record(struct pv_display_record_header *record, char *payload,
+                           struct pv_display_consumer *consumer,
+                           pv_display_replay_lookup lookup, void *opaque)
+{
+    struct dh_header *header = (struct dh_header *)payload;
+    struct pv_display_backend *display = NULL;
+    uint64_t before;
+
+    //Validate the record before we hand any of it to a handler.
+    switch(record->type)
+    {
+        case PV_DISPLAY_RECORD_CONTROL_PACKET:
+        case PV_DISPLAY_RECORD_EVENT_PACKET:
+            if((record->length < sizeof(struct dh_header) + sizeof(struct dh_footer)) ||
+               (header->length != record->length - (sizeof(struct dh_header) + sizeof(struct dh_footer))))
+                return -EINVAL;
+
+            //Hold replayed packets to the same standard as received ones.
+            if(__pv_helper_validate_header(header, record->type == PV_DISPLAY_RECORD_EVENT_PACKET) ||
+               __pv_helper_validate_payload(header, payload + sizeof(*header)))
+                return -EINVAL;
+            break;
+
+        case PV_DISPLAY_RECORD_DIRTY_RECTANGLE:
+            if(record->length != sizeof(struct dh_dirty_rectangle))
+                return -EINVAL;
+            break;
+
+        case PV_DISPLAY_RECORD_FRAMEBUFFER:
+            break;
+
+        default:
+            //Skip anything we don't understand; it may be from a newer recorder.
+            pv_display_debug("Skipping unknown record type %u.\n", (unsigned int)record->type);
+            return 0;
+    }
+
+    if((record->type != PV_DISPLAY_RECORD_CONTROL_PACKET) && lookup)
+        display = lookup(opaque, record->source);
+
+    switch(record->type)
+    {
+        case PV_DISPLAY_RECORD_CONTROL_PACKET:
+            if(consumer) {
+                pv_helper_lock(&consumer->lock);
+                __deliver_control_packet(consumer, header, payload + sizeof(*header));
+                pv_helper_unlock(&consumer->lock);
+            }
+            break;
+
+        case PV_DISPLAY_RECORD_EVENT_PACKET:
+            if(display) {
+                pv_helper_lock(&display->lock);
+                __deliver_event_packet(display, header, payload + sizeof(*header));
+                pv_helper_unlock(&display->lock);
+            }
+            break;
+
+        case PV_DISPLAY_RECORD_DIRTY_RECTANGLE:
+            if(display) {
+                struct pv_display_latency *latency = __get_latency(display);
+
+                before = pv_helper_stats_read(display->stats.dirty_rects_submitted);
+                __deliver_dirty_rectangle(display, (struct dh_dirty_rectangle *)payload);
+                __finish_dirty_rectangles(display, before, latency, latency ? pv_helper_timestamp() : 0, NULL, 0);
+            }
+            break;
+
+        case PV_DISPLAY_RECORD_FRAMEBUFFER:
+            if(display && display->framebuffer && (display->framebuffer_size >= record->length)) {
+                pv_helper_lock(&display->lock);
+                memcpy(display->framebuffer, payload, record->length);
+                pv_helper_unlock(&display->lock);
+            }
+            break;
+    }
+
+    return 0;
+}
+
+/**
+ * Returns the largest payload a record of the given type could usefully have,
+ * so we never allocate more than that for a record read from a recording.
+ * Framebuffer captures are bounded by the framebuffer they'd be copied into.
+ */
+static size_t __replay_record_limit(struct pv_display_record_header *record,
+                                    pv_display_replay_lookup lookup, void *opaque)
+{
+    struct pv_display_backend *display;
+    size_t limit = 0;
+
+    switch(record->type)
+    {
+        case PV_DISPLAY_RECORD_CONTROL_PACKET:
+        case PV_DISPLAY_RECORD_EVENT_PACKET:
+            return PV_HELPER_PACKET_BUFFER_SIZE;
+
+        case PV_DISPLAY_RECORD_DIRTY_RECTANGLE:
+            return sizeof(struct dh_dirty_rectangle);
+
+        case PV_DISPLAY_RECORD_FRAMEBUFFER:
+            display = lookup ? lookup(opaque, record->source) : NULL;
+
+            if(display) {
+                pv_helper_lock(&display->lock);
+                limit = display->framebuffer ? display->framebuffer_size : 0;
+                pv_helper_unlock(&display->lock);
+            }
+
+            return limit;
+
+        default:
+            return 0;
+    }
+}
+
+long pv_display_replay(const char *path, struct pv_display_consumer *consumer,
+                       pv_display_replay_lookup lookup, void *opaque, uint32_t flags)
+{
+    struct pv_display_recording_header recording;
+    struct pv_display_record_header record;
+    char *payload = NULL;
+    size_t capacity = 0;
+    uint64_t start_ns, elapsed_ns;
+    long replayed = 0;
+    FILE *file;
+    int rc = 0;
+
+    pv_display_checkp(path, -EINVAL);
+
+    file = fopen(path, "rb");
+
+    if(!file) {
+        pv_display_error("Could not open recording %s!\n", path);
+        return -ENOENT;
+    }
+
+    if((fread(&recording, sizeof(recording), 1, file) != 1) ||
+       (recording.magic != PV_DISPLAY_RECORDING_MAGIC) ||
+       (recording.version != PV_DISPLAY_RECORDING_VERSION)) {
+        pv_display_error("%s is not a recording this helper can replay.\n", path);
+        fclose(file);
+        return -EINVAL;
+    }
+
+    start_ns = pv_helper_time_ns();
+
+    while(fread(&record, sizeof(record), 1, file) == 1)
+    {
+        //Don't trust the recording's lengths any further than we have to.
+        if(record.length > __replay_record_limit(&record, lookup, opaque)) {
+
+            //No packet or rectangle is that large...
+            if((record.type == PV_DISPLAY_RECORD_CONTROL_PACKET) ||
+               (record.type == PV_DISPLAY_RECORD_EVENT_PACKET) ||
+               (record.type == PV_DISPLAY_RECORD_DIRTY_RECTANGLE)) {
+                pv_display_error("Recording %s has an oversized record (%ld).\n", path, replayed);
+                rc = -EINVAL;
+                break;
+            }
+
+            //... but anything else is a capture with nowhere to go, or a record we
+            //don't understand, either of which we'd skip anyway.
+            if(fseek(file, record.length, SEEK_CUR)) {
+                pv_display_error("Recording %s is truncated.\n", path);
+                rc = -EIO;
+                break;
+            }
+
+            ++replayed;
+            continue;
+        }
+
+        //Grow our payload buffer as needed; it's reused for every record.
+        if(record.length > capacity) {
+            pv_helper_free(payload);
+            payload = pv_helper_malloc_uninit(record.length);
+            capacity = payload ? record.length : 0;
+
+            if(!payload) {
+                rc = -ENOMEM;
+                break;
+            }
+        }
+
+        if(fread(payload, 1, record.length, file) != record.length) {
+            pv_display_error("Recording %s is truncated.\n", path);
+            rc = -EIO;
+            break;
+        }
+
+        //If we're reproducing the original timing, wait until the record is due.
+        if(flags & PV_DISPLAY_REPLAY_REALTIME) {
+            elapsed_ns = pv_helper_time_ns() - start_ns;
+
+            if(record.time_ns > elapsed_ns)
+                pv_helper_sleep_ns(record.time_ns - elapsed_ns);
+        }
+
+        if((rc = __replay_record(&record, payload, consumer, lookup, opaque))) {
+            pv_display_error("Recording %s has a malformed record (%ld).\n", path, replayed);
+            break;
+        }
+
+        ++replayed;
+    }
+
+    pv_helper_free(payload);
+    fclose(file);
+
+    return rc ? rc : replayed;
+}
@@ -10,6 +10,9 @@
 
 struct pv_display_backend;
 struct pv_display_consumer;
+struct pv_display_recorder;
+struct pv_display_dispatcher;
+struct pv_display_dispatch_queue;
 
 typedef void (*framebuffer_connection_handler)(void *opaque, struct libivc_client *client);
 typedef void (*dirty_rect_connection_handler)(void *opaque, struct libivc_client *client);
@@ -29,6 +32,52 @@ typedef void (*set_display_request_handler)(struct pv_display_backend *display,
 typedef void (*blank_display_request_handler)(struct pv_display_backend *display,
                                               uint32_t reason);
 
+/**
+ * Framebuffer Preserved Handler
+ *
+ * Handles a guest's word that a reconnected display's framebuffer contents survived
+ * the reconnect, and can be presented as-is (see dh_framebuffer_preserved). If no
+ * handler is registered, the whole framebuffer is reported as a dirty rectangle.
+ */
+typedef void (*framebuffer_preserved_request_handler)(struct pv_display_backend *display,
+                                                      uint32_t width, uint32_t height,
+                                                      uint32_t stride);
+
+/**
+ * Frame Commit Handler
+ *
+ * Handles a guest's word that all of the dirty rectangles for one of its frames have
+ * been delivered, so the frame can be presented (see Frame Commits). Only called if
+ * DH_CAP_FRAME_COMMIT was offered via the consumer's set_host_capabilities.
+ *
+ * @param frame The frame's sequence number, which increases by one with each frame.
+ */
+typedef void (*frame_commit_request_handler)(struct pv_display_backend *display, uint32_t frame);
+
+/**
+ * Set Overlay Handler
+ *
+ * Handles a guest's description of a display's video overlay (see Video Overlays):
+ * the format and layout of its frames, and the region of the display they should be
+ * scaled to fill. A format of DH_OVERLAY_FORMAT_NONE, or an empty region, hides the
+ * overlay. Only called for overlays offered via the consumer's add_overlay.
+ */
+typedef void (*set_overlay_request_handler)(struct pv_display_backend *display,
+                                            struct dh_set_overlay *overlay);
+
+/**
+ * Overlay Frame Handler
+ *
+ * Handles the presentation of a new video overlay frame.
+ *
+ * @param frame The frame's sequence number, which increases by one with each frame.
+ * @param image The frame's Y plane, laid out as the last set overlay event described;
+ *    or NULL, if the guest named a frame that doesn't fit in the overlay's buffer.
+ *    Only valid until the handler returns.
+ */
+typedef void (*overlay_frame_request_handler)(struct pv_display_backend *display,
+                                              uint32_t frame, void *image);
+
 /**
  * Fatal Display Error Handler
  *
@@ -40,6 +89,197 @@ typedef void (*blank_display_request_handler)(struct pv_display_backend *display
  */
 typedef void (*fatal_display_backend_error_handler)(struct pv_display_backend *display);
 
+/**
+ * Latency measurement state for a single display backend; see
+ * Latency Sampling in pv_driver_interface.h.
+ */
+struct pv_display_latency
+{
+    //Protects the structure; the dirty rectangle and event channels
+    //update it from different threads.
+    pv_helper_mutex lock;
+
+    //Delays from dirty rectangle submission, and from cursor packet
+    //transmission, to receipt; in units of 1024ns.
+    struct pv_helper_histogram damage;
+    struct pv_helper_histogram cursor;
+
+    //The smallest delays seen so far, against which the above are measured.
+    struct pv_helper_delay_baseline damage_baseline;
+    struct pv_helper_delay_baseline cursor_baseline;
+
+    //The number of dirty rectangles received over the current dirty rectangle
+    //connection. Like the samples' sequence numbers, this restarts from zero
+    //whenever the guest connects (or reconnects) its dirty rectangle channel.
+    uint32_t dirty_rects_received;
+
+    //The most recent damage sample, if we haven't yet received the dirty
+    //rectangle it refers to.
+    struct dh_damage_sample pending_sample;
+    bool sample_pending;
+};
+
+/**
+ * PV Display Recordings
+ *
+ * A recording captures everything a consumer and its displays receive from a guest,
+ * so that it can later be fed back through the same handlers offline; see
+ * create_pv_display_recorder and pv_display_replay. A recording is a file header,
+ * followed by a sequence of records, each a record header followed by its payload:
+ *
+ *   PV_DISPLAY_RECORD_CONTROL_PACKET   a control packet, exactly as received:
+ *                                      dh_header, payload and dh_footer
+ *   PV_DISPLAY_RECORD_EVENT_PACKET     an event packet, in the same form
+ *   PV_DISPLAY_RECORD_DIRTY_RECTANGLE  a single dh_dirty_rectangle
+ *   PV_DISPLAY_RECORD_FRAMEBUFFER      the contents of a display's framebuffer
+ *
+ * All fields are in host byte order; recordings aren't meant to move between
+ * architectures.
+ */
+#define PV_DISPLAY_RECORDING_MAGIC   (0x52445650) // "PVDR"
+#define PV_DISPLAY_RECORDING_VERSION (1)
+
+enum pv_display_record_type
+{
+    PV_DISPLAY_RECORD_CONTROL_PACKET  = 1,
+    PV_DISPLAY_RECORD_EVENT_PACKET    = 2,
+    PV_DISPLAY_RECORD_DIRTY_RECTANGLE = 3,
+    PV_DISPLAY_RECORD_FRAMEBUFFER     = 4,
+};
+
+struct pv_display_recording_header
+{
+    uint32_t magic;
+    uint32_t version;
+};
+
+struct pv_display_record_header
+{
+    //The time at which the record was received, in nanoseconds since the
+    //recording started.
+    uint64_t time_ns;
+
+    //The record's type (enum pv_display_record_type).
+    uint16_t type;
+
+    //The event port of the display that received the record, which identifies
+    //the display during replay; or 0 for control packets.
+    uint16_t source;
+
+    //The length of the payload that follows.
+    uint32_t length;
+};
+
+/**
+ * PV Display Recorder
+ * Writes a recording; may be shared by a consumer and any number of its displays.
+ */
+struct pv_display_recorder
+{
+    //Serializes writes to the recording.
+    pv_helper_mutex lock;
+
+    //The file being written, and the time at which the recording started.
+    FILE *file;
+    uint64_t start_ns;
+
+    //If non-zero, each display's framebuffer is captured after every this-many
+    //dirty rectangles it receives.
+    uint32_t snapshot_interval;
+
+    //Set once a write has failed; nothing further is recorded.
+    bool failed;
+
+    //The number of records, and of bytes, written so far.
+    uint64_t records;
+    uint64_t bytes;
+};
+
+/**
+ * Creates a new recorder, which writes to a new file at the given path.
+ * Attach it to a consumer and/or displays with their set_recorder methods.
+ *
+ * @param recorder Out: the new recorder.
+ * @param path The path of the recording to be created. Any existing file is replaced.
+ * @param snapshot_interval If non-zero, the number of dirty rectangles each display
+ *    receives between captures of its framebuffer. Captures are full-size, so
+ *    this should be generous.
+ * @return 0 on success, or an error code on failure.
+ */
+int create_pv_display_recorder(struct pv_display_recorder **recorder, const char *path, uint32_t snapshot_interval);
+
+/**
+ * Finishes a recording, and frees the recorder. It must first be detached from
+ * everything it was attached to.
+ */
+void destroy_pv_display_recorder(struct pv_display_recorder *recorder);
+
+/**
+ * Replay flags.
+ */
+//Reproduce the recording's original timing, rather than replaying as fast as possible.
+#define PV_DISPLAY_REPLAY_REALTIME (1 << 0)
+
+/**
+ * Finds the display backend to which a replayed record should be delivered.
+ *
+ * @param opaque The opaque pointer passed to pv_display_replay.
+ * @param source The event port of the display that originally received the record.
+ * @return The display to receive the record, or NULL to skip it.
+ */
+typedef struct pv_display_backend *(*pv_display_replay_lookup)(void *opaque, uint16_t source);
+
+/**
+ * Feeds a recording back through the given consumer's and displays' handlers,
+ * exactly as if it were being received from a guest: registered handlers, stats
+ * and latency histograms all see each record. Framebuffer captures are copied
+ * into the relevant display's framebuffer, if it has one large enough.
+ *
+ * @param path The recording to be replayed.
+ * @param consumer The consumer to receive control packets, or NULL to skip them.
+ * @param lookup Finds the display to receive each event packet, dirty rectangle and
+ *    framebuffer capture; or NULL to skip them all.
+ * @param opaque Passed to lookup.
+ * @param flags Any combination of the PV_DISPLAY_REPLAY_* flags.
+ * @return The number of records replayed, or a negative error code on failure.
+ */
+long pv_display_replay(const char *path, struct pv_display_consumer *consumer,
+                       pv_display_replay_lookup lookup, void *opaque, uint32_t flags);
+
+/**
+ * PV Display Dispatcher
+ *
+ * By default, a display backend's event handlers run as soon as their events are
+ * received, on whichever thread received them-- so a slow handler for one guest
+ * holds up receipt for everyone sharing that thread. A dispatcher instead queues
+ * each display's decoded events, and runs their handlers on a pool of worker
+ * threads; see set_dispatcher.
+ *
+ * Each display is assigned to a single worker, so its handlers still run one at a
+ * time, in the order their events arrived; but different displays' handlers can
+ * run in parallel, across cores. Handlers run without the display's lock held.
+ * Receipt never waits on a worker: if a display's handlers fall far enough behind,
+ * its backlog is coalesced, keeping only the latest event of each type (and the
+ * bounding box of any dirty rectangles), which are then delivered in the order
+ * set display, framebuffer preserved, blank, cursor update, cursor move, set
+ * overlay, overlay frame, dirty rectangle. Only supported in Linux userspace.
+ */
+
+/**
+ * Creates a new dispatcher, and starts its workers.
+ *
+ * @param dispatcher Out: the new dispatcher.
+ * @param workers The number of worker threads to run, or 0 for one per online CPU.
+ * @return 0 on success, or an error code on failure.
+ */
+int create_pv_display_dispatcher(struct pv_display_dispatcher **dispatcher, uint32_t workers);
+
+/**
+ * Stops a dispatcher's workers, and frees it. Every display must first be detached
+ * from it (or destroyed).
+ */
+void destroy_pv_display_dispatcher(struct pv_display_dispatcher *dispatcher);
+
 /**
  * PV Display "Object"
  * Represents an active PV display's backend, as created by a PV display consumer.
@@ -66,6 +306,7 @@ struct pv_display_backend
     uint16_t framebuffer_port;
     uint16_t cursor_bitmap_port;
     uint16_t dirty_rectangles_port;
+    uint16_t overlay_port;
 
     //The Display Handler key associated with the given display.
     uint32_t key;
@@ -86,9 +327,47 @@ struct pv_display_backend
     //associated with the display.
     struct pv_cursor cursor;
 
+    //The display's video overlay, as last described by the guest, and the shared
+    //buffer holding its frames; or NULL, if the guest hasn't connected one.
+    struct dh_set_overlay overlay;
+    void *overlay_buffer;
+    size_t overlay_buffer_size;
+
+    //Where the guest keeps compressed tiles of the framebuffer, for its current
+    //geometry; columns is 0 if it isn't. See Compressed Tiles. The geometry is the
+    //guest's latest set_display, kept apart from width and height, which belong to
+    //the display's owner.
+    struct dh_tile_store tile_store;
+    uint32_t tile_width;
+    uint32_t tile_height;
+
+    //The capabilities negotiated with the guest when the display was created.
+    uint32_t capabilities;
+
     //Flag to indicate that display has disconnected
     bool disconnected;
 
+    //Performance counters for the given display; see get_stats.
+    struct pv_helper_stats stats;
+
+    //When each step of the display's bring-up completed; see get_startup_profile.
+    struct pv_helper_startup_profile startup;
+
+    //Hands the display's work to its owner's event loop, once enabled; see enable_polling.
+    struct pv_helper_notifier notifier;
+
+    //Latency histograms for the given display, or NULL if they
+    //haven't been enabled; see enable_latency_histograms.
+    struct pv_display_latency *latency;
+
+    //The recorder capturing everything the display receives, if any; see set_recorder.
+    struct pv_display_recorder *recorder;
+
+    //The display's place in a dispatcher, if it's been given one; see set_dispatcher.
+    //The lock keeps it from being detached while an event is being queued on it.
+    struct pv_display_dispatch_queue *dispatch_queue;
+    pv_helper_mutex dispatch_lock;
+
     //
     // Required Connections
     //
@@ -117,6 +396,11 @@ struct pv_display_backend
     struct libivc_server *cursor_image_server;
     struct libivc_client *cursor_image_connection;
 
+    //The IVC connection used to share video overlay frames; see start_overlay_server.
+    bool overlay_server_listening;
+    struct libivc_server *overlay_server;
+    struct libivc_client *overlay_connection;
+
     // Connection handlers
     framebuffer_connection_handler new_framebuffer_connection_handler;
     dirty_rect_connection_handler  new_dirty_rect_connection_handler;
@@ -143,8 +427,122 @@ struct pv_display_backend
     void *(*get_driver_data)(struct pv_display_backend *display);
     void (*set_driver_data)(struct pv_display_backend *display, void *data);
 
+    /**
+     * Takes a snapshot of the display's performance counters. Safe to call
+     * at any time, from any thread.
+     */
+    void (*get_stats)(struct pv_display_backend *display, struct pv_helper_stats *stats);
+
+    /**
+     * Takes a snapshot of the display's startup profile: when each step of the
+     * initialization sequence completed, relative to the consumer's creation. Best
+     * read once the display is up; a snapshot taken mid-bring-up may be torn.
+     */
+    void (*get_startup_profile)(struct pv_display_backend *display, struct pv_helper_startup_profile *profile);
+
+    /**
+     * Stops the display from handling data and disconnects on libivc's threads. Instead,
+     * each leaves its work pending, and makes the returned file descriptor readable;
+     * the owner's event loop (epoll, io_uring, ...) should then call process_pending.
+     * A loop can drive many displays this way, from threads of its choosing, handling
+     * everything that's arrived since its last wake-up in a single pass.
+     *
+     * Must be called before start_servers. Only supported in Linux userspace.
+     *
+     * @return The file descriptor to poll for readability, or an error code on failure.
+     *    The descriptor belongs to the display, and is closed when it's destroyed.
+     */
+    int (*enable_polling)(struct pv_display_backend *display);
+
+    /**
+     * Does whatever work the display has left pending since the last call; see
+     * enable_polling. Must not be called concurrently with itself, or with the
+     * display's destruction.
+     */
+    void (*process_pending)(struct pv_display_backend *display);
+
+    /**
+     * Starts recording damage and cursor latency histograms for the given display.
+     * Damage latency also requires DH_CAP_LATENCY_SAMPLES to have been offered via
+     * the consumer's set_host_capabilities.
+     *
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*enable_latency_histograms)(struct pv_display_backend *display);
+
+    /**
+     * Takes a snapshot of the given display's latency histograms. Values are in
+     * units of 1024ns, relative to the fastest delivery seen on the display.
+     *
+     * @return 0 on success, or -ENOENT if histograms haven't been enabled.
+     */
+    int (*get_latency_histograms)(struct pv_display_backend *display,
+                                  struct pv_helper_histogram *damage,
+                                  struct pv_helper_histogram *cursor);
+
+    /**
+     * Starts recording everything the display receives to the given recorder,
+     * or stops recording if it's NULL. Once this returns, the display no longer
+     * uses any recorder it was previously given.
+     */
+    void (*set_recorder)(struct pv_display_backend *display, struct pv_display_recorder *recorder);
+
+    /**
+     * Has a dispatcher's workers run the display's event handlers, rather than the
+     * threads that receive its events; or, given NULL, stops doing so, discarding
+     * any events not yet handled. See create_pv_display_dispatcher.
+     *
+     * Must be called before start_servers (or after disconnect_display), and never
+     * from one of the display's own handlers.
+     *
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*set_dispatcher)(struct pv_display_backend *display, struct pv_display_dispatcher *dispatcher);
+
     int (*start_servers)(struct pv_display_backend *display);
 
+    /**
+     * Starts listening for a video overlay buffer on the given port (see Video
+     * Overlays), which should then be offered to the guest via the consumer's
+     * add_overlay. Overlay frames are connected directly, without a connection
+     * handler; they're delivered to the set overlay and overlay frame handlers.
+     *
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*start_overlay_server)(struct pv_display_backend *display, uint16_t overlay_port);
+
+    /**
+     * Finds one of the guest's compressed framebuffer tiles (see Compressed Tiles),
+     * for forwarding as-is. The guest may rewrite the tile at any time; a copy that
+     * no longer decodes should be treated as damaged. Requires DH_CAP_COMPRESSED_TILES
+     * to have been offered via the consumer's set_host_capabilities.
+     *
+     * Takes the display's lock, so may be called from its dirty rectangle and frame
+     * commit handlers, but not from those for its event channel.
+     *
+     * @param column, row The tile's position, in tiles from the top-left of the display.
+     * @param header Out argument to receive the tile's size and compressed length.
+     * @param data Out argument to receive the compressed tile itself.
+     * @return 0 on success, -ENOENT if the guest isn't keeping that tile, or -EINVAL if
+     *    the tile's header is malformed.
+     */
+    int (*get_compressed_tile)(struct pv_display_backend *display, uint32_t column, uint32_t row,
+                               struct dh_tile_header *header, const void **data);
+
+    /**
+     * Decompresses one of the guest's framebuffer tiles into the given image, as
+     * 32bpp pixels; tiles on the right and bottom edges of the display may be
+     * smaller than DH_TILE_SIZE square. Locks as get_compressed_tile does.
+     *
+     * @param column, row The tile's position, in tiles from the top-left of the display.
+     * @param image Receives the tile, starting with its top-left pixel.
+     * @param stride The distance between the image's rows, in bytes.
+     * @return 0 on success, -ENOENT if the guest isn't keeping that tile, or -EINVAL if
+     *    it doesn't decode; either way, the caller should read the framebuffer instead.
+     */
+    int (*decompress_tile)(struct pv_display_backend *display, uint32_t column, uint32_t row,
+                           void *image, uint32_t stride);
+
     //
     // Event Registration Functions
     //
@@ -158,6 +556,14 @@ struct pv_display_backend
                                          set_display_request_handler handler);
     void (*register_blank_display_handler)(struct pv_display_backend *display,
                                            blank_display_request_handler handler);
+    void (*register_framebuffer_preserved_handler)(struct pv_display_backend *display,
+                                                   framebuffer_preserved_request_handler handler);
+    void (*register_frame_commit_handler)(struct pv_display_backend *display,
+                                          frame_commit_request_handler handler);
+    void (*register_set_overlay_handler)(struct pv_display_backend *display,
+                                         set_overlay_request_handler handler);
+    void (*register_overlay_frame_handler)(struct pv_display_backend *display,
+                                           overlay_frame_request_handler handler);
 
     //Register an Fatal Error handler
     void (*register_fatal_error_handler)(struct pv_display_backend *display,
@@ -172,12 +578,23 @@ struct pv_display_backend
     update_cursor_request_handler update_cursor_handler;
     set_display_request_handler set_display_handler;
     blank_display_request_handler blank_display_handler;
+    framebuffer_preserved_request_handler framebuffer_preserved_handler;
+    frame_commit_request_handler frame_commit_handler;
+    set_overlay_request_handler set_overlay_handler;
+    overlay_frame_request_handler overlay_frame_handler;
 
     fatal_display_backend_error_handler fatal_error_handler;
 
     //A data structure storing the header for the packet currently being
     //recieved. If this packet is valid, it will have a non-zero length.
     struct dh_header current_packet_header;
+
+    //Our place in the event stream, should we lose it; see Resynchronization in common.h.
+    struct pv_helper_resync resync;
+
+    //Set by the receive path when the event stream can no longer be trusted;
+    //the fatal error handler is triggered once the display's lock is released.
+    bool event_stream_failed;
 };
 
 
@@ -213,6 +630,11 @@ struct pv_display_consumer
     //Used to ensure exclusive access to the given display provider.
     pv_helper_mutex lock;
 
+    //Serializes sends on the control channel, from the receive thread's replies and
+    //the consumer's methods alike, so no packet can land in the middle of another.
+    //Taken after (never before) the lock above.
+    pv_helper_mutex send_lock;
+
     //
     // Fields
     //
@@ -236,11 +658,36 @@ struct pv_display_consumer
     //The module/object that owns the given plugin.
     void *data;
 
+    //The capabilities we advertise to the guest: our own, and the negotiable ones
+    //(DH_CAP_NEGOTIABLE) we're willing to offer; and the subset of the negotiable
+    //ones that the guest asked for and was granted.
+    uint32_t capabilities;
+    uint32_t negotiated_capabilities;
+
+    //The guest driver's interface version and full capabilities, as of its last
+    //dh_driver_capabilities; or 0 if it hasn't sent any.
+    uint32_t driver_version;
+    uint32_t driver_capabilities;
+
+    //Performance counters for the control channel; see get_stats.
+    struct pv_helper_stats stats;
+
+    //When each step of the session's initialization completed; see get_startup_profile.
+    struct pv_helper_startup_profile startup;
+
+    //Hands the control channel's work to our owner's event loop, once enabled; see enable_polling.
+    struct pv_helper_notifier notifier;
+
+    //The recorder capturing received control packets, if any; see set_recorder.
+    struct pv_display_recorder *recorder;
 
     //A data structure storing the header for the packet currently being
     //recieved. If this packet is valid, it will have a non-zero length.
     struct dh_header current_packet_header;
 
+    //Our place in the control stream, should we lose it; see Resynchronization in common.h.
+    struct pv_helper_resync resync;
+
     //
     // Methods
     //
@@ -255,7 +702,57 @@ struct pv_display_consumer
                                      void *opaque);
 
     void (*set_driver_data)(struct pv_display_consumer *consumer, void *data);
+
+    /**
+     * Sets the capabilities we advertise to the guest (see Capability Negotiation):
+     * our own, such as DH_CAP_HOTPLUG, and the negotiable ones (DH_CAP_NEGOTIABLE)
+     * we're willing to grant, such as the largest cursor size class we can display.
+     * Must be called before the guest's capabilities arrive to take effect.
+     * Capabilities the helper handles by itself, like compact dirty rectangles,
+     * are always offered.
+     *
+     * @param consumer The relevant PV display consumer object.
+     * @param flags The capabilities to be offered.
+     */
+    void (*set_host_capabilities)(struct pv_display_consumer *consumer, uint32_t flags);
+
     void *(*get_driver_data)(struct pv_display_consumer *consumer);
+
+    /**
+     * Takes a snapshot of the control channel's performance counters. Safe to
+     * call at any time, from any thread.
+     */
+    void (*get_stats)(struct pv_display_consumer *consumer, struct pv_helper_stats *stats);
+
+    /**
+     * Takes a snapshot of the session's startup profile: when each session step of
+     * the initialization sequence completed, relative to the consumer's creation.
+     * Best read once the guest's displays are up; a snapshot taken mid-handshake
+     * may be torn.
+     */
+    void (*get_startup_profile)(struct pv_display_consumer *consumer, struct pv_helper_startup_profile *profile);
+
+    /**
+     * Stops the consumer from handling control packets and disconnects on libivc's
+     * threads; see the display backend's enable_polling, which this mirrors.
+     * Must be called before finish_control_connection.
+     *
+     * @return The file descriptor to poll for readability, or an error code on failure.
+     */
+    int (*enable_polling)(struct pv_display_consumer *consumer);
+
+    /**
+     * Handles whatever control packets and disconnects are pending since the last
+     * call; see enable_polling. Must not be called concurrently with itself, or with
+     * the consumer's destruction.
+     */
+    void (*process_pending)(struct pv_display_consumer *consumer);
+
+    /**
+     * Starts recording every control packet received to the given recorder, or
+     * stops recording if it's NULL. Displays are recorded separately.
+     */
+    void (*set_recorder)(struct pv_display_consumer *consumer, struct pv_display_recorder *recorder);
     int (*start_server)(struct pv_display_consumer *consumer);
 
     /**
@@ -305,6 +802,58 @@ struct pv_display_consumer
     int (*remove_display)(struct pv_display_consumer *consumer,
                           uint32_t key);
 
+    /**
+     * Tells the guest that we've finished with one of a display's frames-- typically
+     * at the vblank after presenting it-- so it can pace its rendering to ours
+     * (see Frame Done). Does nothing unless the guest asked for these reports.
+     * Safe to call from any thread. Reports are held back while the control ring
+     * is nearly full, to leave room for add_display and remove_display; a held
+     * back report is made up for by the next one.
+     *
+     * @param consumer The relevant PV display consumer object.
+     * @param key The key associated with the display.
+     * @param frame The frame's sequence number: the one from its frame commit, if
+     *    frame commits are in use, or otherwise a count of frames presented.
+     *
+     * @return 0 on success, -EAGAIN if the report was held back, or an error
+     *    code on failure.
+     */
+    int (*frame_done)(struct pv_display_consumer *consumer,
+                      uint32_t key, uint32_t frame);
+
+    /**
+     * Allows the guest to send some more of a display's dirty rectangles (see
+     * Dirty Rectangle Credits). Once a display has been granted any, the guest
+     * coalesces whatever damage it has no credit for until it's granted more; so
+     * a backend that grants roughly what it handled each frame keeps the guest at
+     * its own pace. Never granting leaves the guest unlimited. Does nothing unless
+     * the guest supports credits. Safe to call from any thread.
+     *
+     * @param consumer The relevant PV display consumer object.
+     * @param key The key associated with the display.
+     * @param credits The number of additional dirty rectangles the guest may send.
+     *
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*grant_dirty_rectangle_credits)(struct pv_display_consumer *consumer,
+                                         uint32_t key, uint32_t credits);
+
+    /**
+     * Offers one of the guest's displays a video overlay (see Video Overlays), on a
+     * port the display is already listening on; see start_overlay_server. Must be
+     * sent after the display's add_display, and again after it reconnects. Safe to
+     * call from any thread.
+     *
+     * @param consumer The relevant PV display consumer object.
+     * @param key The key associated with the display.
+     * @param overlay_port The port to which the guest should connect the overlay's buffer.
+     *
+     * @return 0 on success, -ENODEV if the guest doesn't support overlays, or an
+     *    error code on failure.
+     */
+    int (*add_overlay)(struct pv_display_consumer *consumer,
+                       uint32_t key, uint32_t overlay_port);
+
     /**
      * Destroy a display via the consumer
      *
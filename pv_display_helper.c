@@ -9,6 +9,20 @@
 #include "common.h"
 #include "pv_display_helper.h"
 
+//Instantiate our tracepoints, which common.h has already declared.
+#if defined __linux__ && defined __KERNEL__
+#define CREATE_TRACE_POINTS
+#include "pv_display_helper_trace.h"
+#endif
+
+//Userspace x86 builds can expand cursors with SSE2, which every x86-64 CPU has.
+//Kernel builds stick to the scalar loops: using vector registers there would
+//mean saving and restoring the FPU state around each conversion.
+#if !defined KERNEL && (defined __SSE2__ || defined _M_X64)
+#include <emmintrin.h>
+#define PV_HELPER_CURSOR_SSE2
+#endif
+
 /******************************************************************************/
 /* Module Parameters                                                          */
 /******************************************************************************/
@@ -46,10 +60,175 @@ static int dirty_rectangles_pages = 32;
 module_param(dirty_rectangles_pages, int, S_IRUGO | S_IWUSR);
 #endif
 
+
+//The number of dirty rectangles between damage latency samples (see
+//dh_damage_sample), if the host supports them; or 0 to never send samples.
+static int latency_sample_interval = 64;
+
+//If we're a linux kernel module, allow the module inserter to change this
+//parameter, allowing easy tuning.
+#if defined __linux__ && defined __KERNEL__
+module_param(latency_sample_interval, int, S_IRUGO | S_IWUSR);
+#endif
+
+
+//The pool our packet buffers are drawn from; set up when the driver is loaded.
+PV_HELPER_DEFINE_PACKET_POOL();
+
+
+//The number of bytes the control channel may discard while resynchronizing after
+//a framing error, before it gives up and tears down the connection.
+static int resync_threshold = PV_HELPER_RESYNC_THRESHOLD;
+
+//If we're a linux kernel module, allow the module inserter to change this
+//parameter, allowing easy tuning.
+#if defined __linux__ && defined __KERNEL__
+module_param(resync_threshold, int, S_IRUGO | S_IWUSR);
+#endif
+
+
+//If non-zero, providers whose Display Handler goes away (or isn't there yet) keep
+//trying to reach it in the background, rather than reporting a fatal error.
+//This relies on deferred work (see common.h), which isn't yet available on Windows.
+#if defined _WIN32
+static int auto_reconnect = 0;
+#else
+static int auto_reconnect = 1;
+#endif
+
+//If we're a linux kernel module, allow the module inserter to change this
+//parameter, allowing easy tuning.
+#if defined __linux__ && defined __KERNEL__
+module_param(auto_reconnect, int, S_IRUGO | S_IWUSR);
+#endif
+
+
+//The delay before the first attempt to reach the Display Handler again, in milliseconds.
+//Each failed attempt doubles the delay, up to reconnect_max_delay_ms; each is jittered,
+//so that many guests don't all retry at once when the Display Handler restarts.
+static int reconnect_min_delay_ms = 50;
+static int reconnect_max_delay_ms = 5000;
+
+//If we're a linux kernel module, allow the module inserter to change these
+//parameters, allowing easy tuning.
+#if defined __linux__ && defined __KERNEL__
+module_param(reconnect_min_delay_ms, int, S_IRUGO | S_IWUSR);
+module_param(reconnect_max_delay_ms, int, S_IRUGO | S_IWUSR);
+#endif
+
+/******************************************************************************/
+/* Performance Counter Publishing                                             */
+/******************************************************************************/
+
+#if defined __linux__ && defined __KERNEL__
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+//The debugfs directory (pv_display_helper) in which each provider's and
+//display's performance counters are published, or NULL if debugfs is unavailable.
+static struct dentry *stats_root;
+
+/**
+ * Prints a snapshot of a set of performance counters to a debugfs file.
+ */
+static int pv_display_stats_show(struct seq_file *file, void *unused)
+{
+    struct pv_helper_stats stats;
+    int i;
+
+    pv_helper_stats_snapshot(&stats, file->private);
+
+    seq_puts(file, "type packets_sent bytes_sent packets_received bytes_received\n");
+    for(i = 0; i < PV_HELPER_STATS_PACKET_TYPES; ++i)
+    {
+        if(!stats.packets_sent[i] && !stats.packets_received[i])
+            continue;
+
+        seq_printf(file, "%d %llu %llu %llu %llu\n", i,
+            stats.packets_sent[i], stats.bytes_sent[i],
+            stats.packets_received[i], stats.bytes_received[i]);
+    }
+
+    seq_printf(file, "dirty_rects_submitted %llu\n", stats.dirty_rects_submitted);
+    seq_printf(file, "dirty_rects_coalesced %llu\n", stats.dirty_rects_coalesced);
+    seq_printf(file, "dirty_rects_dropped %llu\n", stats.dirty_rects_dropped);
+    seq_printf(file, "frames_committed %llu\n", stats.frames_committed);
+    seq_printf(file, "ring_full %llu\n", stats.ring_full);
+    seq_printf(file, "full_refreshes %llu\n", stats.full_refreshes);
+    seq_printf(file, "crc_failures %llu\n", stats.crc_failures);
+    seq_printf(file, "malformed_packets %llu\n", stats.malformed_packets);
+    seq_printf(file, "resyncs %llu\n", stats.resyncs);
+    seq_printf(file, "resync_bytes_skipped %llu\n", stats.resync_bytes_skipped);
+    seq_printf(file, "reconnect_attempts %llu\n", stats.reconnect_attempts);
+    seq_printf(file, "reconnects %llu\n", stats.reconnects);
+    seq_printf(file, "notifies %llu\n", stats.notifies);
+    seq_printf(file, "lock_contentions %llu\n", stats.lock_contentions);
+    seq_printf(file, "lock_wait_ns %llu\n", stats.lock_wait_ns);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(pv_display_stats);
+
+/**
+ * Publishes a set of performance counters as a debugfs file named
+ * <kind>-<domain>-<id>, storing the new entry in *node.
+ */
+static void __publish_stats(void **node, struct pv_helper_stats *stats, const char *kind, uint32_t domain, uint32_t id)
+{
+    char name[32];
+
+    *node = NULL;
+
+    if(IS_ERR_OR_NULL(stats_root))
+        return;
+
+    snprintf(name, sizeof(name), "%s-%u-%u", kind, (unsigned int)domain, (unsigned int)id);
+    *node = debugfs_create_file(name, S_IRUGO, stats_root, stats, &pv_display_stats_fops);
+}
+
+/**
+ * Removes a set of performance counters published by __publish_stats.
+ */
+static void __unpublish_stats(void **node)
+{
+    if(!IS_ERR_OR_NULL(*node))
+        debugfs_remove(*node);
+
+    *node = NULL;
+}
+#else
+//Performance counters are only published on the Linux kernel; elsewhere,
+//they can be read using the relevant object's get_stats method.
+static void __publish_stats(void **node, struct pv_helper_stats *stats, const char *kind, uint32_t domain, uint32_t id)
+{
+    (void)stats;
+    (void)kind;
+    (void)domain;
+    (void)id;
+    *node = NULL;
+}
+
+static void __unpublish_stats(void **node)
+{
+    *node = NULL;
+}
+#endif
+
 /******************************************************************************/
 /* Event Handlers                                                             */
 /******************************************************************************/
 
+/**
+ * Records the completion of a session step in the provider's startup profile.
+ */
+static void __mark_provider_startup(struct pv_display_provider *provider, enum pv_helper_startup_step step)
+{
+    pv_helper_lock(&provider->lock);
+    pv_helper_startup_mark(&provider->startup, 0, step);
+    pv_helper_unlock(&provider->lock);
+}
+
+
 /**
  * Handles changes in the Host Display List.
  *
@@ -69,6 +248,8 @@ static void __handle_host_display_changed_event(struct pv_display_provider *prov
     //that has been transmitted...
     struct dh_display_list *list = (struct dh_display_list *)payload;
 
+    __mark_provider_startup(provider, PV_HELPER_STARTUP_DISPLAY_LIST);
+
     //If the user hasn't registered a handle for the Display List event, abort.
     if(!provider->host_display_change_handler)
     {
@@ -81,6 +262,84 @@ static void __handle_host_display_changed_event(struct pv_display_provider *prov
 }
 
 
+/**
+ * Re-establishes the connections of a display that were lost along with a previous
+ * Display Handler, in response to a new Display Handler's request for the display;
+ * then tells the new Display Handler everything it needs to show it.
+ *
+ * @param provider The display provider which received the request.
+ * @param request The Add Display request.
+ * @return True iff the request was for such a display, and has been handled.
+ */
+static bool __reconnect_pending_display(struct pv_display_provider *provider, struct dh_add_display *request)
+{
+    //The capabilities fixed when the display was created: the cursor size, by the size
+    //of the cursor buffer, and compressed tiles, by the size of the framebuffer's. The
+    //rest can be picked up (or dropped) on reconnecting.
+    const uint32_t fixed = DH_CAP_CURSOR_SIZE_MASK | DH_CAP_COMPRESSED_TILES;
+    const uint32_t renegotiable = DH_CAP_NEGOTIABLE & ~fixed;
+
+    struct pv_display *display;
+    uint32_t negotiated;
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    //Find the display, if we have it, and claim its reconnection.
+    pv_helper_lock(&provider->lock);
+    for(display = provider->displays; display; display = display->next)
+    {
+        if(display->reconnect_pending && (display->key == request->key))
+        {
+            display->reconnect_pending = false;
+            break;
+        }
+    }
+    negotiated = provider->negotiated_capabilities;
+    pv_helper_unlock(&provider->lock);
+
+    if(!display)
+        return false;
+
+    pv_display_debug("Reconnecting display %u to the new Display Handler.\n", (unsigned int)display->key);
+
+    //Use whatever the new Display Handler agreed to-- so long as it agreed to everything
+    //fixed at the display's creation; if not, the display has to be recreated...
+    pv_helper_lock(&display->lock);
+
+    if((display->capabilities ^ negotiated) & fixed)
+    {
+        rc = -EPROTO;
+    }
+    else
+    {
+        display->capabilities = (display->capabilities & ~renegotiable) | (negotiated & renegotiable);
+        rc = 0;
+    }
+
+    pv_helper_unlock(&display->lock);
+
+    //... re-establish the display's connections, bringing its framebuffer contents with it...
+    if(!rc)
+        rc = display->reconnect_with_flags(display, request, provider->rx_domain, PV_DISPLAY_RECONNECT_PRESERVE);
+
+    //... and re-send its cursor, which the new Display Handler hasn't seen.
+    if(!rc && display->cursor.image && display->cursor_image_connection)
+        rc = display->set_cursor_visibility(display, display->cursor.visible);
+
+    //If we couldn't bring the display back, let the driver deal with it.
+    if(rc)
+    {
+        pv_display_error("Could not reconnect display %u (%d)!\n", (unsigned int)display->key, rc);
+
+        if(display->fatal_error_handler)
+            display->fatal_error_handler(display);
+    }
+
+    return true;
+}
+
+
 /**
  * Handles a host Add Display request.
  *
@@ -93,6 +352,13 @@ static void __handle_add_display_request(struct pv_display_provider *provider, s
 {
     __PV_HELPER_TRACE__;
 
+    __mark_provider_startup(provider, PV_HELPER_STARTUP_ADD_DISPLAY);
+
+    //If the Display Handler is asking for a display we lost along with its predecessor,
+    //bring the display back ourselves-- the driver already considers it up.
+    if(__reconnect_pending_display(provider, request))
+        return;
+
     //If the user hasn't registered a handle for the Display List event, abort.
     //We'll issue a full-on error message here, as lacking this listener makes us useless.
     if(!provider->add_display_handler)
@@ -135,6 +401,123 @@ static void __handle_remove_display_request(struct pv_display_provider *provider
     provider->remove_display_handler(provider, request);
 }
 
+/**
+ * Handles a host Frame Done event.
+ *
+ * @param provider The display provider which received the event.
+ * @param event The Frame Done event.
+ */
+static void __handle_frame_done_event(struct pv_display_provider *provider, struct dh_frame_done *event)
+{
+    __PV_HELPER_TRACE__;
+
+    //We only ask for these once a handler's registered, so there should always be one.
+    if(!provider->frame_done_handler)
+    {
+        pv_display_debug("Received a Frame Done event, but no handler is registered.\n");
+        return;
+    }
+
+    provider->frame_done_handler(provider, event);
+}
+
+static void __flush_held_damage(struct pv_display *display);
+
+/**
+ * Handles a host grant of dirty rectangle credits, sending any damage that was
+ * held back for want of them.
+ *
+ * @param provider The display provider which received the grant.
+ * @param event The Dirty Rectangle Credits packet.
+ */
+static void __handle_dirty_rectangle_credits(struct pv_display_provider *provider, struct dh_dirty_rectangle_credits *event)
+{
+    struct pv_display *display;
+
+    __PV_HELPER_TRACE__;
+
+    //Find the display, and hand over to its lock; flushing the held damage sends on
+    //the dirty rectangle ring, which shouldn't hold up the rest of the provider.
+    pv_helper_lock_counted(&provider->lock, &provider->stats);
+
+    for(display = provider->displays; display; display = display->next)
+    {
+        if(display->key == event->key)
+        {
+            pv_helper_lock_counted(&display->lock, &display->stats);
+            break;
+        }
+    }
+
+    pv_helper_unlock(&provider->lock);
+
+    if(!display)
+    {
+        pv_display_debug("Received dirty rectangle credits for unknown display %u.\n", (unsigned int)event->key);
+        return;
+    }
+
+    display->credits_enabled = true;
+    display->credits = (display->credits > 0xFFFFFFFF - event->credits) ?
+        0xFFFFFFFF : display->credits + event->credits;
+    __flush_held_damage(display);
+
+    pv_helper_unlock(&display->lock);
+}
+
+/**
+ * Handles the host's offer of a video overlay for one of our displays. If the display
+ * already has an overlay-- that is, we're reconnecting-- its buffer is re-shared on the
+ * new port, and the overlay described to the host again.
+ *
+ * @param provider The display provider which received the offer.
+ * @param request The Add Overlay packet.
+ */
+static void __handle_add_overlay_request(struct pv_display_provider *provider, struct dh_add_overlay *request)
+{
+    struct pv_display *display;
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    //Find the display, and hand over to its lock; reconnecting the overlay can take
+    //a while, and shouldn't hold up the rest of the provider.
+    pv_helper_lock(&provider->lock);
+
+    for(display = provider->displays; display; display = display->next)
+    {
+        if(display->key == request->key)
+        {
+            pv_helper_lock(&display->lock);
+            break;
+        }
+    }
+
+    pv_helper_unlock(&provider->lock);
+
+    if(!display)
+    {
+        pv_display_debug("Received an overlay offer for unknown display %u.\n", (unsigned int)request->key);
+        return;
+    }
+
+    display->overlay_port = request->overlay_port;
+
+    if(display->overlay_connection)
+    {
+        rc = libivc_reconnect(display->overlay_connection, provider->rx_domain, (uint16_t)request->overlay_port);
+
+        if(!rc)
+            rc = __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_SET_OVERLAY,
+                               &display->overlay, sizeof(display->overlay));
+
+        if(rc)
+            pv_display_error("Could not restore the video overlay for display %u (%d)!\n", (unsigned int)display->key, rc);
+    }
+
+    pv_helper_unlock(&display->lock);
+}
+
 /******************************************************************************/
 /* Internal Functions                                                         */
 /******************************************************************************/
@@ -152,6 +535,45 @@ static void __trigger_fatal_error_on_provider(struct pv_display_provider *provid
         provider->fatal_error_handler(provider);
 }
 
+/**
+ * Handles receipt of the Display Handler's reply to our negotiable capabilities,
+ * recording the capabilities that both sides have agreed to use. Displays
+ * created from here on will use the negotiated capabilities.
+ *
+ * @param provider The display provider which received the reply.
+ * @param capabilities The capabilities accepted by the Display Handler.
+ */
+static void __handle_host_capabilities(struct pv_display_provider *provider, struct dh_host_capabilities *capabilities)
+{
+    __PV_HELPER_TRACE__;
+
+    pv_helper_lock(&provider->lock);
+    provider->host_version      = capabilities->version;
+    provider->host_capabilities = capabilities->flags & ~DH_CAP_NEGOTIABLE;
+
+    //A Display Handler from another major version may not mean what we do by any of its
+    //bits; stick to the base protocol. (It shouldn't have accepted anything, either.)
+    if(!PV_DRIVER_INTERFACE_COMPATIBLE(capabilities->version, PV_DRIVER_INTERFACE_VERSION))
+    {
+        pv_display_error("The Display Handler speaks interface version %x, which is incompatible with ours (%x).\n",
+            (unsigned int)capabilities->version, (unsigned int)PV_DRIVER_INTERFACE_VERSION);
+        provider->negotiated_capabilities = 0;
+        pv_helper_unlock(&provider->lock);
+        return;
+    }
+
+    provider->negotiated_capabilities =
+        __pv_helper_negotiate_capabilities(provider->capabilities, capabilities->flags);
+
+    pv_display_debug("Display Handler version %x has capabilities %x; negotiated %x; cursors will be %ux%u.\n",
+        (unsigned int)provider->host_version, (unsigned int)provider->host_capabilities,
+        (unsigned int)provider->negotiated_capabilities,
+        (unsigned int)DH_CAP_CURSOR_SIZE(provider->negotiated_capabilities),
+        (unsigned int)DH_CAP_CURSOR_SIZE(provider->negotiated_capabilities));
+    pv_helper_unlock(&provider->lock);
+}
+
+
 /**
  * Handles receipt of a Display Handler control packet, delegating the packet to the appropriate handler
  * accoring to type.
@@ -163,6 +585,7 @@ static void __trigger_fatal_error_on_provider(struct pv_display_provider *provid
 static void __handle_control_packet_receipt(struct pv_display_provider *provider, struct dh_header *header, void *buffer)
 {
     __PV_HELPER_TRACE__;
+    pv_helper_probe(control_dispatch, header->type, header->length);
 
     //Delegate the event to the approriate handler, according to type.
     switch(header->type)
@@ -187,6 +610,25 @@ static void __handle_control_packet_receipt(struct pv_display_provider *provider
             __handle_remove_display_request(provider, (struct dh_remove_display *)buffer);
             return;
 
+        //Host Capabilities-- the Display Handler has replied to our negotiable capabilities.
+        case PACKET_TYPE_CONTROL_HOST_CAPABILITIES:
+            pv_display_debug("Received the host's capabilities!\n");
+            __handle_host_capabilities(provider, (struct dh_host_capabilities *)buffer);
+            return;
+
+        //Frame Done events-- the Display Handler has finished with one of a display's frames.
+        case PACKET_TYPE_CONTROL_FRAME_DONE:
+            __handle_frame_done_event(provider, (struct dh_frame_done *)buffer);
+            return;
+
+        case PACKET_TYPE_CONTROL_DIRTY_RECTANGLE_CREDITS:
+            __handle_dirty_rectangle_credits(provider, (struct dh_dirty_rectangle_credits *)buffer);
+            return;
+
+        case PACKET_TYPE_CONTROL_ADD_OVERLAY:
+            __handle_add_overlay_request(provider, (struct dh_add_overlay *)buffer);
+            return;
+
         default:
             //For now, do nothing if we receive an unknown packet type-- this gives us some safety in the event of a version
             //mismatch. We may want to consider other behaviors, as well-- disconnecting, or sending an event to the host.
@@ -209,13 +651,21 @@ static bool __try_to_read_header(struct pv_display_provider *provider)
     __PV_HELPER_TRACE__;
 
 
-    //Attempt to perform a packetized read, which will pull in a header packet
-    //if at all possible.
-    pv_helper_lock(&provider->lock);
-    rc = libivc_recv(provider->control_channel, (char *)&provider->current_packet_header, sizeof(struct dh_header));
+    //Attempt to read in a valid header, resynchronizing with the stream if need be.
+    pv_helper_lock_counted(&provider->lock, &provider->stats);
+    rc = __pv_helper_receive_header(provider->control_channel, &provider->resync, &provider->stats,
+                                    &provider->current_packet_header, false, (uint64_t)resync_threshold);
     pv_helper_unlock(&provider->lock);
 
-    return (rc == SUCCESS);
+    //If we couldn't find our place in the stream again, it can't be trusted.
+    if(rc < 0)
+    {
+        pv_display_error("Communications error: lost the control stream. Terminating connections.\n");
+        __trigger_fatal_error_on_provider(provider);
+        return false;
+    }
+
+    return (rc > 0);
 }
 
 
@@ -229,15 +679,18 @@ static bool __try_to_receive_control_packet(struct pv_display_provider *provider
 {
     __PV_HELPER_TRACE__;
 
+    struct dh_header header;
     size_t length_with_footer;
 
     size_t data_available;
     struct dh_footer *footer;
     uint16_t checksum;
+    bool valid = true;
+    bool give_up;
     char *buffer;
     int rc;
 
-    pv_helper_lock(&provider->lock);
+    pv_helper_lock_counted(&provider->lock, &provider->stats);
 
     //Determine the size of the remainder of the packet-- composed of the packet body ("payload") and footer.
     length_with_footer = provider->current_packet_header.length + sizeof(struct dh_footer);
@@ -266,7 +719,7 @@ static bool __try_to_receive_control_packet(struct pv_display_provider *provider
 
     //Otherwise, try to read the given data. First, we'll create a buffer
     //large enough to receive the rest of the packet.
-    buffer = pv_helper_malloc(length_with_footer);
+    buffer = pv_helper_packet_alloc(length_with_footer);
 
     //If we weren't able to allocate a receive buffer, we'll try to recover
     //on a future iteration. For now, abort!
@@ -288,7 +741,7 @@ static bool __try_to_receive_control_packet(struct pv_display_provider *provider
     {
         pv_display_error("Could not read in a packet, though IVC claims it's there. Locking problems?\n");
         pv_helper_unlock(&provider->lock);
-        pv_helper_free(buffer);
+        pv_helper_packet_free(buffer, length_with_footer);
         return false;
     }
 
@@ -296,36 +749,66 @@ static bool __try_to_receive_control_packet(struct pv_display_provider *provider
     //which should be located right after the main packet body.
     footer = (struct dh_footer *)(buffer + provider->current_packet_header.length);
 
-    //Compute the checksum of the received packet.
-    checksum = __pv_helper_packet_checksum(&provider->current_packet_header, buffer, provider->current_packet_header.length);
+    //Make sure the payload agrees with its header before we spend any time checksumming it;
+    //then check the packet's CRC.
+    if(__pv_helper_validate_payload(&provider->current_packet_header, buffer))
+    {
+        pv_display_error("Communications error: received a malformed Type-%u control packet. Dropping it.\n",
+                         (unsigned int)provider->current_packet_header.type);
+        pv_helper_stats_inc(provider->stats.malformed_packets);
+        valid = false;
+    }
+    else if((checksum = __pv_helper_packet_checksum(&provider->current_packet_header, buffer,
+                                                    provider->current_packet_header.length)) != footer->crc)
+    {
+        pv_display_error("Communications error: CRC did not match for a control packet. Dropping it.\n");
+        pv_helper_stats_inc(provider->stats.crc_failures);
+        pv_helper_probe(crc_mismatch, provider->current_packet_header.type, provider->current_packet_header.length,
+                        footer->crc, checksum);
+        valid = false;
+    }
 
-    //Check the packet's CRC. If it doesn't match, we're in serious trouble. Bail out.
-    if(checksum != footer->crc)
+    //If the packet was bad, drop it; the next header will tell us whether we're still in step
+    //with the stream. We only give up on it if we've been out of step for too long.
+    if(!valid)
     {
-        pv_display_error("Communications error: CRC did not match for a control packet. Terminating connections.\n");
+        give_up = __pv_helper_resync_skip(&provider->resync, &provider->stats,
+                                          sizeof(struct dh_header) + length_with_footer, (uint64_t)resync_threshold);
 
         //Invalidate the received packet...
         provider->current_packet_header.length = 0;
 
         //... clean up, and return.
-        pv_helper_free(buffer);
+        pv_helper_packet_free(buffer, length_with_footer);
         pv_helper_unlock(&provider->lock);
 
-        __trigger_fatal_error_on_provider(provider);
-        return false;
+        if(give_up)
+        {
+            pv_display_error("Communications error: too many bad control packets. Terminating connections.\n");
+            __trigger_fatal_error_on_provider(provider);
+            return false;
+        }
+
+        return true;
     }
 
+    __pv_helper_resync_complete(&provider->resync);
+
+    pv_helper_stats_count_packet(provider->stats.packets_received, provider->stats.bytes_received,
+        provider->current_packet_header.type, provider->current_packet_header.length);
+
     //Invalidate the current packet header, as we've already handled it!
+    header = provider->current_packet_header;
     provider->current_packet_header.length = 0;
 
     //Give up exclusive access to the display object, as we're done modifying it.
     pv_helper_unlock(&provider->lock);
 
     //Finally, pass the compelted packet to our packet receipt handler.
-    __handle_control_packet_receipt(provider, &provider->current_packet_header, buffer);
+    __handle_control_packet_receipt(provider, &header, buffer);
 
     //Clean up our buffer.
-    pv_helper_free(buffer);
+    pv_helper_packet_free(buffer, length_with_footer);
     return true;
 }
 
@@ -371,19 +854,93 @@ static void __handle_control_channel_event(void *opaque, struct libivc_client *c
 
 
 /**
- * Handle control channel events. These events usually indicate that we've
- * received a collection of control data-- but not necessarily a whole packet.
+ * Determines how long to wait before the next attempt to reach the Display Handler:
+ * reconnect_min_delay_ms, doubled for each consecutive failure up to reconnect_max_delay_ms,
+ * of which we wait at least half, and a random amount of the rest.
+ *
+ * Assumes the provider is already locked.
+ *
+ * @return The delay, in nanoseconds.
  */
-static void __handle_control_channel_disconnect(void *opaque, struct libivc_client *client)
+static uint64_t __reconnect_delay_ns(struct pv_display_provider *provider)
 {
-    __PV_HELPER_TRACE__;
-    (void)opaque;
-    (void)client;
-    //Find the PV display provider associated with the given client...
-    struct pv_display_provider *provider = opaque;
+    uint32_t minimum = (reconnect_min_delay_ms > 0) ? (uint32_t)reconnect_min_delay_ms : 1;
+    uint32_t maximum = (reconnect_max_delay_ms > (int)minimum) ? (uint32_t)reconnect_max_delay_ms : minimum;
+    uint32_t delay = minimum;
+    uint32_t doublings = provider->reconnect_attempts;
+    uint32_t random = provider->reconnect_seed;
 
-    //... and trigger its fatal error handler.
-    __trigger_fatal_error_on_provider(provider);
+    while(doublings-- && (delay < maximum))
+        delay *= 2;
+
+    if(delay > maximum)
+        delay = maximum;
+
+    //Step our xorshift PRNG; this needn't be any better than enough to spread guests out.
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    provider->reconnect_seed = random;
+
+    return (uint64_t)((delay / 2) + (random % ((delay / 2) + 1))) * 1000000ULL;
+}
+
+
+/**
+ * Starts trying to reach the Display Handler again in the background, if we aren't already.
+ * Assumes the provider is already locked.
+ *
+ * @return 0 on success, or an error code if we can't reconnect.
+ */
+static int __schedule_reconnect(struct pv_display_provider *provider)
+{
+    int rc;
+
+    if(!auto_reconnect || provider->destroying)
+        return -ENOTCONN;
+
+    if(provider->reconnecting)
+        return 0;
+
+    rc = pv_helper_work_schedule(&provider->reconnect_work, __reconnect_delay_ns(provider));
+
+    if(rc)
+        return rc;
+
+    //Whatever comes next is a new session, and gets a startup profile of its own.
+    provider->reconnecting = true;
+    pv_helper_startup_begin(&provider->startup);
+    return 0;
+}
+
+
+/**
+ * Handle control channel disconnects, which usually mean that the Display Handler
+ * has gone away. If we can, we'll wait for it to come back; otherwise, we'll report
+ * a fatal error.
+ */
+static void __handle_control_channel_disconnect(void *opaque, struct libivc_client *client)
+{
+    __PV_HELPER_TRACE__;
+    (void)opaque;
+    (void)client;
+    //Find the PV display provider associated with the given client...
+    struct pv_display_provider *provider = opaque;
+    int rc;
+
+    //... try to reach its Display Handler again...
+    pv_helper_lock(&provider->lock);
+    rc = __schedule_reconnect(provider);
+    pv_helper_unlock(&provider->lock);
+
+    if(!rc)
+    {
+        pv_display_debug("Lost the Display Handler; trying to reconnect.\n");
+        return;
+    }
+
+    //... or, failing that, trigger its fatal error handler.
+    __trigger_fatal_error_on_provider(provider);
 }
 
 
@@ -391,7 +948,8 @@ static void __handle_control_channel_disconnect(void *opaque, struct libivc_clie
  * Attempts to open a control channel to the Display Handler.
  *
  * @param The display provider for which a control channel should be opened.
- *    It's assumed that the provider is already locked.
+ *    It's assumed that the provider is already locked, or that the caller
+ *    otherwise has exclusive use of its control channel.
  */
 static int __open_control_connection(struct pv_display_provider *provider)
 {
@@ -414,14 +972,146 @@ static int __open_control_connection(struct pv_display_provider *provider)
     if(unlikely(rc != SUCCESS))
     {
         libivc_disconnect(provider->control_channel);
+        provider->control_channel = NULL;
         return rc;
     }
 
     //Otherwise, indicate success.
+    pv_helper_startup_mark(&provider->startup, 0, PV_HELPER_STARTUP_CONTROL_CONNECTED);
     return 0;
 }
 
 
+/**
+ * Sends our capabilities to the Display Handler. Assumes the provider is already locked.
+ */
+static int __send_driver_capabilities(struct pv_display_provider *provider)
+{
+    struct dh_driver_capabilities capabilities =
+    {
+        .max_displays = provider->max_displays,
+        .version = PV_DRIVER_INTERFACE_VERSION,
+        .flags = provider->capabilities
+    };
+    int rc;
+
+    rc = __send_packet(provider->control_channel, &provider->stats, PACKET_TYPE_CONTROL_DRIVER_CAPABILITIES,
+                       &capabilities, sizeof(struct dh_driver_capabilities));
+
+    if(!rc)
+        pv_helper_startup_mark(&provider->startup, 0, PV_HELPER_STARTUP_CAPABILITIES);
+
+    return rc;
+}
+
+
+/**
+ * Sends our most recently advertised displays to the Display Handler.
+ * Assumes the provider is already locked.
+ */
+static int __send_advertised_displays(struct pv_display_provider *provider)
+{
+    struct pv_helper_iovec list = { provider->advertised_displays, provider->advertised_displays_size };
+    int rc;
+
+    //We hold the lock, so the list can go straight from our copy into the ring.
+    rc = __send_packetv(provider->control_channel, &provider->stats, PACKET_TYPE_CONTROL_ADVERTISED_DISPLAY_LIST,
+                        &list, 1);
+
+    if(!rc)
+        pv_helper_startup_mark(&provider->startup, 0, PV_HELPER_STARTUP_ADVERTISED_LIST);
+
+    return rc;
+}
+
+
+/**
+ * Attempts to reach the Display Handler again, after losing it (or never reaching it at
+ * all). On failure, tries again later; on success, tells the new Display Handler what
+ * it needs to know to pick up where the old one left off. Runs as background work.
+ *
+ * @param opaque The display provider that should reconnect.
+ */
+static void __reconnect_to_display_handler(void *opaque)
+{
+    struct pv_display_provider *provider = opaque;
+    struct pv_display *display;
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    pv_helper_lock(&provider->lock);
+
+    //If the provider's on its way out, there's no one left to reconnect.
+    if(provider->destroying)
+    {
+        pv_helper_unlock(&provider->lock);
+        return;
+    }
+
+    pv_helper_stats_inc(provider->stats.reconnect_attempts);
+
+    //The new Display Handler knows nothing of the old one's stream, or what it agreed to.
+    //Forget both before reconnecting: the channel's events come back on with it, so the
+    //new stream may start arriving before we take the lock again.
+    provider->negotiated_capabilities = 0;
+    provider->host_version = 0;
+    provider->host_capabilities = 0;
+    provider->current_packet_header.length = 0;
+    memset(&provider->resync, 0, sizeof(provider->resync));
+
+    pv_helper_unlock(&provider->lock);
+
+    //Try to reach the Display Handler, re-using our old control channel if we have one.
+    //We're the only ones who touch the channel while we're reconnecting, so we can leave
+    //the provider unlocked-- in case libivc reports the old channel's disconnect as we go.
+    if(provider->control_channel)
+        rc = libivc_reconnect(provider->control_channel, provider->rx_domain, provider->control_port);
+    else
+        rc = __open_control_connection(provider);
+
+    pv_helper_lock(&provider->lock);
+
+    //If it's not back yet, wait a little longer each time before trying again.
+    //(If we're being destroyed, the destructor will cancel this for us.)
+    if(rc)
+    {
+        ++provider->reconnect_attempts;
+        rc = pv_helper_work_schedule(&provider->reconnect_work, __reconnect_delay_ns(provider));
+        pv_helper_unlock(&provider->lock);
+
+        if(rc)
+            pv_display_error("Could not schedule a reconnect to the Display Handler (%d); giving up.\n", rc);
+
+        return;
+    }
+
+    pv_display_debug("Reconnected to the Display Handler after %u failed attempts.\n",
+                     (unsigned int)provider->reconnect_attempts);
+    pv_helper_stats_inc(provider->stats.reconnects);
+
+    provider->reconnecting       = false;
+    provider->reconnect_attempts = 0;
+
+    //Our displays' connections went with the old Display Handler; we'll bring each
+    //back when the new one asks for it (see __reconnect_pending_display).
+    for(display = provider->displays; display; display = display->next)
+    {
+        display->reconnect_pending = true;
+        display->overlay_port = 0;
+    }
+
+    //Finally, re-send our capabilities and displays, just as the driver did the first time.
+    if(provider->capabilities_advertised && (rc = __send_driver_capabilities(provider)))
+        pv_display_error("Could not re-advertise the driver's capabilities (%d)!\n", rc);
+
+    if(provider->advertised_displays && (rc = __send_advertised_displays(provider)))
+        pv_display_error("Could not re-advertise the driver's displays (%d)!\n", rc);
+
+    pv_helper_unlock(&provider->lock);
+}
+
+
 /******************************************************************************/
 /* PV Display Object Methods                                                  */
 /******************************************************************************/
@@ -472,6 +1162,135 @@ static void *pv_display_get_driver_data(struct pv_display *display)
 }
 
 
+/**
+ * Takes a snapshot of the given display's performance counters.
+ */
+static void pv_display_get_stats(struct pv_display *display, struct pv_helper_stats *stats)
+{
+    pv_helper_stats_snapshot(stats, &display->stats);
+}
+
+
+/**
+ * Takes a snapshot of the given display's startup profile.
+ */
+static void pv_display_get_startup_profile(struct pv_display *display, struct pv_helper_startup_profile *profile)
+{
+    pv_helper_lock(&display->lock);
+    *profile = display->startup;
+    pv_helper_unlock(&display->lock);
+}
+
+
+/**
+ * Starts a display's startup profile afresh, from its provider's current session,
+ * as the display is created or reconnected. Assumes the provider isn't locked.
+ */
+static void __begin_display_startup(struct pv_display_provider *provider, struct pv_display *display)
+{
+    if(provider)
+    {
+        pv_helper_lock(&provider->lock);
+        display->startup = provider->startup;
+        pv_helper_unlock(&provider->lock);
+    }
+    else
+    {
+        pv_helper_startup_begin(&display->startup);
+    }
+
+    display->startup.step_ns[PV_HELPER_STARTUP_ADD_DISPLAY] = 0;
+    pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_ADD_DISPLAY);
+}
+
+
+/**
+ * Compresses a single tile of the display's framebuffer into its slot in the tile
+ * store. Assumes the display is locked, and that the tile is on the display.
+ */
+static void __compress_tile(struct pv_display *display, uint32_t column, uint32_t row)
+{
+    uint32_t x = column * DH_TILE_SIZE;
+    uint32_t y = row * DH_TILE_SIZE;
+    char *slot = (char *)display->tile_store + ((((size_t)row * display->tile_columns) + column) * DH_TILE_SLOT_SIZE);
+    const char *image = (const char *)display->framebuffer + ((size_t)y * display->stride) + (x * sizeof(uint32_t));
+    struct dh_tile_header *header = (struct dh_tile_header *)slot;
+    uint32_t width  = ((display->width - x) < DH_TILE_SIZE) ? (display->width - x) : DH_TILE_SIZE;
+    uint32_t height = ((display->height - y) < DH_TILE_SIZE) ? (display->height - y) : DH_TILE_SIZE;
+    size_t words;
+
+    words = __pv_helper_tile_compress((uint32_t *)(slot + sizeof(*header)), image, display->stride, width, height);
+
+    header->width  = (uint16_t)width;
+    header->height = (uint16_t)height;
+    header->length = (uint32_t)(words * sizeof(uint32_t));
+}
+
+
+/**
+ * Brings every tile touched by the given region up to date, if the display is
+ * keeping compressed tiles. Assumes the display is locked.
+ */
+static void __update_tiles(struct pv_display *display, const struct dh_dirty_rectangle *region)
+{
+    uint64_t right  = (uint64_t)region->x + region->width;
+    uint64_t bottom = (uint64_t)region->y + region->height;
+    uint32_t column, row, last_column, last_row;
+
+    //Commit markers, and anything entirely off the display, touch no tiles.
+    if(!(display->capabilities & DH_CAP_COMPRESSED_TILES) || !display->tile_columns ||
+       !region->width || !region->height)
+        return;
+
+    if((region->x >= display->width) || (region->y >= display->height))
+        return;
+
+    if(right > display->width)
+        right = display->width;
+
+    if(bottom > display->height)
+        bottom = display->height;
+
+    last_column = (uint32_t)((right - 1) / DH_TILE_SIZE);
+    last_row    = (uint32_t)((bottom - 1) / DH_TILE_SIZE);
+
+    for(row = region->y / DH_TILE_SIZE; row <= last_row; ++row)
+        for(column = region->x / DH_TILE_SIZE; column <= last_column; ++column)
+            __compress_tile(display, column, row);
+}
+
+
+/**
+ * Lays out the display's tile store for a new geometry, discarding any tiles from
+ * the old one. If the geometry doesn't fit the store-- or the framebuffer-- no tiles
+ * are kept until it changes again. Assumes the display is locked.
+ */
+static void __reset_tile_store(struct pv_display *display, uint32_t width, uint32_t height, uint32_t stride)
+{
+    uint32_t columns = (width + DH_TILE_SIZE - 1) / DH_TILE_SIZE;
+    uint32_t rows    = (height + DH_TILE_SIZE - 1) / DH_TILE_SIZE;
+    uint32_t tile;
+
+    display->tile_columns = 0;
+    display->tile_rows    = 0;
+
+    if(!display->tile_store)
+        return;
+
+    if(((uint64_t)columns * rows > display->tile_capacity) || (stride < (uint64_t)width * sizeof(uint32_t)) ||
+       ((uint64_t)stride * height > display->framebuffer_size))
+        return;
+
+    //Empty tiles don't decode, so the host will read the framebuffer until we've
+    //compressed each of them.
+    for(tile = 0; tile < columns * rows; ++tile)
+        memset((char *)display->tile_store + ((size_t)tile * DH_TILE_SLOT_SIZE), 0, sizeof(struct dh_tile_header));
+
+    display->tile_columns = columns;
+    display->tile_rows    = rows;
+}
+
+
 /**
  * Changes the internal record of a PV display's resolution, and notifies the
  * Display Handler of the geometry change.
@@ -502,14 +1321,34 @@ static int pv_display_change_resolution(struct pv_display *display, uint32_t wid
     pv_helper_lock(&display->lock);
 
     //Update the display's internal fields...
+    if((display->width != width) || (display->height != height) || (display->stride != stride))
+        __reset_tile_store(display, width, height, stride);
+
     display->width = width;
     display->height = height;
     display->stride = stride;
 
     //... notify the Display Handler...
-    rc = __send_packet(display->event_connection, PACKET_TYPE_EVENT_SET_DISPLAY,
+    rc = __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_SET_DISPLAY,
                        &new_geometry, sizeof(new_geometry));
 
+    if(!rc)
+        pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_SET_DISPLAY);
+
+    //... tell it where to find our compressed tiles, if we're keeping any...
+    if(!rc && display->tile_store && (display->capabilities & DH_CAP_COMPRESSED_TILES))
+    {
+        struct dh_tile_store store =
+        {
+            .offset  = display->tile_store_offset,
+            .columns = display->tile_columns,
+            .rows    = display->tile_rows
+        };
+
+        rc = __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_TILE_STORE,
+                           &store, sizeof(store));
+    }
+
     //... and finally, release our lock on the display.
     pv_helper_unlock(&display->lock);
 
@@ -518,85 +1357,336 @@ static int pv_display_change_resolution(struct pv_display *display, uint32_t wid
 
 
 /**
- * Marks a given region of the shared framebuffer as requiring a redraw ("dirty"),
- * and requests that the host redraw a given region.
- *
- * @param display The PV display whose region is to be invalidated.
- * @param x, y, width, height -- The four bounds of the "dirty rectangle" to be invalidated.
- *
- * @param int 0 on success, or an error code otherwise.
+ * Packs a dirty rectangle into its compact form. Anything that doesn't fit in
+ * 16 bits is clamped; it's well off the display, which the host clips to anyway.
  */
-static int pv_display_invalidate_region(struct pv_display *display, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+static void __compact_dirty_rectangle(struct dh_compact_dirty_rectangle *compact, const struct dh_dirty_rectangle *region)
 {
-    size_t available_space;
-    int rc;
+    compact->x      = (uint16_t)((region->x > 0xFFFF) ? 0xFFFF : region->x);
+    compact->y      = (uint16_t)((region->y > 0xFFFF) ? 0xFFFF : region->y);
+    compact->width  = (uint16_t)((region->width > 0xFFFF) ? 0xFFFF : region->width);
+    compact->height = (uint16_t)((region->height > 0xFFFF) ? 0xFFFF : region->height);
+}
 
-    //Create a "dirty rectangle" data structure that describes the invalidated region...
-    struct dh_dirty_rectangle region =
-    {
-        .x = x,
-        .y = y,
-        .width = width,
-        .height = height
-    };
 
-    //Validate our input.
-    pv_display_checkp(display, -EINVAL);
-    pv_display_checkp(display->dirty_rectangles_connection, -EINVAL);
+/**
+ * @return The size of each dirty rectangle on the display's dirty rectangle connection.
+ */
+static size_t __dirty_rectangle_size(struct pv_display *display)
+{
+    //Rectangles go out in whichever format we negotiated; see Compact Dirty Rectangles.
+    return (display->capabilities & DH_CAP_COMPACT_DIRTY_RECTANGLES) ?
+        sizeof(struct dh_compact_dirty_rectangle) : sizeof(struct dh_dirty_rectangle);
+}
 
-    pv_helper_lock(&display->lock);
 
-    //First, get the amount of available space in the Dirty Rectangles buffer.
-    rc = libivc_getAvailableSpace(display->dirty_rectangles_connection, &available_space);
+/**
+ * Sends a single dirty rectangle (or commit marker) over the display's dirty rectangle
+ * connection, in the negotiated format. Assumes the display is locked, and that the
+ * caller has checked there's room for it.
+ */
+static int __send_dirty_rectangle(struct pv_display *display, struct dh_dirty_rectangle *region)
+{
+    struct dh_compact_dirty_rectangle compact;
 
-    //If we couldn't get the amount of available space, something's gone very wrong.
-    //Trigger our error handler.
-    if(rc)
+    //The host may read the tiles under a rectangle as soon as it arrives.
+    __update_tiles(display, region);
+
+    if(display->capabilities & DH_CAP_COMPACT_DIRTY_RECTANGLES)
     {
-        pv_display_error("Could not query for the amount of space left in the dirty rectangles buffer!");
-        pv_helper_unlock(&display->lock);
-        __trigger_fatal_error_on_display(display);
-        return rc;
+        __compact_dirty_rectangle(&compact, region);
+        return libivc_send(display->dirty_rectangles_connection, (char *)&compact, sizeof(compact));
     }
 
-    //If we can't fit a dirty rectangle, skip this update.
-    //We should automatically recover, as a full update will be scheduled at the end of the queue.
-    //See the condition below.
-    if(available_space < sizeof(struct dh_dirty_rectangle))
+    return libivc_send(display->dirty_rectangles_connection, (char *)region, sizeof(*region));
+}
+
+
+/**
+ * Sends the display's next frame commit marker, if there's room for it.
+ * Assumes the display is locked.
+ */
+static int __send_commit_marker(struct pv_display *display)
+{
+    struct dh_dirty_rectangle marker;
+    size_t available_space;
+    int rc;
+
+    //invalidate_region always leaves room for a marker, so we should only run out
+    //if the driver commits repeatedly without drawing. The next commit covers this one.
+    rc = libivc_getAvailableSpace(display->dirty_rectangles_connection, &available_space);
+    if(!rc && (available_space < __dirty_rectangle_size(display)))
     {
-        pv_helper_unlock(&display->lock);
-        return -EAGAIN;
+        pv_helper_stats_inc(display->stats.ring_full);
+        pv_helper_probe(ring_full, 0, __dirty_rectangle_size(display), available_space);
+        rc = -EAGAIN;
     }
 
-    //If we have enough space to store a dirty rectangle, but not enough space
-    //to store /two/, we're about to overrun. To handle this as gracefully as we can,
-    //we'll queue a full screen refresh.
-    if(available_space < (sizeof(struct dh_dirty_rectangle) * 2))
+    if(!rc)
     {
-        region.x = 0;
-        region.y = 0;
-        region.width  = display->width;
-        region.height = display ->height;
+        marker.x      = DH_FRAME_COMMIT_X(display->frames_committed + 1);
+        marker.y      = DH_FRAME_COMMIT_Y(display->frames_committed + 1);
+        marker.width  = 0;
+        marker.height = 0;
+
+        rc = __send_dirty_rectangle(display, &marker);
     }
 
-    //Send the dirty region over the "dirty rectangles" connection.
-    rc = libivc_send(display->dirty_rectangles_connection, (char *)&region, sizeof(region));
+    if(!rc)
+    {
+        ++display->frames_committed;
+        pv_helper_stats_inc(display->stats.frames_committed);
+    }
 
-    pv_helper_unlock(&display->lock);
     return rc;
 }
 
+
 /**
- * @return True iff the given display currently supports a hardware cursor.
+ * Grows the display's held-back damage to cover the given region.
+ * Assumes the display is locked.
  */
-static int pv_display_supports_cursor(struct pv_display *display)
+static void __hold_damage(struct pv_display *display, struct dh_dirty_rectangle *region)
 {
-    int display_supported;
+    struct dh_dirty_rectangle *held = &display->held_region;
+    uint64_t right, bottom;
 
-    __PV_HELPER_TRACE__;
-    pv_display_checkp(display, -EINVAL);
-
-    //Finally, send the update notification.
+    if(!display->region_held)
+    {
+        *held = *region;
+        display->region_held = true;
+        return;
+    }
+
+    //Take the bounding box of the two, working in 64 bits so the far edges can't wrap.
+    right  = (uint64_t)held->x + held->width;
+    bottom = (uint64_t)held->y + held->height;
+
+    if((uint64_t)region->x + region->width > right)
+        right = (uint64_t)region->x + region->width;
+    if((uint64_t)region->y + region->height > bottom)
+        bottom = (uint64_t)region->y + region->height;
+
+    if(region->x < held->x)
+        held->x = region->x;
+    if(region->y < held->y)
+        held->y = region->y;
+
+    held->width  = (uint32_t)((right - held->x > 0xFFFFFFFF) ? 0xFFFFFFFF : right - held->x);
+    held->height = (uint32_t)((bottom - held->y > 0xFFFFFFFF) ? 0xFFFFFFFF : bottom - held->y);
+
+    pv_helper_stats_inc(display->stats.dirty_rects_coalesced);
+}
+
+
+/**
+ * Sends the display's held-back damage, and then any commit held back behind it,
+ * if we now have the credit and ring space to. Assumes the display is locked.
+ */
+static void __flush_held_damage(struct pv_display *display)
+{
+    size_t available_space;
+    size_t rect_size = __dirty_rectangle_size(display);
+    size_t reserved  = (display->capabilities & DH_CAP_FRAME_COMMIT) ? rect_size : 0;
+
+    if(!display->region_held || !display->credits || !display->dirty_rectangles_connection)
+        return;
+
+    //If there's no room yet, we'll try again on the next invalidate_region.
+    if(libivc_getAvailableSpace(display->dirty_rectangles_connection, &available_space) ||
+       (available_space < rect_size + reserved))
+        return;
+
+    if(__send_dirty_rectangle(display, &display->held_region))
+        return;
+
+    display->region_held = false;
+    --display->credits;
+    ++display->dirty_rects_sent;
+
+    if(display->commit_held)
+    {
+        display->commit_held = false;
+        __send_commit_marker(display);
+    }
+}
+
+
+/**
+ * Marks a given region of the shared framebuffer as requiring a redraw ("dirty"),
+ * and requests that the host redraw a given region.
+ *
+ * @param display The PV display whose region is to be invalidated.
+ * @param x, y, width, height -- The four bounds of the "dirty rectangle" to be invalidated.
+ *
+ * @param int 0 on success, or an error code otherwise.
+ */
+static int pv_display_invalidate_region(struct pv_display *display, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    struct dh_damage_sample sample;
+    size_t available_space;
+    size_t rect_size;
+    size_t reserved;
+    int rc;
+
+    //Create a "dirty rectangle" data structure that describes the invalidated region...
+    struct dh_dirty_rectangle region =
+    {
+        .x = x,
+        .y = y,
+        .width = width,
+        .height = height
+    };
+
+    //Validate our input.
+    pv_display_checkp(display, -EINVAL);
+    pv_display_checkp(display->dirty_rectangles_connection, -EINVAL);
+
+    pv_helper_lock_counted(&display->lock, &display->stats);
+
+    //Once frame commits are in use, a zero-area rectangle would read as a commit marker;
+    //there's nothing to redraw, anyway.
+    if((display->capabilities & DH_CAP_FRAME_COMMIT) && (!width || !height))
+    {
+        pv_helper_unlock(&display->lock);
+        return 0;
+    }
+
+    pv_helper_stats_inc(display->stats.dirty_rects_submitted);
+
+    //If the host has us on credit and we're out (or are already holding damage back,
+    //which must go first), fold this region in with the rest until it grants more.
+    if(display->credits_enabled && (!display->credits || display->region_held))
+    {
+        __hold_damage(display, &region);
+        __flush_held_damage(display);
+        pv_helper_unlock(&display->lock);
+        return 0;
+    }
+
+    //Leave room for the frame's commit marker, if we'll be sending one.
+    rect_size = __dirty_rectangle_size(display);
+    reserved  = (display->capabilities & DH_CAP_FRAME_COMMIT) ? rect_size : 0;
+
+    //First, get the amount of available space in the Dirty Rectangles buffer.
+    rc = libivc_getAvailableSpace(display->dirty_rectangles_connection, &available_space);
+
+    //If we couldn't get the amount of available space, something's gone very wrong.
+    //Trigger our error handler.
+    if(rc)
+    {
+        pv_display_error("Could not query for the amount of space left in the dirty rectangles buffer!");
+        pv_helper_unlock(&display->lock);
+        __trigger_fatal_error_on_display(display);
+        return rc;
+    }
+
+    //If we can't fit a dirty rectangle, skip this update.
+    //We should automatically recover, as a full update will be scheduled at the end of the queue.
+    //See the condition below.
+    if(available_space < rect_size + reserved)
+    {
+        pv_helper_stats_inc(display->stats.ring_full);
+        pv_helper_stats_inc(display->stats.dirty_rects_dropped);
+        pv_helper_probe(ring_full, 0, rect_size, available_space);
+        pv_helper_probe(invalidate_fallback, display->key, 0);
+        pv_helper_unlock(&display->lock);
+        return -EAGAIN;
+    }
+
+    //If we have enough space to store a dirty rectangle, but not enough space
+    //to store /two/, we're about to overrun. To handle this as gracefully as we can,
+    //we'll queue a full screen refresh.
+    if(available_space < (rect_size * 2) + reserved)
+    {
+        pv_helper_stats_inc(display->stats.full_refreshes);
+        pv_helper_probe(invalidate_fallback, display->key, 1);
+        region.x = 0;
+        region.y = 0;
+        region.width  = display->width;
+        region.height = display ->height;
+    }
+
+    //If this rectangle is due to be sampled for latency, note when it was submitted.
+    sample.sequence = display->dirty_rects_sent + 1;
+    sample.timestamp = 0;
+
+    if((display->capabilities & DH_CAP_LATENCY_SAMPLES) && (latency_sample_interval > 0) &&
+       ((sample.sequence % (uint32_t)latency_sample_interval) == 0))
+        sample.timestamp = pv_helper_timestamp();
+
+    //Send the dirty region over the "dirty rectangles" connection.
+    rc = __send_dirty_rectangle(display, &region);
+
+    //Once the rectangle is on its way, tell the host when it was submitted. A sample
+    //that can't be sent is simply skipped; the host will wait for the next one.
+    if(!rc)
+    {
+        display->dirty_rects_sent = sample.sequence;
+
+        if(display->credits_enabled)
+            --display->credits;
+
+        if(sample.timestamp)
+            __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_DAMAGE_SAMPLE,
+                          &sample, sizeof(sample));
+    }
+
+    pv_helper_unlock(&display->lock);
+    return rc;
+}
+
+/**
+ * Tells the host that the frame whose damage has been submitted via invalidate_region
+ * is complete, and can be presented; see Frame Commits in pv_driver_interface.h.
+ * If the host didn't agree to frame commits, it presents as damage arrives, and this
+ * does nothing.
+ *
+ * @param display The PV display whose frame is complete.
+ *
+ * @return 0 on success, or an error code otherwise.
+ */
+static int pv_display_commit_frame(struct pv_display *display)
+{
+    int rc;
+
+    pv_display_checkp(display, -EINVAL);
+    pv_display_checkp(display->dirty_rectangles_connection, -EINVAL);
+
+    pv_helper_lock_counted(&display->lock, &display->stats);
+
+    if(!(display->capabilities & DH_CAP_FRAME_COMMIT))
+    {
+        pv_helper_unlock(&display->lock);
+        return 0;
+    }
+
+    //If some of this frame's damage is still held back for want of credits, the
+    //commit has to follow it; __flush_held_damage will send it once it can.
+    if(display->region_held)
+    {
+        display->commit_held = true;
+        pv_helper_unlock(&display->lock);
+        return 0;
+    }
+
+    rc = __send_commit_marker(display);
+
+    pv_helper_unlock(&display->lock);
+    return rc;
+}
+
+/**
+ * @return True iff the given display currently supports a hardware cursor.
+ */
+static int pv_display_supports_cursor(struct pv_display *display)
+{
+    int display_supported;
+
+    __PV_HELPER_TRACE__;
+    pv_display_checkp(display, -EINVAL);
+
+    //Finally, send the update notification.
     pv_helper_lock(&display->lock);
     display_supported = (display->cursor.image != NULL);
     pv_helper_unlock(&display->lock);
@@ -622,15 +1712,16 @@ _IRQL_requires_same_
 #endif
 static int __send_cursor_update_unsynchronized(struct pv_display *display)
 {
-    //Build the notification packet...
+    //Build the notification packet, scaling the hot spot down along with
+    //the image if it had to be shrunk to fit the cursor buffer...
     struct dh_update_cursor payload = {
-      .xhot = display->cursor.hotspot_x,
-      .yhot = display->cursor.hotspot_y,
+      .xhot = display->cursor.hotspot_x >> display->cursor.scale_shift,
+      .yhot = display->cursor.hotspot_y >> display->cursor.scale_shift,
       .show = display->cursor.visible
     };
 
     //... and send it to the display handler.
-    return  __send_packet(display->event_connection, PACKET_TYPE_EVENT_UPDATE_CURSOR, &payload, sizeof(payload));
+    return  __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_UPDATE_CURSOR, &payload, sizeof(payload));
 }
 
 
@@ -654,14 +1745,16 @@ static int pv_display_set_cursor_hotspot(struct pv_display *display,
     pv_display_checkp(display->cursor.image, -EINVAL);
     pv_display_checkp(display->cursor_image_connection, -EINVAL);
 
-    //... ensure that the cursor itself is valid...
-    if(hotspot_x > PV_DRIVER_CURSOR_WIDTH)
-      return -EINVAL;
-    if(hotspot_y > PV_DRIVER_CURSOR_HEIGHT)
-      return -EINVAL;
+    pv_helper_lock_counted(&display->lock, &display->stats);
+
+    //... ensure that the hotspot lies within the cursor size we negotiated...
+    if((hotspot_x > display->cursor.size) || (hotspot_y > display->cursor.size))
+    {
+        pv_helper_unlock(&display->lock);
+        return -EINVAL;
+    }
 
     //... update the cursor information...
-    pv_helper_lock(&display->lock);
     display->cursor.hotspot_x = hotspot_x;
     display->cursor.hotspot_y = hotspot_y;
 
@@ -691,7 +1784,7 @@ static int pv_display_set_cursor_visibility(struct pv_display *display,
     pv_display_checkp(display->cursor_image_connection, -EINVAL);
 
     //... update the cursor information...
-    pv_helper_lock(&display->lock);
+    pv_helper_lock_counted(&display->lock, &display->stats);
     display->cursor.visible = (visible != 0);
 
     //... and notify the display handler of the change.
@@ -721,7 +1814,7 @@ static int __send_cursor_movement_unsynchronized(struct pv_display *display, uin
     };
 
     //... and send it to the display handler.
-    return __send_packet(display->event_connection, PACKET_TYPE_EVENT_MOVE_CURSOR, &payload, sizeof(payload));
+    return __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_MOVE_CURSOR, &payload, sizeof(payload));
 }
 
 
@@ -745,22 +1838,30 @@ static int pv_display_move_cursor(struct pv_display *display, uint32_t x, uint32
     pv_display_checkp(display->cursor_image_connection, -EINVAL);
 
     //Finally, send the update notification.
-    pv_helper_lock(&display->lock);
+    pv_helper_lock_counted(&display->lock, &display->stats);
     rc = __send_cursor_movement_unsynchronized(display, x, y);
     pv_helper_unlock(&display->lock);
 
     return rc;
 }
+
+
+/**
+ * Copies an ARGB8888 image which fits within the display's cursor buffer
+ * into that buffer, padding it out with transparent pixels.
+ *
+ * Assumes that the caller already holds the display's lock.
+ */
 #if defined _WIN32
 _IRQL_requires_same_
 #endif
-static void copy_image(struct pv_display * display, char * source, uint8_t source_height,
+static void copy_image(struct pv_display * display, const char * source, uint32_t source_height,
     size_t source_stride, size_t stride_difference,
     char * destination, size_t destination_stride)
 {
-    int y;
+    uint32_t y;
     //Iterate over each row in the given image...
-    for(y = 0; y < PV_DRIVER_CURSOR_HEIGHT; ++y)
+    for(y = 0; y < display->cursor.size; ++y)
     {
 
         //If we've run out of source image...
@@ -785,9 +1886,111 @@ static void copy_image(struct pv_display * display, char * source, uint8_t sourc
         source += source_stride;
         destination += destination_stride;
     }
+}
+
+
+/**
+ * Computes the power-of-two factor (as a shift) by which an image of the given
+ * size must be shrunk to fit the display's cursor buffer; 0 if it already fits.
+ */
+static uint32_t __cursor_scale_shift(struct pv_display *display, uint32_t width, uint32_t height)
+{
+    uint32_t shift = 0;
+
+    while((((width + (1U << shift) - 1) >> shift) > display->cursor.size) ||
+          (((height + (1U << shift) - 1) >> shift) > display->cursor.size))
+        ++shift;
+
+    return shift;
+}
+
+
+/**
+ * Shrinks an ARGB8888 image by a power of two into the display's cursor buffer.
+ * Each destination pixel is a box filter over its source block, with colors
+ * weighted by alpha so that transparent pixels don't darken the cursor's edges.
+ * Source pixels past the image's bounds count as transparent.
+ *
+ * Assumes that the caller already holds the display's lock.
+ *
+ * @param display The display whose cursor buffer is to be populated.
+ * @param source The ARGB8888 image to be shrunk.
+ * @param source_stride The length of a single source row, in bytes.
+ * @param source_width, source_height The size of the source image.
+ * @param shift The scale factor, as a power of two (see __cursor_scale_shift).
+ */
+#if defined _WIN32
+_IRQL_requires_same_
+#endif
+static void __downscale_cursor_image(struct pv_display *display, const char *source,
+    size_t source_stride, uint32_t source_width, uint32_t source_height, uint32_t shift)
+{
+    const uint32_t samples = 1U << (shift * 2);
+    uint32_t *destination = (uint32_t *)display->cursor.image;
+    uint32_t x, y, source_x, source_y;
+
+    for(y = 0; y < display->cursor.size; ++y)
+    {
+        for(x = 0; x < display->cursor.size; ++x)
+        {
+            uint32_t alpha = 0, red = 0, green = 0, blue = 0;
+
+            //Accumulate each of the source pixels that fall within this block...
+            for(source_y = y << shift; (source_y < ((y + 1) << shift)) && (source_y < source_height); ++source_y)
+            {
+                const uint32_t *row = (const uint32_t *)(source + source_y * source_stride);
+
+                for(source_x = x << shift; (source_x < ((x + 1) << shift)) && (source_x < source_width); ++source_x)
+                {
+                    const uint32_t pixel = row[source_x];
+                    const uint32_t pixel_alpha = pixel >> 24;
+
+                    alpha += pixel_alpha;
+                    red   += ((pixel >> 16) & 0xFF) * pixel_alpha;
+                    green += ((pixel >> 8) & 0xFF) * pixel_alpha;
+                    blue  += (pixel & 0xFF) * pixel_alpha;
+                }
+            }
+
+            //... and write out their average.
+            if(alpha)
+                destination[x] = ((alpha / samples) << 24) | ((red / alpha) << 16) | ((green / alpha) << 8) | (blue / alpha);
+            else
+                destination[x] = 0;
+        }
+
+        destination += display->cursor.size;
+    }
+}
+
+
+/**
+ * Loads an ARGB8888 image into the display's cursor buffer, shrinking it if it
+ * is larger than the negotiated cursor size, and notifies the display handler.
+ *
+ * Assumes that the caller already holds the display's lock, and that the
+ * display has a cursor buffer.
+ */
+#if defined _WIN32
+_IRQL_requires_same_
+#endif
+static int __load_cursor_image_unsynchronized(struct pv_display *display, const char *source,
+    size_t source_stride, uint32_t source_width, uint32_t source_height)
+{
+    size_t destination_stride = pixels_to_bytes(display->cursor.size);
+
+    //Figure out how much the image needs to be shrunk to fit...
+    display->cursor.scale_shift = __cursor_scale_shift(display, source_width, source_height);
+
+    //... and copy it in, shrinking it if need be.
+    if(display->cursor.scale_shift)
+        __downscale_cursor_image(display, source, source_stride, source_width, source_height, display->cursor.scale_shift);
+    else
+        copy_image(display, source, source_height, pixels_to_bytes(source_width),
+            destination_stride - pixels_to_bytes(source_width), (char *)display->cursor.image, destination_stride);
 
     //Finally, notify the display handler of the new image.
-    __send_cursor_update_unsynchronized(display);
+    return __send_cursor_update_unsynchronized(display);
 }
 
 /**
@@ -796,52 +1999,41 @@ static void copy_image(struct pv_display * display, char * source, uint8_t sourc
  *
  * @param display The display for which the cursor image is to be populated.
  * @param image A pointer to an ARGB8888 image to be loaded.
- * @param width The width (max 64) of the image to be loaded.
- * @param height The height (max 64) of the image to be loaded.
+ * @param width The width (max 256) of the image to be loaded.
+ * @param height The height (max 256) of the image to be loaded.
  */
 #if defined _WIN32
 _IRQL_requires_same_
 #endif
 static int pv_display_load_cursor_image(struct pv_display *display,
-    void *image, uint8_t source_width, uint8_t source_height)
+    void *image, uint32_t source_width, uint32_t source_height)
 {
-    size_t source_stride, destination_stride, stride_difference;
-    char *source, *destination;
     int rc = SUCCESS;
 
-    if((source_width > PV_DRIVER_CURSOR_WIDTH) ||
-       (source_height > PV_DRIVER_CURSOR_HEIGHT)) {
+    pv_display_checkp(display, -EINVAL);
+
+    if((source_width > PV_DRIVER_MAX_CURSOR_WIDTH) ||
+       (source_height > PV_DRIVER_MAX_CURSOR_HEIGHT)) {
 
         pv_display_error("PV cursor image is larger than %dx%d! Rejecting.",
-            PV_DRIVER_CURSOR_WIDTH, PV_DRIVER_CURSOR_HEIGHT);
+            PV_DRIVER_MAX_CURSOR_WIDTH, PV_DRIVER_MAX_CURSOR_HEIGHT);
         return -EINVAL;
     }
 
-    //Compute the source and destination strides...
-    source_stride = pixels_to_bytes(source_width);
-    destination_stride = pixels_to_bytes(PV_DRIVER_CURSOR_WIDTH);
-
-    //... and the difference between them, which will need to be filled
-    //in with transparent pixels.
-    stride_difference = destination_stride - source_stride;
-
     //Get a reference to the source image...
-    source = (char *)image;
-    pv_display_checkp(source, -EINVAL);
-
-    pv_helper_lock(&display->lock);
+    pv_display_checkp(image, -EINVAL);
 
-    //... and get a reference to its destination.
-    destination = (char *)display->cursor.image;
+    pv_helper_lock_counted(&display->lock, &display->stats);
 
     //If we weren't able to get the PV cursor image,
     //we must not have cursor support. Abort!
-    if(!destination) {
+    if(!display->cursor.image) {
         rc = -EINVAL;
     }
     else
     {
-        copy_image(display, source, source_height, source_stride, stride_difference, destination, destination_stride);
+        rc = __load_cursor_image_unsynchronized(display, (const char *)image,
+            pixels_to_bytes(source_width), source_width, source_height);
     }
 
     pv_helper_unlock(&display->lock);
@@ -849,62 +2041,428 @@ static int pv_display_load_cursor_image(struct pv_display *display,
     return rc;
 }
 
+
 /**
- * Re-establishes all display connections for the active display.
- *
- * This can be used to reconnect to the Display Handler in the event
- * that the display handler is killed. In this case, the normal
- * handshaking process should be followed, but instead of creating
- * a new display, the PV driver should call reconnect() on the
- * extisting display.
- *
- * @param display The display to be reconnected.
- * @param request The display handler "add_display" request
- *    that triggered the display reconnection.
- * @param rx_domain The display domain to reconnect to.
+ * ARGB values used when expanding a monochrome (AND/XOR) cursor, indexed by
+ * (AND bit << 1) | XOR bit. ARGB has no way to express "invert the screen
+ * underneath", so inverted pixels are approximated as opaque black.
  */
-static int pv_display_reconnect(struct pv_display *display,
-    struct dh_add_display *request, domid_t rx_domain)
+static const uint32_t mono_cursor_palette[4] =
 {
-    int rc;
+    0xFF000000, //AND 0, XOR 0: black
+    0xFFFFFFFF, //AND 0, XOR 1: white
+    0x00000000, //AND 1, XOR 0: transparent
+    0xFF000000  //AND 1, XOR 1: inverted
+};
 
-    __PV_HELPER_TRACE__;
+//Looks up the ARGB value for bit 'bit' (MSB first) of a pair of mask bytes.
+#define MONO_CURSOR_PIXEL(and_byte, xor_byte, bit) \
+    mono_cursor_palette[((((and_byte) >> (7 - (bit))) & 1) << 1) | (((xor_byte) >> (7 - (bit))) & 1)]
 
-    pv_display_checkp(display, -EINVAL);
-    pv_display_checkp(request, -EINVAL);
 
-    //First, ensure that we have a existing framebuffer and
-    //event connection to reconnect to-- if we didn't, the
-    //display state is invalid, and we can't reconnect.
-    if(!display->framebuffer_connection || !display->event_connection)
-        return -EINVAL;
+/**
+ * Expands a single row of a 1bpp AND/XOR cursor into ARGB8888 pixels.
+ * Whole mask bytes are expanded eight pixels at a time, without branches,
+ * which keeps the inner loop friendly to the compiler's vectorizer.
+ *
+ * @param destination The ARGB row to be populated.
+ * @param and_row The row's AND mask, MSB first.
+ * @param xor_row The row's XOR mask, MSB first.
+ * @param width The number of pixels to be expanded.
+ */
+static void __expand_mono_cursor_row(uint32_t *destination, const uint8_t *and_row,
+    const uint8_t *xor_row, uint32_t width)
+{
+    uint32_t x, bit;
 
-    //Ensure that we've been provided a valid port for the /required/
-    //connections-- we need at least a framebuffer and event connection.
-    if((request->framebuffer_port == 0) || (request->event_port == 0))
-        return -EINVAL;
+    //Expand a full mask byte at a time...
+    for(x = 0; x + 8 <= width; x += 8)
+    {
+        const uint8_t a = and_row[x >> 3];
+        const uint8_t b = xor_row[x >> 3];
+
+        destination[x + 0] = MONO_CURSOR_PIXEL(a, b, 0);
+        destination[x + 1] = MONO_CURSOR_PIXEL(a, b, 1);
+        destination[x + 2] = MONO_CURSOR_PIXEL(a, b, 2);
+        destination[x + 3] = MONO_CURSOR_PIXEL(a, b, 3);
+        destination[x + 4] = MONO_CURSOR_PIXEL(a, b, 4);
+        destination[x + 5] = MONO_CURSOR_PIXEL(a, b, 5);
+        destination[x + 6] = MONO_CURSOR_PIXEL(a, b, 6);
+        destination[x + 7] = MONO_CURSOR_PIXEL(a, b, 7);
+    }
 
-    //Reconnect to our framebuffer...
-    rc = libivc_reconnect(display->framebuffer_connection, rx_domain,
-        (uint16_t)request->framebuffer_port);
-    if(rc)
-      return -ENXIO;
+    //... and then handle any partial byte at the end of the row.
+    for(bit = 0; x < width; ++x, ++bit)
+        destination[x] = MONO_CURSOR_PIXEL(and_row[x >> 3], xor_row[x >> 3], bit);
+}
 
-    //... and our event connection.
-    rc = libivc_reconnect(display->event_connection, rx_domain,
-        (uint16_t)request->event_port);
-    if(rc)
-      return -ENXIO;
 
+/**
+ * Expands a single row of a 32bpp cursor with a separate 1bpp AND mask into
+ * ARGB8888 pixels. Pixels with a clear AND bit are drawn opaque; pixels with
+ * a set AND bit are transparent, unless their color is non-zero (an inverting
+ * pixel), in which case the color is drawn opaque as an approximation.
+ *
+ * @param destination The ARGB row to be populated.
+ * @param source The row's XRGB8888 color data.
+ * @param and_row The row's AND mask, MSB first.
+ * @param width The number of pixels to be expanded.
+ */
+static void __expand_masked_cursor_row(uint32_t *destination, const uint32_t *source,
+    const uint8_t *and_row, uint32_t width)
+{
+    uint32_t x;
 
-    //If we had a dirty rectangles connection, and we have a valid
-    //new connection target, reconnect our dirty rectangles connection.
+    for(x = 0; x < width; ++x)
+    {
+        const uint32_t color = source[x] & 0x00FFFFFF;
+        const uint32_t masked = (and_row[x >> 3] >> (7 - (x & 7))) & 1;
+
+        //Build an all-ones mask for opaque pixels, and an all-zeroes mask
+        //for transparent ones, and apply it to the opaque form of the color.
+        const uint32_t opaque = (uint32_t)0 - (uint32_t)(!masked | (color != 0));
+        destination[x] = (color | 0xFF000000) & opaque;
+    }
+}
+
+
+#ifdef PV_HELPER_CURSOR_SSE2
+
+/**
+ * Expands a single row of a 1bpp AND/XOR cursor into ARGB8888 pixels, as
+ * __expand_mono_cursor_row does, eight pixels (one mask byte) at a time.
+ */
+static void __expand_mono_cursor_row_sse2(uint32_t *destination, const uint8_t *and_row,
+    const uint8_t *xor_row, uint32_t width)
+{
+    //Each lane tests one bit of a mask byte, MSB (the leftmost pixel) first.
+    const __m128i high_bits = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i low_bits  = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+    const __m128i alpha     = _mm_set1_epi32((int)0xFF000000);
+    const __m128i rgb       = _mm_set1_epi32(0x00FFFFFF);
+    uint32_t x;
+
+    for(x = 0; x + 8 <= width; x += 8)
+    {
+        const __m128i a = _mm_set1_epi32(and_row[x >> 3]);
+        const __m128i b = _mm_set1_epi32(xor_row[x >> 3]);
+        int half;
+
+        for(half = 0; half < 2; ++half)
+        {
+            const __m128i bits    = half ? low_bits : high_bits;
+            const __m128i and_set = _mm_cmpeq_epi32(_mm_and_si128(a, bits), bits);
+            const __m128i xor_set = _mm_cmpeq_epi32(_mm_and_si128(b, bits), bits);
+
+            //Every pixel but a transparent one (AND set, XOR clear) is opaque; only
+            //white ones (AND clear, XOR set) have any color. See mono_cursor_palette.
+            const __m128i opaque = _mm_andnot_si128(_mm_andnot_si128(xor_set, and_set), alpha);
+            const __m128i white  = _mm_andnot_si128(and_set, _mm_and_si128(xor_set, rgb));
+
+            _mm_storeu_si128((__m128i *)(destination + x + (half * 4)), _mm_or_si128(opaque, white));
+        }
+    }
+
+    //Leave any partial byte at the end of the row to the scalar loop.
+    if(x < width)
+        __expand_mono_cursor_row(destination + x, and_row + (x >> 3), xor_row + (x >> 3), width - x);
+}
+
+
+/**
+ * Expands a single row of a masked-color cursor into ARGB8888 pixels, as
+ * __expand_masked_cursor_row does, eight pixels (one mask byte) at a time.
+ */
+static void __expand_masked_cursor_row_sse2(uint32_t *destination, const uint32_t *source,
+    const uint8_t *and_row, uint32_t width)
+{
+    const __m128i high_bits = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i low_bits  = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+    const __m128i alpha     = _mm_set1_epi32((int)0xFF000000);
+    const __m128i rgb       = _mm_set1_epi32(0x00FFFFFF);
+    const __m128i zero      = _mm_setzero_si128();
+    uint32_t x;
+
+    for(x = 0; x + 8 <= width; x += 8)
+    {
+        const __m128i a = _mm_set1_epi32(and_row[x >> 3]);
+        int half;
+
+        for(half = 0; half < 2; ++half)
+        {
+            const __m128i bits   = half ? low_bits : high_bits;
+            const __m128i masked = _mm_cmpeq_epi32(_mm_and_si128(a, bits), bits);
+            const __m128i color  = _mm_and_si128(_mm_loadu_si128((const __m128i *)(source + x + (half * 4))), rgb);
+
+            //Only masked, black pixels are transparent.
+            const __m128i clear  = _mm_and_si128(masked, _mm_cmpeq_epi32(color, zero));
+
+            _mm_storeu_si128((__m128i *)(destination + x + (half * 4)),
+                _mm_andnot_si128(clear, _mm_or_si128(color, alpha)));
+        }
+    }
+
+    if(x < width)
+        __expand_masked_cursor_row(destination + x, source + x, and_row + (x >> 3), width - x);
+}
+
+#endif
+
+
+/**
+ * Expands a monochrome or masked-color cursor into an ARGB8888 image,
+ * padding it out to the destination's size with transparent pixels.
+ *
+ * @param destination The ARGB image to be populated.
+ * @param destination_width, destination_height The destination's size; its stride is its width.
+ * @param color The cursor's XRGB8888 color data, or NULL for a monochrome cursor.
+ * @param color_pitch The length of a single row of color data, in bytes.
+ * @param and_mask The cursor's AND mask.
+ * @param xor_mask The cursor's XOR mask; unused for masked-color cursors.
+ * @param mask_pitch The length of a single mask row, in bytes.
+ * @param source_width, source_height The size of the source cursor.
+ */
+static void __expand_cursor_image(uint32_t *destination, uint32_t destination_width, uint32_t destination_height,
+    const char *color, uint32_t color_pitch, const uint8_t *and_mask, const uint8_t *xor_mask,
+    uint32_t mask_pitch, uint32_t source_width, uint32_t source_height)
+{
+    size_t destination_stride = pixels_to_bytes(destination_width);
+    uint32_t y;
+
+    for(y = 0; y < destination_height; ++y)
+    {
+        //Rows past the end of the source image are fully transparent...
+        if(y >= source_height)
+        {
+            memset(destination, 0, destination_stride);
+        }
+        //... while the rest are expanded, and padded out with transparent pixels.
+        else
+        {
+            if(color)
+            {
+#ifdef PV_HELPER_CURSOR_SSE2
+                __expand_masked_cursor_row_sse2(destination, (const uint32_t *)color, and_mask, source_width);
+#else
+                __expand_masked_cursor_row(destination, (const uint32_t *)color, and_mask, source_width);
+#endif
+                color += color_pitch;
+            }
+            else
+            {
+#ifdef PV_HELPER_CURSOR_SSE2
+                __expand_mono_cursor_row_sse2(destination, and_mask, xor_mask, source_width);
+#else
+                __expand_mono_cursor_row(destination, and_mask, xor_mask, source_width);
+#endif
+                xor_mask += mask_pitch;
+            }
+
+            memset(destination + source_width, 0, destination_stride - pixels_to_bytes(source_width));
+            and_mask += mask_pitch;
+        }
+
+        destination += destination_width;
+    }
+}
+
+
+/**
+ * Loads a monochrome or masked-color cursor into the display's cursor buffer,
+ * expanding it directly into the buffer when it fits, or via a temporary
+ * ARGB image and the downscaler when it doesn't.
+ *
+ * See __expand_cursor_image for a description of the parameters.
+ */
+#if defined _WIN32
+_IRQL_requires_same_
+#endif
+static int __load_converted_cursor_image(struct pv_display *display, const char *color, uint32_t color_pitch,
+    const uint8_t *and_mask, const uint8_t *xor_mask, uint32_t mask_pitch,
+    uint32_t source_width, uint32_t source_height)
+{
+    uint32_t *converted;
+    int rc;
+
+    if((source_width > PV_DRIVER_MAX_CURSOR_WIDTH) ||
+       (source_height > PV_DRIVER_MAX_CURSOR_HEIGHT) ||
+       (color && (color_pitch < pixels_to_bytes(source_width))) ||
+       (mask_pitch < (source_width + 7) / 8)) {
+
+        pv_display_error("PV cursor image is larger than %dx%d, or has a bad pitch! Rejecting.",
+            PV_DRIVER_MAX_CURSOR_WIDTH, PV_DRIVER_MAX_CURSOR_HEIGHT);
+        return -EINVAL;
+    }
+
+    pv_helper_lock_counted(&display->lock, &display->stats);
+
+    //If we don't have a PV cursor image, we don't have cursor support.
+    if(!display->cursor.image)
+    {
+        rc = -EINVAL;
+    }
+
+    //If the image fits, expand it straight into the shared cursor buffer...
+    else if(!__cursor_scale_shift(display, source_width, source_height))
+    {
+        display->cursor.scale_shift = 0;
+        __expand_cursor_image((uint32_t *)display->cursor.image, display->cursor.size, display->cursor.size,
+            color, color_pitch, and_mask, xor_mask, mask_pitch, source_width, source_height);
+        rc = __send_cursor_update_unsynchronized(display);
+    }
+
+    //... otherwise, expand it to full size, and let the downscaler shrink it.
+    else
+    {
+        converted = pv_helper_malloc_uninit(pixels_to_bytes(source_width * source_height));
+
+        if(!converted)
+        {
+            rc = -ENOMEM;
+        }
+        else
+        {
+            __expand_cursor_image(converted, source_width, source_height,
+                color, color_pitch, and_mask, xor_mask, mask_pitch, source_width, source_height);
+            rc = __load_cursor_image_unsynchronized(display, (const char *)converted,
+                pixels_to_bytes(source_width), source_width, source_height);
+            pv_helper_free(converted);
+        }
+    }
+
+    pv_helper_unlock(&display->lock);
+
+    return rc;
+}
+
+
+/**
+ * Loads a monochrome (1bpp AND/XOR) cursor into the PV display's cursor buffer,
+ * converting it to ARGB8888 along the way.
+ *
+ * @param display The display for which the cursor image is to be populated.
+ * @param and_mask The cursor's AND mask, one bit per pixel, MSB first.
+ * @param xor_mask The cursor's XOR mask, in the same format as the AND mask.
+ * @param mask_pitch The length of a single mask row, in bytes.
+ * @param source_width The width (max 256) of the image to be loaded.
+ * @param source_height The height (max 256) of the image to be loaded.
+ */
+static int pv_display_load_cursor_image_mono(struct pv_display *display,
+    void *and_mask, void *xor_mask, uint32_t mask_pitch,
+    uint32_t source_width, uint32_t source_height)
+{
+    pv_display_checkp(display, -EINVAL);
+    pv_display_checkp(and_mask, -EINVAL);
+    pv_display_checkp(xor_mask, -EINVAL);
+
+    return __load_converted_cursor_image(display, NULL, 0, (const uint8_t *)and_mask,
+        (const uint8_t *)xor_mask, mask_pitch, source_width, source_height);
+}
+
+
+/**
+ * Loads a 32bpp cursor with a separate 1bpp AND mask (a "masked color" cursor)
+ * into the PV display's cursor buffer, converting it to ARGB8888 along the way.
+ *
+ * @param display The display for which the cursor image is to be populated.
+ * @param image The cursor's XRGB8888 color data.
+ * @param image_pitch The length of a single color row, in bytes.
+ * @param and_mask The cursor's AND mask, one bit per pixel, MSB first.
+ * @param mask_pitch The length of a single mask row, in bytes.
+ * @param source_width The width (max 256) of the image to be loaded.
+ * @param source_height The height (max 256) of the image to be loaded.
+ */
+static int pv_display_load_cursor_image_masked(struct pv_display *display,
+    void *image, uint32_t image_pitch, void *and_mask, uint32_t mask_pitch,
+    uint32_t source_width, uint32_t source_height)
+{
+    pv_display_checkp(display, -EINVAL);
+    pv_display_checkp(image, -EINVAL);
+    pv_display_checkp(and_mask, -EINVAL);
+
+    return __load_converted_cursor_image(display, (const char *)image, image_pitch,
+        (const uint8_t *)and_mask, NULL, mask_pitch, source_width, source_height);
+}
+
+/**
+ * Re-establishes all display connections for the active display.
+ *
+ * This can be used to reconnect to the Display Handler in the event
+ * that the display handler is killed. In this case, the normal
+ * handshaking process should be followed, but instead of creating
+ * a new display, the PV driver should call reconnect() on the
+ * extisting display.
+ *
+ * @param display The display to be reconnected.
+ * @param request The display handler "add_display" request
+ *    that triggered the display reconnection.
+ * @param rx_domain The display domain to reconnect to.
+ * @param flags PV_DISPLAY_RECONNECT_* flags controlling the reconnect.
+ */
+static int pv_display_reconnect_with_flags(struct pv_display *display,
+    struct dh_add_display *request, domid_t rx_domain, uint32_t flags)
+{
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    pv_display_checkp(display, -EINVAL);
+    pv_display_checkp(request, -EINVAL);
+
+    //First, ensure that we have a existing framebuffer and
+    //event connection to reconnect to-- if we didn't, the
+    //display state is invalid, and we can't reconnect.
+    if(!display->framebuffer_connection || !display->event_connection)
+        return -EINVAL;
+
+    //Ensure that we've been provided a valid port for the /required/
+    //connections-- we need at least a framebuffer and event connection.
+    if((request->framebuffer_port == 0) || (request->event_port == 0))
+        return -EINVAL;
+
+    //The new dirty rectangles connection starts counting from zero, and without credit
+    //limits; anything held back is covered by the new host's first full redraw...
+    pv_helper_lock_counted(&display->lock, &display->stats);
+    display->dirty_rects_sent = 0;
+    display->credits_enabled  = false;
+    display->credits          = 0;
+    display->region_held      = false;
+    display->commit_held      = false;
+    pv_helper_unlock(&display->lock);
+
+    //... and bringing the display back up is timed just like bringing it up the first time.
+    __begin_display_startup(display->provider, display);
+
+    //Reconnect to our framebuffer...
+    rc = libivc_reconnect(display->framebuffer_connection, rx_domain,
+        (uint16_t)request->framebuffer_port);
+    if(rc) {
+      pv_helper_probe(reconnect, display->key, -ENXIO);
+      return -ENXIO;
+    }
+    pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_FRAMEBUFFER_CONNECTED);
+
+    //... and our event connection.
+    rc = libivc_reconnect(display->event_connection, rx_domain,
+        (uint16_t)request->event_port);
+    if(rc) {
+      pv_helper_probe(reconnect, display->key, -ENXIO);
+      return -ENXIO;
+    }
+    pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_EVENT_CONNECTED);
+
+
+    //If we had a dirty rectangles connection, and we have a valid
+    //new connection target, reconnect our dirty rectangles connection.
     if(request->dirty_rectangles_port && display->dirty_rectangles_connection) {
         rc = libivc_reconnect(display->dirty_rectangles_connection, rx_domain,
             (uint16_t)request->dirty_rectangles_port);
 
-        if(rc)
+        if(rc) {
           pv_display_error("Warning: could not reconnect to dirty rectangles port!\n");
+        } else {
+          pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_DIRTY_RECTANGLES_CONNECTED);
+        }
     }
 
     //And do the same for our cursor bitmap port.
@@ -912,14 +2470,64 @@ static int pv_display_reconnect(struct pv_display *display,
         rc = libivc_reconnect(display->cursor_image_connection, rx_domain,
             (uint16_t)request->cursor_bitmap_port);
 
-        if(rc)
+        if(rc) {
           pv_display_error("Warning: could not reconnect to PV cursor port!\n");
+        } else {
+          pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_CURSOR_IMAGE_CONNECTED);
+        }
+    }
+
+    //Our framebuffer connection re-shares the same pages, so their contents are still
+    //good. If asked, bring the new Display Handler up to date: send it our geometry,
+    //then tell it it can show the framebuffer as-is-- or, if it can't take our word
+    //for that, that the whole framebuffer needs drawing.
+    if(flags & PV_DISPLAY_RECONNECT_PRESERVE)
+    {
+        rc = pv_display_change_resolution(display, display->width, display->height, display->stride);
+
+        if(!rc && (display->capabilities & DH_CAP_FRAMEBUFFER_PRESERVE))
+        {
+            struct dh_framebuffer_preserved preserved =
+            {
+                .width  = display->width,
+                .height = display->height,
+                .stride = display->stride
+            };
+
+            pv_helper_lock(&display->lock);
+            rc = __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_FRAMEBUFFER_PRESERVED,
+                               &preserved, sizeof(preserved));
+            pv_helper_unlock(&display->lock);
+        }
+        else if(!rc && display->dirty_rectangles_connection)
+        {
+            rc = pv_display_invalidate_region(display, 0, 0, display->width, display->height);
+        }
+
+        if(rc)
+        {
+            pv_helper_probe(reconnect, display->key, rc);
+            return rc;
+        }
     }
 
+    pv_helper_probe(reconnect, display->key, 0);
     return 0;
 }
 
 
+/**
+ * Re-establishes all display connections for the active display,
+ * leaving the Display Handler to be brought up to date by the driver.
+ * See pv_display_reconnect_with_flags.
+ */
+static int pv_display_reconnect(struct pv_display *display,
+    struct dh_add_display *request, domid_t rx_domain)
+{
+    return pv_display_reconnect_with_flags(display, request, rx_domain, 0);
+}
+
+
 /**
  * Tells the display handler that the display contents are no longer valid, and should be handled
  * appropriately, most likely by rendering an all black alternative buffer. It could potentially
@@ -948,7 +2556,7 @@ static int pv_display_blank_display(struct pv_display *display, bool dpms, bool
 
     //... and send it via IVC.
     pv_helper_lock(&display->lock);
-    rc = __send_packet(display->event_connection, PACKET_TYPE_EVENT_BLANK_DISPLAY,
+    rc = __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_BLANK_DISPLAY,
                        &payload, sizeof(payload));
     pv_helper_unlock(&display->lock);
 
@@ -969,9 +2577,29 @@ static int pv_display_blank_display(struct pv_display *display, bool dpms, bool
  */
 static void pv_display_destroy(struct pv_display *display)
 {
+    struct pv_display **link;
+
     __PV_HELPER_TRACE__;
     pv_display_checkp(display);
 
+    //Make sure our provider no longer tries to reconnect the display...
+    if(display->provider)
+    {
+        pv_helper_lock(&display->provider->lock);
+        for(link = &display->provider->displays; *link; link = &(*link)->next)
+        {
+            if(*link == display)
+            {
+                *link = display->next;
+                break;
+            }
+        }
+        pv_helper_unlock(&display->provider->lock);
+    }
+
+    //Stop publishing the display's counters...
+    __unpublish_stats(&display->stats_node);
+
     //Tear down the event connection...
     if(display->event_connection)
         libivc_disconnect(display->event_connection);
@@ -984,10 +2612,14 @@ static void pv_display_destroy(struct pv_display *display)
     if(display->dirty_rectangles_connection)
         libivc_disconnect(display->dirty_rectangles_connection);
 
-    //... and the cursor image connection.
+    //... the cursor image connection...
     if(display->cursor_image_connection)
         libivc_disconnect(display->cursor_image_connection);
 
+    //... and the video overlay connection.
+    if(display->overlay_connection)
+        libivc_disconnect(display->overlay_connection);
+
     //Finally, tear down the display object.
     if(display)
         pv_helper_free(display);
@@ -1048,6 +2680,8 @@ static void __handle_disconnect_for_connection(struct libivc_client *connection,
     //This allows a user to request a disconnected as part of a response to a disconnect event
     //without creating an infinite hell-chain.
     static bool handler_in_progress = false;
+    struct pv_display_provider *provider;
+    bool deferred = false;
 
     __PV_HELPER_TRACE__;
 
@@ -1059,6 +2693,41 @@ static void __handle_disconnect_for_connection(struct libivc_client *connection,
     if(handler_in_progress)
         return;
 
+    //A display that create_display_async is still bringing up isn't the driver's yet;
+    //fail the bring-up instead. (create_display holds the lock until it's done.)
+    pv_helper_lock(&display->lock);
+    if(display->bringup_pending)
+    {
+        display->bringup_disconnected = true;
+        deferred = true;
+    }
+    pv_helper_unlock(&display->lock);
+
+    if(deferred)
+        return;
+
+    //If we've lost the Display Handler as a whole, and our provider will reconnect to
+    //it, the display will come back with it; there's nothing for the driver to do.
+    //If only this display went away, though, the driver needs to hear about it.
+    provider = display->provider;
+
+    if(auto_reconnect && provider)
+    {
+        pv_helper_lock(&provider->lock);
+
+        if((display->provider == provider) &&
+           (provider->reconnecting || !provider->control_channel || !libivc_isOpen(provider->control_channel)))
+        {
+            display->reconnect_pending = true;
+            deferred = true;
+        }
+
+        pv_helper_unlock(&provider->lock);
+
+        if(deferred)
+            return;
+    }
+
     //If we were able to locate a display, trigger its fatal error handler.
     if(display)
     {
@@ -1115,6 +2784,39 @@ static void __cursor_image_disconnect_handler(void *opaque, struct libivc_client
 }
 
 
+/**
+ * Handle PV video overlay disconnects.
+ */
+static void __overlay_disconnect_handler(void *opaque, struct libivc_client *client)
+{
+    struct pv_display *display = (struct pv_display *)opaque;
+
+    __PV_HELPER_TRACE__;
+
+    if(!display)
+        return;
+
+    //The overlay is optional, so losing it doesn't take the display with it; it's just
+    //gone, as if destroy_overlay had been called, and can be created again.
+    pv_helper_lock(&display->lock);
+
+    if(display->overlay_connection != client)
+    {
+        pv_helper_unlock(&display->lock);
+        return;
+    }
+
+    display->overlay_connection = NULL;
+    display->overlay_buffer     = NULL;
+    memset(&display->overlay, 0, sizeof(display->overlay));
+
+    pv_helper_unlock(&display->lock);
+
+    pv_display_error("Video overlay connection for display %u broken.\n", (unsigned int)display->key);
+    libivc_disconnect(client);
+}
+
+
 /**
  * Attempts to open a shared memory channel to the display handler, which will be used
  * to sharea cursor image for use as a hardware cursor.
@@ -1132,7 +2834,7 @@ static int __open_cursor_image_connection(struct pv_display *display, struct lib
     //For now, we'll allocate one page more than needed for the image,
     //to ensure that we can get a page-aligned address. See framebuffer creation
     //for more information.
-    pages_to_allocate = (int)((align_to_next_page(CURSOR_IMAGE_SIZE) >> PAGE_SHIFT) + 1);
+    pages_to_allocate = (int)((align_to_next_page(cursor_image_size(display->cursor.size)) >> PAGE_SHIFT) + 1);
 
     //First, attempt to create a new buffer for the hardware cursor image.
     rc = __open_outgoing_connection(display, client, pages_to_allocate, rx_domain, port, __cursor_image_disconnect_handler, conn_id);
@@ -1170,59 +2872,362 @@ static int __open_cursor_image_connection(struct pv_display *display, struct lib
 }
 
 
-
 /**
- * Creates each of the IVC connections for a given PV display object, with the exception of its framebuffer.
+ * Creates a video overlay for the display; see Video Overlays in pv_driver_interface.h.
  *
- * @param display The display for which the connections should be created.
- * @param request The "Display Add" request, which stores connection metadata.
- * @param rx_domain The domain to which an IVC connection should be created. This is almost always the
- *    domain ID of the domain that originated the request.
+ * @param display The display to receive the overlay.
+ * @param format DH_OVERLAY_FORMAT_NV12 or DH_OVERLAY_FORMAT_I420.
+ * @param width, height The size of each frame, in pixels.
+ * @param x, y, dest_width, dest_height The region of the display the frames should fill.
  *
  * @return 0 on success, or an error code on failure.
  */
-static int __create_pv_display_support_connections(struct pv_display *display, struct dh_add_display *request, uint16_t rx_domain, uint64_t conn_id)
+static int pv_display_create_overlay(struct pv_display *display, uint32_t format,
+    uint32_t width, uint32_t height,
+    uint32_t x, uint32_t y, uint32_t dest_width, uint32_t dest_height)
 {
+    struct libivc_client *connection;
+    char *buffer;
+    uint32_t pitch;
+    uint16_t port;
+    int pages_to_allocate;
     int rc;
 
     __PV_HELPER_TRACE__;
 
-    //Set up the display's event connection.
+    pv_display_checkp(display, -EINVAL);
+    pv_display_checkp(display->provider, -ENODEV);
 
-    rc = __open_outgoing_connection(display, &display->event_connection, event_ring_pages, rx_domain, (uint16_t)request->event_port, __event_disconnect_handler, conn_id);
-    //If we weren't able to create an event connection, error out!
-    if(rc)
+    if(((format != DH_OVERLAY_FORMAT_NV12) && (format != DH_OVERLAY_FORMAT_I420)) ||
+       !width || !height || (width & 1) || (height & 1))
     {
-        pv_display_error("Could not create an event connection for display %u!\n", (unsigned int)request->key);
-        return rc;
+        pv_display_error("Invalid video overlay format %u (%ux%u)!\n", (unsigned int)format,
+            (unsigned int)width, (unsigned int)height);
+        return -EINVAL;
     }
 
-    //If the host has offered a dirty rectangle port, create a dirty rectangle connection.
-    if(request->dirty_rectangles_port) {
+    //Keep each row of the Y plane (and so each row of the half-width U and V planes,
+    //for I420) aligned, as hardware scalers tend to want.
+    pitch = (width + 63) & ~63u;
 
-        //Set up the display's dirty rectangle connection.
-        rc = __open_outgoing_connection(display, &display->dirty_rectangles_connection, dirty_rectangles_pages, rx_domain, (uint16_t)request->dirty_rectangles_port, __dirty_rectangles_disconnect_handler, conn_id);
+    pv_helper_lock(&display->lock);
+    port = (uint16_t)display->overlay_port;
+    rc = 0;
 
-        //If we weren't able to create an event connection, print an error to the log,
-        //but continue-- the Display Handler will refresh the whole screen.
-        if(rc) {
-            pv_display_error("Could not create a dirty rectangle connection for display %u!\n", (unsigned int)request->key);
-            pv_display_error("Performance will be reduced.");
-        }
-    }
+    if(!(display->capabilities & DH_CAP_VIDEO_OVERLAY) || !port)
+        rc = -ENODEV;
+    else if(display->overlay_connection)
+        rc = -EBUSY;
 
-    //If the host has offered a cursor image connection, enable hardware cursor support!
-    if(request->cursor_bitmap_port) {
+    pv_helper_unlock(&display->lock);
 
-        //Create the hardware cursor connection-- which implicitly creates the hardware cursor buffer.
-        rc = __open_cursor_image_connection(display, &display->cursor_image_connection, rx_domain, (uint16_t)request->cursor_bitmap_port, conn_id);
+    if(rc)
+        return rc;
 
-        //If we weren't able to create the connection, print an error, but continue
-        //using a software cursor.
-        if(rc) {
-            pv_display_error("Could not create a hardware cursor connection for display %u!\n", (unsigned int)request->key);
-            pv_display_error("Falling back to a software cursor.");
-        }
+    //Connect the overlay's buffer. As with the cursor, we allocate one more page than
+    //the frames need; see framebuffer creation for more information.
+    pages_to_allocate = (int)((align_to_next_page(DH_OVERLAY_BUFFER_SIZE(pitch, height)) >> PAGE_SHIFT) + 1);
+
+    rc = __open_outgoing_connection(display, &connection, pages_to_allocate, display->provider->rx_domain,
+                                    port, __overlay_disconnect_handler, display->provider->conn_id);
+    if(rc)
+    {
+        pv_display_error("Could not create a video overlay connection for display %u!\n", (unsigned int)display->key);
+        return rc;
+    }
+
+    rc = libivc_getLocalBuffer(connection, &buffer);
+    if(unlikely(rc != SUCCESS))
+    {
+        pv_display_error("IVC reports a valid connection, but won't give us its internal buffer!\n");
+        libivc_disconnect(connection);
+        return rc;
+    }
+
+    //Finally, describe the overlay to the host-- unless someone beat us to it while
+    //we were connecting.
+    pv_helper_lock(&display->lock);
+
+    if(display->overlay_connection)
+    {
+        pv_helper_unlock(&display->lock);
+        libivc_disconnect(connection);
+        return -EBUSY;
+    }
+
+    display->overlay_connection = connection;
+    display->overlay_buffer     = buffer;
+    display->overlay_frames     = 0;
+
+    display->overlay.format      = format;
+    display->overlay.width       = width;
+    display->overlay.height      = height;
+    display->overlay.pitch       = pitch;
+    display->overlay.x           = x;
+    display->overlay.y           = y;
+    display->overlay.dest_width  = dest_width;
+    display->overlay.dest_height = dest_height;
+
+    rc = __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_SET_OVERLAY,
+                       &display->overlay, sizeof(display->overlay));
+
+    pv_helper_unlock(&display->lock);
+
+    if(rc)
+        pv_display_error("Could not describe the video overlay for display %u (%d)!\n", (unsigned int)display->key, rc);
+
+    return rc;
+}
+
+
+/**
+ * @return The start of the given frame in the display's overlay buffer, or NULL
+ *    if there's no such frame.
+ */
+static void *pv_display_get_overlay_buffer(struct pv_display *display, uint32_t buffer)
+{
+    void *frame = NULL;
+
+    pv_display_checkp(display, NULL);
+
+    pv_helper_lock(&display->lock);
+
+    if(display->overlay_buffer && (buffer < DH_OVERLAY_BUFFERS))
+        frame = (char *)display->overlay_buffer +
+            (buffer * DH_OVERLAY_FRAME_SIZE(display->overlay.pitch, display->overlay.height));
+
+    pv_helper_unlock(&display->lock);
+    return frame;
+}
+
+
+/**
+ * Presents one of the frames in the display's overlay buffer.
+ *
+ * @param display The display whose overlay is to be updated.
+ * @param buffer The index of the frame to be presented.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static int pv_display_present_overlay(struct pv_display *display, uint32_t buffer)
+{
+    struct dh_overlay_frame frame;
+    int rc;
+
+    pv_display_checkp(display, -EINVAL);
+
+    if(buffer >= DH_OVERLAY_BUFFERS)
+        return -EINVAL;
+
+    pv_helper_lock_counted(&display->lock, &display->stats);
+
+    //If the host hasn't (re-)offered the overlay, there's no one to show it.
+    if(!display->overlay_connection || !display->overlay_port)
+    {
+        pv_helper_unlock(&display->lock);
+        return -ENODEV;
+    }
+
+    frame.frame  = display->overlay_frames + 1;
+    frame.buffer = buffer;
+
+    rc = __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_OVERLAY_FRAME,
+                       &frame, sizeof(frame));
+
+    if(!rc)
+        display->overlay_frames = frame.frame;
+
+    pv_helper_unlock(&display->lock);
+    return rc;
+}
+
+
+/**
+ * Moves the display's overlay to a new region of the display.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static int pv_display_move_overlay(struct pv_display *display, uint32_t x, uint32_t y,
+    uint32_t dest_width, uint32_t dest_height)
+{
+    int rc;
+
+    pv_display_checkp(display, -EINVAL);
+
+    pv_helper_lock_counted(&display->lock, &display->stats);
+
+    if(!display->overlay_connection || !display->overlay_port)
+    {
+        pv_helper_unlock(&display->lock);
+        return -ENODEV;
+    }
+
+    display->overlay.x           = x;
+    display->overlay.y           = y;
+    display->overlay.dest_width  = dest_width;
+    display->overlay.dest_height = dest_height;
+
+    rc = __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_SET_OVERLAY,
+                       &display->overlay, sizeof(display->overlay));
+
+    pv_helper_unlock(&display->lock);
+    return rc;
+}
+
+
+/**
+ * Hides and destroys the display's overlay, if it has one.
+ */
+static void pv_display_destroy_overlay(struct pv_display *display)
+{
+    struct libivc_client *connection;
+
+    __PV_HELPER_TRACE__;
+    pv_display_checkp(display);
+
+    pv_helper_lock(&display->lock);
+
+    connection = display->overlay_connection;
+
+    //Tell the host to stop showing the overlay, if it's listening, before its buffer goes.
+    if(connection && display->overlay_port)
+    {
+        struct dh_set_overlay hidden;
+
+        memset(&hidden, 0, sizeof(hidden));
+        __send_packet(display->event_connection, &display->stats, PACKET_TYPE_EVENT_SET_OVERLAY,
+                      &hidden, sizeof(hidden));
+    }
+
+    display->overlay_connection = NULL;
+    display->overlay_buffer     = NULL;
+    memset(&display->overlay, 0, sizeof(display->overlay));
+
+    pv_helper_unlock(&display->lock);
+
+    if(connection)
+        libivc_disconnect(connection);
+}
+
+
+
+/**
+ * The IVC connections that make up a PV display. Each can be opened independently
+ * of the others, so a display's connections can be brought up in parallel.
+ */
+enum pv_display_connection
+{
+    PV_DISPLAY_CONNECTION_FRAMEBUFFER,
+    PV_DISPLAY_CONNECTION_EVENT,
+    PV_DISPLAY_CONNECTION_DIRTY_RECTANGLES,
+    PV_DISPLAY_CONNECTION_CURSOR_IMAGE,
+    PV_DISPLAY_CONNECTION_COUNT
+};
+
+
+/**
+ * Creates one of the IVC connections for a given PV display object, other than its framebuffer.
+ *
+ * @param display The display for which the connection should be created.
+ * @param request The "Display Add" request, which stores connection metadata.
+ * @param rx_domain The domain to which an IVC connection should be created. This is almost always the
+ *    domain ID of the domain that originated the request.
+ * @param connection The connection to be created.
+ *
+ * @return 0 on success, or an error code if a required connection couldn't be created.
+ *    Optional connections (dirty rectangles and cursor) can fail without an error.
+ */
+static int __create_pv_display_support_connection(struct pv_display *display, struct dh_add_display *request,
+                                                  uint16_t rx_domain, uint64_t conn_id, enum pv_display_connection connection)
+{
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    switch(connection)
+    {
+        //Set up the display's event connection.
+        case PV_DISPLAY_CONNECTION_EVENT:
+            rc = __open_outgoing_connection(display, &display->event_connection, event_ring_pages, rx_domain, (uint16_t)request->event_port, __event_disconnect_handler, conn_id);
+
+            //If we weren't able to create an event connection, error out!
+            if(rc)
+            {
+                pv_display_error("Could not create an event connection for display %u!\n", (unsigned int)request->key);
+                return rc;
+            }
+
+            pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_EVENT_CONNECTED);
+            return 0;
+
+        //If the host has offered a dirty rectangle port, create a dirty rectangle connection.
+        case PV_DISPLAY_CONNECTION_DIRTY_RECTANGLES:
+            if(!request->dirty_rectangles_port)
+                return 0;
+
+            //Set up the display's dirty rectangle connection.
+            rc = __open_outgoing_connection(display, &display->dirty_rectangles_connection, dirty_rectangles_pages, rx_domain, (uint16_t)request->dirty_rectangles_port, __dirty_rectangles_disconnect_handler, conn_id);
+
+            //If we weren't able to create an event connection, print an error to the log,
+            //but continue-- the Display Handler will refresh the whole screen.
+            if(rc) {
+                pv_display_error("Could not create a dirty rectangle connection for display %u!\n", (unsigned int)request->key);
+                pv_display_error("Performance will be reduced.");
+                return 0;
+            }
+
+            pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_DIRTY_RECTANGLES_CONNECTED);
+            return 0;
+
+        //If the host has offered a cursor image connection, enable hardware cursor support!
+        case PV_DISPLAY_CONNECTION_CURSOR_IMAGE:
+            if(!request->cursor_bitmap_port)
+                return 0;
+
+            //Create the hardware cursor connection-- which implicitly creates the hardware cursor buffer.
+            rc = __open_cursor_image_connection(display, &display->cursor_image_connection, rx_domain, (uint16_t)request->cursor_bitmap_port, conn_id);
+
+            //If we weren't able to create the connection, print an error, but continue
+            //using a software cursor.
+            if(rc) {
+                pv_display_error("Could not create a hardware cursor connection for display %u!\n", (unsigned int)request->key);
+                pv_display_error("Falling back to a software cursor.");
+                return 0;
+            }
+
+            pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_CURSOR_IMAGE_CONNECTED);
+            return 0;
+
+        default:
+            return -EINVAL;
+    }
+}
+
+
+/**
+ * Creates each of the IVC connections for a given PV display object, with the exception of its framebuffer,
+ * one after the other.
+ *
+ * @param display The display for which the connections should be created.
+ * @param request The "Display Add" request, which stores connection metadata.
+ * @param rx_domain The domain to which an IVC connection should be created. This is almost always the
+ *    domain ID of the domain that originated the request.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static int __create_pv_display_support_connections(struct pv_display *display, struct dh_add_display *request, uint16_t rx_domain, uint64_t conn_id)
+{
+    int connection;
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    for(connection = PV_DISPLAY_CONNECTION_EVENT; connection < PV_DISPLAY_CONNECTION_COUNT; ++connection)
+    {
+        rc = __create_pv_display_support_connection(display, request, rx_domain, conn_id, (enum pv_display_connection)connection);
+
+        if(rc)
+            return rc;
     }
 
     //Indicate success.
@@ -1323,149 +3328,474 @@ static void pv_display_register_fatal_error_handler(struct pv_display *display,
 
 
 /**
- * Validates a given "Add Display" request.
- *
- * @return True if the request is valid, or false otherwise.
+ * Validates a given "Add Display" request.
+ *
+ * @return True if the request is valid, or false otherwise.
+ */
+static bool __validate_add_display_request(struct dh_add_display *request)
+{
+    __PV_HELPER_TRACE__;
+
+    //Ensure that we have a framebuffer...
+    if(request->framebuffer_port == 0)
+    {
+        pv_display_error("The Display Handler provided a display without a framebuffer connection-- rejecting it!\n");
+        return false;
+    }
+
+    //... and ensure that we have an event connection.
+    if(request->event_port == 0)
+    {
+        pv_display_error("The Display Handler provided a display without an event connection-- rejecting it!\n");
+        return false;
+    }
+
+    //If none of our checks have failed, the request is valid!
+    return true;
+}
+
+
+/**
+ * Allocates and initializes a new PV display object, without any of its connections.
+ *
+ * @return The new display, or NULL if it couldn't be allocated.
+ */
+static struct pv_display *__allocate_display(struct pv_display_provider *provider, struct dh_add_display *request,
+                                             uint32_t width, uint32_t height, uint32_t stride)
+{
+    struct pv_display *display;
+
+    __PV_HELPER_TRACE__;
+
+    //First, allocate the new display structure.
+    display = pv_helper_malloc(sizeof(struct pv_display));
+
+    //If we couldn't allocate a new display, return an error code.
+    if(!display)
+    {
+        pv_display_error("Could not allocate enough memory for a new PV display object!\n")
+        return NULL;
+    }
+
+    pv_helper_mutex_init(&display->lock);
+
+    //Initialize our display object's basic fields.
+    display->key    = request->key;
+    display->width  = width;
+    display->height = height;
+    display->stride = stride;
+
+    //By default, assume we have no connections.
+    display->framebuffer_connection      = NULL;
+    display->event_connection            = NULL;
+    display->cursor_image_connection     = NULL;
+    display->dirty_rectangles_connection = NULL;
+    display->overlay_connection          = NULL;
+
+    //... and assume we have no hardware cursor, or video overlay.
+    display->cursor.image                = NULL;
+    display->overlay_buffer              = NULL;
+    display->overlay_port                = 0;
+    display->overlay_frames              = 0;
+    memset(&display->overlay, 0, sizeof(display->overlay));
+
+    //... or compressed tiles, until our framebuffer has room for them.
+    display->tile_store                  = NULL;
+    display->tile_store_offset           = 0;
+    display->tile_capacity               = 0;
+    display->tile_columns                = 0;
+    display->tile_rows                   = 0;
+
+    //Record the capabilities we negotiated with the host...
+    display->capabilities                = provider->negotiated_capabilities;
+    display->dirty_rects_sent            = 0;
+    display->frames_committed            = 0;
+    display->credits_enabled             = false;
+    display->credits                     = 0;
+    display->region_held                 = false;
+    display->commit_held                 = false;
+
+    //... including the size of our hardware cursor, if we do get one.
+    display->cursor.size                 = DH_CAP_CURSOR_SIZE(provider->negotiated_capabilities);
+    display->cursor.scale_shift          = 0;
+
+    //Figure out how big the display's framebuffer will need to be...
+    display->framebuffer_size = stride * height;
+
+    //... and start timing its bring-up.
+    __begin_display_startup(provider, display);
+
+    return display;
+}
+
+
+/**
+ * Sets up the shared framebuffer for a new display.
+ *
+ * @return 0 on success, or an error code on failure.
+ */
+static int __create_display_framebuffer(struct pv_display_provider *provider, struct pv_display *display, struct dh_add_display *request)
+{
+    uint64_t shared_size = display->framebuffer_size;
+    uint64_t store_offset = align_to_next_page(display->framebuffer_size);
+    uint64_t capacity = (uint64_t)((display->width + DH_TILE_SIZE - 1) / DH_TILE_SIZE) *
+                        ((display->height + DH_TILE_SIZE - 1) / DH_TILE_SIZE);
+    uint64_t store_size = capacity * DH_TILE_SLOT_SIZE;
+
+    //If we agreed to keep compressed tiles, they go after the framebuffer, in the same
+    //shared buffer-- as long as IVC can share that many pages (plus its metadata page).
+    if((display->capabilities & DH_CAP_COMPRESSED_TILES) &&
+       ((align_to_next_page(store_offset + store_size) >> PAGE_SHIFT) < 0xFFFF))
+    {
+        shared_size = store_offset + store_size;
+    }
+    else if(display->capabilities & DH_CAP_COMPRESSED_TILES)
+    {
+        pv_display_error("Display %u is too large for a compressed tile store; continuing without one.\n", (unsigned int)request->key);
+    }
+
+    display->framebuffer = __create_shared_framebuffer(display, provider->rx_domain, (uint16_t)request->framebuffer_port, (uint32_t)shared_size, &display->framebuffer_connection, provider->conn_id);
+
+    //If we weren't able to create a framebuffer, abort!
+    if(!display->framebuffer)
+    {
+        pv_display_error("Could not create a framebuffer for display %u!\n", (unsigned int)request->key);
+        return -ENOMEM;
+    }
+
+    if(shared_size > display->framebuffer_size)
+    {
+        display->tile_store        = (char *)display->framebuffer + store_offset;
+        display->tile_store_offset = (uint32_t)store_offset;
+        display->tile_capacity     = (uint32_t)capacity;
+        __reset_tile_store(display, display->width, display->height, display->stride);
+    }
+
+    pv_helper_startup_mark(&display->startup, display->key, PV_HELPER_STARTUP_FRAMEBUFFER_CONNECTED);
+    return 0;
+}
+
+
+/**
+ * Finishes off a display whose connections have all been created, making it ready for use.
+ * Assumes the display is locked.
+ *
+ * @param initial_contents The initial contents of the framebuffer, or NULL; see create_display.
+ */
+static void __finish_display(struct pv_display_provider *provider, struct pv_display *display, void *initial_contents)
+{
+    //If initial contents were provided, copy them into the new framebuffer.
+    if(initial_contents)
+        memcpy(display->framebuffer, initial_contents, display->framebuffer_size);
+
+    //Finally, bind the display's methods...
+    display->reconnect              = pv_display_reconnect;
+    display->reconnect_with_flags   = pv_display_reconnect_with_flags;
+    display->set_driver_data        = pv_display_set_driver_data;
+    display->get_driver_data        = pv_display_get_driver_data;
+    display->get_stats              = pv_display_get_stats;
+    display->get_startup_profile    = pv_display_get_startup_profile;
+    display->change_resolution      = pv_display_change_resolution;
+    display->invalidate_region      = pv_display_invalidate_region;
+    display->commit_frame           = pv_display_commit_frame;
+    display->supports_cursor        = pv_display_supports_cursor;
+    display->load_cursor_image      = pv_display_load_cursor_image;
+    display->load_cursor_image_mono = pv_display_load_cursor_image_mono;
+    display->load_cursor_image_masked = pv_display_load_cursor_image_masked;
+    display->set_cursor_hotspot     = pv_display_set_cursor_hotspot;
+    display->set_cursor_visibility  = pv_display_set_cursor_visibility;
+    display->move_cursor            = pv_display_move_cursor;
+    display->blank_display          = pv_display_blank_display;
+    display->create_overlay         = pv_display_create_overlay;
+    display->get_overlay_buffer     = pv_display_get_overlay_buffer;
+    display->present_overlay        = pv_display_present_overlay;
+    display->move_overlay           = pv_display_move_overlay;
+    display->destroy_overlay        = pv_display_destroy_overlay;
+    display->destroy                = pv_display_destroy;
+
+    //Bind events.
+    display->register_fatal_error_handler = pv_display_register_fatal_error_handler;
+
+    //Publish the display's performance counters, where supported.
+    __publish_stats(&display->stats_node, &display->stats, "display", provider->rx_domain, display->key);
+}
+
+
+/**
+ * Has the provider keep track of a newly-created display, so it can be reconnected if need be.
+ * Assumes the display is no longer locked.
+ */
+static void __track_display(struct pv_display_provider *provider, struct pv_display *display)
+{
+    pv_helper_lock(&provider->lock);
+    display->provider  = provider;
+    display->next      = provider->displays;
+    provider->displays = display;
+    pv_helper_unlock(&provider->lock);
+}
+
+
+/**
+ * Creates a new PV Display object, which represents an individual display -- as typically provided by a display provider.
+ * Note that creating a display will not immediately make it usable-- to user a display, one must call its update_resolution
+ * method.
+ *
+ * @param provider The display provider that should create the new domain.
+ * @param new_display The out argument to recieve the new PV display object.
+ * @param request The PV display creation request, which contains the information necessary to create display connections.
+ * @param width The "virtual width" of the new framebuffer. This should be the largest possible width this display will be
+ *    expected to take-- the user can modeset to create a smaller "view" of this framebuffer, but not a larger one.
+ * @param height The "virtual height" of the new framebuffer-- see the caveat in the "width" parameter.
+ * @param stride The largest possible stride of the framebuffer, in bytes.
+ * @param initial_contents The initial contents of the framebuffer, as a raw binary blob -- or NULL if the framebuffer
+ *    need not be initialized. This can be used to create "copies" of existing framebuffers, which is useful for handling
+ *    reconnects.
+ *
+ */
+static int provider_create_display(struct pv_display_provider *provider, struct pv_display **new_display,
+                            struct dh_add_display *request, uint32_t width, uint32_t height, uint32_t stride, void *initial_contents)
+{
+    struct pv_display *display;
+    int rc;
+
+    __PV_HELPER_TRACE__;
+
+    //First, validate the given display request, and ensure it represents a usable display.
+    if(!__validate_add_display_request(request))
+        return -EINVAL;
+
+    //Next, allocate the new display structure.
+    display = __allocate_display(provider, request, width, height, stride);
+
+    //If we couldn't allocate a new display, return an error code.
+    if(!display)
+        return -ENOMEM;
+
+    //Lock the new display immediately. This is important, to ensure that none of our callbacks
+    //are executed before the object is completely initialized.
+    pv_helper_lock(&display->lock);
+
+    //Next, set up the display's framebuffer.
+    rc = __create_display_framebuffer(provider, display, request);
+
+    //If we weren't able to create a framebuffer, tear ourselves down and abort!
+    if(rc)
+    {
+        pv_helper_unlock(&display->lock);
+        pv_display_destroy(display);
+        *new_display = NULL;
+
+        return rc;
+    }
+
+    //Create the support connections for the given display-- including the event,
+    //dirty rectangles, and cursor connections.
+    rc = __create_pv_display_support_connections(display, request, provider->rx_domain, provider->conn_id);
+
+    //If we weren't able to create the given connections, fail out!
+    if(rc)
+    {
+
+        pv_helper_unlock(&display->lock);
+        pv_display_destroy(display);
+        *new_display = NULL;
+
+        return rc;
+    }
+
+    //Make the display ready for use...
+    __finish_display(provider, display, initial_contents);
+
+    //... unlock the PV display object...
+    pv_helper_unlock(&display->lock);
+
+    //... have the provider keep track of it, so it can be reconnected if need be...
+    __track_display(provider, display);
+
+    //... and return, indicating success.
+    *new_display = display;
+    return 0;
+}
+
+
+/**
+ * The state of an asynchronous display bring-up (see provider_create_display_async),
+ * shared by the tasks that each open one of the display's connections.
+ */
+struct __display_bringup
+{
+    struct pv_display_provider *provider;
+    struct pv_display *display;
+    struct dh_add_display request;
+    void *initial_contents;
+
+    display_created_callback callback;
+    void *opaque;
+
+    //Protects the fields below, which track the connections still being opened,
+    //and the first error to occur opening any of them.
+    pv_helper_mutex lock;
+    int remaining;
+    int rc;
+
+    //The argument passed to the task that opens each connection.
+    struct __display_bringup_task
+    {
+        struct __display_bringup *bringup;
+        enum pv_display_connection connection;
+    } tasks[PV_DISPLAY_CONNECTION_COUNT];
+};
+
+
+/**
+ * Completes an asynchronous display bring-up once all of its connections have been
+ * attempted, reporting the new display (or the failure to create it) to its callback.
  */
-static bool __validate_add_display_request(struct dh_add_display *request)
+static void __complete_display_bringup(struct __display_bringup *bringup)
 {
+    struct pv_display_provider *provider = bringup->provider;
+    struct pv_display *display = bringup->display;
+
     __PV_HELPER_TRACE__;
 
-    //Ensure that we have a framebuffer...
-    if(request->framebuffer_port == 0)
+    //If every required connection came up, and stayed up, make the display ready for
+    //use, just as create_display would; from here on, its disconnects are the driver's.
+    pv_helper_lock(&display->lock);
+    display->bringup_pending = false;
+
+    if(!bringup->rc && display->bringup_disconnected)
+        bringup->rc = -ENOTCONN;
+
+    if(!bringup->rc)
+        __finish_display(provider, display, bringup->initial_contents);
+
+    pv_helper_unlock(&display->lock);
+
+    //Otherwise, tear down what we've got.
+    if(bringup->rc)
     {
-        pv_display_error("The Display Handler provided a display without a framebuffer connection-- rejecting it!\n");
-        return false;
+        pv_display_destroy(display);
+        display = NULL;
     }
-
-    //... and ensure that we have an event connection.
-    if(request->event_port == 0)
+    else
     {
-        pv_display_error("The Display Handler provided a display without an event connection-- rejecting it!\n");
-        return false;
+        __track_display(provider, display);
     }
 
-    //If none of our checks have failed, the request is valid!
-    return true;
+    //Let the provider know we're done with it before we call back, as the callback
+    //may well destroy it...
+    pv_helper_lock(&provider->lock);
+    if(--provider->pending_bringups == 0)
+        pv_helper_completion_complete(&provider->bringups_done);
+    pv_helper_unlock(&provider->lock);
+
+    //... and report the outcome.
+    bringup->callback(provider, display, bringup->rc, bringup->opaque);
+    pv_helper_free(bringup);
 }
 
 
 /**
- * Creates a new PV Display object, which represents an individual display -- as typically provided by a display provider.
- * Note that creating a display will not immediately make it usable-- to user a display, one must call its update_resolution
- * method.
- *
- * @param provider The display provider that should create the new domain.
- * @param new_display The out argument to recieve the new PV display object.
- * @param request The PV display creation request, which contains the information necessary to create display connections.
- * @param width The "virtual width" of the new framebuffer. This should be the largest possible width this display will be
- *    expected to take-- the user can modeset to create a smaller "view" of this framebuffer, but not a larger one.
- * @param height The "virtual height" of the new framebuffer-- see the caveat in the "width" parameter.
- * @param stride The largest possible stride of the framebuffer, in bytes.
- * @param initial_contents The initial contents of the framebuffer, as a raw binary blob -- or NULL if the framebuffer
- *    need not be initialized. This can be used to create "copies" of existing framebuffers, which is useful for handling
- *    reconnects.
+ * Opens one of the connections for an asynchronous display bring-up. Whichever
+ * connection finishes last completes the bring-up.
  *
+ * @param opaque The __display_bringup_task describing the connection to be opened.
  */
-static int provider_create_display(struct pv_display_provider *provider, struct pv_display **new_display,
-                            struct dh_add_display *request, uint32_t width, uint32_t height, uint32_t stride, void *initial_contents)
+static void __open_display_connection_async(void *opaque)
 {
-    struct pv_display *display;
+    struct __display_bringup_task *task = opaque;
+    struct __display_bringup *bringup = task->bringup;
+    struct pv_display_provider *provider = bringup->provider;
+    bool last;
     int rc;
 
     __PV_HELPER_TRACE__;
 
-    //First, validate the given display request, and ensure it represents a usable display.
-    if(!__validate_add_display_request(request))
-        return -EINVAL;
+    //Each connection touches only its own fields of the display, so they can all
+    //be opened at once; the display isn't visible to anyone else until it's done,
+    //and disconnects are held back until then (see __handle_disconnect_for_connection).
+    if(task->connection == PV_DISPLAY_CONNECTION_FRAMEBUFFER)
+        rc = __create_display_framebuffer(provider, bringup->display, &bringup->request);
+    else
+        rc = __create_pv_display_support_connection(bringup->display, &bringup->request, provider->rx_domain,
+                                                    provider->conn_id, task->connection);
 
-    //First, allocate the new display structure.
-    display = pv_helper_malloc(sizeof(struct pv_display));
+    pv_helper_lock(&bringup->lock);
+    if(rc && !bringup->rc)
+        bringup->rc = rc;
+    last = (--bringup->remaining == 0);
+    pv_helper_unlock(&bringup->lock);
 
-    //If we couldn't allocate a new display, return an error code.
-    if(!display)
-    {
-        pv_display_error("Could not allocate enough memory for a new PV display object!\n")
-        return -ENOMEM;
-    }
+    if(last)
+        __complete_display_bringup(bringup);
+}
 
-    //Initialize our object's lock, and immediately lock it.
-    //This is important, to ensure that none of our callbacks are executed before the object
-    //is completely initialized.
-    pv_helper_mutex_init(&display->lock);
-    pv_helper_lock(&display->lock);
 
-    //Initialize our display object's basic fields.
-    display->key    = request->key;
-    display->width  = width;
-    display->height = height;
-    display->stride = stride;
+/**
+ * Starts creating a new PV Display object, opening all of its connections at once;
+ * see create_display_async in pv_display_helper.h.
+ */
+static int provider_create_display_async(struct pv_display_provider *provider, struct dh_add_display *request,
+                                         uint32_t width, uint32_t height, uint32_t stride, void *initial_contents,
+                                         display_created_callback callback, void *opaque)
+{
+    struct __display_bringup *bringup;
+    int connection;
 
-    //By default, assume we have no connections.
-    display->framebuffer_connection      = NULL;
-    display->event_connection            = NULL;
-    display->cursor_image_connection     = NULL;
-    display->dirty_rectangles_connection = NULL;
+    __PV_HELPER_TRACE__;
 
-    //... and assume we have no hardware cursor.
-    display->cursor.image                = NULL;
+    pv_display_checkp(provider, -EINVAL);
+    pv_display_checkp(callback, -EINVAL);
 
-    //Next, set up the display's framebuffer.
-    display->framebuffer_size = stride * height;
+    //First, validate the given display request, and ensure it represents a usable display.
+    if(!__validate_add_display_request(request))
+        return -EINVAL;
 
-    display->framebuffer = __create_shared_framebuffer(display, provider->rx_domain, (uint16_t)request->framebuffer_port, display->framebuffer_size, &display->framebuffer_connection, provider->conn_id);
-    //If we weren't able to create a framebuffer, tear ourselves down and abort!
-    if(!display->framebuffer)
-    {
-        pv_display_error("Could not create a framebuffer for display %u!\n", (unsigned int)request->key);
-        pv_helper_unlock(&display->lock);
-        pv_display_destroy(display);
-        *new_display = NULL;
+    bringup = pv_helper_malloc(sizeof(*bringup));
 
+    if(!bringup)
         return -ENOMEM;
-    }
 
-    //Create the support connections for the given display-- including the event,
-    //dirty rectangles, and cursor connections.
-    rc = __create_pv_display_support_connections(display, request, provider->rx_domain, provider->conn_id);
+    bringup->display = __allocate_display(provider, request, width, height, stride);
 
-    //If we weren't able to create the given connections, fail out!
-    if(rc)
+    if(!bringup->display)
     {
+        pv_helper_free(bringup);
+        return -ENOMEM;
+    }
 
-        pv_helper_unlock(&display->lock);
-        pv_display_destroy(display);
-        *new_display = NULL;
+    bringup->provider         = provider;
+    bringup->request          = *request;
+    bringup->initial_contents = initial_contents;
+    bringup->callback         = callback;
+    bringup->opaque           = opaque;
+    bringup->remaining        = PV_DISPLAY_CONNECTION_COUNT;
+    bringup->rc               = 0;
+    pv_helper_mutex_init(&bringup->lock);
 
-        return rc;
-    }
+    //Nothing opened from here on reaches the driver until the bring-up is complete.
+    bringup->display->bringup_pending = true;
 
-    //If initial contents were provided, copy them into the new framebuffer.
-    if(initial_contents)
-        memcpy(display->framebuffer, initial_contents, display->framebuffer_size);
+    //Keep the provider around until we're done with it.
+    pv_helper_lock(&provider->lock);
+    if(provider->pending_bringups++ == 0)
+        pv_helper_completion_reset(&provider->bringups_done);
+    pv_helper_unlock(&provider->lock);
 
-    //Finally, bind the display's methods...
-    display->reconnect              = pv_display_reconnect;
-    display->set_driver_data        = pv_display_set_driver_data;
-    display->get_driver_data        = pv_display_get_driver_data;
-    display->change_resolution      = pv_display_change_resolution;
-    display->invalidate_region      = pv_display_invalidate_region;
-    display->supports_cursor        = pv_display_supports_cursor;
-    display->load_cursor_image      = pv_display_load_cursor_image;
-    display->set_cursor_hotspot     = pv_display_set_cursor_hotspot;
-    display->set_cursor_visibility  = pv_display_set_cursor_visibility;
-    display->move_cursor            = pv_display_move_cursor;
-    display->blank_display          = pv_display_blank_display;
-    display->destroy                = pv_display_destroy;
+    //Open each of the display's connections in the background. If we can't, open it
+    //here and now instead; the bring-up just won't be as quick. Once the last task has
+    //started, the bring-up may already be complete, so we mustn't touch it again.
+    for(connection = 0; connection < PV_DISPLAY_CONNECTION_COUNT; ++connection)
+    {
+        struct __display_bringup_task *task = &bringup->tasks[connection];
 
-    //Bind events.
-    display->register_fatal_error_handler = pv_display_register_fatal_error_handler;
+        task->bringup    = bringup;
+        task->connection = (enum pv_display_connection)connection;
 
-    //... unlock the PV display object...
-    pv_helper_unlock(&display->lock);
+        if(pv_helper_run_async(__open_display_connection_async, task))
+            __open_display_connection_async(task);
+    }
 
-    //... and return, indicating success.
-    *new_display = display;
     return 0;
 }
 
@@ -1505,7 +3835,7 @@ int provider_destroy_display(struct pv_display_provider *provider, struct pv_dis
     request.key = display->key;
 
     pv_helper_lock(&provider->lock);
-    rc = __send_packet(provider->control_channel, PACKET_TYPE_CONTROL_DISPLAY_NO_LONGER_AVAILABLE,
+    rc = __send_packet(provider->control_channel, &provider->stats, PACKET_TYPE_CONTROL_DISPLAY_NO_LONGER_AVAILABLE,
                        &request, sizeof(request));
     pv_helper_unlock(&provider->lock);
 
@@ -1539,19 +3869,16 @@ static int provider_advertise_capabilities(struct pv_display_provider *provider,
 
     __PV_HELPER_TRACE__;
 
-    //Populate a "driver capabilities" packet...
-    struct dh_driver_capabilities capabilities =
-    {
-        .max_displays = max_displays,
-        .version = PV_DRIVER_INTERFACE_VERSION
-    };
-
     pv_display_checkp(provider, -EINVAL);
 
-    //... and send it via IVC.
+    //Remember our capabilities, so we can advertise them again should we reconnect...
     pv_helper_lock(&provider->lock);
-    rc = __send_packet(provider->control_channel, PACKET_TYPE_CONTROL_DRIVER_CAPABILITIES,
-                       &capabilities, sizeof(struct dh_driver_capabilities));
+    provider->capabilities_advertised = true;
+    provider->max_displays = max_displays;
+
+    //... and send them via IVC, along with any negotiable capabilities we'd like. If we're
+    //waiting for the Display Handler to come back, they'll be sent once it does.
+    rc = provider->reconnecting ? 0 : __send_driver_capabilities(provider);
     pv_helper_unlock(&provider->lock);
 
     //If we couldn't send the given packet, print a diagnostic, but continue.
@@ -1567,6 +3894,97 @@ static int provider_advertise_capabilities(struct pv_display_provider *provider,
 }
 
 
+/**
+ * Requests a hardware cursor larger than 64x64, for use on HiDPI displays.
+ * The request is sent with the next capabilities advertisement; the Display
+ * Handler may grant a smaller size, or none at all if it predates this feature.
+ *
+ * @param provider The Display Provider whose displays should use the larger cursor.
+ * @param size The desired cursor width and height: 64, 128, or 256.
+ */
+static int provider_set_max_cursor_size(struct pv_display_provider *provider, uint32_t size)
+{
+    __PV_HELPER_TRACE__;
+
+    pv_display_checkp(provider, -EINVAL);
+
+    if((size != 64) && (size != 128) && (size != 256))
+    {
+        pv_display_error("Cursor size %u is not supported; use 64, 128, or 256.\n", (unsigned int)size);
+        return -EINVAL;
+    }
+
+    pv_helper_lock(&provider->lock);
+    provider->capabilities &= ~DH_CAP_CURSOR_SIZE_MASK;
+    provider->capabilities |= DH_CAP_CURSOR_SIZE_CLASS(size);
+    pv_helper_unlock(&provider->lock);
+
+    return 0;
+}
+
+
+/**
+ * Offers to mark the end of each frame with a commit marker. The offer is sent with
+ * the next capabilities advertisement; a Display Handler that predates frame commits
+ * will simply present as damage arrives.
+ *
+ * @param provider The Display Provider whose displays will commit their frames.
+ */
+static int provider_enable_frame_commits(struct pv_display_provider *provider)
+{
+    __PV_HELPER_TRACE__;
+
+    pv_display_checkp(provider, -EINVAL);
+
+    pv_helper_lock(&provider->lock);
+    provider->capabilities |= DH_CAP_FRAME_COMMIT;
+    pv_helper_unlock(&provider->lock);
+
+    return 0;
+}
+
+
+/**
+ * Offers to keep a compressed tile store alongside each framebuffer. The offer is
+ * sent with the next capabilities advertisement; displays created before the host
+ * agrees have no store.
+ *
+ * @param provider The Display Provider whose displays will keep compressed tiles.
+ */
+static int provider_enable_compressed_tiles(struct pv_display_provider *provider)
+{
+    __PV_HELPER_TRACE__;
+
+    pv_display_checkp(provider, -EINVAL);
+
+    pv_helper_lock(&provider->lock);
+    provider->capabilities |= DH_CAP_COMPRESSED_TILES;
+    pv_helper_unlock(&provider->lock);
+
+    return 0;
+}
+
+
+/**
+ * Takes a snapshot of the provider's control channel performance counters.
+ */
+static void provider_get_stats(struct pv_display_provider *provider, struct pv_helper_stats *stats)
+{
+    pv_helper_stats_snapshot(stats, &provider->stats);
+}
+
+
+/**
+ * Takes a snapshot of the provider's startup profile, for its current session.
+ */
+static void provider_get_startup_profile(struct pv_display_provider *provider, struct pv_helper_startup_profile *profile)
+{
+    pv_helper_lock(&provider->lock);
+    *profile = provider->startup;
+    pv_helper_unlock(&provider->lock);
+}
+
+
 /**
  * Advertises a list of displays that the PV Driver would /like/ to handle-- typically in response
  * to a Host Display Change event.
@@ -1591,7 +4009,7 @@ static int provider_advertise_displays(struct pv_display_provider *provider, str
     size_t payload_size = sizeof(struct dh_display_advertised_list) + sizeof(struct dh_display_info) * display_count;
 
     //Allocate space for the list of advertised displays...
-    struct dh_display_advertised_list *list = pv_helper_malloc(payload_size);
+    struct dh_display_advertised_list *list = pv_helper_malloc_uninit(payload_size);
 
     //If we weren't able to allocate a memory buffer, fail out!
     if(!list)
@@ -1604,9 +4022,15 @@ static int provider_advertise_displays(struct pv_display_provider *provider, str
     list->num_displays = display_count;
     memcpy(list->displays, displays, sizeof(struct dh_display_info) * display_count);
 
-    //Finally, send the newly-constructed packet.
+    //Keep the list, replacing any we advertised before, so we can advertise it again
+    //should we reconnect...
     pv_helper_lock(&provider->lock);
-    rc = __send_packet(provider->control_channel, PACKET_TYPE_CONTROL_ADVERTISED_DISPLAY_LIST, list, payload_size);
+    pv_helper_free(provider->advertised_displays);
+    provider->advertised_displays      = list;
+    provider->advertised_displays_size = payload_size;
+
+    //... and send it, unless we're waiting for the Display Handler to come back.
+    rc = provider->reconnecting ? 0 : __send_advertised_displays(provider);
     pv_helper_unlock(&provider->lock);
 
     //For now, provide a notification on failure.
@@ -1615,7 +4039,6 @@ static int provider_advertise_displays(struct pv_display_provider *provider, str
         pv_display_error("Unable to send a list of advertised displays! (%d)", rc);
     }
 
-    pv_helper_free(list);
     return rc;
 }
 
@@ -1640,7 +4063,7 @@ static int provider_force_text_mode(struct pv_display_provider *provider, bool f
 
     //... and send it via IVC.
     pv_helper_lock(&provider->lock);
-    rc = __send_packet(provider->control_channel, PACKET_TYPE_CONTROL_TEXT_MODE,
+    rc = __send_packet(provider->control_channel, &provider->stats, PACKET_TYPE_CONTROL_TEXT_MODE,
                        &payload, sizeof(payload));
     pv_helper_unlock(&provider->lock);
 
@@ -1667,6 +4090,8 @@ static int provider_force_text_mode(struct pv_display_provider *provider, bool f
  */
 static void provider_destroy(struct pv_display_provider *provider)
 {
+    struct pv_display *display;
+
     __PV_HELPER_TRACE__;
 
     //If we were passed a null pointer, something's gone wrong. Report the issue.
@@ -1676,10 +4101,37 @@ static void provider_destroy(struct pv_display_provider *provider)
         return;
     }
 
+    //Wait for any displays still being brought up, which will report back to us...
+    pv_helper_lock(&provider->lock);
+    while(provider->pending_bringups)
+    {
+        pv_helper_unlock(&provider->lock);
+        pv_helper_completion_wait(&provider->bringups_done);
+        pv_helper_lock(&provider->lock);
+    }
+
+    //... stop trying to reconnect, and let go of any displays we were tracking...
+    provider->destroying = true;
+
+    for(display = provider->displays; display; display = display->next)
+        display->provider = NULL;
+
+    provider->displays = NULL;
+    pv_helper_unlock(&provider->lock);
+
+    //... waiting for any reconnect in progress to notice.
+    pv_helper_work_cancel(&provider->reconnect_work);
+
+    //Stop publishing the provider's counters...
+    __unpublish_stats(&provider->stats_node);
+
     //Close and clean up the control channel.
     if(provider->control_channel)
         libivc_disconnect(provider->control_channel);
 
+    pv_helper_free(provider->advertised_displays);
+    pv_helper_completion_destroy(&provider->bringups_done);
+
     //Finally, destroy the object itself.
     pv_helper_free(provider);
 }
@@ -1750,6 +4202,28 @@ static void provider_register_remove_display_request_handler(struct pv_display_p
 }
 
 
+/**
+ * Handles registration of an event handler for Frame Done events.
+ * Currently only allows registration of a single handler.
+ *
+ * @param provider The display event for which the handler should be registered.
+ * @param handler The callback function which should be called to handle the given event.
+ */
+static void provider_register_frame_done_handler(struct pv_display_provider *provider, frame_done_event_handler handler)
+{
+    __PV_HELPER_TRACE__;
+    pv_helper_lock(&provider->lock);
+
+    //Update the registration.
+    provider->frame_done_handler = handler;
+
+    // Update the capabilities provided by the driver
+    provider->capabilities |= DH_CAP_FRAME_DONE;
+
+    pv_helper_unlock(&provider->lock);
+}
+
+
 /**
  * Handles registration of a fatal error handler for PV display providers.
  * Currently only allows registration of a single handler.
@@ -1796,18 +4270,47 @@ int create_pv_display_provider_with_conn_id(struct pv_display_provider **display
     provider->owner        = NULL;
     provider->current_packet_header.length = 0;
 
+    //Ask for damage latency samples, if they're enabled.
+    if(latency_sample_interval > 0)
+        provider->capabilities |= DH_CAP_LATENCY_SAMPLES;
+
+    //We can always vouch for our framebuffers' contents across a reconnect, and
+    //always send compact dirty rectangles; credits and overlays only come into play
+    //if the host makes use of them.
+    provider->capabilities |= DH_CAP_FRAMEBUFFER_PRESERVE | DH_CAP_COMPACT_DIRTY_RECTANGLES |
+                              DH_CAP_DIRTY_RECTANGLE_CREDITS | DH_CAP_VIDEO_OVERLAY;
+
+    //Every display we create is a linear framebuffer, and we bring displays back
+    //ourselves should the Display Handler restart.
+    provider->capabilities |= DH_CAP_LFB | DH_CAP_RECONNECT;
+
+    //Prepare to reconnect, should we need to, seeding our jitter so that
+    //guests don't all retry in lockstep...
+    pv_helper_work_init(&provider->reconnect_work, __reconnect_to_display_handler, provider);
+    provider->reconnect_seed = (uint32_t)(pv_helper_time_ns() ^ (uintptr_t)provider) | 1;
+
     //... and the lock that protects the display provider.
     pv_helper_mutex_init(&provider->lock);
+    pv_helper_completion_init(&provider->bringups_done);
     pv_helper_lock(&provider->lock);
 
-    //Set up the main control channel connection.
+    //Set up the main control channel connection, timing the session from here. If
+    //the Display Handler isn't up yet, keep trying in the background.
+    pv_helper_startup_begin(&provider->startup);
     rc = __open_control_connection(provider);
 
+    if(unlikely(rc) && !__schedule_reconnect(provider))
+    {
+        pv_display_debug("The Display Handler isn't reachable yet; will keep trying.\n");
+        rc = 0;
+    }
+
     //If we weren't able to connect, fail out.
     if(unlikely(rc))
     {
         pv_helper_unlock(&provider->lock);
         //Tear down what we've already allocated...
+        pv_helper_completion_destroy(&provider->bringups_done);
         pv_helper_free(provider);
         *display_provider = NULL;
 
@@ -1815,10 +4318,19 @@ int create_pv_display_provider_with_conn_id(struct pv_display_provider **display
         return -ENXIO;
     }
 
+    //Publish the provider's performance counters, where supported.
+    __publish_stats(&provider->stats_node, &provider->stats, "provider", provider->rx_domain, provider->control_port);
+
     //Finally, bind methods to the display provider.
     provider->advertise_capabilities    = provider_advertise_capabilities;
+    provider->set_max_cursor_size       = provider_set_max_cursor_size;
+    provider->enable_frame_commits      = provider_enable_frame_commits;
+    provider->enable_compressed_tiles   = provider_enable_compressed_tiles;
+    provider->get_stats                 = provider_get_stats;
+    provider->get_startup_profile       = provider_get_startup_profile;
     provider->advertise_displays        = provider_advertise_displays;
     provider->create_display            = provider_create_display;
+    provider->create_display_async      = provider_create_display_async;
     provider->destroy_display           = provider_destroy_display;
     provider->force_text_mode           = provider_force_text_mode;
     provider->destroy                   = provider_destroy;
@@ -1827,6 +4339,7 @@ int create_pv_display_provider_with_conn_id(struct pv_display_provider **display
     provider->register_host_display_change_handler    = provider_register_host_display_change_handler;
     provider->register_add_display_request_handler    = provider_register_add_display_request_handler;
     provider->register_remove_display_request_handler = provider_register_remove_display_request_handler;
+    provider->register_frame_done_handler = provider_register_frame_done_handler;
     provider->register_fatal_error_handler            = provider_register_fatal_error_handler;
 
     //Finally, unlock the PV display provider, making it ready for use.
@@ -1849,12 +4362,40 @@ int create_pv_display_provider(struct pv_display_provider **display_provider, do
 #if defined __linux__ && defined __KERNEL__
 EXPORT_SYMBOL(create_pv_display_provider);
 
+static int __init pv_display_helper_init(void)
+{
+    int rc;
+
+    //Set up the pool our packet buffers are drawn from.
+    rc = pv_helper_packet_pool_init();
+    if(rc)
+    {
+        pv_display_error("Could not create the packet buffer pool!\n");
+        return rc;
+    }
+
+    //Create the directory in which performance counters are published.
+    //If debugfs isn't available, the counters simply won't be published.
+    stats_root = debugfs_create_dir("pv_display_helper", NULL);
+    return 0;
+}
+
+static void __exit pv_display_helper_exit(void)
+{
+    debugfs_remove_recursive(stats_root);
+    pv_helper_packet_pool_destroy();
+}
+
+module_init(pv_display_helper_init);
+module_exit(pv_display_helper_exit);
+
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("PV display communications helpers");
 
 #elif defined WIN32 && defined KERNEL
 DRIVER_INITIALIZE DriverEntry;
 EVT_WDF_DRIVER_DEVICE_ADD PvDisplayHelperEvtDeviceAdd;
+EVT_WDF_DRIVER_UNLOAD PvDisplayHelperEvtDriverUnload;
 
 NTSTATUS
 DriverEntry(_In_ PDRIVER_OBJECT  DriverObject, _In_ PUNICODE_STRING RegistryPath)
@@ -1863,11 +4404,28 @@ DriverEntry(_In_ PDRIVER_OBJECT  DriverObject, _In_ PUNICODE_STRING RegistryPath
 	WDF_DRIVER_CONFIG config;
 	KdPrintEx((DPFLTR_IHVDRIVER_ID, 0, "pv_display_helper: DriverEntry\n"));
 	WDF_DRIVER_CONFIG_INIT(&config, PvDisplayHelperEvtDeviceAdd);
+	config.EvtDriverUnload = PvDisplayHelperEvtDriverUnload;
+	//Set up the pool our packet buffers are drawn from.
+	if (pv_helper_packet_pool_init())
+	{
+		pv_display_error("Could not create the packet buffer pool!\n");
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
 	status = WdfDriverCreate(DriverObject, RegistryPath, WDF_NO_OBJECT_ATTRIBUTES, &config, WDF_NO_HANDLE);
+	if (!NT_SUCCESS(status))
+	{
+		pv_helper_packet_pool_destroy();
+	}
 	//Initialize the global providers lock.
 	return status;
 }
 
+VOID PvDisplayHelperEvtDriverUnload(_In_ WDFDRIVER Driver)
+{
+	(void)Driver;
+	pv_helper_packet_pool_destroy();
+}
+
 NTSTATUS PvDisplayHelperEvtDeviceAdd(_In_ WDFDRIVER Driver, _Inout_ PWDFDEVICE_INIT DeviceInit)
 {
 	NTSTATUS status;
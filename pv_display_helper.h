@@ -62,6 +62,21 @@ typedef void (*remove_display_request_handler)(struct pv_display_provider *provi
         struct dh_remove_display *request);
 
 
+/**
+ * Frame Done Event Handler
+ *
+ * Handles a Frame Done event, in which the host reports that it has finished with
+ * one of a display's frames (see Frame Done in pv_driver_interface.h); drivers can
+ * pace their rendering, or complete page flips, accordingly.
+ *
+ * @param provider The display provider which has received the event.
+ * @param event The Frame Done event, which identifies the display by its key.
+ *
+ */
+typedef void (*frame_done_event_handler)(struct pv_display_provider *provider,
+        struct dh_frame_done *event);
+
+
 /**
  * Fatal Display Provider Error Handler
  *
@@ -86,6 +101,21 @@ typedef void (*fatal_provider_error_handler)(struct pv_display_provider *provide
 typedef void (*fatal_display_error_handler)(struct pv_display *display);
 
 
+/**
+ * Display Created Callback
+ *
+ * Reports the outcome of a create_display_async call. May be called from a
+ * background thread, or before create_display_async has even returned.
+ *
+ * @param provider The display provider that was asked to create the display.
+ * @param display The new display, or NULL if it couldn't be created.
+ * @param rc 0 on success, or an error code on failure.
+ * @param opaque The opaque pointer passed to create_display_async.
+ */
+typedef void (*display_created_callback)(struct pv_display_provider *provider,
+        struct pv_display *display, int rc, void *opaque);
+
+
 /******************************************************************************/
 /* Iteration Helper Functions                                                 */
 /******************************************************************************/
@@ -119,6 +149,11 @@ typedef bool (*display_connection_filter)(struct pv_display *display,
 typedef struct pv_display *(*pv_display_locator)(struct libivc_client *client);
 
 
+/**
+ * Flags for pv_display->reconnect_with_flags.
+ */
+#define PV_DISPLAY_RECONNECT_PRESERVE (1 << 0) //The framebuffer's contents are still valid.
+
 /******************************************************************************/
 /* Data Structures                                                            */
 /******************************************************************************/
@@ -162,6 +197,58 @@ struct pv_display
     //associated with the display.
     struct pv_cursor cursor;
 
+    //The negotiable capabilities in effect for this display (see dh_host_capabilities).
+    uint32_t capabilities;
+
+    //The number of dirty rectangles sent since the dirty rectangles connection
+    //was established; used to sequence damage latency samples.
+    uint32_t dirty_rects_sent;
+
+    //The sequence number of the last frame committed; see commit_frame.
+    uint32_t frames_committed;
+
+    //Dirty rectangle flow control; see Dirty Rectangle Credits in pv_driver_interface.h.
+    //Once the host has granted credits, damage we have no credit for is folded into
+    //held_region, and any commit that would overtake it is held back behind it.
+    bool credits_enabled;
+    uint32_t credits;
+    bool region_held;
+    struct dh_dirty_rectangle held_region;
+    bool commit_held;
+
+    //The display's video overlay; see create_overlay. overlay_port is the port the
+    //host offered for its buffer (or 0, if it hasn't), and overlay describes the
+    //overlay as last sent to the host (or has format DH_OVERLAY_FORMAT_NONE).
+    uint32_t overlay_port;
+    struct dh_set_overlay overlay;
+    uint32_t overlay_frames;
+    void *overlay_buffer;
+
+    //The display's compressed tile store; see Compressed Tiles in pv_driver_interface.h.
+    //The store follows the framebuffer in its shared buffer, and has room for
+    //tile_capacity tiles; tile_columns and tile_rows describe the grid in use (or
+    //are 0, if the current resolution doesn't fit the store).
+    void *tile_store;
+    uint32_t tile_store_offset;
+    uint32_t tile_capacity;
+    uint32_t tile_columns;
+    uint32_t tile_rows;
+
+    //The provider that created the display, or NULL if it's since been destroyed;
+    //and the next display created by the same provider.
+    struct pv_display_provider *provider;
+    struct pv_display *next;
+
+    //True iff the display's connections were lost along with the Display Handler,
+    //and should be re-established when a new Display Handler asks for the display.
+    bool reconnect_pending;
+
+    //True while create_display_async is still opening the display's connections.
+    //Any connection lost in the meantime fails the bring-up, rather than reaching
+    //the driver's fatal error handler on a half-built display.
+    bool bringup_pending;
+    bool bringup_disconnected;
+
     //
     // Required Connections
     //
@@ -182,6 +269,22 @@ struct pv_display
     //The IVC connection used to share the cursor image.
     struct libivc_client *cursor_image_connection;
 
+    //The IVC connection used to share video overlay frames.
+    struct libivc_client *overlay_connection;
+
+    //
+    // Instrumentation
+    //
+
+    //Performance counters for the given display; see get_stats.
+    struct pv_helper_stats stats;
+
+    //When each step of the display's bring-up completed; see get_startup_profile.
+    struct pv_helper_startup_profile startup;
+
+    //The debugfs entry that publishes the counters, if any (Linux kernel only).
+    void *stats_node;
+
     //
     // Methods
     //
@@ -195,6 +298,9 @@ struct pv_display
      * a new display, the PV driver should call reconnect() on the
      * extisting display.
      *
+     * Providers that reconnect on their own call this automatically, for
+     * displays whose connections went with the old Display Handler.
+     *
      * @param display The display to be reconnected.
      * @param request The display handler "add_display" request
      *    that triggered the display reconnection.
@@ -203,6 +309,25 @@ struct pv_display
     int (*reconnect)(struct pv_display *display,
         struct dh_add_display *request, domid_t rx_domain);
 
+    /**
+     * Re-establishes all display connections for the active display, as reconnect()
+     * does; but can also bring the Display Handler up to date afterwards.
+     *
+     * With PV_DISPLAY_RECONNECT_PRESERVE, the display re-sends its geometry, and then
+     * tells the Display Handler that its framebuffer contents survived the reconnect,
+     * so the screen comes back without waiting for a redraw. If the Display Handler
+     * doesn't support that (DH_CAP_FRAMEBUFFER_PRESERVE), the whole framebuffer is
+     * marked dirty instead.
+     *
+     * @param display The display to be reconnected.
+     * @param request The display handler "add_display" request
+     *    that triggered the display reconnection.
+     * @param rx_domain The display domain to reconnect to.
+     * @param flags PV_DISPLAY_RECONNECT_* flags.
+     */
+    int (*reconnect_with_flags)(struct pv_display *display,
+        struct dh_add_display *request, domid_t rx_domain, uint32_t flags);
+
     /**
      * Sets the private per-driver data for the given display.
      *
@@ -218,6 +343,27 @@ struct pv_display
     void *(*get_driver_data)(struct pv_display *display);
 
 
+    /**
+     * Takes a snapshot of the display's performance counters. Safe to call
+     * at any time, from any thread.
+     *
+     * @param display The display whose counters should be read.
+     * @param stats Out argument to receive the snapshot.
+     */
+    void (*get_stats)(struct pv_display *display, struct pv_helper_stats *stats);
+
+
+    /**
+     * Takes a snapshot of the display's startup profile: when each step of the
+     * initialization sequence completed, relative to the start of the provider's
+     * session. Restarts whenever the display is reconnected.
+     *
+     * @param display The display whose profile should be read.
+     * @param profile Out argument to receive the snapshot.
+     */
+    void (*get_startup_profile)(struct pv_display *display, struct pv_helper_startup_profile *profile);
+
+
     /**
      * Changes the internal record of a PV display's resolution, and notifies the
      * Display Handler of the geometry change.
@@ -244,6 +390,18 @@ struct pv_display
     int (*invalidate_region)(struct pv_display *display, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
 
 
+    /**
+     * Marks the end of a frame: everything invalidated since the last commit is
+     * complete, and the host may present it. Does nothing unless frame commits were
+     * enabled on the provider, and the host agreed to them.
+     *
+     * @param display The PV display whose frame is complete.
+     *
+     * @return 0 on success, or an error code otherwise.
+     */
+    int (*commit_frame)(struct pv_display *display);
+
+
     /**
      * @return True iff the given display currently supports a hardware cursor.
      */
@@ -289,11 +447,12 @@ struct pv_display
      *
      * @param display The display for which the cursor image is to be populated.
      * @param image A pointer to an ARGB8888 image to be loaded.
-     * @param width The width (max 64) of the image to be loaded.
-     * @param height The height (max 64) of the image to be loaded.
+     * @param width The width (max 256) of the image to be loaded. Images larger
+     *    than the negotiated cursor size are shrunk to fit.
+     * @param height The height (max 256) of the image to be loaded.
      */
     int (*load_cursor_image)(struct pv_display *display, void *image,
-        uint8_t source_width, uint8_t source_height);
+        uint32_t source_width, uint32_t source_height);
 
     /**
      * Blank a given display
@@ -305,6 +464,60 @@ struct pv_display
      */
      int (*blank_display)(struct pv_display *display, bool dpms, bool blank);
 
+    /**
+     * Creates a video overlay for the display: a separate buffer of YUV frames, which
+     * the host scales, converts and composites over the framebuffer by itself (see
+     * Video Overlays in pv_driver_interface.h). Only possible once the host has
+     * offered the display an overlay. The overlay is shown once its first frame
+     * is presented. If its connection breaks, the overlay is destroyed, as if by
+     * destroy_overlay, and may be created again.
+     *
+     * @param display The display to receive the overlay.
+     * @param format DH_OVERLAY_FORMAT_NV12 or DH_OVERLAY_FORMAT_I420.
+     * @param width, height The size of each frame, in pixels; both must be even.
+     * @param x, y, dest_width, dest_height The region of the display, in framebuffer
+     *    pixels, over which the frames should be shown.
+     *
+     * @return 0 on success, -ENODEV if the host hasn't offered an overlay, -EBUSY if
+     *    the display already has one, or another error code on failure.
+     */
+    int (*create_overlay)(struct pv_display *display, uint32_t format,
+        uint32_t width, uint32_t height,
+        uint32_t x, uint32_t y, uint32_t dest_width, uint32_t dest_height);
+
+    /**
+     * @return The start of one of the overlay's frames (the first byte of its Y
+     *    plane), which is overlay.pitch bytes per row; or NULL if the display has
+     *    no overlay, or buffer isn't less than DH_OVERLAY_BUFFERS.
+     */
+    void *(*get_overlay_buffer)(struct pv_display *display, uint32_t buffer);
+
+    /**
+     * Presents one of the overlay's frames. The frame's buffer mustn't be drawn into
+     * again until a frame from another buffer has been presented.
+     *
+     * @param display The display whose overlay is to be updated.
+     * @param buffer The index of the frame's buffer, as for get_overlay_buffer.
+     *
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*present_overlay)(struct pv_display *display, uint32_t buffer);
+
+    /**
+     * Moves (or scales) the overlay to a new region of the display; an empty region
+     * hides it.
+     *
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*move_overlay)(struct pv_display *display, uint32_t x, uint32_t y,
+        uint32_t dest_width, uint32_t dest_height);
+
+    /**
+     * Hides and destroys the display's overlay, if it has one. Its frames' contents
+     * should be redrawn into the framebuffer, if they're still wanted.
+     */
+    void (*destroy_overlay)(struct pv_display *display);
+
     /**
      * Destroys the given framebuffer, freeing its associated memory.
      */
@@ -325,6 +538,44 @@ struct pv_display
     fatal_display_error_handler fatal_error_handler;
 
 
+    //
+    // Later Additions
+    //
+    // Appended, so the members above keep their offsets for existing binaries.
+    //
+
+    /**
+     * Loads a monochrome (1bpp AND/XOR) cursor image into the PV display's
+     * cursor buffer, converting it to ARGB8888. Pixels which would invert
+     * the screen are drawn as opaque black.
+     *
+     * @param display The display for which the cursor image is to be populated.
+     * @param and_mask The cursor's AND mask, one bit per pixel, MSB first.
+     * @param xor_mask The cursor's XOR mask, in the same format as the AND mask.
+     * @param mask_pitch The length of a single mask row, in bytes.
+     * @param width The width (max 256) of the image to be loaded. Images larger
+     *    than the negotiated cursor size are shrunk to fit.
+     * @param height The height (max 256) of the image to be loaded.
+     */
+    int (*load_cursor_image_mono)(struct pv_display *display, void *and_mask,
+        void *xor_mask, uint32_t mask_pitch, uint32_t source_width, uint32_t source_height);
+
+    /**
+     * Loads a 32bpp color cursor with a separate 1bpp AND mask into the PV
+     * display's cursor buffer, converting it to ARGB8888.
+     *
+     * @param display The display for which the cursor image is to be populated.
+     * @param image A pointer to the cursor's XRGB8888 color data.
+     * @param image_pitch The length of a single row of color data, in bytes.
+     * @param and_mask The cursor's AND mask, one bit per pixel, MSB first.
+     * @param mask_pitch The length of a single mask row, in bytes.
+     * @param width The width (max 256) of the image to be loaded. Images larger
+     *    than the negotiated cursor size are shrunk to fit.
+     * @param height The height (max 256) of the image to be loaded.
+     */
+    int (*load_cursor_image_masked)(struct pv_display *display, void *image,
+        uint32_t image_pitch, void *and_mask, uint32_t mask_pitch,
+        uint32_t source_width, uint32_t source_height);
 };
 
 
@@ -358,13 +609,68 @@ struct pv_display_provider
     //Driver capabilities (negotiating protocol)
     uint32_t capabilities;
 
+    //The negotiable capabilities the Display Handler has agreed to use,
+    //or 0 if it hasn't replied (see dh_host_capabilities).
+    uint32_t negotiated_capabilities;
+
+    //The Display Handler's interface version and own (non-negotiable) capabilities,
+    //as of its last dh_host_capabilities; or 0 if it hasn't replied.
+    uint32_t host_version;
+    uint32_t host_capabilities;
+
     //The module/object that owns the given plugin.
     void *owner;
 
+    //Performance counters for the control channel; see get_stats.
+    struct pv_helper_stats stats;
+
+    //When each step of the current session's initialization completed; see get_startup_profile.
+    struct pv_helper_startup_profile startup;
+
+    //Our place in the control stream, should we lose it; see Resynchronization in common.h.
+    struct pv_helper_resync resync;
+
+    //The debugfs entry that publishes the counters, if any (Linux kernel only).
+    void *stats_node;
+
     //A data structure storing the header for the packet currently being
     //recieved. If this packet is valid, it will have a non-zero length.
     struct dh_header current_packet_header;
 
+    //The displays this provider has created, linked through their next fields.
+    struct pv_display *displays;
+
+    //The number of create_display_async calls still opening connections, and a
+    //completion signalled each time that drops to zero, for destroy to wait on.
+    uint32_t pending_bringups;
+    pv_helper_completion bringups_done;
+
+    //
+    // Reconnection
+    //
+
+    //The maximum display count last passed to advertise_capabilities, if it's been
+    //called; and the last list of advertised displays, if any. Both are sent again
+    //whenever we reconnect to the Display Handler.
+    bool capabilities_advertised;
+    uint32_t max_displays;
+    struct dh_display_advertised_list *advertised_displays;
+    size_t advertised_displays_size;
+
+    //Background work that tries to reach the Display Handler while we can't.
+    struct pv_helper_work reconnect_work;
+
+    //True iff we've lost the Display Handler, and are trying to reach it again.
+    bool reconnecting;
+
+    //True iff the provider is being destroyed, and should stop reconnecting.
+    bool destroying;
+
+    //The number of consecutive failed reconnection attempts, and the state of the
+    //PRNG used to jitter the delay between them.
+    uint32_t reconnect_attempts;
+    uint32_t reconnect_seed;
+
     //
     // Methods
     //
@@ -380,6 +686,56 @@ struct pv_display_provider
      */
     int (*advertise_capabilities)(struct pv_display_provider *provider, uint32_t max_displays);
 
+    /**
+     * Requests hardware cursors larger than 64x64 on all displays created after the
+     * host agrees. Must be called before advertise_capabilities to take effect.
+     *
+     * @param provider The relevant PV display provider object.
+     * @param size The desired cursor width and height: 64, 128, or 256.
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*set_max_cursor_size)(struct pv_display_provider *provider, uint32_t size);
+
+    /**
+     * Promises to end each frame with commit_frame, so the host can present once per
+     * frame rather than on every dirty rectangle. Must be called before
+     * advertise_capabilities to take effect.
+     *
+     * @param provider The relevant PV display provider object.
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*enable_frame_commits)(struct pv_display_provider *provider);
+
+    /**
+     * Offers to keep a compressed copy of each display's framebuffer alongside it,
+     * updated as damage is reported, so the host can forward or store frames without
+     * reading every pixel. Costs guest CPU time for each dirty rectangle. Must be
+     * called before advertise_capabilities to take effect.
+     *
+     * @param provider The relevant PV display provider object.
+     * @return 0 on success, or an error code on failure.
+     */
+    int (*enable_compressed_tiles)(struct pv_display_provider *provider);
+
+    /**
+     * Takes a snapshot of the provider's control channel performance counters.
+     * Safe to call at any time, from any thread.
+     *
+     * @param provider The relevant PV display provider object.
+     * @param stats Out argument to receive the snapshot.
+     */
+    void (*get_stats)(struct pv_display_provider *provider, struct pv_helper_stats *stats);
+
+    /**
+     * Takes a snapshot of the provider's startup profile: when each session step
+     * of the initialization sequence completed, relative to the provider's creation--
+     * or, after a reconnect, to the loss of the previous Display Handler.
+     *
+     * @param provider The relevant PV display provider object.
+     * @param profile Out argument to receive the snapshot.
+     */
+    void (*get_startup_profile)(struct pv_display_provider *provider, struct pv_helper_startup_profile *profile);
+
     /**
      * Advertises a collection of displays that the PV Driver would like to provide.
      * This is typically sent in response to a host display list, but can be received at any time.
@@ -412,6 +768,30 @@ struct pv_display_provider
                           struct dh_add_display *request, uint32_t width, uint32_t height, uint32_t stride, void *initial_contents);
 
 
+    /**
+     * Starts creating a new PV Display object, as create_display does, but returns at once; the
+     * outcome is reported to the given callback. All of the display's connections are opened at
+     * once, rather than one after another-- and as many displays can be brought up at once as
+     * the Display Handler asks for, which cuts the time to first frame on multi-monitor guests.
+     *
+     * @param provider The display provider that should create the new domain.
+     * @param request The PV display creation request; copied, so it needn't outlive the call.
+     * @param width, height, stride See create_display.
+     * @param initial_contents See create_display. Must remain valid until the callback is called.
+     * @param callback The function to be called once the display is created, or can't be.
+     * @param opaque An opaque pointer to be passed to the callback.
+     *
+     * @return 0 if the display is being created, and the callback will be called exactly once;
+     *    or an error code, in which case it won't be.
+     *
+     * Destroying the provider waits for any displays still being brought up; the callback
+     * itself may destroy the provider.
+     */
+    int (*create_display_async)(struct pv_display_provider *provider, struct dh_add_display *request,
+                                uint32_t width, uint32_t height, uint32_t stride, void *initial_contents,
+                                display_created_callback callback, void *opaque);
+
+
     /**
      * Destroys an existing PV display object, and notifies the Display Handler.
      *
@@ -458,6 +838,10 @@ struct pv_display_provider
     //Register a Remove Display Request handler.
     void (*register_remove_display_request_handler)(struct pv_display_provider *provider, remove_display_request_handler request_handler);
 
+    //Register a Frame Done event handler. Asks the host for Frame Done events, so must
+    //be called before advertise_capabilities to take effect.
+    void (*register_frame_done_handler)(struct pv_display_provider *provider, frame_done_event_handler event_handler);
+
     //Register an Fatal Error handler
     void (*register_fatal_error_handler)(struct pv_display_provider *provider, fatal_provider_error_handler error_handler);
 
@@ -475,6 +859,9 @@ struct pv_display_provider
     //Add Display Request
     remove_display_request_handler remove_display_handler;
 
+    //Frame Done
+    frame_done_event_handler frame_done_handler;
+
     //Fatal Provider Error
     fatal_provider_error_handler fatal_error_handler;
 
@@ -488,6 +875,11 @@ struct pv_display_provider
 /**
  * Create a new PV display provider object, and start up its control channel.
  *
+ * If the Display Handler can't be reached-- now, or later, should it restart-- the
+ * provider keeps trying in the background (see the auto_reconnect parameter). Once
+ * it's back, the provider advertises its capabilities and displays again, and
+ * reconnects each of its existing displays when the Display Handler asks for them.
+ *
  * @param pv_display_provider Out argument to recieve the newly-created display provider object.
  * @param owner The device object that owns the given display provider. Not used internally-- but can be accessed from events and callbacks.
  * @param display_domain The domain ID for the domain that will recieve our display information, typically domain 0.
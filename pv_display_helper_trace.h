@@ -0,0 +1,192 @@
+//
+// PV Display Helper
+//
+// Copyright (C) 2016 - 2017 Assured Information Security, Inc. All rights reserved.
+//
+// Kernel tracepoints for the PV display helper's hot paths. These cost next to
+// nothing while disabled, and can be enabled at runtime via perf, ftrace or
+// bpftrace (e.g. "perf record -e 'pv_display:*'"). Include via common.h.
+//
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pv_display
+
+#if !defined(PV_DISPLAY_HELPER_TRACE__H) || defined(TRACE_HEADER_MULTI_READ)
+#define PV_DISPLAY_HELPER_TRACE__H
+
+#include <linux/tracepoint.h>
+
+/**
+ * A packet is about to be built and sent on a control or event channel.
+ */
+TRACE_EVENT(pv_display_send_enter,
+    TP_PROTO(uint32_t type, uint32_t length),
+    TP_ARGS(type, length),
+    TP_STRUCT__entry(
+        __field(uint32_t, type)
+        __field(uint32_t, length)
+    ),
+    TP_fast_assign(
+        __entry->type   = type;
+        __entry->length = length;
+    ),
+    TP_printk("type=%u length=%u", __entry->type, __entry->length)
+);
+
+/**
+ * A packet send has completed, successfully or otherwise.
+ */
+TRACE_EVENT(pv_display_send_exit,
+    TP_PROTO(uint32_t type, uint32_t length, int rc),
+    TP_ARGS(type, length, rc),
+    TP_STRUCT__entry(
+        __field(uint32_t, type)
+        __field(uint32_t, length)
+        __field(int, rc)
+    ),
+    TP_fast_assign(
+        __entry->type   = type;
+        __entry->length = length;
+        __entry->rc     = rc;
+    ),
+    TP_printk("type=%u length=%u rc=%d", __entry->type, __entry->length, __entry->rc)
+);
+
+/**
+ * A send was refused because its ring had no room for it.
+ */
+TRACE_EVENT(pv_display_ring_full,
+    TP_PROTO(uint32_t type, size_t needed, size_t available),
+    TP_ARGS(type, needed, available),
+    TP_STRUCT__entry(
+        __field(uint32_t, type)
+        __field(size_t, needed)
+        __field(size_t, available)
+    ),
+    TP_fast_assign(
+        __entry->type      = type;
+        __entry->needed    = needed;
+        __entry->available = available;
+    ),
+    TP_printk("type=%u needed=%zu available=%zu", __entry->type, __entry->needed, __entry->available)
+);
+
+/**
+ * invalidate_region couldn't send the requested rectangle as-is: it was either
+ * replaced with a full-screen refresh (full_refresh=1), or dropped (full_refresh=0).
+ */
+TRACE_EVENT(pv_display_invalidate_fallback,
+    TP_PROTO(uint32_t key, int full_refresh),
+    TP_ARGS(key, full_refresh),
+    TP_STRUCT__entry(
+        __field(uint32_t, key)
+        __field(int, full_refresh)
+    ),
+    TP_fast_assign(
+        __entry->key          = key;
+        __entry->full_refresh = full_refresh;
+    ),
+    TP_printk("key=%u full_refresh=%d", __entry->key, __entry->full_refresh)
+);
+
+/**
+ * A received control packet is being dispatched to its handler.
+ */
+TRACE_EVENT(pv_display_control_dispatch,
+    TP_PROTO(uint32_t type, uint32_t length),
+    TP_ARGS(type, length),
+    TP_STRUCT__entry(
+        __field(uint32_t, type)
+        __field(uint32_t, length)
+    ),
+    TP_fast_assign(
+        __entry->type   = type;
+        __entry->length = length;
+    ),
+    TP_printk("type=%u length=%u", __entry->type, __entry->length)
+);
+
+/**
+ * A received packet failed its CRC check.
+ */
+TRACE_EVENT(pv_display_crc_mismatch,
+    TP_PROTO(uint32_t type, uint32_t length, uint16_t expected, uint16_t actual),
+    TP_ARGS(type, length, expected, actual),
+    TP_STRUCT__entry(
+        __field(uint32_t, type)
+        __field(uint32_t, length)
+        __field(uint16_t, expected)
+        __field(uint16_t, actual)
+    ),
+    TP_fast_assign(
+        __entry->type     = type;
+        __entry->length   = length;
+        __entry->expected = expected;
+        __entry->actual   = actual;
+    ),
+    TP_printk("type=%u length=%u expected=%04x actual=%04x",
+        __entry->type, __entry->length, __entry->expected, __entry->actual)
+);
+
+/**
+ * A display has re-established its connections to the Display Handler.
+ */
+TRACE_EVENT(pv_display_reconnect,
+    TP_PROTO(uint32_t key, int rc),
+    TP_ARGS(key, rc),
+    TP_STRUCT__entry(
+        __field(uint32_t, key)
+        __field(int, rc)
+    ),
+    TP_fast_assign(
+        __entry->key = key;
+        __entry->rc  = rc;
+    ),
+    TP_printk("key=%u rc=%d", __entry->key, __entry->rc)
+);
+
+/**
+ * A receive path has found its place in a stream again, after a framing error.
+ */
+TRACE_EVENT(pv_display_resync,
+    TP_PROTO(uint64_t skipped),
+    TP_ARGS(skipped),
+    TP_STRUCT__entry(
+        __field(uint64_t, skipped)
+    ),
+    TP_fast_assign(
+        __entry->skipped = skipped;
+    ),
+    TP_printk("skipped=%llu", (unsigned long long)__entry->skipped)
+);
+
+/**
+ * A step of the initialization sequence has completed (see pv_helper_startup_step);
+ * key is 0 for session steps, and identifies the display otherwise.
+ */
+TRACE_EVENT(pv_display_startup_step,
+    TP_PROTO(uint32_t key, uint32_t step, uint64_t elapsed_ns),
+    TP_ARGS(key, step, elapsed_ns),
+    TP_STRUCT__entry(
+        __field(uint32_t, key)
+        __field(uint32_t, step)
+        __field(uint64_t, elapsed_ns)
+    ),
+    TP_fast_assign(
+        __entry->key        = key;
+        __entry->step       = step;
+        __entry->elapsed_ns = elapsed_ns;
+    ),
+    TP_printk("key=%u step=%u elapsed_ns=%llu", __entry->key, __entry->step,
+        (unsigned long long)__entry->elapsed_ns)
+);
+
+#endif // PV_DISPLAY_HELPER_TRACE__H
+
+//This header lives alongside the module's sources, rather than in include/trace/events.
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pv_display_helper_trace
+
+#include <trace/define_trace.h>
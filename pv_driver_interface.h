@@ -342,6 +342,202 @@
  * Display Handler                      Driver
  *                                 |<-- 1. dh_move_cursor (e1)
  *
+ * Capability Negotiation
+ * ----------------------
+ *
+ * The driver's dh_driver_capabilities and the display handler's reply,
+ * dh_host_capabilities, each carry the sender's interface version and a set of
+ * DH_CAP_* flags. The low byte of the flags describes what the sender itself
+ * supports (resizing, hotplug, and so on), and is purely informational; the
+ * remaining bits (DH_CAP_NEGOTIABLE) are features that change what goes over
+ * the wire, and are only used once both sides have agreed to them. The driver
+ * sets those it would like; the display handler replies with those it accepts,
+ * and both sides use exactly that subset. Either side ignores bits it doesn't
+ * recognise, so new features can be added one at a time, and rolled out to
+ * drivers and display handlers in any order.
+ *
+ * Versions with the same major number (PV_DRIVER_INTERFACE_MAJOR) are
+ * compatible; if the majors differ, nothing is negotiated, and both sides fall
+ * back to the base protocol. A driver that never receives a reply (from an older
+ * display handler) likewise uses no negotiable features.
+ *
+ * Display Handler                      Driver
+ *                                 |<-- 1. dh_driver_capabilities
+ *  2. dh_host_capabilities ------>|        (version, driver flags)
+ *     (version, accepted flags,   |
+ *      display handler flags)     |
+ *  3. dh_display_list ----------->|
+ *
+ * Larger Cursors
+ * --------------
+ *
+ * HiDPI guests may want a cursor larger than 64x64. A driver that can provide
+ * one sets the cursor size class (DH_CAP_CURSOR_SIZE_MASK) in the flags of its
+ * dh_driver_capabilities packet. A display handler that understands the class
+ * replies with dh_host_capabilities before sending its dh_display_list,
+ * carrying the largest class it is willing to accept, which is never larger
+ * than the class requested. From then on, every cursor image buffer for that
+ * driver is negotiated size x negotiated size, with a stride of the negotiated
+ * size. Drivers which never receive the reply must assume 64x64, as above.
+ *
+ * Display Handler                      Driver
+ *                                 |<-- 1. dh_driver_capabilities (class 2)
+ *  2. dh_host_capabilities ------>|        (class 1, i.e. 128x128)
+ *  3. dh_display_list ----------->|
+ *
+ * Latency Sampling
+ * ----------------
+ *
+ * To measure how long damage and cursor updates take to reach the display
+ * handler, the driver stamps each packet's footer with the time it was sent,
+ * in units of 1024ns (PV_DRIVER_TIMESTAMP_NS_SHIFT), truncated to 32 bits.
+ * Dirty rectangles have no footer; instead, if DH_CAP_LATENCY_SAMPLES was
+ * negotiated, the driver periodically sends a dh_damage_sample over the
+ * event channel, giving the time at which its Nth dirty rectangle since the
+ * display was connected was submitted. The display handler notes the time at
+ * which it has received N dirty rectangles.
+ *
+ * The two sides' clocks aren't synchronized, so the display handler measures
+ * each delay relative to the smallest delay it has observed on that display.
+ * A timestamp of zero means "not stamped", and must be ignored.
+ *
+ * Display Handler                      Driver
+ *                                 |<-- 1. dirty rectangles 1..N (d)
+ *                                 |<-- 2. dh_damage_sample (e1, sequence N)
+ *
+ * Framebuffer Preservation
+ * ------------------------
+ *
+ * When a driver reconnects a display to a restarted display handler (see
+ * Reconnect, above), it re-shares the same framebuffer pages, whose
+ * contents are still good. If DH_CAP_FRAMEBUFFER_PRESERVE was negotiated, the
+ * driver says so by following its dh_set_display with a
+ * dh_framebuffer_preserved, and the display handler may present the
+ * framebuffer at once, rather than waiting for the driver to redraw it.
+ * Without the capability, the driver marks the whole framebuffer dirty.
+ *
+ * Display Handler                      Driver
+ *                                 |<-- 1. dh_set_display (e1)
+ *                                 |<-- 2. dh_framebuffer_preserved (e1)
+ *
+ * Compact Dirty Rectangles
+ * ------------------------
+ *
+ * Display coordinates fit comfortably in 16 bits. If
+ * DH_CAP_COMPACT_DIRTY_RECTANGLES was negotiated, the driver sends every
+ * dirty rectangle for its displays as an 8-byte dh_compact_dirty_rectangle,
+ * rather than a 16-byte dh_dirty_rectangle, so the same dirty rectangle
+ * ring holds twice the damage. The format is fixed for the life of a dirty
+ * rectangle connection; the two are never mixed.
+ *
+ * Display Handler                      Driver
+ *                                 |<-- 1. dh_compact_dirty_rectangle (d)
+ *
+ * Frame Commits
+ * -------------
+ *
+ * Dirty rectangles alone don't say where one frame's damage ends and the
+ * next one's begins. If DH_CAP_FRAME_COMMIT was negotiated, the driver
+ * follows the last dirty rectangle of each frame with a commit marker on the
+ * same dirty rect channel: a dirty rectangle (of whichever format is in use)
+ * with zero width and height, whose x and y hold the low and high 16 bits of
+ * the frame's sequence number. The display handler may then present once per
+ * frame, when the marker arrives, rather than once per rectangle. Zero-area
+ * rectangles are never sent as damage once the capability is negotiated.
+ *
+ * Display Handler                      Driver
+ *                                 |<-- 1. dirty rectangles of frame N (d)
+ *                                 |<-- 2. commit marker, frame N (d)
+ *
+ * Frame Done
+ * ----------
+ *
+ * If DH_CAP_FRAME_DONE was negotiated, the display handler tells the driver
+ * each time it finishes with one of a display's frames-- typically at the
+ * vblank after presenting it-- with a dh_frame_done on the control channel.
+ * Drivers can pace their rendering to these, rather than drawing frames that
+ * will never be shown, and complete page flips when they arrive. Reports may
+ * be coalesced; the frame numbers say how many frames have passed.
+ *
+ * Display Handler                      Driver
+ *                                 |<-- 1. commit marker, frame N (d)
+ *  2. dh_frame_done (frame N) --->|
+ *
+ * Dirty Rectangle Credits
+ * -----------------------
+ *
+ * If DH_CAP_DIRTY_RECTANGLE_CREDITS was negotiated, the display handler may
+ * limit how many dirty rectangles the driver sends for a display, by granting
+ * it credits with dh_dirty_rectangle_credits; typically, as many as it can
+ * absorb before it next grants more (say, once per frame). Until the first
+ * grant for a display's current connection, the driver sends freely. After
+ * that, each dirty rectangle spends a credit (commit markers are free); a
+ * driver that's out of credits folds any further damage into one held-back
+ * bounding box, and sends it-- followed by any frame commit held back behind
+ * it-- once it's granted more. Credits add up; they're never taken back.
+ *
+ * Display Handler                      Driver
+ *  1. dh_dirty_rectangle_credits -->|
+ *     (8 credits)                   |<-- 2. up to 8 dirty rectangles (d)
+ *
+ * Video Overlays
+ * --------------
+ *
+ * Rather than converting video to XRGB and redrawing it into the framebuffer,
+ * a driver can hand its YUV frames to the display handler as-is, to be scaled,
+ * converted and composited over the framebuffer by the host's hardware. If
+ * DH_CAP_VIDEO_OVERLAY was negotiated, the display handler may offer a display
+ * an overlay port with dh_add_overlay, after its dh_add_display (and again after
+ * each reconnect). To use it, the driver connects a buffer to that port, large
+ * enough for DH_OVERLAY_BUFFERS frames (DH_OVERLAY_BUFFER_SIZE), and describes
+ * the overlay with dh_set_overlay: its format and size, and where on the
+ * display it should be shown. The driver then draws each frame into whichever
+ * buffer the display handler isn't showing, and sends dh_overlay_frame to
+ * present it. A dh_set_overlay with DH_OVERLAY_FORMAT_NONE, or an empty
+ * destination, hides the overlay. Whatever the framebuffer holds under the
+ * overlay is never shown while it's visible, so needn't be redrawn.
+ *
+ * Display Handler                      Driver
+ *  1. dh_add_overlay ------------>|
+ *                                 |<-- 2. connects to the overlay port
+ *                                 |<-- 3. dh_set_overlay (e)
+ *                                 |<-- 4. dh_overlay_frame (e), buffer 0
+ *                                 |<-- 5. dh_overlay_frame (e), buffer 1
+ *
+ * Compressed Tiles
+ * ----------------
+ *
+ * A display handler that forwards frames elsewhere, rather than scanning them
+ * out, may be limited by memory bandwidth rather than CPU. If
+ * DH_CAP_COMPRESSED_TILES was negotiated, the driver keeps a losslessly
+ * compressed copy of its framebuffer, in DH_TILE_SIZE x DH_TILE_SIZE tiles,
+ * in a tile store placed after the framebuffer in the same shared buffer. The
+ * display handler can then read (or forward) just the compressed tiles under
+ * each dirty rectangle, rather than the pixels themselves.
+ *
+ * After each dh_set_display, the driver sends dh_tile_store, giving the store's
+ * offset from the start of the framebuffer, and how many columns and rows of
+ * tiles the new geometry has; or no columns, if the store is too small for it,
+ * in which case the display handler must read the framebuffer as usual. The
+ * store is an array of DH_TILE_SLOT_SIZE-byte slots, one per tile, in row-major
+ * order. Each holds a dh_tile_header, giving the tile's size (tiles on the right
+ * and bottom edges may be partial) and compressed length, followed by its
+ * pixels, row by row, run-length encoded as a sequence of 32-bit words:
+ *
+ *   (DH_TILE_RUN | n), p      n (3 or more) copies of the pixel p
+ *   n, p1 ... pn              n literal pixels
+ *
+ * The driver updates every tile touched by a dirty rectangle before sending it.
+ * Like the framebuffer itself, a tile may be rewritten as it's read; the display
+ * handler should treat a tile that doesn't decode as damaged, and fall back to
+ * the framebuffer for it.
+ *
+ * Display Handler                      Driver
+ *                                 |<-- 1. dh_set_display (e)
+ *                                 |<-- 2. dh_tile_store (e)
+ *                                 |<-- 3. dh_dirty_rectangle (d); the tiles
+ *                                 |       under it are already up to date
+ *
  * Display Blanking
  * ---------------
  * In order to handle modesetting without the seizure inducing flashing people
@@ -450,7 +646,11 @@ enum
     PACKET_TYPE_CONTROL_REMOVE_DISPLAY                = 5,
     PACKET_TYPE_CONTROL_DISPLAY_NO_LONGER_AVAILABLE   = 6,
     PACKET_TYPE_CONTROL_TEXT_MODE                     = 7,
-    PACKET_TYPE_CONTROL_END                           = 8
+    PACKET_TYPE_CONTROL_HOST_CAPABILITIES             = 8,
+    PACKET_TYPE_CONTROL_FRAME_DONE                    = 9,
+    PACKET_TYPE_CONTROL_DIRTY_RECTANGLE_CREDITS       = 10,
+    PACKET_TYPE_CONTROL_ADD_OVERLAY                   = 11,
+    PACKET_TYPE_CONTROL_END                           = 12
 };
 
 /**
@@ -463,7 +663,12 @@ enum
     PACKET_TYPE_EVENT_UPDATE_CURSOR                   = 102,
     PACKET_TYPE_EVENT_MOVE_CURSOR                     = 103,
     PACKET_TYPE_EVENT_BLANK_DISPLAY                   = 104,
-    PACKET_TYPE_EVENT_END                             = 105
+    PACKET_TYPE_EVENT_DAMAGE_SAMPLE                   = 105,
+    PACKET_TYPE_EVENT_FRAMEBUFFER_PRESERVED           = 106,
+    PACKET_TYPE_EVENT_SET_OVERLAY                     = 107,
+    PACKET_TYPE_EVENT_OVERLAY_FRAME                   = 108,
+    PACKET_TYPE_EVENT_TILE_STORE                      = 109,
+    PACKET_TYPE_EVENT_END                             = 110
 };
 
 
@@ -473,13 +678,14 @@ enum
  *
  * @var crc should be set to dh_crc16(dh_header + payload)
  * @var dh_reserved_halfword is unused
- * @var dh_reserved_word is unused
+ * @var timestamp is the time the packet was sent, in the sender's clock
+ *        (see Latency Sampling), or 0 if the sender doesn't stamp packets
  */
 struct dh_footer
 {
     uint16_t crc;
     uint16_t dh_reserved_halfword;
-    uint32_t dh_reserved_word;
+    uint32_t timestamp;
 };
 
 
@@ -504,8 +710,9 @@ struct dh_display_info
     uint32_t dh_reserved_word;
 };
 
-                                    /* These flags indicate that the driver provides
-				       the following capabilities:                  */
+                                    /* These flags indicate that the sender (driver,
+				       or display handler) provides the following
+				       capabilities; they aren't negotiated:        */
 #define DH_CAP_LFB        (1<<0)    /* Linear Framebuffer                           */
 #define DH_CAP_HW_CURSOR  (1<<1)    /* Hardware Cursor                              */
 #define DH_CAP_RESIZE     (1<<2)    /* Online resolution resizing                   */
@@ -513,6 +720,35 @@ struct dh_display_info
 #define DH_CAP_HOTPLUG    (1<<4)    /* Hot plugging displays                        */
 #define DH_CAP_BLANKING   (1<<5)    /* A message to indicate the display is blank   */
 
+                                    /* These bits are negotiated with the display
+                                       handler via dh_host_capabilities:            */
+#define DH_CAP_CURSOR_SIZE_SHIFT (8)
+#define DH_CAP_CURSOR_SIZE_MASK  (3<<DH_CAP_CURSOR_SIZE_SHIFT) /* Cursor size class */
+
+#define DH_CAP_LATENCY_SAMPLES (1<<10) /* dh_damage_sample packets          */
+#define DH_CAP_FRAMEBUFFER_PRESERVE (1<<11) /* dh_framebuffer_preserved packets */
+#define DH_CAP_COMPACT_DIRTY_RECTANGLES (1<<12) /* dh_compact_dirty_rectangle */
+#define DH_CAP_FRAME_COMMIT (1<<13) /* Frame commit markers on the dirty rect channel */
+#define DH_CAP_FRAME_DONE (1<<14) /* dh_frame_done packets */
+#define DH_CAP_DIRTY_RECTANGLE_CREDITS (1<<15) /* dh_dirty_rectangle_credits packets */
+#define DH_CAP_VIDEO_OVERLAY (1<<16) /* dh_add_overlay, and YUV overlay planes */
+#define DH_CAP_COMPRESSED_TILES (1<<17) /* dh_tile_store, and a compressed tile store */
+
+#define DH_CAP_NEGOTIABLE (DH_CAP_CURSOR_SIZE_MASK | DH_CAP_LATENCY_SAMPLES | \
+                           DH_CAP_FRAMEBUFFER_PRESERVE | DH_CAP_COMPACT_DIRTY_RECTANGLES | \
+                           DH_CAP_FRAME_COMMIT | DH_CAP_FRAME_DONE | \
+                           DH_CAP_DIRTY_RECTANGLE_CREDITS | DH_CAP_VIDEO_OVERLAY | \
+                           DH_CAP_COMPRESSED_TILES)
+
+/**
+ * Converts between a cursor size class, as stored in the capabilities flags,
+ * and the width/height of the cursor it describes: 0 => 64, 1 => 128, 2 => 256.
+ */
+#define DH_CAP_CURSOR_SIZE(flags) \
+    (PV_DRIVER_CURSOR_WIDTH << (((flags) & DH_CAP_CURSOR_SIZE_MASK) >> DH_CAP_CURSOR_SIZE_SHIFT))
+#define DH_CAP_CURSOR_SIZE_CLASS(size) \
+    ((((size) >= 256) ? 2 : ((size) >= 128) ? 1 : 0) << DH_CAP_CURSOR_SIZE_SHIFT)
+
 /**
  * Display Handler Driver Capabilities Packet:
  *
@@ -527,7 +763,9 @@ struct dh_display_info
  * @var max_displays defines the maximum number of displays that the driver
  *        supports.
  * @var version should be set to PV_DRIVER_INTERFACE_VERSION
- * @var flags is unused
+ * @var flags defines the driver's own capabilities (DH_CAP_LFB through
+ *        DH_CAP_BLANKING), and the negotiable capabilities it would like to use
+ *        (DH_CAP_NEGOTIABLE); see Capability Negotiation
  * @var dh_reserved_word is unused
  *
  * DRIVER -> DISPLAY HANDLER via CONTROL CHANNEL
@@ -542,8 +780,43 @@ struct dh_driver_capabilities
 
 /**
  * Defines dh_driver_capabilities->version (0xMMNNPPPP, Major.miNor.Patch)
+ *
+ * 0.1.0 added the display handler's own capabilities to dh_host_capabilities,
+ * which is now always sent.
+ */
+#define PV_DRIVER_INTERFACE_VERSION (0x00010000)
+#define PV_DRIVER_INTERFACE_MAJOR(version) (((version) >> 24) & 0xFF)
+
+/**
+ * True iff two interface versions can negotiate capabilities with each other.
+ */
+#define PV_DRIVER_INTERFACE_COMPATIBLE(a, b) \
+    (PV_DRIVER_INTERFACE_MAJOR(a) == PV_DRIVER_INTERFACE_MAJOR(b))
+
+
+
+/**
+ * Display Handler Host Capabilities Packet:
+ *
+ * Sent by the display handler in response to each dh_driver_capabilities
+ * packet, before the dh_display_list (see Capability Negotiation). Older
+ * display handlers only send this packet if the driver requested a negotiable
+ * capability (DH_CAP_NEGOTIABLE), and never at all before that; a driver that
+ * receives no reply must not use any of the negotiable capabilities.
+ *
+ * @var version should be set to PV_DRIVER_INTERFACE_VERSION
+ * @var flags defines the display handler's own capabilities (DH_CAP_LFB through
+ *        DH_CAP_BLANKING), and the subset of the driver's negotiable capabilities
+ *        that the display handler accepts; for the cursor size class, the largest
+ *        class the display handler accepts, no larger than requested.
+ *
+ * DISPLAY HANDLER -> DRIVER via CONTROL CHANNEL
  */
-#define PV_DRIVER_INTERFACE_VERSION (0x00000001)
+struct dh_host_capabilities
+{
+    uint32_t version;
+    uint32_t flags;
+};
 
 
 
@@ -654,6 +927,71 @@ struct dh_remove_display
 
 
 
+/**
+ * Display Handler Frame Done Packet:
+ *
+ * Sent by the display handler to the driver, if DH_CAP_FRAME_DONE was
+ * negotiated, when it has finished with one of a display's frames.
+ *
+ * @var key defines a unique identifier for each display
+ * @var frame is the sequence number of the frame: the one from its commit
+ *        marker, if DH_CAP_FRAME_COMMIT was negotiated, or otherwise a count
+ *        of frames the display handler has presented
+ * @var timestamp is the time the frame was finished with, in the display
+ *        handler's clock and the units of dh_footer->timestamp; only the
+ *        differences between reports are meaningful to the driver
+ *
+ * DISPLAY HANDLER -> DRIVER via CONTROL CHANNEL
+ */
+struct dh_frame_done
+{
+    uint32_t key;
+    uint32_t frame;
+    uint32_t timestamp;
+};
+
+
+
+/**
+ * Display Handler Dirty Rectangle Credits Packet:
+ *
+ * Sent by the display handler to the driver, if DH_CAP_DIRTY_RECTANGLE_CREDITS
+ * was negotiated, to allow the driver to send more dirty rectangles for a
+ * display (see Dirty Rectangle Credits).
+ *
+ * @var key defines a unique identifier for each display
+ * @var credits is the number of additional dirty rectangles the driver may send
+ *
+ * DISPLAY HANDLER -> DRIVER via CONTROL CHANNEL
+ */
+struct dh_dirty_rectangle_credits
+{
+    uint32_t key;
+    uint32_t credits;
+};
+
+
+
+/**
+ * Display Handler Add Overlay Packet:
+ *
+ * Sent by the display handler to the driver, if DH_CAP_VIDEO_OVERLAY was
+ * negotiated, to offer one of its displays a video overlay (see Video Overlays).
+ *
+ * @var key defines a unique identifier for each display
+ * @var overlay_port is the IVC port to which the overlay's buffer should be
+ *        connected
+ *
+ * DISPLAY HANDLER -> DRIVER via CONTROL CHANNEL
+ */
+struct dh_add_overlay
+{
+    uint32_t key;
+    uint32_t overlay_port;
+};
+
+
+
 /**
  * Display Handler Display No Longer Avaialable Packet:
  *
@@ -732,6 +1070,160 @@ enum
     PACKET_BLANKING_MODESETTING_FILL_DISABLE    = 3
 };
 
+/**
+ * Display Handler Damage Sample Packet:
+ *
+ * Sent by the driver to the display handler, if DH_CAP_LATENCY_SAMPLES was
+ * negotiated, to allow the display handler to measure dirty rectangle latency.
+ *
+ * @var sequence is the number of dirty rectangles sent on this display's
+ *        dirty rect channel since it was connected, including the sampled one
+ * @var timestamp is the time the sampled dirty rectangle was submitted,
+ *        in the same units as dh_footer->timestamp
+ *
+ * DRIVER -> DISPLAY HANDLER via EVENT CHANNEL
+ */
+struct dh_damage_sample
+{
+    uint32_t sequence;
+    uint32_t timestamp;
+};
+
+/**
+ * Display Handler Framebuffer Preserved Packet:
+ *
+ * Sent by the driver to the display handler, if DH_CAP_FRAMEBUFFER_PRESERVE was
+ * negotiated, after reconnecting a display whose framebuffer contents survived
+ * the reconnect. The framebuffer may be presented as-is; no redraw will follow.
+ *
+ * @var width, height and stride repeat those of the preceding dh_set_display,
+ *        describing the layout of the preserved contents
+ *
+ * DRIVER -> DISPLAY HANDLER via EVENT CHANNEL
+ */
+struct dh_framebuffer_preserved
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+};
+
+/**
+ * Video overlay formats (dh_set_overlay->format). Each frame starts with a
+ * full-resolution Y plane, of height rows of pitch bytes. For NV12, that's
+ * followed by a half-resolution plane of interleaved U and V samples, of
+ * height / 2 rows of pitch bytes; for I420, by half-resolution U and then V
+ * planes, each of height / 2 rows of pitch / 2 bytes. Width, height and pitch
+ * must be even.
+ */
+#define DH_OVERLAY_FORMAT_NONE (0)
+#define DH_OVERLAY_FORMAT_NV12 (1)
+#define DH_OVERLAY_FORMAT_I420 (2)
+
+/**
+ * The number of frames an overlay's buffer holds, one after the other, and the
+ * size of each; both NV12 and I420 frames take one and a half bytes per pixel.
+ */
+#define DH_OVERLAY_BUFFERS (2)
+#define DH_OVERLAY_FRAME_SIZE(pitch, height) (((size_t)(pitch) * (height) * 3) / 2)
+#define DH_OVERLAY_BUFFER_SIZE(pitch, height) (DH_OVERLAY_BUFFERS * DH_OVERLAY_FRAME_SIZE(pitch, height))
+
+/**
+ * Display Handler Set Overlay Packet:
+ *
+ * Sent by the driver to the display handler, once it's connected a display's
+ * overlay buffer, to describe (or hide) the overlay; see Video Overlays.
+ *
+ * @var format is one of the DH_OVERLAY_FORMAT_* values; DH_OVERLAY_FORMAT_NONE
+ *        hides the overlay
+ * @var width, height and pitch describe each frame in the overlay buffer
+ * @var x, y, dest_width and dest_height give the region of the display, in
+ *        framebuffer pixels, over which the frames are to be scaled; an empty
+ *        region hides the overlay
+ *
+ * DRIVER -> DISPLAY HANDLER via EVENT CHANNEL
+ */
+struct dh_set_overlay
+{
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+    uint32_t x;
+    uint32_t y;
+    uint32_t dest_width;
+    uint32_t dest_height;
+};
+
+/**
+ * Display Handler Overlay Frame Packet:
+ *
+ * Sent by the driver to the display handler to present a new overlay frame.
+ *
+ * @var frame is the frame's sequence number, which increases by one with each
+ *        frame presented
+ * @var buffer is the index of the frame within the overlay buffer, less than
+ *        DH_OVERLAY_BUFFERS; the driver won't draw into it again until it has
+ *        presented a frame from another
+ *
+ * DRIVER -> DISPLAY HANDLER via EVENT CHANNEL
+ */
+struct dh_overlay_frame
+{
+    uint32_t frame;
+    uint32_t buffer;
+};
+
+/**
+ * The width and height of a compressed tile, in pixels; the flag marking a run
+ * in a compressed tile; and the most words a tile can take once compressed--
+ * runs are never shorter than three pixels, so compression never costs more
+ * than the one word.
+ */
+#define DH_TILE_SIZE      (64)
+#define DH_TILE_RUN       (0x80000000)
+#define DH_TILE_MAX_WORDS ((DH_TILE_SIZE * DH_TILE_SIZE) + 1)
+
+/**
+ * Describes the compressed tile that follows it in its tile store slot.
+ *
+ * @var width and height give the size of the tile, in pixels
+ * @var length is the number of bytes of compressed data that follow
+ */
+struct dh_tile_header
+{
+    uint16_t width;
+    uint16_t height;
+    uint32_t length;
+};
+
+#define DH_TILE_SLOT_SIZE (sizeof(struct dh_tile_header) + (DH_TILE_MAX_WORDS * sizeof(uint32_t)))
+
+/**
+ * Display Handler Tile Store Packet:
+ *
+ * Sent by the driver to the display handler, if DH_CAP_COMPRESSED_TILES was
+ * negotiated, after each dh_set_display; see Compressed Tiles.
+ *
+ * @var offset is the tile store's offset from the start of the framebuffer, in bytes
+ * @var columns and rows give the number of tiles across and down the display, or
+ *        0 if the display's tiles aren't being kept up to date
+ *
+ * DRIVER -> DISPLAY HANDLER via EVENT CHANNEL
+ */
+struct dh_tile_store
+{
+    uint32_t offset;
+    uint32_t columns;
+    uint32_t rows;
+};
+
+/**
+ * Defines the units of dh_footer->timestamp and dh_damage_sample->timestamp:
+ * a nanosecond clock shifted right by this amount.
+ */
+#define PV_DRIVER_TIMESTAMP_NS_SHIFT (10)
+
 /**
  * Display Handler Dirty Rectangle Packet:
  *
@@ -752,6 +1244,30 @@ struct dh_dirty_rectangle
     uint32_t height;
 };
 
+/**
+ * Display Handler Compact Dirty Rectangle Packet:
+ *
+ * Sent instead of dh_dirty_rectangle if DH_CAP_COMPACT_DIRTY_RECTANGLES was
+ * negotiated (see Compact Dirty Rectangles); has the same meaning, but the
+ * display handler will always read in 8 bytes at a time.
+ *
+ * DRIVER -> DISPLAY HANDLER via DIRTY RECT CHANNEL
+ */
+struct dh_compact_dirty_rectangle
+{
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+};
+
+/**
+ * Packs and unpacks a frame commit marker's sequence number (see Frame Commits).
+ */
+#define DH_FRAME_COMMIT_X(frame) ((frame) & 0xFFFF)
+#define DH_FRAME_COMMIT_Y(frame) (((frame) >> 16) & 0xFFFF)
+#define DH_FRAME_COMMIT_FRAME(x, y) (((uint32_t)(x) & 0xFFFF) | (((uint32_t)(y) & 0xFFFF) << 16))
+
 
 
 /**
@@ -805,6 +1321,12 @@ struct dh_update_cursor
 #define PV_DRIVER_CURSOR_HEIGHT (64)
 #define PV_DRIVER_CURSOR_STRIDE (PV_DRIVER_CURSOR_WIDTH * 4)
 
+/**
+ * Defines the largest cursor image size that can be negotiated.
+ */
+#define PV_DRIVER_MAX_CURSOR_WIDTH (256)
+#define PV_DRIVER_MAX_CURSOR_HEIGHT (256)
+
 /**
  * Define the dh_text_mode->mode field
  */